@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "empathy-avatar-cache.h"
+
+/* Process wide cache of the decoded and scaled avatars, so the roster,
+ * the chat tabs and the notifications don't decode the same avatar over
+ * and over. Least recently used pixbufs are dropped once they use more
+ * than the budget. Avatars are decoded from threads so it's protected by
+ * a lock. */
+
+#define BUDGET (16 * 1024 * 1024)
+
+typedef struct
+{
+  gchar *key;
+  GdkPixbuf *pixbuf;
+  gsize size;
+} CacheEntry;
+
+G_LOCK_DEFINE_STATIC (cache);
+
+/* gchar *key -> GList * link of lru, owned by the list */
+static GHashTable *entries = NULL;
+/* Queue of CacheEntry*s, most recently used first */
+static GQueue lru = G_QUEUE_INIT;
+static gsize total_size = 0;
+
+static gchar *
+cache_make_key (const gchar *token,
+    gint width,
+    gint height,
+    gboolean roundified)
+{
+  return g_strdup_printf ("%s:%dx%d%s", token, width, height,
+      roundified ? ":round" : "");
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->key);
+  g_object_unref (entry->pixbuf);
+  g_slice_free (CacheEntry, entry);
+}
+
+/* Must be called with the lock held */
+static void
+cache_evict (void)
+{
+  while (total_size > BUDGET && !g_queue_is_empty (&lru))
+    {
+      CacheEntry *entry = g_queue_pop_tail (&lru);
+
+      g_hash_table_remove (entries, entry->key);
+      total_size -= entry->size;
+      cache_entry_free (entry);
+    }
+}
+
+/* Returns a new ref on the cached pixbuf, or NULL */
+GdkPixbuf *
+empathy_avatar_cache_lookup (const gchar *token,
+    gint width,
+    gint height,
+    gboolean roundified)
+{
+  GdkPixbuf *pixbuf = NULL;
+  GList *link;
+  gchar *key;
+
+  if (token == NULL)
+    return NULL;
+
+  key = cache_make_key (token, width, height, roundified);
+
+  G_LOCK (cache);
+
+  link = entries != NULL ? g_hash_table_lookup (entries, key) : NULL;
+  if (link != NULL)
+    {
+      CacheEntry *entry = link->data;
+
+      /* Move it to the front */
+      g_queue_unlink (&lru, link);
+      g_queue_push_head_link (&lru, link);
+
+      pixbuf = g_object_ref (entry->pixbuf);
+    }
+
+  G_UNLOCK (cache);
+
+  g_free (key);
+
+  return pixbuf;
+}
+
+void
+empathy_avatar_cache_insert (const gchar *token,
+    gint width,
+    gint height,
+    gboolean roundified,
+    GdkPixbuf *pixbuf)
+{
+  CacheEntry *entry;
+  GList *link;
+
+  g_return_if_fail (GDK_IS_PIXBUF (pixbuf));
+
+  if (token == NULL)
+    return;
+
+  entry = g_slice_new0 (CacheEntry);
+  entry->key = cache_make_key (token, width, height, roundified);
+  entry->pixbuf = g_object_ref (pixbuf);
+  entry->size = gdk_pixbuf_get_rowstride (pixbuf) *
+    gdk_pixbuf_get_height (pixbuf);
+
+  G_LOCK (cache);
+
+  if (entries == NULL)
+    entries = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* Another thread may have decoded the same avatar meanwhile */
+  link = g_hash_table_lookup (entries, entry->key);
+  if (link != NULL)
+    {
+      CacheEntry *old = link->data;
+
+      g_queue_delete_link (&lru, link);
+      g_hash_table_remove (entries, old->key);
+      total_size -= old->size;
+      cache_entry_free (old);
+    }
+
+  g_queue_push_head (&lru, entry);
+  g_hash_table_insert (entries, entry->key, lru.head);
+  total_size += entry->size;
+
+  cache_evict ();
+
+  G_UNLOCK (cache);
+}
@@ -150,6 +150,12 @@ struct _EmpathyChatPriv {
 	 * notified again about the already notified pending messages when the
 	 * messages in tab will be properly shown */
 	gboolean           retrieving_backlogs;
+	/* TRUE while fetching an older page of logs */
+	gboolean           retrieving_older_logs;
+	/* TRUE if the last page of logs was full, so older ones may exist */
+	gboolean           has_more_logs;
+	/* Timestamp of the oldest message loaded from the logs */
+	gint64             oldest_log_timestamp;
 	gboolean           sms_channel;
 
 	/* we need to know whether populate-popup happened in response to
@@ -2491,41 +2497,138 @@ chat_input_populate_popup_cb (GtkTextView *view,
 }
 
 
+/* State of one request for a page of logs */
+typedef struct {
+	TpWeakRef  *wr;
+	/* Only events older than this are fetched, or sent at that time
+	 * but not in boundary */
+	gint64      before;
+	/* Set of chat_log_message_key()s of the messages displayed with
+	 * timestamp before */
+	GHashTable *boundary;
+	/* Set of the pending EmpathyMessage*s, which are displayed anyway */
+	GHashTable *pending;
+	guint       page_size;
+} LogsPageData;
+
+static LogsPageData *
+logs_page_data_new (EmpathyChat *chat,
+		    gint64       before,
+		    guint        page_size)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	LogsPageData *data;
+	const GList *l;
+
+	data = g_slice_new0 (LogsPageData);
+	data->wr = tp_weak_ref_new (chat, NULL, NULL);
+	data->before = before;
+	data->page_size = page_size;
+	data->boundary = g_hash_table_new_full (g_str_hash, g_str_equal,
+		g_free, NULL);
+	data->pending = g_hash_table_new_full (empathy_message_hash,
+		(GEqualFunc) empathy_message_equal, g_object_unref, NULL);
+
+	if (priv->tp_chat != NULL) {
+		l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+		for (; l != NULL; l = g_list_next (l)) {
+			g_hash_table_add (data->pending, g_object_ref (l->data));
+		}
+	}
+
+	return data;
+}
+
+static void
+logs_page_data_free (LogsPageData *data)
+{
+	tp_weak_ref_destroy (data->wr);
+	g_hash_table_unref (data->boundary);
+	g_hash_table_unref (data->pending);
+	g_slice_free (LogsPageData, data);
+}
+
+/* Identifies a message among those sent in the same second. Old logs
+ * don't have tokens, the body is the best we can do for them. */
+static const gchar *
+chat_log_message_key (EmpathyMessage *message)
+{
+	const gchar *token = empathy_message_get_token (message);
+
+	if (!EMP_STR_EMPTY (token))
+		return token;
+
+	return empathy_message_get_body (message);
+}
+
+/* Remember the messages already displayed at data->before, as timestamps
+ * only have a one second resolution and more messages of that second may
+ * be in the page we are about to fetch */
+static void
+logs_page_data_add_boundary (LogsPageData      *data,
+			     EmpathyThemeAdium *view)
+{
+	GList *messages, *l;
+
+	if (empathy_theme_adium_get_oldest_timestamp (view) != data->before)
+		return;
+
+	messages = empathy_theme_adium_get_oldest_messages (view);
+	for (l = messages; l != NULL; l = g_list_next (l)) {
+		const gchar *key = chat_log_message_key (l->data);
+
+		if (key != NULL)
+			g_hash_table_add (data->boundary, g_strdup (key));
+	}
+	g_list_free (messages);
+}
+
 static gboolean
 chat_log_filter (TplEvent *event,
 		 gpointer user_data)
 {
-	TpWeakRef *wr = user_data;
-	EmpathyChat *chat = tp_weak_ref_dup_object (wr);
+	LogsPageData *data = user_data;
 	EmpathyMessage *message;
-	EmpathyChatPriv *priv;
-	const GList *pending;
-	bool retval = FALSE;
-
-	if (chat == NULL)
-		return FALSE;
+	const gchar *key;
+	gint64 timestamp;
+	gboolean retval;
 
 	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
-	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
 
-	priv = GET_PRIV (chat);
+	timestamp = tpl_event_get_timestamp (event);
+	if (timestamp > data->before)
+		return FALSE;
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
 	message = empathy_message_from_tpl_log_event (event);
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data))
-			goto out;
-	}
+	key = chat_log_message_key (message);
 
-	retval = TRUE;
-
-out:
+	if (timestamp == data->before && key != NULL &&
+	    g_hash_table_contains (data->boundary, key))
+		retval = FALSE;
+	else
+		retval = !g_hash_table_contains (data->pending, message);
 	g_object_unref (message);
-	g_object_unref (chat);
+
 	return retval;
 }
 
+/* Update the paging state once a page of logs has been received */
+static void
+chat_logs_page_received (EmpathyChat  *chat,
+			 LogsPageData *data,
+			 GList        *events)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	priv->has_more_logs = (g_list_length (events) >= data->page_size);
+
+	if (events != NULL) {
+		priv->oldest_log_timestamp = MIN (priv->oldest_log_timestamp,
+			tpl_event_get_timestamp (events->data));
+	}
+}
+
 
 static void
 show_pending_messages (EmpathyChat *chat) {
@@ -2556,13 +2659,13 @@ got_filtered_messages_cb (GObject *manager,
 {
 	GList *l;
 	GList *messages;
-	TpWeakRef *wr = user_data;
-	EmpathyChat *chat = tp_weak_ref_dup_object (wr);
+	LogsPageData *data = user_data;
+	EmpathyChat *chat = tp_weak_ref_dup_object (data->wr);
 	EmpathyChatPriv *priv;
 	GError *error = NULL;
 
 	if (chat == NULL) {
-		tp_weak_ref_destroy (wr);
+		logs_page_data_free (data);
 		return;
 	}
 
@@ -2577,6 +2680,8 @@ got_filtered_messages_cb (GObject *manager,
 		goto out;
 	}
 
+	chat_logs_page_received (chat, data, messages);
+
 	for (l = messages; l; l = g_list_next (l)) {
 		EmpathyMessage *message;
 
@@ -2631,7 +2736,18 @@ out:
 	empathy_theme_adium_scroll (chat->view, TRUE);
 
 	g_object_unref (chat);
-	tp_weak_ref_destroy (wr);
+	logs_page_data_free (data);
+}
+
+static TplEntity *
+chat_dup_log_target (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
+	  return tpl_entity_new_from_room_id (priv->id);
+	else
+	  return tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
 }
 
 static void
@@ -2639,7 +2755,7 @@ chat_add_logs (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	TplEntity       *target;
-	TpWeakRef       *wr;
+	LogsPageData    *data;
 
 	if (!priv->id) {
 		return;
@@ -2648,27 +2764,177 @@ chat_add_logs (EmpathyChat *chat)
 	/* Turn off scrolling temporarily */
 	empathy_theme_adium_scroll (chat->view, FALSE);
 
-	/* Add messages from last conversation */
-	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
-	  target = tpl_entity_new_from_room_id (priv->id);
-	else
-	  target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
+	/* Add messages from last conversation, older pages are loaded
+	 * when scrolling back to the top */
+	target = chat_dup_log_target (chat);
 
 	priv->retrieving_backlogs = TRUE;
-	wr = tp_weak_ref_new (chat, NULL, NULL);
+	priv->oldest_log_timestamp = G_MAXINT64;
+	data = logs_page_data_new (chat, G_MAXINT64,
+		g_settings_get_uint (priv->gsettings_chat,
+			EMPATHY_PREFS_CHAT_BACKLOG_PAGE_SIZE));
 	tpl_log_manager_get_filtered_events_async (priv->log_manager,
 						   priv->account,
 						   target,
 						   TPL_EVENT_MASK_TEXT,
-						   5,
+						   data->page_size,
 						   chat_log_filter,
-						   wr,
+						   data,
 						   got_filtered_messages_cb,
-						   wr);
+						   data);
+
+	g_object_unref (target);
+}
+
+static void
+got_older_messages_cb (GObject      *manager,
+		       GAsyncResult *result,
+		       gpointer      user_data)
+{
+	LogsPageData *data = user_data;
+	EmpathyChat *chat = tp_weak_ref_dup_object (data->wr);
+	EmpathyChatPriv *priv;
+	GList *messages, *l;
+	GError *error = NULL;
+
+	if (chat == NULL)
+		goto out;
+
+	priv = GET_PRIV (chat);
+	priv->retrieving_older_logs = FALSE;
+
+	if (!tpl_log_manager_get_filtered_events_finish (TPL_LOG_MANAGER (manager),
+		result, &messages, &error)) {
+		DEBUG ("Failed to reload older logs: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	chat_logs_page_received (chat, data, messages);
+
+	/* Events are sorted oldest first, and each one is inserted above
+	 * the ones already displayed */
+	for (l = g_list_last (messages); l != NULL; l = g_list_previous (l)) {
+		EmpathyMessage *message;
+
+		message = empathy_message_from_tpl_log_event (l->data);
+
+		if (empathy_message_is_edit (message)) {
+			/* See got_filtered_messages_cb() */
+			EmpathyMessage *syn_msg = g_object_new (
+				EMPATHY_TYPE_MESSAGE,
+				"body", "",
+				"token", empathy_message_get_supersedes (message),
+				"type", empathy_message_get_tptype (message),
+				"timestamp", empathy_message_get_original_timestamp (message),
+				"incoming", empathy_message_is_incoming (message),
+				"is-backlog", TRUE,
+				"receiver", empathy_message_get_receiver (message),
+				"sender", empathy_message_get_sender (message),
+				NULL);
+
+			empathy_theme_adium_prepend_message (chat->view, syn_msg,
+							  chat_should_highlight (chat, syn_msg));
+			empathy_theme_adium_edit_message (chat->view, message);
+
+			g_object_unref (syn_msg);
+		} else {
+			empathy_theme_adium_prepend_message (chat->view, message,
+							  chat_should_highlight (chat, message));
+		}
+
+		g_object_unref (message);
+	}
+	g_list_free_full (messages, g_object_unref);
+
+out:
+	tp_clear_object (&chat);
+	logs_page_data_free (data);
+}
+
+/* Load the page of logs preceding the oldest message displayed, if any.
+ * This is also done when scrolling back to the top of the view. */
+void
+empathy_chat_load_older_messages (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	LogsPageData    *data;
+	TplEntity       *target;
+	gint64           before;
+	guint            page_size, n_pruned;
+
+	if (priv->id == NULL || priv->retrieving_backlogs ||
+	    priv->retrieving_older_logs)
+		return;
+
+	page_size = g_settings_get_uint (priv->gsettings_chat,
+		EMPATHY_PREFS_CHAT_BACKLOG_PAGE_SIZE);
+
+	/* First reload what was removed from the view to keep its
+	 * scrollback bounded, then continue with what was never loaded */
+	n_pruned = empathy_theme_adium_get_n_pruned (chat->view);
+	if (n_pruned > 0) {
+		before = empathy_theme_adium_get_oldest_timestamp (chat->view);
+		page_size = MIN (page_size, n_pruned);
+	} else if (priv->has_more_logs) {
+		before = priv->oldest_log_timestamp;
+	} else {
+		return;
+	}
+
+	data = logs_page_data_new (chat, before, page_size);
+	logs_page_data_add_boundary (data, chat->view);
+
+	target = chat_dup_log_target (chat);
+
+	priv->retrieving_older_logs = TRUE;
+	tpl_log_manager_get_filtered_events_async (priv->log_manager,
+						   priv->account,
+						   target,
+						   TPL_EVENT_MASK_TEXT,
+						   data->page_size,
+						   chat_log_filter,
+						   data,
+						   got_older_messages_cb,
+						   data);
 
 	g_object_unref (target);
 }
 
+static void
+chat_view_vadjustment_value_changed_cb (GtkAdjustment *adjustment,
+					EmpathyChat   *chat)
+{
+	if (gtk_adjustment_get_value (adjustment) >
+	    gtk_adjustment_get_lower (adjustment))
+		return;
+
+	empathy_chat_load_older_messages (chat);
+}
+
+/* A conversation too short to fill the view can't be scrolled back, keep
+ * loading older pages until it can or the logs are exhausted. Once
+ * messages have been pruned the view was full at some point, so this
+ * doesn't fight with pruning. */
+static void
+chat_view_vadjustment_changed_cb (GtkAdjustment *adjustment,
+				  EmpathyChat   *chat)
+{
+	/* Not allocated yet */
+	if (gtk_adjustment_get_page_size (adjustment) <= 0)
+		return;
+
+	if (gtk_adjustment_get_upper (adjustment) -
+	    gtk_adjustment_get_lower (adjustment) >
+	    gtk_adjustment_get_page_size (adjustment))
+		return;
+
+	if (empathy_theme_adium_get_n_pruned (chat->view) > 0)
+		return;
+
+	empathy_chat_load_older_messages (chat);
+}
+
 static gint
 chat_contacts_completion_func (const gchar *s1,
 			       const gchar *s2,
@@ -3181,6 +3447,18 @@ chat_create_ui (EmpathyChat *chat)
 			   GTK_WIDGET (chat->view));
 	gtk_widget_show (GTK_WIDGET (chat->view));
 
+	/* Load older messages when scrolling back to the top */
+	g_signal_connect (gtk_scrolled_window_get_vadjustment (
+				GTK_SCROLLED_WINDOW (priv->scrolled_window_chat)),
+			  "value-changed",
+			  G_CALLBACK (chat_view_vadjustment_value_changed_cb),
+			  chat);
+	g_signal_connect (gtk_scrolled_window_get_vadjustment (
+				GTK_SCROLLED_WINDOW (priv->scrolled_window_chat)),
+			  "changed",
+			  G_CALLBACK (chat_view_vadjustment_changed_cb),
+			  chat);
+
 	/* Add input GtkTextView */
 	chat->input_text_view = empathy_input_text_view_new ();
 	g_signal_connect (chat->input_text_view, "notify::has-focus",
@@ -100,6 +100,118 @@ static void individual_store_contact_update (EmpathyIndividualStore *self,
 G_DEFINE_TYPE (EmpathyIndividualStore, empathy_individual_store,
     GTK_TYPE_TREE_STORE);
 
+/* What individual_store_contact_sort() and the presence comparison of
+ * individual_store_state_sort_func() need to know about an individual,
+ * computed once per change of the individual rather than on each
+ * comparison. Stored as qdata on the individual and pointed to by the
+ * EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY column of its rows. */
+typedef struct
+{
+  gchar *alias_key;
+  /* Higher when more available */
+  gint presence_rank;
+  /* NULL if the individual has no EmpathyContact */
+  gchar *protocol;
+  gchar *account_path;
+  gchar *id_key;
+} SortKey;
+
+static GQuark
+sort_key_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-individual-store-sort-key");
+
+  return quark;
+}
+
+static void
+sort_key_clear (SortKey *key)
+{
+  g_free (key->alias_key);
+  g_free (key->protocol);
+  g_free (key->account_path);
+  g_free (key->id_key);
+}
+
+static void
+sort_key_free (gpointer data)
+{
+  SortKey *key = data;
+
+  sort_key_clear (key);
+  g_slice_free (SortKey, key);
+}
+
+static gint
+presence_rank (TpConnectionPresenceType presence)
+{
+  TpConnectionPresenceType type;
+  gint rank = 0;
+
+  /* Number of presence types @presence is more available than */
+  for (type = TP_CONNECTION_PRESENCE_TYPE_UNSET;
+      type < NUM_TP_CONNECTION_PRESENCE_TYPES; type++)
+    {
+      if (tp_connection_presence_type_cmp_availability (presence, type) > 0)
+        rank++;
+    }
+
+  return rank;
+}
+
+/* Returns the SortKey of @individual, updated to its current state. The key
+ * lives as long as @individual. */
+static SortKey *
+individual_store_update_sort_key (FolksIndividual *individual)
+{
+  SortKey *key;
+  EmpathyContact *contact;
+
+  key = g_object_get_qdata (G_OBJECT (individual), sort_key_quark ());
+  if (key == NULL)
+    {
+      key = g_slice_new0 (SortKey);
+      g_object_set_qdata_full (G_OBJECT (individual), sort_key_quark (), key,
+          sort_key_free);
+    }
+  else
+    {
+      sort_key_clear (key);
+    }
+
+  key->alias_key = g_utf8_collate_key (
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)), -1);
+
+  key->presence_rank = presence_rank (empathy_folks_presence_type_to_tp (
+        folks_presence_details_get_presence_type (
+          FOLKS_PRESENCE_DETAILS (individual))));
+
+  contact = empathy_contact_dup_from_folks_individual (individual);
+  if (contact != NULL)
+    {
+      TpAccount *account = empathy_contact_get_account (contact);
+
+      g_assert (account != NULL);
+
+      key->protocol = g_strdup (tp_account_get_protocol_name (account));
+      key->account_path = g_strdup (tp_proxy_get_object_path (account));
+
+      g_object_unref (contact);
+    }
+  else
+    {
+      key->protocol = NULL;
+      key->account_path = NULL;
+    }
+
+  key->id_key = g_utf8_collate_key (folks_individual_get_id (individual), -1);
+
+  return key;
+}
+
 static void
 add_individual_to_store (GtkTreeStore *store,
     GtkTreeIter *iter,
@@ -125,6 +237,8 @@ add_individual_to_store (GtkTreeStore *store,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_AUDIO_CALL, can_audio_call,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_VIDEO_CALL, can_video_call,
       EMPATHY_INDIVIDUAL_STORE_COL_CLIENT_TYPES, types,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY,
+        individual_store_update_sort_key (individual),
       -1);
 
   queue = g_hash_table_lookup (self->priv->folks_individual_cache, individual);
@@ -653,6 +767,10 @@ individual_store_contact_update (EmpathyIndividualStore *self,
   pixbuf_status =
       empathy_individual_store_get_individual_status_icon (self, individual);
 
+  /* The rows are resorted when they are set below */
+  if (set_model)
+    individual_store_update_sort_key (individual);
+
   for (l = iters; l && set_model; l = l->next)
     {
       gboolean can_audio_call, can_video_call;
@@ -1104,57 +1222,34 @@ compare_separator_and_groups (gboolean is_separator_a,
 }
 
 static gint
-individual_store_contact_sort (FolksIndividual *individual_a,
-    FolksIndividual *individual_b)
+individual_store_contact_sort (const SortKey *key_a,
+    const SortKey *key_b)
 {
   gint ret_val;
-  EmpathyContact *contact_a = NULL, *contact_b = NULL;
-  TpAccount *account_a, *account_b;
-
-  g_return_val_if_fail (individual_a != NULL || individual_b != NULL, 0);
 
   /* alias */
-  ret_val = g_utf8_collate (
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_a)),
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_b)));
+  ret_val = strcmp (key_a->alias_key, key_b->alias_key);
 
   if (ret_val != 0)
-    goto out;
+    return ret_val;
 
-  contact_a = empathy_contact_dup_from_folks_individual (individual_a);
-  contact_b = empathy_contact_dup_from_folks_individual (individual_b);
-  if (contact_a != NULL && contact_b != NULL)
+  if (key_a->account_path != NULL && key_b->account_path != NULL)
     {
-      account_a = empathy_contact_get_account (contact_a);
-      account_b = empathy_contact_get_account (contact_b);
-
-      g_assert (account_a != NULL);
-      g_assert (account_b != NULL);
-
       /* protocol */
-      ret_val = g_strcmp0 (tp_account_get_protocol_name (account_a),
-          tp_account_get_protocol_name (account_b));
+      ret_val = g_strcmp0 (key_a->protocol, key_b->protocol);
 
       if (ret_val != 0)
-        goto out;
+        return ret_val;
 
       /* account ID */
-      ret_val = g_strcmp0 (tp_proxy_get_object_path (account_a),
-          tp_proxy_get_object_path (account_b));
+      ret_val = strcmp (key_a->account_path, key_b->account_path);
 
       if (ret_val != 0)
-        goto out;
+        return ret_val;
     }
 
   /* identifier */
-  ret_val = g_utf8_collate (folks_individual_get_id (individual_a),
-      folks_individual_get_id (individual_b));
-
-out:
-  tp_clear_object (&contact_a);
-  tp_clear_object (&contact_b);
-
-  return ret_val;
+  return strcmp (key_a->id_key, key_b->id_key);
 }
 
 static gint
@@ -1168,8 +1263,26 @@ individual_store_state_sort_func (GtkTreeModel *model,
   gchar *name_a, *name_b;
   gboolean is_separator_a, is_separator_b;
   gboolean fake_group_a, fake_group_b;
-  FolksPresenceType folks_presence_type_a, folks_presence_type_b;
-  TpConnectionPresenceType tp_presence_a, tp_presence_b;
+  SortKey *key_a, *key_b;
+
+  gtk_tree_model_get (model, iter_a,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_a, -1);
+  gtk_tree_model_get (model, iter_b,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_b, -1);
+
+  if (key_a != NULL && key_b != NULL)
+    {
+      /* Most available first */
+      ret_val = key_b->presence_rank - key_a->presence_rank;
+
+      if (ret_val == 0)
+        {
+          /* Fallback: compare by name et al. */
+          ret_val = individual_store_contact_sort (key_a, key_b);
+        }
+
+      return ret_val;
+    }
 
   gtk_tree_model_get (model, iter_a,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
@@ -1182,36 +1295,11 @@ individual_store_state_sort_func (GtkTreeModel *model,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
 
-  if (individual_a == NULL || individual_b == NULL)
-    {
-      ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
-          name_a, name_b, individual_a, individual_b, fake_group_a,
-          fake_group_b);
-      goto free_and_out;
-    }
-
-  /* If we managed to get this far, we can start looking at
-   * the presences.
-   */
-  folks_presence_type_a =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_a));
-  folks_presence_type_b =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_b));
-  tp_presence_a = empathy_folks_presence_type_to_tp (folks_presence_type_a);
-  tp_presence_b = empathy_folks_presence_type_to_tp (folks_presence_type_b);
-
-  ret_val = -tp_connection_presence_type_cmp_availability (tp_presence_a,
-      tp_presence_b);
-
-  if (ret_val == 0)
-    {
-      /* Fallback: compare by name et al. */
-      ret_val = individual_store_contact_sort (individual_a, individual_b);
-    }
+  /* At least one of them is a group or a separator */
+  ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
+      name_a, name_b, individual_a, individual_b, fake_group_a,
+      fake_group_b);
 
-free_and_out:
   g_free (name_a);
   g_free (name_b);
   tp_clear_object (&individual_a);
@@ -1231,6 +1319,15 @@ individual_store_name_sort_func (GtkTreeModel *model,
   gboolean is_separator_a = FALSE, is_separator_b = FALSE;
   gint ret_val;
   gboolean fake_group_a, fake_group_b;
+  SortKey *key_a, *key_b;
+
+  gtk_tree_model_get (model, iter_a,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_a, -1);
+  gtk_tree_model_get (model, iter_b,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_b, -1);
+
+  if (key_a != NULL && key_b != NULL)
+    return individual_store_contact_sort (key_a, key_b);
 
   gtk_tree_model_get (model, iter_a,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
@@ -1243,11 +1340,9 @@ individual_store_name_sort_func (GtkTreeModel *model,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
 
-  if (individual_a == NULL || individual_b == NULL)
-    ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
-        name_a, name_b, individual_a, individual_b, fake_group_a, fake_group_b);
-  else
-    ret_val = individual_store_contact_sort (individual_a, individual_b);
+  /* At least one of them is a group or a separator */
+  ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
+      name_a, name_b, individual_a, individual_b, fake_group_a, fake_group_b);
 
   tp_clear_object (&individual_a);
   tp_clear_object (&individual_b);
@@ -1278,6 +1373,7 @@ individual_store_setup (EmpathyIndividualStore *self)
     G_TYPE_BOOLEAN,             /* Is a fake group */
     G_TYPE_STRV,                /* Client types */
     G_TYPE_UINT,                /* Event count */
+    G_TYPE_POINTER,             /* Sort key */
   };
 
   gtk_tree_store_set_column_types (GTK_TREE_STORE (self),
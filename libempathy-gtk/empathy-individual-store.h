@@ -67,6 +67,7 @@ typedef enum
   EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP,
   EMPATHY_INDIVIDUAL_STORE_COL_CLIENT_TYPES,
   EMPATHY_INDIVIDUAL_STORE_COL_EVENT_COUNT,
+  EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, /* private */
   EMPATHY_INDIVIDUAL_STORE_COL_COUNT,
 } EmpathyIndividualStoreCol;
 
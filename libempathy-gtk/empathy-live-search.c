@@ -169,9 +169,37 @@ empathy_live_search_strip_utf8_string (const gchar *string)
   return word_array;
 }
 
+/* Returns @string with each char stripped by stripped_char(), dropping the
+ * ignored ones. Matching words against it with
+ * empathy_live_search_match_words_stripped() gives the same result as
+ * matching them against @string, without stripping it again each time. */
+gchar *
+empathy_live_search_strip_string (const gchar *string)
+{
+  GString *result;
+  const gchar *p;
+
+  if (EMP_STR_EMPTY (string))
+    return NULL;
+
+  result = g_string_sized_new (strlen (string));
+
+  for (p = string; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      gunichar sc;
+
+      sc = stripped_char (g_utf8_get_char (p));
+      if (sc != 0)
+        g_string_append_unichar (result, sc);
+    }
+
+  return g_string_free (result, FALSE);
+}
+
 static gboolean
 live_search_match_prefix (const gchar *string,
-    const gchar *prefix)
+    const gchar *prefix,
+    gboolean stripped)
 {
   const gchar *p;
   const gchar *prefix_p;
@@ -190,7 +218,9 @@ live_search_match_prefix (const gchar *string,
 
       /* Make the char lower-case, remove its accentuation marks, and ignore it
        * if it is just unicode marks */
-      sc = stripped_char (g_utf8_get_char (p));
+      sc = g_utf8_get_char (p);
+      if (!stripped)
+        sc = stripped_char (sc);
       if (sc == 0)
         continue;
 
@@ -232,7 +262,27 @@ empathy_live_search_match_words (const gchar *string,
     return TRUE;
 
   for (i = 0; i < words->len; i++)
-    if (!live_search_match_prefix (string, g_ptr_array_index (words, i)))
+    if (!live_search_match_prefix (string, g_ptr_array_index (words, i),
+          FALSE))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Same as empathy_live_search_match_words() but @stripped has already been
+ * returned by empathy_live_search_strip_string() */
+gboolean
+empathy_live_search_match_words_stripped (const gchar *stripped,
+    GPtrArray *words)
+{
+  guint i;
+
+  if (words == NULL)
+    return TRUE;
+
+  for (i = 0; i < words->len; i++)
+    if (!live_search_match_prefix (stripped, g_ptr_array_index (words, i),
+          TRUE))
       return FALSE;
 
   return TRUE;
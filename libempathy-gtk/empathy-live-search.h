@@ -70,6 +70,11 @@ gboolean empathy_live_search_match_words (const gchar *string,
 
 GPtrArray * empathy_live_search_get_words (EmpathyLiveSearch *self);
 
+gchar * empathy_live_search_strip_string (const gchar *string);
+
+gboolean empathy_live_search_match_words_stripped (const gchar *stripped,
+    GPtrArray *words);
+
 /* Made public for unit tests */
 gboolean empathy_live_search_match_string (const gchar *string,
    const gchar *prefix);
@@ -0,0 +1,1799 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* Full-text index over the text logs, used by the log window instead of
+ * tpl_log_manager_search_async() which reads every log file on each query.
+ *
+ * A document is one (account, entity, day) triplet, which is also the
+ * granularity of a TplLogSearchHit. The index maps every word, and every
+ * pair of adjacent words, to the sorted list of documents containing it;
+ * the latter lets phrases be answered without storing word positions.
+ * It is kept in the user's cache directory and brought up to date by
+ * re-reading only the days which could have changed since the last run.
+ *
+ * The file is a snapshot of the whole index, followed by a journal of the
+ * messages indexed since, so that a new message only costs an append.
+ * All the file accesses happen in a thread, one job after another. */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include <libempathy/empathy-utils.h>
+
+#include "empathy-log-index.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include <libempathy/empathy-debug.h>
+
+#define INDEX_FILENAME "log-index"
+#define JOURNAL_FILENAME "log-index.journal"
+#define INDEX_VERSION 1
+#define INDEX_FORMAT "(ua(sssuuu)a{sau}a{sau})"
+/* account path, id, alias, entity type, julian day, text */
+#define RECORD_FORMAT "(sssuus)"
+
+/* Longer words are most likely URLs or pasted binary data */
+#define MAX_WORD_LENGTH 64
+
+/* Once the journal is that large, it's folded into a new snapshot */
+#define MAX_JOURNAL_SIZE (1024 * 1024)
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *log_index_singleton = NULL;
+
+typedef struct
+{
+  /* "<account path>\n<id>\n<julian day>", key of doc_ids */
+  gchar *key;
+  gchar *account_path;
+  gchar *id;
+  gchar *alias;
+  TplEntityType type;
+  guint32 julian;
+  /* Julian day on which the logs for this day were last read; if that's a
+   * later day, no new events can be added to it anymore */
+  guint32 crawled;
+} Doc;
+
+typedef struct
+{
+  /* owned term -> GArray of sorted, unique guint32 document ids */
+  GHashTable *postings;
+  /* borrowed terms in strcmp() order, for prefix lookups */
+  GPtrArray *sorted;
+  /* borrowed terms added since, merged into sorted on the next prefix
+   * lookup so it's never sorted again from scratch */
+  GPtrArray *added;
+} Terms;
+
+typedef struct
+{
+  /* Doc, indexed by document id */
+  GPtrArray *docs;
+  /* borrowed Doc key -> document id + 1 */
+  GHashTable *doc_ids;
+
+  Terms words;
+  Terms pairs;
+} Index;
+
+/* A message to index or, if @text is %NULL, the account to forget; all
+ * of them if @account_path is %NULL as well */
+typedef struct
+{
+  gchar *account_path;
+  gchar *id;
+  gchar *alias;
+  TplEntityType type;
+  guint32 julian;
+  gchar *text;
+} Record;
+
+typedef enum
+{
+  JOB_LOAD,
+  JOB_APPEND,
+  JOB_SNAPSHOT
+} JobType;
+
+typedef struct
+{
+  JobType type;
+
+  /* JOB_LOAD: the index read from disk, whether it came from a valid
+   * snapshot, how much of the journal could be replayed and whether
+   * anything after that had to be ignored */
+  Index *index;
+  gboolean complete;
+  gsize journal_size;
+  gboolean damaged;
+
+  /* JOB_APPEND: the serialized records to add to the journal */
+  GByteArray *records;
+
+  /* JOB_SNAPSHOT: the whole index, replacing the journal. It's borrowed
+   * and not modified until the job is done. */
+  Index *snapshot;
+} Job;
+
+typedef struct
+{
+  TpAccount *account;
+  /* NULL while listing the entities of the account */
+  TplEntity *entity;
+  /* NULL while listing the dates of the entity */
+  GDate *date;
+} CrawlItem;
+
+struct _EmpathyLogIndexPriv
+{
+  gchar *filename;
+  gchar *journal_filename;
+
+  /* Only ever used from the main thread; empty until the load job is done */
+  Index *index;
+  gboolean loaded;
+  /* Record which came in while loading or saving, applied once the index
+   * is there or the snapshot is written */
+  GQueue *pending;
+  /* empathy_log_index_update() was called while loading */
+  gboolean update_pending;
+
+  /* A snapshot job is reading the index; nothing may modify it until
+   * it's done */
+  gboolean saving;
+  /* log_index_save() was called while saving */
+  gboolean save_pending;
+  /* The index changed since the last snapshot */
+  gboolean dirty;
+
+  /* TRUE once the index covers the logs, either because it was loaded
+   * from disk or because a crawl went through all of them */
+  gboolean ready;
+
+  TplLogManager *log_manager;
+  TpAccountManager *account_manager;
+
+  /* queue of CrawlItem left to read, and the one being read */
+  GQueue *crawl;
+  CrawlItem *crawling;
+  gboolean updating;
+  /* The crawl waits for the snapshot being written */
+  gboolean crawl_paused;
+
+  /* queue of Job waiting for the one being run, if any */
+  GQueue *jobs;
+  gboolean job_running;
+  /* bytes in the journal, including the appends still queued */
+  gsize journal_size;
+};
+
+static void
+doc_free (Doc *doc)
+{
+  g_free (doc->key);
+  g_free (doc->account_path);
+  g_free (doc->id);
+  g_free (doc->alias);
+  g_slice_free (Doc, doc);
+}
+
+static CrawlItem *
+crawl_item_new (TpAccount *account,
+    TplEntity *entity,
+    GDate *date)
+{
+  CrawlItem *item = g_slice_new0 (CrawlItem);
+
+  item->account = g_object_ref (account);
+
+  if (entity != NULL)
+    item->entity = g_object_ref (entity);
+
+  if (date != NULL)
+    item->date = g_date_new_julian (g_date_get_julian (date));
+
+  return item;
+}
+
+static void
+crawl_item_free (CrawlItem *item)
+{
+  g_object_unref (item->account);
+  tp_clear_object (&item->entity);
+  tp_clear_pointer (&item->date, g_date_free);
+  g_slice_free (CrawlItem, item);
+}
+
+static Record *
+record_new (const gchar *account_path,
+    const gchar *id,
+    const gchar *alias,
+    TplEntityType type,
+    guint32 julian,
+    const gchar *text)
+{
+  Record *record = g_slice_new0 (Record);
+
+  record->account_path = g_strdup (account_path);
+  record->id = g_strdup (id);
+  record->alias = g_strdup (alias);
+  record->type = type;
+  record->julian = julian;
+  record->text = g_strdup (text);
+
+  return record;
+}
+
+static void
+record_free (Record *record)
+{
+  g_free (record->account_path);
+  g_free (record->id);
+  g_free (record->alias);
+  g_free (record->text);
+  g_slice_free (Record, record);
+}
+
+static Job *
+job_new (JobType type)
+{
+  Job *job = g_slice_new0 (Job);
+
+  job->type = type;
+
+  return job;
+}
+
+static void index_free (Index *index);
+
+static void
+job_free (Job *job)
+{
+  tp_clear_pointer (&job->index, index_free);
+  if (job->records != NULL)
+    g_byte_array_unref (job->records);
+  g_slice_free (Job, job);
+}
+
+static guint32
+today_julian (void)
+{
+  GDateTime *now;
+  GDate *date;
+  guint32 julian;
+
+  /* The logger files events under their UTC day */
+  now = g_date_time_new_now_utc ();
+  date = g_date_new_dmy (g_date_time_get_day_of_month (now),
+      g_date_time_get_month (now), g_date_time_get_year (now));
+
+  julian = g_date_get_julian (date);
+
+  g_date_free (date);
+  g_date_time_unref (now);
+
+  return julian;
+}
+
+static void
+terms_init (Terms *terms)
+{
+  terms->postings = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_array_unref);
+  terms->sorted = g_ptr_array_new ();
+  terms->added = g_ptr_array_new ();
+}
+
+static void
+terms_clear (Terms *terms)
+{
+  tp_clear_pointer (&terms->added, g_ptr_array_unref);
+  tp_clear_pointer (&terms->sorted, g_ptr_array_unref);
+  tp_clear_pointer (&terms->postings, g_hash_table_unref);
+}
+
+static void
+postings_add (GArray *docs,
+    guint32 doc)
+{
+  guint lo = 0, hi = docs->len;
+
+  /* Documents are mostly added in order */
+  if (docs->len == 0 || g_array_index (docs, guint32, docs->len - 1) < doc)
+    {
+      g_array_append_val (docs, doc);
+      return;
+    }
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+
+      if (g_array_index (docs, guint32, mid) < doc)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (g_array_index (docs, guint32, lo) != doc)
+    g_array_insert_val (docs, lo, doc);
+}
+
+static void
+terms_add (Terms *terms,
+    const gchar *term,
+    guint32 doc)
+{
+  GArray *docs;
+
+  docs = g_hash_table_lookup (terms->postings, term);
+  if (docs == NULL)
+    {
+      gchar *key = g_strdup (term);
+
+      docs = g_array_new (FALSE, FALSE, sizeof (guint32));
+      g_hash_table_insert (terms->postings, key, docs);
+      g_ptr_array_add (terms->added, key);
+    }
+
+  postings_add (docs, doc);
+}
+
+static gint
+compare_terms (gconstpointer a,
+    gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Only the new terms are sorted, then merged in linear time. Inserting
+ * each of them in place would cost as much per term, which adds up when
+ * the index is first built. */
+static void
+terms_merge_added (Terms *terms)
+{
+  GPtrArray *merged;
+  guint i = 0, j = 0;
+
+  if (terms->added->len == 0)
+    return;
+
+  g_ptr_array_sort (terms->added, compare_terms);
+
+  merged = g_ptr_array_sized_new (terms->sorted->len + terms->added->len);
+
+  while (i < terms->sorted->len || j < terms->added->len)
+    {
+      if (j == terms->added->len ||
+          (i < terms->sorted->len &&
+           strcmp (g_ptr_array_index (terms->sorted, i),
+               g_ptr_array_index (terms->added, j)) < 0))
+        g_ptr_array_add (merged, g_ptr_array_index (terms->sorted, i++));
+      else
+        g_ptr_array_add (merged, g_ptr_array_index (terms->added, j++));
+    }
+
+  g_ptr_array_unref (terms->sorted);
+  terms->sorted = merged;
+  g_ptr_array_set_size (terms->added, 0);
+}
+
+static void
+postings_mark (GArray *docs,
+    guint8 *marks)
+{
+  guint i;
+
+  for (i = 0; i < docs->len; i++)
+    marks[g_array_index (docs, guint32, i)] = 1;
+}
+
+/* Sets marks[doc] for every document containing @term, or a term
+ * starting with @term if @prefix is %TRUE */
+static void
+terms_mark (Terms *terms,
+    const gchar *term,
+    gboolean prefix,
+    guint8 *marks)
+{
+  guint lo, hi, i;
+
+  if (!prefix)
+    {
+      GArray *docs = g_hash_table_lookup (terms->postings, term);
+
+      if (docs != NULL)
+        postings_mark (docs, marks);
+
+      return;
+    }
+
+  terms_merge_added (terms);
+
+  lo = 0;
+  hi = terms->sorted->len;
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+
+      if (strcmp (g_ptr_array_index (terms->sorted, mid), term) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (i = lo; i < terms->sorted->len; i++)
+    {
+      const gchar *key = g_ptr_array_index (terms->sorted, i);
+
+      if (!g_str_has_prefix (key, term))
+        break;
+
+      postings_mark (g_hash_table_lookup (terms->postings, key), marks);
+    }
+}
+
+/* @remap maps old document ids to new ones, or G_MAXUINT32 for dropped
+ * documents; it has to preserve the order of the ids it keeps */
+static void
+terms_remap (Terms *terms,
+    const guint32 *remap)
+{
+  guint t, kept = 0;
+
+  /* Walking the sorted terms lets the dropped ones be removed from it
+   * without sorting it again */
+  terms_merge_added (terms);
+
+  for (t = 0; t < terms->sorted->len; t++)
+    {
+      const gchar *key = g_ptr_array_index (terms->sorted, t);
+      GArray *docs = g_hash_table_lookup (terms->postings, key);
+      guint i, n = 0;
+
+      for (i = 0; i < docs->len; i++)
+        {
+          guint32 doc = remap[g_array_index (docs, guint32, i)];
+
+          if (doc != G_MAXUINT32)
+            g_array_index (docs, guint32, n++) = doc;
+        }
+
+      if (n == 0)
+        {
+          g_hash_table_remove (terms->postings, key);
+          continue;
+        }
+
+      g_array_set_size (docs, n);
+      g_ptr_array_index (terms->sorted, kept++) = (gpointer) key;
+    }
+
+  g_ptr_array_set_size (terms->sorted, kept);
+}
+
+/* Returns the words of @text, case-folded and normalized so they can be
+ * compared bytewise. Free with g_ptr_array_unref(). */
+static GPtrArray *
+tokenize (const gchar *text)
+{
+  GPtrArray *words;
+  gchar *normalized, *folded;
+  const gchar *p, *start = NULL;
+
+  words = g_ptr_array_new_with_free_func (g_free);
+
+  normalized = g_utf8_normalize (text, -1, G_NORMALIZE_ALL);
+  if (normalized == NULL)
+    return words;
+
+  folded = g_utf8_casefold (normalized, -1);
+
+  for (p = folded; ; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (c != 0 && g_unichar_isalnum (c))
+        {
+          if (start == NULL)
+            start = p;
+
+          continue;
+        }
+
+      if (start != NULL && p - start <= MAX_WORD_LENGTH)
+        g_ptr_array_add (words, g_strndup (start, p - start));
+
+      start = NULL;
+
+      if (c == 0)
+        break;
+    }
+
+  g_free (folded);
+  g_free (normalized);
+
+  return words;
+}
+
+static gchar *
+make_pair (const gchar *first,
+    const gchar *second)
+{
+  return g_strconcat (first, " ", second, NULL);
+}
+
+static gchar *
+make_doc_key (const gchar *account_path,
+    const gchar *id,
+    guint32 julian)
+{
+  return g_strdup_printf ("%s\n%s\n%u", account_path, id, julian);
+}
+
+static Index *
+index_new (void)
+{
+  Index *index = g_slice_new0 (Index);
+
+  index->docs = g_ptr_array_new_with_free_func ((GDestroyNotify) doc_free);
+  index->doc_ids = g_hash_table_new (g_str_hash, g_str_equal);
+
+  terms_init (&index->words);
+  terms_init (&index->pairs);
+
+  return index;
+}
+
+static void
+index_free (Index *index)
+{
+  terms_clear (&index->words);
+  terms_clear (&index->pairs);
+  g_hash_table_unref (index->doc_ids);
+  g_ptr_array_unref (index->docs);
+  g_slice_free (Index, index);
+}
+
+static guint32
+index_ensure_doc (Index *index,
+    const gchar *account_path,
+    const gchar *id,
+    const gchar *alias,
+    TplEntityType type,
+    guint32 julian)
+{
+  gchar *key;
+  gpointer value;
+  Doc *doc;
+
+  key = make_doc_key (account_path, id, julian);
+
+  value = g_hash_table_lookup (index->doc_ids, key);
+  if (value != NULL)
+    {
+      g_free (key);
+
+      doc = g_ptr_array_index (index->docs, GPOINTER_TO_UINT (value) - 1);
+
+      /* Keep the most recent alias */
+      if (!EMP_STR_EMPTY (alias) && tp_strdiff (doc->alias, alias))
+        {
+          g_free (doc->alias);
+          doc->alias = g_strdup (alias);
+        }
+
+      return GPOINTER_TO_UINT (value) - 1;
+    }
+
+  doc = g_slice_new0 (Doc);
+  doc->key = key;
+  doc->account_path = g_strdup (account_path);
+  doc->id = g_strdup (id);
+  doc->alias = g_strdup (EMP_STR_EMPTY (alias) ? id : alias);
+  doc->type = type;
+  doc->julian = julian;
+
+  g_ptr_array_add (index->docs, doc);
+  g_hash_table_insert (index->doc_ids, doc->key,
+      GUINT_TO_POINTER (index->docs->len));
+
+  return index->docs->len - 1;
+}
+
+static void
+index_add_text (Index *index,
+    guint32 doc,
+    const gchar *text)
+{
+  GPtrArray *words;
+  guint i;
+
+  words = tokenize (text);
+
+  for (i = 0; i < words->len; i++)
+    {
+      terms_add (&index->words, g_ptr_array_index (words, i), doc);
+
+      if (i > 0)
+        {
+          gchar *pair = make_pair (g_ptr_array_index (words, i - 1),
+              g_ptr_array_index (words, i));
+
+          terms_add (&index->pairs, pair, doc);
+          g_free (pair);
+        }
+    }
+
+  g_ptr_array_unref (words);
+}
+
+/* Drops the documents of @account_path, or all of them if it's %NULL */
+static void
+index_forget (Index *index,
+    const gchar *account_path)
+{
+  GPtrArray *docs;
+  guint32 *remap;
+  guint i;
+
+  /* doc_ids borrows the keys of the documents which are about to go */
+  g_hash_table_remove_all (index->doc_ids);
+
+  docs = g_ptr_array_new_with_free_func ((GDestroyNotify) doc_free);
+  remap = g_new (guint32, index->docs->len);
+
+  for (i = 0; i < index->docs->len; i++)
+    {
+      Doc *doc = g_ptr_array_index (index->docs, i);
+
+      if (account_path == NULL || !tp_strdiff (doc->account_path, account_path))
+        {
+          remap[i] = G_MAXUINT32;
+          doc_free (doc);
+        }
+      else
+        {
+          remap[i] = docs->len;
+          g_ptr_array_add (docs, doc);
+        }
+    }
+
+  terms_remap (&index->words, remap);
+  terms_remap (&index->pairs, remap);
+  g_free (remap);
+
+  /* Every document was either freed or moved over to the new array */
+  g_ptr_array_set_free_func (index->docs, NULL);
+  g_ptr_array_unref (index->docs);
+  index->docs = docs;
+
+  for (i = 0; i < docs->len; i++)
+    g_hash_table_insert (index->doc_ids,
+        ((Doc *) g_ptr_array_index (docs, i))->key, GUINT_TO_POINTER (i + 1));
+}
+
+static void
+index_apply (Index *index,
+    Record *record)
+{
+  guint32 doc;
+
+  if (record->text == NULL)
+    {
+      index_forget (index, record->account_path);
+      return;
+    }
+
+  doc = index_ensure_doc (index, record->account_path, record->id,
+      record->alias, record->type, record->julian);
+  index_add_text (index, doc, record->text);
+}
+
+static GVariant *
+terms_to_variant (Terms *terms)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sau}"));
+
+  g_hash_table_iter_init (&iter, terms->postings);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GArray *docs = value;
+
+      g_variant_builder_add (&builder, "{s@au}", key,
+          g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+              docs->data, docs->len, sizeof (guint32)));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+terms_load (Terms *terms,
+    GVariant *variant,
+    guint n_docs)
+{
+  GVariantIter iter;
+  const gchar *key;
+  gchar *term;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_loop (&iter, "{&s@au}", &key, &value))
+    {
+      const guint32 *ids;
+      gsize n, i;
+      GArray *docs;
+
+      ids = g_variant_get_fixed_array (value, &n, sizeof (guint32));
+
+      for (i = 0; i < n; i++)
+        {
+          if (ids[i] >= n_docs || (i > 0 && ids[i] <= ids[i - 1]))
+            {
+              g_variant_unref (value);
+              return FALSE;
+            }
+        }
+
+      docs = g_array_sized_new (FALSE, FALSE, sizeof (guint32), n);
+      g_array_append_vals (docs, ids, n);
+      term = g_strdup (key);
+      g_hash_table_insert (terms->postings, term, docs);
+      g_ptr_array_add (terms->added, term);
+    }
+
+  /* Sorted from the loading thread */
+  terms_merge_added (terms);
+
+  return TRUE;
+}
+
+/* Takes ownership of @contents; returns %NULL if they aren't a valid
+ * snapshot */
+static Index *
+index_load_snapshot (gchar *contents,
+    gsize length)
+{
+  Index *index;
+  GVariant *variant, *docs, *words, *pairs;
+  GVariantIter iter;
+  const gchar *account_path, *id, *alias;
+  guint32 version, type, julian, crawled;
+
+  variant = g_variant_new_from_data (G_VARIANT_TYPE (INDEX_FORMAT),
+      contents, length, FALSE, g_free, contents);
+  g_variant_ref_sink (variant);
+
+  g_variant_get (variant, "(u@a(sssuuu)@a{sau}@a{sau})",
+      &version, &docs, &words, &pairs);
+
+  index = index_new ();
+
+  if (version != INDEX_VERSION)
+    {
+      DEBUG ("Ignoring log index version %u", version);
+      tp_clear_pointer (&index, index_free);
+      goto out;
+    }
+
+  g_variant_iter_init (&iter, docs);
+  while (g_variant_iter_next (&iter, "(&s&s&suuu)",
+        &account_path, &id, &alias, &type, &julian, &crawled))
+    {
+      guint32 doc;
+
+      doc = index_ensure_doc (index, account_path, id, alias, type, julian);
+      ((Doc *) g_ptr_array_index (index->docs, doc))->crawled = crawled;
+    }
+
+  if (index->docs->len != g_variant_n_children (docs) ||
+      !terms_load (&index->words, words, index->docs->len) ||
+      !terms_load (&index->pairs, pairs, index->docs->len))
+    {
+      DEBUG ("Log index is corrupted, rebuilding it");
+      tp_clear_pointer (&index, index_free);
+      goto out;
+    }
+
+ out:
+  g_variant_unref (docs);
+  g_variant_unref (words);
+  g_variant_unref (pairs);
+  g_variant_unref (variant);
+
+  return index;
+}
+
+/* The journal is a sequence of RECORD_FORMAT variants, each preceded by
+ * its size as a little-endian guint32. Returns the length of the records
+ * which could be replayed; anything after that was cut short by a crash. */
+static gsize
+index_replay_journal (Index *index,
+    const gchar *contents,
+    gsize length)
+{
+  gsize offset = 0;
+
+  while (length - offset >= sizeof (guint32))
+    {
+      const gchar *account_path, *id, *alias, *text;
+      guint32 size, type, julian, doc;
+      GVariant *variant;
+      gpointer data;
+
+      memcpy (&size, contents + offset, sizeof (size));
+      size = GUINT32_FROM_LE (size);
+
+      if (size == 0 || size > length - offset - sizeof (guint32))
+        break;
+
+      /* Copied so the variant's data is suitably aligned */
+      data = g_memdup (contents + offset + sizeof (guint32), size);
+      variant = g_variant_new_from_data (G_VARIANT_TYPE (RECORD_FORMAT),
+          data, size, FALSE, g_free, data);
+      g_variant_ref_sink (variant);
+
+      g_variant_get (variant, "(&s&s&suu&s)",
+          &account_path, &id, &alias, &type, &julian, &text);
+
+      doc = index_ensure_doc (index, account_path, id, alias, type, julian);
+      index_add_text (index, doc, text);
+
+      g_variant_unref (variant);
+
+      offset += sizeof (guint32) + size;
+    }
+
+  return offset;
+}
+
+static GVariant *
+index_to_variant (Index *index)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sssuuu)"));
+
+  for (i = 0; i < index->docs->len; i++)
+    {
+      Doc *doc = g_ptr_array_index (index->docs, i);
+
+      g_variant_builder_add (&builder, "(sssuuu)",
+          doc->account_path, doc->id, doc->alias, doc->type,
+          doc->julian, doc->crawled);
+    }
+
+  return g_variant_new ("(u@a(sssuuu)@a{sau}@a{sau})", INDEX_VERSION,
+      g_variant_builder_end (&builder),
+      terms_to_variant (&index->words),
+      terms_to_variant (&index->pairs));
+}
+
+static void
+ensure_parent_dir (const gchar *filename)
+{
+  gchar *dir;
+
+  dir = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+  g_free (dir);
+}
+
+static void
+job_load (Job *job,
+    const gchar *filename,
+    const gchar *journal_filename)
+{
+  gchar *contents;
+  gsize length;
+  GError *error = NULL;
+
+  if (g_file_get_contents (filename, &contents, &length, &error))
+    {
+      job->index = index_load_snapshot (contents, length);
+      job->complete = (job->index != NULL);
+    }
+  else
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        DEBUG ("Could not read the log index: %s", error->message);
+
+      g_clear_error (&error);
+    }
+
+  if (job->index == NULL)
+    job->index = index_new ();
+
+  if (g_file_get_contents (journal_filename, &contents, &length, &error))
+    {
+      job->journal_size = index_replay_journal (job->index, contents, length);
+      job->damaged = (job->journal_size != length);
+      g_free (contents);
+    }
+  else
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        DEBUG ("Could not read the log index journal: %s", error->message);
+
+      g_error_free (error);
+    }
+}
+
+static void
+job_append (Job *job,
+    const gchar *journal_filename)
+{
+  GFile *file;
+  GFileOutputStream *stream;
+  GError *error = NULL;
+
+  ensure_parent_dir (journal_filename);
+
+  file = g_file_new_for_path (journal_filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+  g_object_unref (file);
+
+  if (stream == NULL)
+    goto out;
+
+  if (g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+          job->records->data, job->records->len, NULL, NULL, &error))
+    g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+
+  g_object_unref (stream);
+
+ out:
+  if (error != NULL)
+    {
+      DEBUG ("Could not append to the log index journal: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+job_snapshot (Job *job,
+    const gchar *filename,
+    const gchar *journal_filename)
+{
+  GVariant *variant;
+  GFile *file;
+  gboolean saved;
+  GError *error = NULL;
+
+  ensure_parent_dir (filename);
+
+  variant = g_variant_ref_sink (index_to_variant (job->snapshot));
+
+  /* The index is written to a temporary file which is then renamed, so a
+   * crash never leaves a truncated index behind. Like the journal, it's
+   * only readable by the user, whatever the permissions of the file it
+   * replaces. */
+  file = g_file_new_for_path (filename);
+  saved = g_file_replace_contents (file, g_variant_get_data (variant),
+      g_variant_get_size (variant), NULL, FALSE,
+      G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL, NULL,
+      &error);
+
+  g_object_unref (file);
+  g_variant_unref (variant);
+
+  if (!saved)
+    {
+      DEBUG ("Could not save the log index: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* Everything it held is part of the snapshot now */
+  g_unlink (journal_filename);
+}
+
+static void
+log_index_job_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+  Job *job = g_simple_async_result_get_op_res_gpointer (simple);
+
+  /* The file names never change once the index has been created */
+  switch (job->type)
+    {
+      case JOB_LOAD:
+        job_load (job, self->priv->filename, self->priv->journal_filename);
+        break;
+      case JOB_APPEND:
+        job_append (job, self->priv->journal_filename);
+        break;
+      case JOB_SNAPSHOT:
+        job_snapshot (job, self->priv->filename, self->priv->journal_filename);
+        break;
+    }
+}
+
+static void log_index_run_next_job (EmpathyLogIndex *self);
+static void log_index_loaded (EmpathyLogIndex *self, Job *job);
+static void log_index_saved (EmpathyLogIndex *self);
+
+static void
+log_index_job_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (source);
+  Job *job = g_simple_async_result_get_op_res_gpointer (
+      G_SIMPLE_ASYNC_RESULT (result));
+
+  self->priv->job_running = FALSE;
+
+  if (job->type == JOB_LOAD)
+    log_index_loaded (self, job);
+  else if (job->type == JOB_SNAPSHOT)
+    log_index_saved (self);
+
+  log_index_run_next_job (self);
+}
+
+static void
+log_index_run_next_job (EmpathyLogIndex *self)
+{
+  GSimpleAsyncResult *result;
+  Job *job;
+
+  if (self->priv->job_running)
+    return;
+
+  job = g_queue_pop_head (self->priv->jobs);
+  if (job == NULL)
+    return;
+
+  self->priv->job_running = TRUE;
+
+  /* GTask isn't available with the GLib we depend on. The result keeps
+   * the index alive until the job is done. */
+  result = g_simple_async_result_new (G_OBJECT (self), log_index_job_done_cb,
+      NULL, log_index_run_next_job);
+  g_simple_async_result_set_op_res_gpointer (result, job,
+      (GDestroyNotify) job_free);
+
+  g_simple_async_result_run_in_thread (result, log_index_job_thread,
+      G_PRIORITY_LOW, NULL);
+
+  g_object_unref (result);
+}
+
+static void
+log_index_queue_job (EmpathyLogIndex *self,
+    Job *job)
+{
+  g_queue_push_tail (self->priv->jobs, job);
+  log_index_run_next_job (self);
+}
+
+/* Replaces the file with the whole index, once the jobs already queued
+ * are done */
+static void
+log_index_save (EmpathyLogIndex *self)
+{
+  Job *job;
+
+  /* Taken again once the changes which came in meanwhile are applied */
+  if (self->priv->saving)
+    {
+      self->priv->save_pending = TRUE;
+      return;
+    }
+
+  /* The snapshot covers whatever the queued appends would have written;
+   * the load is never queued once the index is loaded, and no other
+   * snapshot is queued while saving */
+  while ((job = g_queue_pop_head (self->priv->jobs)) != NULL)
+    job_free (job);
+
+  /* The thread builds the snapshot from the index itself, which is left
+   * alone until it's done */
+  job = job_new (JOB_SNAPSHOT);
+  job->snapshot = self->priv->index;
+
+  self->priv->saving = TRUE;
+  self->priv->dirty = FALSE;
+  self->priv->journal_size = 0;
+  log_index_queue_job (self, job);
+}
+
+/* Applies the records which came in while the index couldn't be modified.
+ * Returns %TRUE if an account was forgotten, which isn't journaled. */
+static gboolean
+log_index_apply_pending (EmpathyLogIndex *self)
+{
+  gboolean forgot = FALSE;
+  Record *record;
+
+  while ((record = g_queue_pop_head (self->priv->pending)) != NULL)
+    {
+      forgot |= (record->text == NULL);
+      index_apply (self->priv->index, record);
+      record_free (record);
+
+      self->priv->dirty = TRUE;
+    }
+
+  return forgot;
+}
+
+static void log_index_crawl_next (EmpathyLogIndex *self);
+
+static void
+log_index_saved (EmpathyLogIndex *self)
+{
+  gboolean forgot;
+
+  self->priv->saving = FALSE;
+
+  /* Their appends were queued after the snapshot */
+  forgot = log_index_apply_pending (self);
+
+  if (forgot || self->priv->save_pending)
+    {
+      self->priv->save_pending = FALSE;
+      log_index_save (self);
+    }
+
+  if (self->priv->crawl_paused)
+    {
+      self->priv->crawl_paused = FALSE;
+      log_index_crawl_next (self);
+    }
+}
+
+/* Queues @record to be appended to the journal, along with any other
+ * record which comes in before the thread gets to it */
+static void
+log_index_journal (EmpathyLogIndex *self,
+    Record *record)
+{
+  GVariant *variant;
+  guint32 size;
+  Job *job;
+
+  variant = g_variant_new (RECORD_FORMAT, record->account_path, record->id,
+      record->alias != NULL ? record->alias : "", record->type,
+      record->julian, record->text);
+  g_variant_ref_sink (variant);
+
+  size = GUINT32_TO_LE (g_variant_get_size (variant));
+
+  job = g_queue_peek_tail (self->priv->jobs);
+  if (job == NULL || job->type != JOB_APPEND)
+    {
+      job = job_new (JOB_APPEND);
+      job->records = g_byte_array_new ();
+      g_queue_push_tail (self->priv->jobs, job);
+    }
+
+  g_byte_array_append (job->records, (const guint8 *) &size, sizeof (size));
+  g_byte_array_append (job->records, g_variant_get_data (variant),
+      g_variant_get_size (variant));
+
+  self->priv->journal_size += sizeof (size) + g_variant_get_size (variant);
+
+  g_variant_unref (variant);
+
+  if (self->priv->loaded && self->priv->journal_size > MAX_JOURNAL_SIZE)
+    log_index_save (self);
+  else
+    log_index_run_next_job (self);
+}
+
+static void
+log_index_loaded (EmpathyLogIndex *self,
+    Job *job)
+{
+  gboolean forgot;
+
+  index_free (self->priv->index);
+  self->priv->index = job->index;
+  job->index = NULL;
+
+  self->priv->loaded = TRUE;
+  self->priv->ready = job->complete;
+  self->priv->journal_size += job->journal_size;
+  /* The journal is folded into the snapshot after the next crawl */
+  self->priv->dirty = (job->journal_size > 0);
+
+  /* Their appends are queued after the load, so the journal it read didn't
+   * have them */
+  forgot = log_index_apply_pending (self);
+
+  DEBUG ("Loaded log index: %u days, %u words",
+      self->priv->index->docs->len,
+      g_hash_table_size (self->priv->index->words.postings));
+
+  /* Forgetting an account isn't journaled, and a damaged journal has to be
+   * replaced before anything gets appended to it */
+  if (forgot || job->damaged ||
+      self->priv->journal_size > MAX_JOURNAL_SIZE)
+    log_index_save (self);
+
+  if (self->priv->update_pending)
+    {
+      self->priv->update_pending = FALSE;
+      empathy_log_index_update (self);
+    }
+}
+
+static void
+log_index_got_entities_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  CrawlItem *item = self->priv->crawling;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
+      result, &entities, &error))
+    {
+      DEBUG ("Could not get entities: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = entities; l != NULL; l = l->next)
+    g_queue_push_tail (self->priv->crawl,
+        crawl_item_new (item->account, l->data, NULL));
+
+  g_list_free_full (entities, g_object_unref);
+
+ out:
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  CrawlItem *item = self->priv->crawling;
+  GList *dates, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
+      result, &dates, &error))
+    {
+      DEBUG ("Could not get dates: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = dates; l != NULL; l = l->next)
+    {
+      GDate *date = l->data;
+      gchar *key;
+      gpointer value;
+
+      key = make_doc_key (tp_proxy_get_object_path (item->account),
+          tpl_entity_get_identifier (item->entity),
+          g_date_get_julian (date));
+      value = g_hash_table_lookup (self->priv->index->doc_ids, key);
+      g_free (key);
+
+      if (value != NULL)
+        {
+          Doc *doc = g_ptr_array_index (self->priv->index->docs,
+              GPOINTER_TO_UINT (value) - 1);
+
+          /* Already indexed, and nothing can be logged for it anymore */
+          if (doc->crawled > doc->julian)
+            continue;
+        }
+
+      g_queue_push_tail (self->priv->crawl,
+          crawl_item_new (item->account, item->entity, date));
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+
+ out:
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  CrawlItem *item = self->priv->crawling;
+  GList *events, *l;
+  guint32 doc;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+      result, &events, &error))
+    {
+      DEBUG ("Could not get events: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  /* A snapshot started while they were being read; the day is read again
+   * once it's written */
+  if (self->priv->saving)
+    {
+      g_list_free_full (events, g_object_unref);
+
+      g_queue_push_head (self->priv->crawl, item);
+      self->priv->crawling = NULL;
+      self->priv->crawl_paused = TRUE;
+      return;
+    }
+
+  doc = index_ensure_doc (self->priv->index,
+      tp_proxy_get_object_path (item->account),
+      tpl_entity_get_identifier (item->entity),
+      tpl_entity_get_alias (item->entity),
+      tpl_entity_get_entity_type (item->entity),
+      g_date_get_julian (item->date));
+
+  for (l = events; l != NULL; l = l->next)
+    {
+      if (TPL_IS_TEXT_EVENT (l->data))
+        index_add_text (self->priv->index, doc,
+            tpl_text_event_get_message (l->data));
+    }
+
+  ((Doc *) g_ptr_array_index (self->priv->index->docs, doc))->crawled =
+      today_julian ();
+  self->priv->dirty = TRUE;
+
+  g_list_free_full (events, g_object_unref);
+
+ out:
+  log_index_crawl_next (self);
+}
+
+static void
+log_index_crawl_next (EmpathyLogIndex *self)
+{
+  CrawlItem *item;
+
+  tp_clear_pointer (&self->priv->crawling, crawl_item_free);
+
+  /* Resumed by log_index_saved() */
+  if (self->priv->saving)
+    {
+      self->priv->crawl_paused = TRUE;
+      return;
+    }
+
+  item = g_queue_pop_head (self->priv->crawl);
+  if (item == NULL)
+    {
+      DEBUG ("Log index is up to date: %u days, %u words",
+          self->priv->index->docs->len,
+          g_hash_table_size (self->priv->index->words.postings));
+
+      self->priv->ready = TRUE;
+      self->priv->updating = FALSE;
+
+      /* Nothing to write if every day was already indexed */
+      if (self->priv->dirty)
+        log_index_save (self);
+
+      /* Reference taken in empathy_log_index_update() */
+      g_object_unref (self);
+      return;
+    }
+
+  self->priv->crawling = item;
+
+  if (item->entity == NULL)
+    tpl_log_manager_get_entities_async (self->priv->log_manager,
+        item->account, log_index_got_entities_cb, self);
+  else if (item->date == NULL)
+    tpl_log_manager_get_dates_async (self->priv->log_manager,
+        item->account, item->entity, TPL_EVENT_MASK_TEXT,
+        log_index_got_dates_cb, self);
+  else
+    tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+        item->account, item->entity, TPL_EVENT_MASK_TEXT, item->date,
+        log_index_got_events_cb, self);
+}
+
+static void
+log_index_account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      DEBUG ("Failed to prepare account manager: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      accounts = tp_account_manager_get_valid_accounts (
+          self->priv->account_manager);
+
+      for (l = accounts; l != NULL; l = l->next)
+        g_queue_push_tail (self->priv->crawl,
+            crawl_item_new (l->data, NULL, NULL));
+
+      g_list_free (accounts);
+    }
+
+  log_index_crawl_next (self);
+}
+
+/**
+ * empathy_log_index_update:
+ * @self: an #EmpathyLogIndex
+ *
+ * Reads the days of logs which are missing from the index, or which may
+ * have changed since they were indexed, in the background.
+ */
+void
+empathy_log_index_update (EmpathyLogIndex *self)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (self->priv->updating)
+    return;
+
+  /* The crawl needs to know what's already in the index */
+  if (!self->priv->loaded)
+    {
+      self->priv->update_pending = TRUE;
+      return;
+    }
+
+  self->priv->updating = TRUE;
+
+  /* Released once the crawl is done */
+  g_object_ref (self);
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      log_index_account_manager_prepared_cb, self);
+}
+
+/**
+ * empathy_log_index_is_ready:
+ * @self: an #EmpathyLogIndex
+ *
+ * Returns: %TRUE if empathy_log_index_search() can be used in place of
+ * tpl_log_manager_search_async()
+ */
+gboolean
+empathy_log_index_is_ready (EmpathyLogIndex *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  return self->priv->ready;
+}
+
+/**
+ * empathy_log_index_add_message:
+ * @self: an #EmpathyLogIndex
+ * @account: the account the message was exchanged on
+ * @target: the contact or room the message was exchanged with
+ * @date: the day under which the logger stores the message
+ * @text: the text of the message
+ *
+ * Indexes a message as soon as it is sent or received, without waiting
+ * for the next update.
+ */
+void
+empathy_log_index_add_message (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *target,
+    GDate *date,
+    const gchar *text)
+{
+  Record *record;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (TPL_IS_ENTITY (target));
+
+  if (EMP_STR_EMPTY (text))
+    return;
+
+  record = record_new (tp_proxy_get_object_path (account),
+      tpl_entity_get_identifier (target),
+      tpl_entity_get_alias (target),
+      tpl_entity_get_entity_type (target),
+      g_date_get_julian (date),
+      text);
+
+  if (self->priv->loaded && !self->priv->saving)
+    {
+      /* Applied first as journaling it may trigger a snapshot */
+      index_apply (self->priv->index, record);
+      self->priv->dirty = TRUE;
+      log_index_journal (self, record);
+      record_free (record);
+    }
+  else
+    {
+      log_index_journal (self, record);
+      g_queue_push_tail (self->priv->pending, record);
+    }
+}
+
+/**
+ * empathy_log_index_forget_account:
+ * @self: an #EmpathyLogIndex
+ * @account: (allow-none): the account whose logs are being deleted, or
+ *  %NULL for all of them
+ *
+ * Drops everything which was indexed for @account.
+ */
+void
+empathy_log_index_forget_account (EmpathyLogIndex *self,
+    TpAccount *account)
+{
+  const gchar *path = NULL;
+  GList *l, *next;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (account != NULL)
+    path = tp_proxy_get_object_path (account);
+
+  for (l = self->priv->crawl->head; l != NULL; l = next)
+    {
+      CrawlItem *item = l->data;
+
+      next = l->next;
+
+      if (path == NULL ||
+          !tp_strdiff (tp_proxy_get_object_path (item->account), path))
+        {
+          crawl_item_free (item);
+          g_queue_delete_link (self->priv->crawl, l);
+        }
+    }
+
+  /* A new snapshot is taken once it's applied */
+  if (!self->priv->loaded || self->priv->saving)
+    {
+      g_queue_push_tail (self->priv->pending,
+          record_new (path, NULL, NULL, 0, 0, NULL));
+      return;
+    }
+
+  index_forget (self->priv->index, path);
+  log_index_save (self);
+}
+
+/**
+ * empathy_log_index_search:
+ * @self: an #EmpathyLogIndex
+ * @text: the text to look for
+ *
+ * Looks for the days on which @text was written. The last word of @text
+ * is matched as a prefix, so the query can be run while it's being typed;
+ * several words have to appear next to each other, in that order.
+ *
+ * @hits: (out): a list of #TplLogSearchHit, to be freed with
+ * tpl_log_manager_search_free()
+ *
+ * Returns: %FALSE if @text has no word the index could look for, in which
+ * case tpl_log_manager_search_async() has to be used instead
+ */
+gboolean
+empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text,
+    GList **hits)
+{
+  GPtrArray *words;
+  guint8 *marks, *clause;
+  guint n_docs, i, j;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+  g_return_val_if_fail (hits != NULL, FALSE);
+
+  *hits = NULL;
+
+  words = tokenize (text);
+  n_docs = self->priv->index->docs->len;
+
+  if (words->len == 0)
+    {
+      g_ptr_array_unref (words);
+      return FALSE;
+    }
+
+  if (n_docs == 0)
+    {
+      g_ptr_array_unref (words);
+      return TRUE;
+    }
+
+  marks = g_new0 (guint8, n_docs);
+
+  if (words->len == 1)
+    {
+      terms_mark (&self->priv->index->words, g_ptr_array_index (words, 0),
+          TRUE, marks);
+    }
+  else
+    {
+      clause = g_new (guint8, n_docs);
+
+      for (i = 0; i + 1 < words->len; i++)
+        {
+          gchar *pair = make_pair (g_ptr_array_index (words, i),
+              g_ptr_array_index (words, i + 1));
+
+          memset (clause, 0, n_docs);
+          terms_mark (&self->priv->index->pairs, pair, i + 2 == words->len,
+              clause);
+          g_free (pair);
+
+          for (j = 0; j < n_docs; j++)
+            marks[j] = (i == 0 ? clause[j] : marks[j] & clause[j]);
+        }
+
+      g_free (clause);
+    }
+
+  for (i = n_docs; i > 0; i--)
+    {
+      Doc *doc = g_ptr_array_index (self->priv->index->docs, i - 1);
+      TplLogSearchHit *hit;
+      TpAccount *account;
+
+      if (!marks[i - 1])
+        continue;
+
+      account = tp_account_manager_ensure_account (
+          self->priv->account_manager, doc->account_path);
+      if (account == NULL)
+        continue;
+
+      /* tpl_log_manager_search_free() releases hits with g_slice_free() */
+      hit = g_slice_new0 (TplLogSearchHit);
+      hit->account = g_object_ref (account);
+      hit->target = tpl_entity_new (doc->id, doc->type, doc->alias, NULL);
+      hit->date = g_date_new_julian (doc->julian);
+
+      *hits = g_list_prepend (*hits, hit);
+    }
+
+  g_free (marks);
+  g_ptr_array_unref (words);
+
+  return TRUE;
+}
+
+static GObject *
+empathy_log_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (log_index_singleton != NULL)
+    {
+      retval = g_object_ref (log_index_singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_log_index_parent_class)->constructor (
+          type, n_props, props);
+
+      log_index_singleton = EMPATHY_LOG_INDEX (retval);
+      g_object_add_weak_pointer (retval, (gpointer) &log_index_singleton);
+
+      log_index_queue_job (log_index_singleton, job_new (JOB_LOAD));
+    }
+
+  return retval;
+}
+
+static void
+empathy_log_index_dispose (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  /* Every job holds a reference, so they're all done by now */
+  tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->account_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->dispose (object);
+}
+
+static void
+empathy_log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  g_queue_free_full (self->priv->crawl, (GDestroyNotify) crawl_item_free);
+  tp_clear_pointer (&self->priv->crawling, crawl_item_free);
+
+  g_queue_free_full (self->priv->pending, (GDestroyNotify) record_free);
+  g_queue_free_full (self->priv->jobs, (GDestroyNotify) job_free);
+
+  index_free (self->priv->index);
+
+  g_free (self->priv->filename);
+  g_free (self->priv->journal_filename);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (EmpathyLogIndexPriv));
+
+  object_class->constructor = empathy_log_index_constructor;
+  object_class->dispose = empathy_log_index_dispose;
+  object_class->finalize = empathy_log_index_finalize;
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  self->priv->filename = g_build_filename (g_get_user_cache_dir (),
+      PACKAGE_NAME, INDEX_FILENAME, NULL);
+  self->priv->journal_filename = g_build_filename (g_get_user_cache_dir (),
+      PACKAGE_NAME, JOURNAL_FILENAME, NULL);
+
+  self->priv->index = index_new ();
+  self->priv->pending = g_queue_new ();
+
+  self->priv->crawl = g_queue_new ();
+  self->priv->jobs = g_queue_new ();
+
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->account_manager = tp_account_manager_dup ();
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+}
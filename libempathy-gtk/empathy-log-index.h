@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_INDEX_H__
+#define __EMPATHY_LOG_INDEX_H__
+
+#include <glib-object.h>
+#include <telepathy-glib/account.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_LOG_INDEX	(empathy_log_index_get_type ())
+#define EMPATHY_LOG_INDEX(obj)	(G_TYPE_CHECK_INSTANCE_CAST ((obj), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndex))
+#define EMPATHY_LOG_INDEX_CLASS(obj)	(G_TYPE_CHECK_CLASS_CAST ((obj), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+#define EMPATHY_IS_LOG_INDEX(obj)	(G_TYPE_CHECK_INSTANCE_TYPE ((obj), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_IS_LOG_INDEX_CLASS(obj)	(G_TYPE_CHECK_CLASS_TYPE ((obj), EMPATHY_TYPE_LOG_INDEX))
+#define EMPATHY_LOG_INDEX_GET_CLASS(obj)	(G_TYPE_INSTANCE_GET_CLASS ((obj), EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexClass))
+
+typedef struct _EmpathyLogIndex EmpathyLogIndex;
+typedef struct _EmpathyLogIndexPriv EmpathyLogIndexPriv;
+typedef struct _EmpathyLogIndexClass EmpathyLogIndexClass;
+
+struct _EmpathyLogIndex
+{
+  GObject parent;
+
+  EmpathyLogIndexPriv *priv;
+};
+
+struct _EmpathyLogIndexClass
+{
+  GObjectClass parent_class;
+};
+
+GType empathy_log_index_get_type (void);
+
+EmpathyLogIndex * empathy_log_index_dup_singleton (void);
+
+void empathy_log_index_update (EmpathyLogIndex *self);
+
+gboolean empathy_log_index_is_ready (EmpathyLogIndex *self);
+
+void empathy_log_index_add_message (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *target,
+    GDate *date,
+    const gchar *text);
+
+void empathy_log_index_forget_account (EmpathyLogIndex *self,
+    TpAccount *account);
+
+gboolean empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text,
+    GList **hits);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_INDEX_H__ */
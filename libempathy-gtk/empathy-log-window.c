@@ -53,6 +53,7 @@
 #include "empathy-call-utils.h"
 #include "empathy-individual-information-dialog.h"
 #include "empathy-images.h"
+#include "empathy-log-index.h"
 #include "empathy-theme-manager.h"
 #include "empathy-ui-utils.h"
 #include "empathy-webkit-utils.h"
@@ -95,6 +96,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -107,13 +109,37 @@ struct _EmpathyLogWindowPriv
   EmpathyCameraMonitor *camera_monitor;
   GBinding *button_video_binding;
 
-  /* Used to cancel logger calls when no longer needed */
-  guint count;
+  /* Cancelled whenever the selection changes, so the results of logger
+   * calls made for the previous one are dropped */
+  GCancellable *cancellable;
+  /* Same for searches, cancelled by the next search */
+  GCancellable *search_cancellable;
 
   /* List of owned TplLogSearchHits, free with tpl_log_search_hit_free */
   GList *hits;
   guint source;
 
+  /* Owned Ctx for every day of events to show, oldest first. Only the
+   * days in [days_first, days_last) are in store_events at any time. */
+  GPtrArray *days;
+  guint days_first;
+  guint days_last;
+  gboolean loading_days;
+  /* Days added by the last page, and days it dropped from the other end.
+   * Until the events are scrolled away from both ends, the next page may
+   * neither drop the former nor add the latter back, so days too short to
+   * fill the view don't make it go back and forth forever. */
+  guint page_first;
+  guint page_last;
+  guint dropped_first;
+  guint dropped_last;
+
+  /* Day being added to store_events, and the conversation row its events
+   * are added to if has_parent is set */
+  gint current_day;
+  GtkTreeIter parent;
+  gboolean has_parent;
+
   /* Only used while waiting for the account chooser to be ready */
   TpAccount *selected_account;
   gchar *selected_chat_id;
@@ -150,6 +176,10 @@ static void start_spinner                        (void);
 static void log_window_create_observer           (EmpathyLogWindow *window);
 static gboolean log_window_events_button_press_event (GtkWidget *webview,
     GdkEventButton *event, EmpathyLogWindow *self);
+static void log_window_events_scrolled_cb (GtkAdjustment *adjustment,
+    EmpathyLogWindow *self);
+static void log_window_load_more_days (EmpathyLogWindow *self,
+    gboolean later);
 static void log_window_update_buttons_sensitivity (EmpathyLogWindow *self);
 
 static void
@@ -212,14 +242,29 @@ enum
   COL_EVENTS_ACCOUNT,
   COL_EVENTS_TARGET,
   COL_EVENTS_EVENT,
+  COL_EVENTS_DAY,
   COL_EVENTS_COUNT
 };
 
+enum
+{
+  EVENTS_TYPE_NORMAL,
+  EVENTS_TYPE_PLACEHOLDER
+};
+
 #define CALENDAR_ICON "stock_calendar"
 
 /* Seconds between two messages to be considered one conversation */
 #define MAX_GAP 30*60
 
+/* Days of events fetched at once when scrolling, and how many of them can
+ * be in the events view at the same time */
+#define DAYS_PER_PAGE 7
+#define MAX_SHOWN_DAYS 28
+
+/* Milliseconds to wait after the last key press before searching */
+#define SEARCH_DELAY 500
+
 #define WHAT_TYPE_SEPARATOR -1
 
 typedef enum
@@ -255,7 +300,9 @@ typedef struct
   GDate *date;
   TplEventTypeMask event_mask;
   EventSubtype subtype;
-  guint count;
+  GCancellable *cancellable;
+  /* index in priv->days of the day being fetched */
+  guint day;
 } Ctx;
 
 static Ctx *
@@ -265,7 +312,7 @@ ctx_new (EmpathyLogWindow *self,
     GDate *date,
     TplEventTypeMask event_mask,
     EventSubtype subtype,
-    guint count)
+    GCancellable *cancellable)
 {
   Ctx *ctx = g_slice_new0 (Ctx);
 
@@ -278,7 +325,8 @@ ctx_new (EmpathyLogWindow *self,
     ctx->date = _date_copy (date);
   ctx->event_mask = event_mask;
   ctx->subtype = subtype;
-  ctx->count = count;
+  if (cancellable != NULL)
+    ctx->cancellable = g_object_ref (cancellable);
 
   return ctx;
 }
@@ -289,10 +337,39 @@ ctx_free (Ctx *ctx)
   tp_clear_object (&ctx->account);
   tp_clear_object (&ctx->entity);
   tp_clear_pointer (&ctx->date, g_date_free);
+  tp_clear_object (&ctx->cancellable);
 
   g_slice_free (Ctx, ctx);
 }
 
+/* Cancels the logger calls made for the previous selection and starts
+ * a new request; pass priv->cancellable to the calls made for it */
+static void
+log_window_new_request (EmpathyLogWindow *self)
+{
+  _tpl_action_chain_clear (self->priv->chain);
+
+  if (self->priv->cancellable != NULL)
+    {
+      g_cancellable_cancel (self->priv->cancellable);
+      g_object_unref (self->priv->cancellable);
+    }
+
+  self->priv->cancellable = g_cancellable_new ();
+}
+
+static void
+log_window_clear_events (EmpathyLogWindow *self)
+{
+  gtk_tree_store_clear (self->priv->store_events);
+
+  tp_clear_pointer (&self->priv->days, g_ptr_array_unref);
+  self->priv->days_first = 0;
+  self->priv->days_last = 0;
+  self->priv->loading_days = FALSE;
+  self->priv->has_parent = FALSE;
+}
+
 static void
 select_account_once_ready (EmpathyLogWindow *self,
     TpAccount *account,
@@ -545,6 +622,13 @@ empathy_log_window_dispose (GObject *object)
       self->priv->source = 0;
     }
 
+  if (self->priv->cancellable != NULL)
+    g_cancellable_cancel (self->priv->cancellable);
+  if (self->priv->search_cancellable != NULL)
+    g_cancellable_cancel (self->priv->search_cancellable);
+  tp_clear_object (&self->priv->cancellable);
+  tp_clear_object (&self->priv->search_cancellable);
+
   if (self->priv->current_dates != NULL)
     {
       g_list_free_full (self->priv->current_dates,
@@ -554,9 +638,11 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_pointer (&self->priv->chain, _tpl_action_chain_free);
   tp_clear_pointer (&self->priv->channels, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->days, g_ptr_array_unref);
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -604,17 +690,22 @@ empathy_log_window_init (EmpathyLogWindow *self)
   GFile *gfile;
   GtkWidget *vbox, *accounts, *search, *label, *closeitem;
   GtkWidget *scrolledwindow_events;
+  GtkAdjustment *adjustment;
   gchar *uri;
 
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       EMPATHY_TYPE_LOG_WINDOW, EmpathyLogWindowPriv);
 
   self->priv->chain = _tpl_action_chain_new_async (NULL, NULL, NULL);
+  self->priv->cancellable = g_cancellable_new ();
 
   self->priv->camera_monitor = empathy_camera_monitor_dup_singleton ();
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
 
+  self->priv->log_index = empathy_log_index_dup_singleton ();
+  empathy_log_index_update (self->priv->log_index);
+
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
       EMPATHY_PREFS_DESKTOP_INTERFACE_SCHEMA);
@@ -739,6 +830,14 @@ empathy_log_window_init (EmpathyLogWindow *self)
       self->priv->webview);
   gtk_widget_show (self->priv->webview);
 
+  /* page days of events in and out as the user scrolls */
+  adjustment = gtk_scrolled_window_get_vadjustment (
+      GTK_SCROLLED_WINDOW (scrolledwindow_events));
+  g_signal_connect (adjustment, "value-changed",
+      G_CALLBACK (log_window_events_scrolled_cb), self);
+  g_signal_connect (adjustment, "changed",
+      G_CALLBACK (log_window_events_scrolled_cb), self);
+
   empathy_webkit_bind_font_setting (WEBKIT_WEB_VIEW (self->priv->webview),
       self->priv->gsettings_desktop,
       EMPATHY_PREFS_DESKTOP_INTERFACE_FONT_NAME);
@@ -928,6 +1027,46 @@ maybe_refresh_logs (TpChannel *channel,
     }
 }
 
+static void
+index_message (EmpathyLogWindow *self,
+    TpChannel *channel,
+    TpAccount *account,
+    TpMessage *message)
+{
+  TplEntity *target;
+  TpContact *contact;
+  TpHandleType handle_type;
+  GDateTime *now;
+  GDate *date;
+  gchar *text;
+
+  if (account == NULL)
+    return;
+
+  text = tp_message_to_text (message, NULL);
+
+  tp_channel_get_handle (channel, &handle_type);
+  contact = tp_channel_get_target_contact (channel);
+
+  target = tpl_entity_new (tp_channel_get_identifier (channel),
+      handle_type == TP_HANDLE_TYPE_ROOM ? TPL_ENTITY_ROOM : TPL_ENTITY_CONTACT,
+      contact != NULL ? tp_contact_get_alias (contact) : NULL,
+      NULL);
+
+  /* The logger files events under their UTC day */
+  now = g_date_time_new_now_utc ();
+  date = g_date_new_dmy (g_date_time_get_day_of_month (now),
+      g_date_time_get_month (now), g_date_time_get_year (now));
+
+  empathy_log_index_add_message (self->priv->log_index, account, target,
+      date, text);
+
+  g_date_free (date);
+  g_date_time_unref (now);
+  g_object_unref (target);
+  g_free (text);
+}
+
 static void
 on_msg_sent (TpTextChannel *channel,
     TpSignalledMessage *message,
@@ -937,6 +1076,7 @@ on_msg_sent (TpTextChannel *channel,
 {
   TpAccount *account = g_hash_table_lookup (self->priv->channels, channel);
 
+  index_message (self, TP_CHANNEL (channel), account, TP_MESSAGE (message));
   maybe_refresh_logs (TP_CHANNEL (channel), account);
 }
 
@@ -953,6 +1093,7 @@ on_msg_received (TpTextChannel *channel,
       type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
     return;
 
+  index_message (self, TP_CHANNEL (channel), account, msg);
   maybe_refresh_logs (TP_CHANNEL (channel), account);
 }
 
@@ -1172,23 +1313,16 @@ get_parent_iter_for_message (TplEvent *event,
   GtkTreeStore *store;
   GtkTreeModel *model;
   GtkTreeIter iter;
-  gboolean parent_found = FALSE;
-  gboolean next;
 
   store = log_window->priv->store_events;
   model = GTK_TREE_MODEL (store);
 
-  for (next = gtk_tree_model_get_iter_first (model, &iter);
-       next;
-       next = gtk_tree_model_iter_next (model, &iter))
+  /* Events of a day come in order, so only the last conversation can
+   * be continued */
+  if (log_window->priv->has_parent &&
+      model_is_parent (model, &log_window->priv->parent, event))
     {
-      if ((parent_found = model_is_parent (model, &iter, event)))
-        break;
-    }
-
-  if (parent_found)
-    {
-      *parent = iter;
+      *parent = log_window->priv->parent;
     }
   else
     {
@@ -1212,9 +1346,12 @@ get_parent_iter_for_message (TplEvent *event,
           COL_EVENTS_ACCOUNT, tpl_event_get_account (event),
           COL_EVENTS_TARGET, event_get_target (event),
           COL_EVENTS_EVENT, event,
+          COL_EVENTS_DAY, log_window->priv->current_day,
           -1);
 
       *parent = iter;
+      log_window->priv->parent = iter;
+      log_window->priv->has_parent = TRUE;
 
       g_free (body);
       g_free (pretty_date);
@@ -1260,7 +1397,7 @@ log_window_append_chat_message (TplEvent *event,
   GtkTreeIter iter, parent;
   gchar *pretty_date, *alias, *body;
   GDateTime *date;
-  EmpathyStringParser *parsers;
+  EmpathyStringParseFlags flags;
   GString *msg;
 
   date = g_date_time_new_from_unix_local (
@@ -1274,13 +1411,14 @@ log_window_append_chat_message (TplEvent *event,
       tpl_entity_get_alias (tpl_event_get_sender (event)), -1);
 
   /* escape the text */
-  parsers = empathy_webkit_get_string_parser (
-      g_settings_get_boolean (log_window->priv->gsettings_chat,
-        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
+  flags = EMPATHY_STRING_PARSE_LINKS | EMPATHY_STRING_PARSE_NEWLINES;
+  if (g_settings_get_boolean (log_window->priv->gsettings_chat,
+        EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+    flags |= EMPATHY_STRING_PARSE_SMILEYS;
   msg = g_string_new ("");
 
-  empathy_string_parser_substr (empathy_message_get_body (message), -1,
-      parsers, msg);
+  empathy_string_append_html (msg, empathy_message_get_body (message), -1,
+      flags);
 
   if (tpl_text_event_get_message_type (TPL_TEXT_EVENT (event))
       == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
@@ -1304,6 +1442,7 @@ log_window_append_chat_message (TplEvent *event,
       COL_EVENTS_ACCOUNT, tpl_event_get_account (event),
       COL_EVENTS_TARGET, event_get_target (event),
       COL_EVENTS_EVENT, event,
+      COL_EVENTS_DAY, log_window->priv->current_day,
       -1);
 
   g_string_free (msg, TRUE);
@@ -1354,6 +1493,7 @@ log_window_append_call (TplEvent *event,
       COL_EVENTS_ACCOUNT, tpl_event_get_account (event),
       COL_EVENTS_TARGET, event_get_target (event),
       COL_EVENTS_EVENT, event,
+      COL_EVENTS_DAY, log_window->priv->current_day,
       -1);
 
   if (tpl_call_event_get_end_reason (call) != TP_CALL_STATE_CHANGE_REASON_NO_ANSWER)
@@ -1395,6 +1535,7 @@ log_window_append_call (TplEvent *event,
           COL_EVENTS_ACCOUNT, tpl_event_get_account (event),
           COL_EVENTS_TARGET, event_get_target (event),
           COL_EVENTS_EVENT, event,
+          COL_EVENTS_DAY, log_window->priv->current_day,
           -1);
 
       g_free (body);
@@ -1628,7 +1769,8 @@ model_has_date (GtkTreeModel *model,
 }
 
 static void
-get_events_for_date (TplActionChain *chain, gpointer user_data);
+log_window_show_days (EmpathyLogWindow *self,
+    GPtrArray *days);
 
 static void
 populate_events_from_search_hits (GList *accounts,
@@ -1640,11 +1782,14 @@ populate_events_from_search_hits (GList *accounts,
   GDate *anytime;
   GList *l;
   gboolean is_anytime = FALSE;
+  GPtrArray *days;
 
   if (!log_window_get_selected (log_window,
       NULL, NULL, NULL, NULL, &event_mask, &subtype))
     return;
 
+  days = g_ptr_array_new_with_free_func ((GDestroyNotify) ctx_free);
+
   anytime = g_date_new_dmy (2, 1, -1);
   if (g_list_find_custom (dates, anytime, (GCompareFunc) g_date_compare))
     is_anytime = TRUE;
@@ -1681,14 +1826,12 @@ populate_events_from_search_hits (GList *accounts,
           Ctx *ctx;
 
           ctx = ctx_new (log_window, hit->account, hit->target, hit->date,
-              event_mask, subtype, log_window->priv->count);
-          _tpl_action_chain_append (log_window->priv->chain,
-              get_events_for_date, ctx);
+              event_mask, subtype, log_window->priv->cancellable);
+          g_ptr_array_add (days, ctx);
         }
     }
 
-  start_spinner ();
-  _tpl_action_chain_start (log_window->priv->chain);
+  log_window_show_days (log_window, days);
 
   g_date_free (anytime);
 }
@@ -1944,38 +2087,67 @@ populate_entities_from_search_hits (void)
     gtk_tree_selection_select_iter (selection, &iter);
 }
 
+static void
+log_window_take_search_hits (EmpathyLogWindow *self,
+    GList *hits)
+{
+  GtkTreeView *view;
+  GtkTreeSelection *selection;
+
+  tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+  self->priv->hits = hits;
+
+  view = GTK_TREE_VIEW (self->priv->treeview_when);
+  selection = gtk_tree_view_get_selection (view);
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_when_changed_cb,
+      self);
+
+  populate_entities_from_search_hits ();
+}
+
 static void
 log_manager_searched_new_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
-  GList *hits;
-  GtkTreeView *view;
-  GtkTreeSelection *selection;
+  GCancellable *cancellable = user_data;
+  GList *hits = NULL;
+  gboolean success;
   GError *error = NULL;
 
-  if (log_window == NULL)
-    return;
+  success = tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
+      result, &hits, &error);
 
-  if (!tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
-      result, &hits, &error))
+  if (!success)
     {
       DEBUG ("%s. Aborting", error->message);
       g_error_free (error);
-      return;
     }
 
-  tp_clear_pointer (&log_window->priv->hits, tpl_log_manager_search_free);
-  log_window->priv->hits = hits;
-
-  view = GTK_TREE_VIEW (log_window->priv->treeview_when);
-  selection = gtk_tree_view_get_selection (view);
+  if (log_window == NULL)
+    {
+      tpl_log_manager_search_free (hits);
+    }
+  else if (!success || g_cancellable_is_cancelled (cancellable))
+    {
+      /* Either failed, or a newer search has been started since; balance
+       * the blocking done in log_window_find_populate() */
+      g_signal_handlers_unblock_by_func (
+          gtk_tree_view_get_selection (
+              GTK_TREE_VIEW (log_window->priv->treeview_when)),
+          log_window_when_changed_cb,
+          log_window);
 
-  g_signal_handlers_unblock_by_func (selection,
-      log_window_when_changed_cb,
-      log_window);
+      tpl_log_manager_search_free (hits);
+    }
+  else
+    {
+      log_window_take_search_hits (log_window, hits);
+    }
 
-  populate_entities_from_search_hits ();
+  g_object_unref (cancellable);
 }
 
 static void
@@ -1986,8 +2158,18 @@ log_window_find_populate (EmpathyLogWindow *self,
   GtkTreeModel *model;
   GtkTreeSelection *selection;
   GtkListStore *store;
+  GList *hits;
 
-  gtk_tree_store_clear (self->priv->store_events);
+  /* Drop the results of the previous search, and anything still being
+   * fetched for the previous selection */
+  if (self->priv->search_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->priv->search_cancellable);
+      tp_clear_object (&self->priv->search_cancellable);
+    }
+
+  log_window_new_request (self);
+  log_window_clear_events (self);
 
   view = GTK_TREE_VIEW (self->priv->treeview_who);
   model = gtk_tree_view_get_model (view);
@@ -2019,9 +2201,23 @@ log_window_find_populate (EmpathyLogWindow *self,
   webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (self->priv->webview),
       search_criteria, FALSE, 0);
 
+  /* Until the index has been built, or if the text has nothing it can
+   * look for, fall back to searching the logs */
+  if (empathy_log_index_is_ready (self->priv->log_index) &&
+      empathy_log_index_search (self->priv->log_index, search_criteria,
+          &hits))
+    {
+      log_window_take_search_hits (self, hits);
+      return;
+    }
+
+  self->priv->search_cancellable = g_cancellable_new ();
+
+  /* Only text events are indexed, so only look for those either way */
   tpl_log_manager_search_async (self->priv->log_manager,
-      search_criteria, TPL_EVENT_MASK_ANY,
-      log_manager_searched_new_cb, NULL);
+      search_criteria, TPL_EVENT_MASK_TEXT,
+      log_manager_searched_new_cb,
+      g_object_ref (self->priv->search_cancellable));
 }
 
 static gboolean
@@ -2029,6 +2225,12 @@ start_find_search (EmpathyLogWindow *self)
 {
   const gchar *str;
 
+  if (self->priv->source != 0)
+    {
+      g_source_remove (self->priv->source);
+      self->priv->source = 0;
+    }
+
   str = gtk_entry_get_text (GTK_ENTRY (self->priv->search_entry));
 
   /* Don't find the same crap again */
@@ -2066,10 +2268,11 @@ log_window_search_entry_changed_cb (GtkWidget *entry,
           GTK_ENTRY_ICON_SECONDARY, FALSE);
     }
 
+  /* Wait for the user to stop typing before searching */
   if (self->priv->source != 0)
     g_source_remove (self->priv->source);
-  self->priv->source = g_timeout_add (500, (GSourceFunc) start_find_search,
-      self);
+  self->priv->source = g_timeout_add (SEARCH_DELAY,
+      (GSourceFunc) start_find_search, self);
 }
 
 static void
@@ -2341,11 +2544,12 @@ log_manager_got_entities_cb (GObject *manager,
   GError                *error = NULL;
   gboolean               select_account = FALSE;
 
-  if (log_window == NULL)
-    goto out;
-
-  if (log_window->priv->count != ctx->count)
-    goto out;
+  /* A newer request owns the chain now, leave it alone */
+  if (log_window == NULL || g_cancellable_is_cancelled (ctx->cancellable))
+    {
+      ctx_free (ctx);
+      return;
+    }
 
   if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
       result, &entities, &error))
@@ -2426,7 +2630,8 @@ get_entities_for_account (TplActionChain *chain, gpointer user_data)
 static void
 select_first_entity (TplActionChain *chain, gpointer user_data)
 {
-  EmpathyLogWindow *self = user_data;
+  GCancellable *cancellable = user_data;
+  EmpathyLogWindow *self = log_window;
   GtkTreeView *view;
   GtkTreeModel *model;
   GtkTreeSelection *selection;
@@ -2439,7 +2644,11 @@ select_first_entity (TplActionChain *chain, gpointer user_data)
   if (gtk_tree_model_get_iter_first (model, &iter))
     gtk_tree_selection_select_iter (selection, &iter);
 
-  _tpl_action_chain_continue (self->priv->chain);
+  /* Selecting the entity may have started a request of its own */
+  if (!g_cancellable_is_cancelled (cancellable))
+    _tpl_action_chain_continue (chain);
+
+  g_object_unref (cancellable);
 }
 
 static void
@@ -2481,8 +2690,7 @@ log_window_who_populate (EmpathyLogWindow *self)
       log_window_who_changed_cb,
       self);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_new_request (self);
 
   if (!all_accounts && account == NULL)
     {
@@ -2490,8 +2698,10 @@ log_window_who_populate (EmpathyLogWindow *self)
     }
   else if (!all_accounts)
     {
-      ctx = ctx_new (self, account, NULL, NULL, 0, 0, self->priv->count);
-      _tpl_action_chain_append (self->priv->chain, get_entities_for_account, ctx);
+      ctx = ctx_new (self, account, NULL, NULL, 0, 0,
+          self->priv->cancellable);
+      _tpl_action_chain_append_full (self->priv->chain,
+          get_entities_for_account, ctx, (GDestroyNotify) ctx_free);
     }
   else
     {
@@ -2505,14 +2715,16 @@ log_window_who_populate (EmpathyLogWindow *self)
         {
           account = l->data;
 
-          ctx = ctx_new (self, account, NULL, NULL, 0, 0, self->priv->count);
-          _tpl_action_chain_append (self->priv->chain,
-              get_entities_for_account, ctx);
+          ctx = ctx_new (self, account, NULL, NULL, 0, 0,
+              self->priv->cancellable);
+          _tpl_action_chain_append_full (self->priv->chain,
+              get_entities_for_account, ctx, (GDestroyNotify) ctx_free);
         }
 
       g_list_free (accounts);
     }
-  _tpl_action_chain_append (self->priv->chain, select_first_entity, self);
+  _tpl_action_chain_append_full (self->priv->chain, select_first_entity,
+      g_object_ref (self->priv->cancellable), g_object_unref);
   _tpl_action_chain_start (self->priv->chain);
 }
 
@@ -2574,6 +2786,7 @@ log_window_find_row (EmpathyLogWindow *self,
   WebKitHitTestResult *hit = webkit_web_view_get_hit_test_result (
       WEBKIT_WEB_VIEW (self->priv->webview), event);
   WebKitDOMNode *inner_node;
+  gboolean load_more = FALSE, later = FALSE;
 
   tp_clear_object (&self->priv->events_contact);
 
@@ -2608,17 +2821,30 @@ log_window_find_row (EmpathyLogWindow *self,
         {
           TpAccount *account;
           TplEntity *target;
+          gint type;
+          gint64 timestamp;
 
           gtk_tree_model_get (model, &iter,
+              COL_EVENTS_TYPE, &type,
+              COL_EVENTS_TS, &timestamp,
               COL_EVENTS_ACCOUNT, &account,
               COL_EVENTS_TARGET, &target,
               -1);
 
-          self->priv->events_contact = empathy_contact_from_tpl_contact (
-              account, target);
+          /* The placeholder after the events is for the later days */
+          if (type == EVENTS_TYPE_PLACEHOLDER)
+            {
+              load_more = TRUE;
+              later = (timestamp == G_MAXINT64);
+            }
 
-          g_object_unref (account);
-          g_object_unref (target);
+          /* Placeholders for days which aren't loaded have neither */
+          if (account != NULL && target != NULL)
+            self->priv->events_contact = empathy_contact_from_tpl_contact (
+                account, target);
+
+          tp_clear_object (&account);
+          tp_clear_object (&target);
         }
 
       g_object_unref (inner_node);
@@ -2627,6 +2853,10 @@ log_window_find_row (EmpathyLogWindow *self,
   g_object_unref (hit);
 
   log_window_update_buttons_sensitivity (self);
+
+  /* Only once we're done with the row, as this removes some of them */
+  if (load_more)
+    log_window_load_more_days (self, later);
 }
 
 static gboolean
@@ -2667,7 +2897,8 @@ log_window_events_setup (EmpathyLogWindow *self)
       G_TYPE_STRING,        /* name */
       TP_TYPE_ACCOUNT,      /* account */
       TPL_TYPE_ENTITY,      /* target */
-      TPL_TYPE_EVENT);      /* event */
+      TPL_TYPE_EVENT,       /* event */
+      G_TYPE_INT);          /* day */
 
   sortable = GTK_TREE_SORTABLE (store);
 
@@ -2751,7 +2982,7 @@ log_window_chats_accounts_changed_cb (GtkWidget *combobox,
     EmpathyLogWindow *self)
 {
   /* Clear all current messages shown in the textview */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
 
   log_window_who_populate (self);
 }
@@ -3190,22 +3421,17 @@ log_window_got_messages_for_date_cb (GObject *manager,
     gpointer user_data)
 {
   Ctx *ctx = user_data;
-  GtkTreeModel *model;
-  GtkTreeIter iter;
   GList *events;
   GList *l;
   GError *error = NULL;
-  gint n;
 
-  if (log_window == NULL)
+  /* A newer request owns the chain now, leave it alone */
+  if (log_window == NULL || g_cancellable_is_cancelled (ctx->cancellable))
     {
       ctx_free (ctx);
       return;
     }
 
-  if (log_window->priv->count != ctx->count)
-    goto out;
-
   if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
       result, &events, &error))
     {
@@ -3215,6 +3441,9 @@ log_window_got_messages_for_date_cb (GObject *manager,
       goto out;
     }
 
+  log_window->priv->current_day = ctx->day;
+  log_window->priv->has_parent = FALSE;
+
   for (l = events; l; l = l->next)
     {
       TplEvent *event = l->data;
@@ -3268,28 +3497,7 @@ log_window_got_messages_for_date_cb (GObject *manager,
     }
   g_list_free (events);
 
-  model = GTK_TREE_MODEL (log_window->priv->store_events);
-  n = gtk_tree_model_iter_n_children (model, NULL) - 1;
-
-  if (n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
-    {
-      GtkTreePath *path;
-      char *str, *script;
-
-      path = gtk_tree_model_get_path (model, &iter);
-      str = gtk_tree_path_to_string (path);
-
-      script = g_strdup_printf ("javascript:scrollToRow([%s]);",
-          g_strdelimit (str, ":", ','));
-
-      webkit_web_view_execute_script (
-          WEBKIT_WEB_VIEW (log_window->priv->webview),
-          script);
-
-      gtk_tree_path_free (path);
-      g_free (str);
-      g_free (script);
-    }
+  log_window->priv->has_parent = FALSE;
 
  out:
   ctx_free (ctx);
@@ -3309,6 +3517,384 @@ get_events_for_date (TplActionChain *chain, gpointer user_data)
       ctx);
 }
 
+static void
+log_window_add_placeholder (EmpathyLogWindow *self,
+    gint64 timestamp,
+    const gchar *text)
+{
+  gchar *markup;
+
+  markup = g_markup_printf_escaped ("<i>%s</i>", text);
+
+  gtk_tree_store_insert_with_values (self->priv->store_events, NULL, NULL, -1,
+      COL_EVENTS_TYPE, EVENTS_TYPE_PLACEHOLDER,
+      COL_EVENTS_TS, timestamp,
+      COL_EVENTS_PRETTY_DATE, "",
+      COL_EVENTS_TEXT, markup,
+      COL_EVENTS_DAY, -1,
+      -1);
+
+  g_free (markup);
+}
+
+static void
+log_window_update_placeholders (EmpathyLogWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GtkTreeIter iter;
+  gboolean valid;
+  guint before, after;
+  gchar *text;
+
+  valid = gtk_tree_model_get_iter_first (model, &iter);
+  while (valid)
+    {
+      gint type;
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_TYPE, &type,
+          -1);
+
+      if (type == EVENTS_TYPE_PLACEHOLDER)
+        valid = gtk_tree_store_remove (self->priv->store_events, &iter);
+      else
+        valid = gtk_tree_model_iter_next (model, &iter);
+    }
+
+  if (self->priv->days == NULL)
+    return;
+
+  before = self->priv->days_first;
+  after = self->priv->days->len - self->priv->days_last;
+
+  /* The store is sorted by timestamp, so these end up first and last */
+  if (before > 0)
+    {
+      text = g_strdup_printf (ngettext (
+            "%u earlier day is not shown, click or scroll up to load it",
+            "%u earlier days are not shown, click or scroll up to load them",
+            before), before);
+      log_window_add_placeholder (self, G_MININT64, text);
+      g_free (text);
+    }
+
+  if (after > 0)
+    {
+      text = g_strdup_printf (ngettext (
+            "%u later day is not shown, click or scroll down to load it",
+            "%u later days are not shown, click or scroll down to load them",
+            after), after);
+      log_window_add_placeholder (self, G_MAXINT64, text);
+      g_free (text);
+    }
+}
+
+static void
+log_window_remove_days (EmpathyLogWindow *self,
+    guint first,
+    guint last)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GtkTreeIter iter;
+  gboolean valid;
+
+  valid = gtk_tree_model_get_iter_first (model, &iter);
+  while (valid)
+    {
+      gint day;
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_DAY, &day,
+          -1);
+
+      if (day >= (gint) first && day < (gint) last)
+        valid = gtk_tree_store_remove (self->priv->store_events, &iter);
+      else
+        valid = gtk_tree_model_iter_next (model, &iter);
+    }
+}
+
+/* Scrolls to the first conversation of @day, or to the last one if @day
+ * isn't shown */
+static void
+log_window_scroll_to_day (EmpathyLogWindow *self,
+    guint day)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GtkTreeIter iter, found;
+  GtkTreePath *path;
+  gboolean valid, has_found = FALSE;
+  gchar *str, *script;
+
+  for (valid = gtk_tree_model_get_iter_first (model, &iter);
+       valid;
+       valid = gtk_tree_model_iter_next (model, &iter))
+    {
+      gint d;
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_DAY, &d,
+          -1);
+
+      if (d == (gint) day)
+        {
+          found = iter;
+          has_found = TRUE;
+          break;
+        }
+    }
+
+  if (!has_found)
+    {
+      gint n = gtk_tree_model_iter_n_children (model, NULL) - 1;
+
+      if (n < 0 || !gtk_tree_model_iter_nth_child (model, &found, NULL, n))
+        return;
+    }
+
+  path = gtk_tree_model_get_path (model, &found);
+  str = gtk_tree_path_to_string (path);
+
+  script = g_strdup_printf ("javascript:scrollToRow([%s]);",
+      g_strdelimit (str, ":", ','));
+
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
+      script);
+
+  gtk_tree_path_free (path);
+  g_free (str);
+  g_free (script);
+}
+
+static void
+log_window_reset_paging (EmpathyLogWindow *self)
+{
+  self->priv->page_first = self->priv->page_last = 0;
+  self->priv->dropped_first = self->priv->dropped_last = 0;
+}
+
+static gboolean
+ranges_overlap (guint first_a,
+    guint last_a,
+    guint first_b,
+    guint last_b)
+{
+  return first_a < last_b && first_b < last_a;
+}
+
+static void log_window_check_days (EmpathyLogWindow *self);
+
+static void
+days_loaded (TplActionChain *chain,
+    gpointer user_data)
+{
+  log_window_update_placeholders (log_window);
+  log_window_scroll_to_day (log_window, GPOINTER_TO_UINT (user_data));
+  log_window->priv->loading_days = FALSE;
+
+  /* The page may not have been enough to fill the view, in which case
+   * there's nothing to scroll to ask for the next one */
+  log_window_check_days (log_window);
+
+  _tpl_action_chain_continue (chain);
+}
+
+/* Queues the fetch of the days preceding the ones in the events view, or
+ * following them if @later is set, and drops as many days from the other
+ * end as needed to keep at most MAX_SHOWN_DAYS of them. The caller has to
+ * start the chain. Returns %FALSE if there was nothing to load, or if it
+ * would undo the previous page. */
+static gboolean
+log_window_load_days (EmpathyLogWindow *self,
+    gboolean later)
+{
+  guint first, last, drop_first, drop_last, anchor, i;
+
+  if (later)
+    {
+      first = self->priv->days_last;
+      last = MIN (first + DAYS_PER_PAGE, self->priv->days->len);
+
+      drop_first = self->priv->days_first;
+      drop_last = last > MAX_SHOWN_DAYS ? last - MAX_SHOWN_DAYS : 0;
+
+      /* keep the previous last day in view */
+      anchor = first - 1;
+    }
+  else
+    {
+      last = self->priv->days_first;
+      first = last > DAYS_PER_PAGE ? last - DAYS_PER_PAGE : 0;
+
+      drop_first = first + MAX_SHOWN_DAYS;
+      drop_last = self->priv->days_last;
+
+      /* keep the previous first day in view, or scroll to the end if this
+       * is the first page */
+      anchor = last;
+    }
+
+  if (first == last)
+    return FALSE;
+
+  if (drop_first > drop_last)
+    drop_first = drop_last;
+
+  if (ranges_overlap (drop_first, drop_last,
+          self->priv->page_first, self->priv->page_last) ||
+      ranges_overlap (first, last,
+          self->priv->dropped_first, self->priv->dropped_last))
+    {
+      DEBUG ("Not loading days %u to %u, it would undo the previous page",
+          first, last);
+      return FALSE;
+    }
+
+  if (drop_first < drop_last)
+    log_window_remove_days (self, drop_first, drop_last);
+
+  if (later)
+    {
+      self->priv->days_first = MAX (self->priv->days_first, drop_last);
+      self->priv->days_last = last;
+    }
+  else
+    {
+      self->priv->days_first = first;
+      self->priv->days_last = MIN (self->priv->days_last, drop_first);
+    }
+
+  self->priv->page_first = first;
+  self->priv->page_last = last;
+  self->priv->dropped_first = drop_first;
+  self->priv->dropped_last = drop_last;
+
+  DEBUG ("Loading days %u to %u of %u", first, last, self->priv->days->len);
+
+  self->priv->loading_days = TRUE;
+
+  for (i = first; i < last; i++)
+    {
+      Ctx *day = g_ptr_array_index (self->priv->days, i);
+      Ctx *ctx;
+
+      ctx = ctx_new (self, day->account, day->entity, day->date,
+          day->event_mask, day->subtype, self->priv->cancellable);
+      ctx->day = i;
+
+      _tpl_action_chain_append_full (self->priv->chain, get_events_for_date,
+          ctx, (GDestroyNotify) ctx_free);
+    }
+
+  _tpl_action_chain_append (self->priv->chain, days_loaded,
+      GUINT_TO_POINTER (anchor));
+
+  return TRUE;
+}
+
+static gint
+compare_days (gconstpointer a,
+    gconstpointer b)
+{
+  const Ctx *ctx_a = *(const Ctx **) a;
+  const Ctx *ctx_b = *(const Ctx **) b;
+  gint ret;
+
+  ret = g_date_compare (ctx_a->date, ctx_b->date);
+
+  if (ret == 0)
+    ret = g_strcmp0 (tp_proxy_get_object_path (ctx_a->account),
+        tp_proxy_get_object_path (ctx_b->account));
+
+  if (ret == 0)
+    ret = g_strcmp0 (tpl_entity_get_identifier (ctx_a->entity),
+        tpl_entity_get_identifier (ctx_b->entity));
+
+  return ret;
+}
+
+/* Takes ownership of @days, an array of Ctx, and shows their most recent
+ * page; earlier ones are fetched as the user scrolls up */
+static void
+log_window_show_days (EmpathyLogWindow *self,
+    GPtrArray *days)
+{
+  g_ptr_array_sort (days, compare_days);
+
+  tp_clear_pointer (&self->priv->days, g_ptr_array_unref);
+  self->priv->days = days;
+  self->priv->days_first = days->len;
+  self->priv->days_last = days->len;
+  self->priv->loading_days = FALSE;
+  log_window_reset_paging (self);
+
+  log_window_load_days (self, FALSE);
+
+  start_spinner ();
+  _tpl_action_chain_start (self->priv->chain);
+}
+
+/* Loads the next page of days if the events view is scrolled close to
+ * either end, or doesn't have enough of them to be scrolled at all */
+static void
+log_window_check_days (EmpathyLogWindow *self)
+{
+  GtkAdjustment *adjustment;
+  gdouble value, lower, upper, page_size;
+  gboolean at_start, at_end;
+
+  if (self->priv->days == NULL || self->priv->loading_days)
+    return;
+
+  adjustment = gtk_scrolled_window_get_vadjustment (
+      GTK_SCROLLED_WINDOW (gtk_widget_get_parent (self->priv->webview)));
+
+  value = gtk_adjustment_get_value (adjustment);
+  lower = gtk_adjustment_get_lower (adjustment);
+  upper = gtk_adjustment_get_upper (adjustment);
+  page_size = gtk_adjustment_get_page_size (adjustment);
+
+  at_start = (value - lower < page_size / 2);
+  at_end = (upper - value - page_size < page_size / 2);
+
+  /* Away from both ends, the next page can only come from the user
+   * scrolling, so it may bring back what the previous one dropped */
+  if (!at_start && !at_end)
+    {
+      log_window_reset_paging (self);
+      return;
+    }
+
+  if ((at_start && self->priv->days_first > 0 &&
+        log_window_load_days (self, FALSE)) ||
+      (at_end && self->priv->days_last < self->priv->days->len &&
+        log_window_load_days (self, TRUE)))
+    _tpl_action_chain_start (self->priv->chain);
+}
+
+static void
+log_window_events_scrolled_cb (GtkAdjustment *adjustment,
+    EmpathyLogWindow *self)
+{
+  log_window_check_days (self);
+}
+
+/* Called when one of the placeholders for the days which aren't shown is
+ * clicked */
+static void
+log_window_load_more_days (EmpathyLogWindow *self,
+    gboolean later)
+{
+  if (self->priv->days == NULL || self->priv->loading_days)
+    return;
+
+  /* Asked for explicitly, so it may undo the previous page */
+  log_window_reset_paging (self);
+
+  if (log_window_load_days (self, later))
+    _tpl_action_chain_start (self->priv->chain);
+}
+
 static void
 log_window_get_messages_for_dates (EmpathyLogWindow *self,
     GList *dates)
@@ -3317,6 +3903,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
   TplEventTypeMask event_mask;
   EventSubtype subtype;
   GDate *date, *anytime, *separator;
+  GPtrArray *days;
 
   if (!log_window_get_selected (self,
       &accounts, &targets, NULL, NULL, &event_mask, &subtype))
@@ -3325,8 +3912,9 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
   anytime = g_date_new_dmy (2, 1, -1);
   separator = g_date_new_dmy (1, 1, -1);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_new_request (self);
+
+  days = g_ptr_array_new_with_free_func ((GDestroyNotify) ctx_free);
 
   for (acc = accounts, targ = targets;
        acc != NULL && targ != NULL;
@@ -3345,8 +3933,8 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
               Ctx *ctx;
 
               ctx = ctx_new (self, account, target, date, event_mask, subtype,
-                  self->priv->count);
-              _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+                  self->priv->cancellable);
+              g_ptr_array_add (days, ctx);
             }
           else
             {
@@ -3370,8 +3958,8 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
                       g_date_compare (d, separator) != 0)
                     {
                       ctx = ctx_new (self, account, target, d,
-                          event_mask, subtype, self->priv->count);
-                      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+                          event_mask, subtype, self->priv->cancellable);
+                      g_ptr_array_add (days, ctx);
                     }
 
                   g_date_free (d);
@@ -3380,8 +3968,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
         }
     }
 
-  start_spinner ();
-  _tpl_action_chain_start (self->priv->chain);
+  log_window_show_days (self, days);
 
   g_list_free_full (accounts, g_object_unref);
   g_list_free_full (targets, g_object_unref);
@@ -3403,15 +3990,13 @@ log_manager_got_dates_cb (GObject *manager,
   GList *l;
   GError *error = NULL;
 
-  if (log_window == NULL)
+  /* A newer request owns the chain now, leave it alone */
+  if (log_window == NULL || g_cancellable_is_cancelled (ctx->cancellable))
     {
       ctx_free (ctx);
       return;
     }
 
-  if (log_window->priv->count != ctx->count)
-    goto out;
-
   if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
        result, &dates, &error))
     {
@@ -3477,6 +4062,7 @@ log_manager_got_dates_cb (GObject *manager,
 static void
 select_date (TplActionChain *chain, gpointer user_data)
 {
+  GCancellable *cancellable = user_data;
   GtkTreeView *view;
   GtkTreeModel *model;
   GtkTreeSelection *selection;
@@ -3524,7 +4110,11 @@ select_date (TplActionChain *chain, gpointer user_data)
         gtk_tree_selection_select_iter (selection, &iter);
     }
 
-  _tpl_action_chain_continue (log_window->priv->chain);
+  /* Selecting the date may have started a request of its own */
+  if (!g_cancellable_is_cancelled (cancellable))
+    _tpl_action_chain_continue (chain);
+
+  g_object_unref (cancellable);
 }
 
 static void
@@ -3558,10 +4148,9 @@ log_window_chats_get_messages (EmpathyLogWindow *self,
   store = GTK_LIST_STORE (model);
 
   /* Clear all current messages shown in the textview */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_new_request (self);
 
   /* If there's a search use the returned hits */
   if (self->priv->hits != NULL)
@@ -3640,11 +4229,13 @@ log_window_chats_get_messages (EmpathyLogWindow *self,
           TpAccount *account = acc->data;
           TplEntity *target = targ->data;
           Ctx *ctx = ctx_new (self, account, target, NULL, event_mask, 0,
-              self->priv->count);
+              self->priv->cancellable);
 
-          _tpl_action_chain_append (self->priv->chain, get_dates_for_entity, ctx);
+          _tpl_action_chain_append_full (self->priv->chain,
+              get_dates_for_entity, ctx, (GDestroyNotify) ctx_free);
         }
-      _tpl_action_chain_append (self->priv->chain, select_date, NULL);
+      _tpl_action_chain_append_full (self->priv->chain, select_date,
+          g_object_ref (self->priv->cancellable), g_object_unref);
       _tpl_action_chain_start (self->priv->chain);
     }
   else
@@ -3719,7 +4310,7 @@ log_window_logger_clear_account_cb (TpProxy *proxy,
 
   /* Refresh the log viewer so the logs are cleared if the account
    * has been deleted */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
   log_window_who_populate (self);
 
   /* Re-filter the account chooser so the accounts without logs get
@@ -3799,6 +4390,8 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
     {
       DEBUG ("Deleting logs for all the accounts");
 
+      empathy_log_index_forget_account (self->priv->log_index, NULL);
+
       emp_cli_logger_call_clear (logger, -1,
           log_window_logger_clear_account_cb,
           self, NULL, G_OBJECT (self));
@@ -3811,6 +4404,8 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
 
       DEBUG ("Deleting logs for %s", tp_proxy_get_object_path (account));
 
+      empathy_log_index_forget_account (self->priv->log_index, account);
+
       emp_cli_logger_call_clear_account (logger, -1,
           tp_proxy_get_object_path (account),
           log_window_logger_clear_account_cb,
@@ -12,6 +12,10 @@
 G_DEFINE_TYPE (EmpathyRosterContact, empathy_roster_contact, GTK_TYPE_ALIGNMENT)
 
 #define AVATAR_SIZE 48
+#define ROW_PADDING 4
+
+/* Maximum number of unused Widgets kept around to be recycled */
+#define MAX_RECYCLED_WIDGETS 64
 
 enum
 {
@@ -31,17 +35,27 @@ enum
 static guint signals[LAST_SIGNAL];
 */
 
-struct _EmpathyRosterContactPriv
+/* The widgets displaying a contact. They are only created while the row is
+ * in, or close to, the visible part of the view and are recycled between
+ * rows when scrolling. */
+typedef struct
 {
-  FolksIndividual *individual;
-  gchar *group;
-
+  GtkWidget *main_box;
   GtkWidget *avatar;
   GtkWidget *first_line_alig;
   GtkWidget *alias;
   GtkWidget *presence_msg;
   GtkWidget *presence_icon;
   GtkWidget *phone_icon;
+} Widgets;
+
+struct _EmpathyRosterContactPriv
+{
+  FolksIndividual *individual;
+  gchar *group;
+
+  /* NULL if the row is not in the viewport */
+  Widgets *widgets;
 
   /* If not NULL, used instead of the individual's presence icon */
   gchar *event_icon;
@@ -49,6 +63,9 @@ struct _EmpathyRosterContactPriv
   gboolean online;
 };
 
+/* queue of unused (Widgets *), owning a ref on their main_box */
+static GQueue recycled_widgets = G_QUEUE_INIT;
+
 static const gchar *
 get_alias (EmpathyRosterContact *self)
 {
@@ -130,7 +147,11 @@ avatar_loaded_cb (GObject *source,
           EMPATHY_IMAGE_AVATAR_DEFAULT, AVATAR_SIZE);
     }
 
-  gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->avatar), pixbuf);
+  /* The row may have left the viewport while loading */
+  if (self->priv->widgets != NULL)
+    gtk_image_set_from_pixbuf (GTK_IMAGE (self->priv->widgets->avatar),
+        pixbuf);
+
   g_object_unref (pixbuf);
 
   g_object_unref (self);
@@ -142,6 +163,9 @@ out:
 static void
 update_avatar (EmpathyRosterContact *self)
 {
+  if (self->priv->widgets == NULL)
+    return;
+
   empathy_pixbuf_avatar_from_individual_scaled_async (self->priv->individual,
       AVATAR_SIZE, AVATAR_SIZE, NULL, avatar_loaded_cb,
       tp_weak_ref_new (self, NULL, NULL));
@@ -158,7 +182,11 @@ avatar_changed_cb (FolksIndividual *individual,
 static void
 update_alias (EmpathyRosterContact *self)
 {
-  gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
+  /* The alias is still notified when not displayed as it is used to sort
+   * the rows */
+  if (self->priv->widgets != NULL)
+    gtk_label_set_text (GTK_LABEL (self->priv->widgets->alias),
+        get_alias (self));
 
   g_object_notify (G_OBJECT (self), "alias");
 }
@@ -189,31 +217,35 @@ is_phone (FolksIndividual *individual)
 static void
 update_presence_msg (EmpathyRosterContact *self)
 {
+  Widgets *widgets = self->priv->widgets;
   const gchar *msg;
 
+  if (widgets == NULL)
+    return;
+
   msg = folks_presence_details_get_presence_message (
       FOLKS_PRESENCE_DETAILS (self->priv->individual));
 
   if (tp_str_empty (msg))
     {
       /* Just display the alias in the center of the row */
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.5, 1, 1);
 
-      gtk_widget_hide (self->priv->presence_msg);
+      gtk_widget_hide (widgets->presence_msg);
     }
   else
     {
-      gtk_label_set_text (GTK_LABEL (self->priv->presence_msg), msg);
+      gtk_label_set_text (GTK_LABEL (widgets->presence_msg), msg);
 
-      gtk_alignment_set (GTK_ALIGNMENT (self->priv->first_line_alig),
+      gtk_alignment_set (GTK_ALIGNMENT (widgets->first_line_alig),
           0, 0.75, 1, 1);
-      gtk_misc_set_alignment (GTK_MISC (self->priv->presence_msg), 0, 0.25);
+      gtk_misc_set_alignment (GTK_MISC (widgets->presence_msg), 0, 0.25);
 
-      gtk_widget_show (self->priv->presence_msg);
+      gtk_widget_show (widgets->presence_msg);
     }
 
-  gtk_widget_set_visible (self->priv->phone_icon,
+  gtk_widget_set_visible (widgets->phone_icon,
       is_phone (self->priv->individual));
 }
 
@@ -230,13 +262,16 @@ update_presence_icon (EmpathyRosterContact *self)
 {
   const gchar *icon;
 
+  if (self->priv->widgets == NULL)
+    return;
+
   if (self->priv->event_icon == NULL)
     icon = empathy_icon_name_for_individual (self->priv->individual);
   else
     icon = self->priv->event_icon;
 
-  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->presence_icon), icon,
-      GTK_ICON_SIZE_MENU);
+  gtk_image_set_from_icon_name (GTK_IMAGE (self->priv->widgets->presence_icon),
+      icon, GTK_ICON_SIZE_MENU);
 }
 
 static void
@@ -308,12 +343,127 @@ empathy_roster_contact_constructed (GObject *object)
   tp_g_signal_connect_object (self->priv->individual, "notify::presence-status",
       G_CALLBACK (presence_status_changed_cb), self, 0);
 
+  update_online (self);
+}
+
+static Widgets *
+widgets_new (void)
+{
+  Widgets *widgets = g_slice_new (Widgets);
+  GtkWidget *box, *first_line_box;
+  GtkStyleContext *context;
+
+  widgets->main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
+
+  /* Avatar */
+  widgets->avatar = gtk_image_new ();
+
+  gtk_widget_set_size_request (widgets->avatar, AVATAR_SIZE, AVATAR_SIZE);
+
+  gtk_box_pack_start (GTK_BOX (widgets->main_box), widgets->avatar,
+      FALSE, FALSE, 0);
+  gtk_widget_show (widgets->avatar);
+
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+
+  /* Alias and phone icon */
+  widgets->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
+  first_line_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+
+  widgets->alias = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (widgets->alias), PANGO_ELLIPSIZE_END);
+  gtk_box_pack_start (GTK_BOX (first_line_box), widgets->alias,
+      FALSE, FALSE, 0);
+  gtk_misc_set_alignment (GTK_MISC (widgets->alias), 0, 0.5);
+  gtk_widget_show (widgets->alias);
+
+  widgets->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
+      GTK_ICON_SIZE_MENU);
+  gtk_misc_set_alignment (GTK_MISC (widgets->phone_icon), 0, 0.5);
+  gtk_box_pack_start (GTK_BOX (first_line_box), widgets->phone_icon,
+      TRUE, TRUE, 0);
+
+  gtk_container_add (GTK_CONTAINER (widgets->first_line_alig),
+      first_line_box);
+  gtk_widget_show (widgets->first_line_alig);
+
+  gtk_box_pack_start (GTK_BOX (box), widgets->first_line_alig,
+      TRUE, TRUE, 0);
+  gtk_widget_show (first_line_box);
+
+  gtk_box_pack_start (GTK_BOX (widgets->main_box), box, TRUE, TRUE, 0);
+  gtk_widget_show (box);
+
+  /* Presence */
+  widgets->presence_msg = gtk_label_new (NULL);
+  gtk_label_set_ellipsize (GTK_LABEL (widgets->presence_msg),
+      PANGO_ELLIPSIZE_END);
+  gtk_box_pack_start (GTK_BOX (box), widgets->presence_msg, TRUE, TRUE, 0);
+  gtk_widget_show (widgets->presence_msg);
+
+  context = gtk_widget_get_style_context (widgets->presence_msg);
+  gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
+
+  /* Presence icon */
+  widgets->presence_icon = gtk_image_new ();
+
+  gtk_box_pack_start (GTK_BOX (widgets->main_box), widgets->presence_icon,
+      FALSE, FALSE, 0);
+  gtk_widget_show (widgets->presence_icon);
+
+  gtk_widget_show (widgets->main_box);
+  g_object_ref_sink (widgets->main_box);
+
+  return widgets;
+}
+
+static void
+widgets_free (Widgets *widgets)
+{
+  gtk_widget_destroy (widgets->main_box);
+  g_object_unref (widgets->main_box);
+
+  g_slice_free (Widgets, widgets);
+}
+
+static void
+add_widgets (EmpathyRosterContact *self)
+{
+  Widgets *widgets;
+
+  widgets = g_queue_pop_head (&recycled_widgets);
+  if (widgets == NULL)
+    widgets = widgets_new ();
+
+  self->priv->widgets = widgets;
+  gtk_container_add (GTK_CONTAINER (self), widgets->main_box);
+
   update_avatar (self);
   update_alias (self);
   update_presence_msg (self);
   update_presence_icon (self);
+}
 
-  update_online (self);
+static void
+remove_widgets (EmpathyRosterContact *self)
+{
+  Widgets *widgets = self->priv->widgets;
+
+  self->priv->widgets = NULL;
+
+  /* Our ref on main_box keeps it alive once removed */
+  gtk_container_remove (GTK_CONTAINER (self), widgets->main_box);
+
+  if (g_queue_get_length (&recycled_widgets) >= MAX_RECYCLED_WIDGETS)
+    {
+      widgets_free (widgets);
+      return;
+    }
+
+  /* Don't keep the previous avatar alive while unused */
+  gtk_image_clear (GTK_IMAGE (widgets->avatar));
+
+  g_queue_push_head (&recycled_widgets, widgets);
 }
 
 static void
@@ -323,6 +473,9 @@ empathy_roster_contact_dispose (GObject *object)
   void (*chain_up) (GObject *) =
       ((GObjectClass *) empathy_roster_contact_parent_class)->dispose;
 
+  if (self->priv->widgets != NULL)
+    remove_widgets (self);
+
   g_clear_object (&self->priv->individual);
 
   if (chain_up != NULL)
@@ -386,71 +539,13 @@ empathy_roster_contact_class_init (
 static void
 empathy_roster_contact_init (EmpathyRosterContact *self)
 {
-  GtkWidget *main_box, *box, *first_line_box;
-  GtkStyleContext *context;
-
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
 
-  main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
-
-  /* Avatar */
-  self->priv->avatar = gtk_image_new ();
-
-  gtk_widget_set_size_request (self->priv->avatar, AVATAR_SIZE, AVATAR_SIZE);
-
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->avatar, FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->avatar);
-
-  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
-
-  /* Alias and phone icon */
-  self->priv->first_line_alig = gtk_alignment_new (0, 0.5, 1, 1);
-  first_line_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
-
-  self->priv->alias = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->alias), PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->alias,
-      FALSE, FALSE, 0);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->alias), 0, 0.5);
-  gtk_widget_show (self->priv->alias);
-
-  self->priv->phone_icon = gtk_image_new_from_icon_name ("phone-symbolic",
-      GTK_ICON_SIZE_MENU);
-  gtk_misc_set_alignment (GTK_MISC (self->priv->phone_icon), 0, 0.5);
-  gtk_box_pack_start (GTK_BOX (first_line_box), self->priv->phone_icon,
-      TRUE, TRUE, 0);
-
-  gtk_container_add (GTK_CONTAINER (self->priv->first_line_alig),
-      first_line_box);
-  gtk_widget_show (self->priv->first_line_alig);
-
-  gtk_box_pack_start (GTK_BOX (box), self->priv->first_line_alig,
-      TRUE, TRUE, 0);
-  gtk_widget_show (first_line_box);
-
-  gtk_box_pack_start (GTK_BOX (main_box), box, TRUE, TRUE, 0);
-  gtk_widget_show (box);
-
-  /* Presence */
-  self->priv->presence_msg = gtk_label_new (NULL);
-  gtk_label_set_ellipsize (GTK_LABEL (self->priv->presence_msg),
-      PANGO_ELLIPSIZE_END);
-  gtk_box_pack_start (GTK_BOX (box), self->priv->presence_msg, TRUE, TRUE, 0);
-  gtk_widget_show (self->priv->presence_msg);
-
-  context = gtk_widget_get_style_context (self->priv->presence_msg);
-  gtk_style_context_add_class (context, GTK_STYLE_CLASS_DIM_LABEL);
-
-  /* Presence icon */
-  self->priv->presence_icon = gtk_image_new ();
-
-  gtk_box_pack_start (GTK_BOX (main_box), self->priv->presence_icon,
-      FALSE, FALSE, 0);
-  gtk_widget_show (self->priv->presence_icon);
-
-  gtk_container_add (GTK_CONTAINER (self), main_box);
-  gtk_widget_show (main_box);
+  /* Rows have the same height whether their widgets are created or not, so
+   * the view can be scrolled without creating them */
+  gtk_widget_set_size_request (GTK_WIDGET (self), -1,
+      AVATAR_SIZE + 2 * ROW_PADDING);
 }
 
 GtkWidget *
@@ -462,9 +557,9 @@ empathy_roster_contact_new (FolksIndividual *individual,
   return g_object_new (EMPATHY_TYPE_ROSTER_CONTACT,
       "individual", individual,
       "group", group,
-      "bottom-padding", 4,
-      "top-padding", 4,
-      "left-padding", 4,
+      "bottom-padding", ROW_PADDING,
+      "top-padding", ROW_PADDING,
+      "left-padding", ROW_PADDING,
       "right-padding", 12,
       NULL);
 }
@@ -500,8 +595,29 @@ empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
   update_presence_icon (self);
 }
 
-GdkPixbuf *
-empathy_roster_contact_get_avatar_pixbuf (EmpathyRosterContact *self)
+/**
+ * empathy_roster_contact_set_in_viewport:
+ * @self: a #EmpathyRosterContact
+ * @in_viewport: whether @self is in, or close to, the visible part of its view
+ *
+ * Rows only create the widgets displaying their contact while they are in the
+ * viewport, so views can contain a lot of rows.
+ */
+void
+empathy_roster_contact_set_in_viewport (EmpathyRosterContact *self,
+    gboolean in_viewport)
+{
+  if ((self->priv->widgets != NULL) == in_viewport)
+    return;
+
+  if (in_viewport)
+    add_widgets (self);
+  else
+    remove_widgets (self);
+}
+
+gboolean
+empathy_roster_contact_is_in_viewport (EmpathyRosterContact *self)
 {
-  return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->avatar));
+  return self->priv->widgets != NULL;
 }
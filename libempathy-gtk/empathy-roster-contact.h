@@ -59,8 +59,10 @@ gboolean empathy_roster_contact_is_online (EmpathyRosterContact *self);
 void empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
     const gchar *icon);
 
-GdkPixbuf * empathy_roster_contact_get_avatar_pixbuf (
-    EmpathyRosterContact *self);
+void empathy_roster_contact_set_in_viewport (EmpathyRosterContact *self,
+    gboolean in_viewport);
+
+gboolean empathy_roster_contact_is_in_viewport (EmpathyRosterContact *self);
 
 G_END_DECLS
 
@@ -31,6 +31,9 @@
 
 #include <libempathy/empathy-utils.h>
 
+#define DEBUG_FLAG EMPATHY_DEBUG_CONTACT
+#include <libempathy/empathy-debug.h>
+
 static void roster_model_iface_init (EmpathyRosterModelInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (EmpathyRosterModelManager,
@@ -58,8 +61,43 @@ struct _EmpathyRosterModelManagerPriv
   EmpathyIndividualManager *manager;
   /* FolksIndividual (borrowed) */
   GList *top_group_members;
+
+  /* queue of (PendingChange *) waiting to be fired by flush_changes() */
+  GQueue *pending;
+  guint flush_id;
+
+  /* Time the model was created, used to report how long it took to get
+   * all the contacts in the roster */
+  gint64 creation_time;
+  gboolean load_reported;
 };
 
+typedef struct
+{
+  FolksIndividual *individual;
+  gboolean added;
+} PendingChange;
+
+static PendingChange *
+pending_change_new (FolksIndividual *individual,
+    gboolean added)
+{
+  PendingChange *change = g_slice_new (PendingChange);
+
+  change->individual = g_object_ref (individual);
+  change->added = added;
+  return change;
+}
+
+static void
+pending_change_free (gpointer data)
+{
+  PendingChange *change = data;
+
+  g_object_unref (change->individual);
+  g_slice_free (PendingChange, change);
+}
+
 static gboolean
 is_xmpp_local_contact (FolksIndividual *individual)
 {
@@ -119,6 +157,86 @@ populate_model (EmpathyRosterModelManager *self)
     }
 }
 
+static void
+report_load_time (EmpathyRosterModelManager *self)
+{
+  if (self->priv->load_reported ||
+      !empathy_individual_manager_get_contacts_loaded (self->priv->manager))
+    return;
+
+  self->priv->load_reported = TRUE;
+
+  DEBUG ("Roster populated in %" G_GINT64_FORMAT " ms",
+      (g_get_monotonic_time () - self->priv->creation_time) / 1000);
+}
+
+static void
+flush_changes (EmpathyRosterModelManager *self)
+{
+  PendingChange *change;
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  if (g_queue_is_empty (self->priv->pending))
+    return;
+
+  empathy_roster_model_fire_freeze (EMPATHY_ROSTER_MODEL (self));
+
+  while ((change = g_queue_pop_head (self->priv->pending)) != NULL)
+    {
+      if (change->added)
+        empathy_roster_model_fire_individual_added (
+            EMPATHY_ROSTER_MODEL (self), change->individual);
+      else
+        empathy_roster_model_fire_individual_removed (
+            EMPATHY_ROSTER_MODEL (self), change->individual);
+
+      pending_change_free (change);
+    }
+
+  empathy_roster_model_fire_thaw (EMPATHY_ROSTER_MODEL (self));
+}
+
+static gboolean
+flush_changes_cb (gpointer user_data)
+{
+  EmpathyRosterModelManager *self = user_data;
+
+  self->priv->flush_id = 0;
+
+  flush_changes (self);
+  report_load_time (self);
+
+  return FALSE;
+}
+
+/* The aggregator reports its individuals in a lot of small chunks when
+ * starting, so queue the changes and fire them all at once when the main loop
+ * is idle. */
+static void
+queue_change (EmpathyRosterModelManager *self,
+    FolksIndividual *individual,
+    gboolean added)
+{
+  g_queue_push_tail (self->priv->pending,
+      pending_change_new (individual, added));
+
+  if (self->priv->flush_id == 0)
+    self->priv->flush_id = g_idle_add (flush_changes_cb, self);
+}
+
+static void
+contacts_loaded_cb (EmpathyIndividualManager *manager,
+    EmpathyRosterModelManager *self)
+{
+  flush_changes (self);
+  report_load_time (self);
+}
+
 static void
 members_changed_cb (EmpathyIndividualManager *manager,
     const gchar *message,
@@ -136,8 +254,7 @@ members_changed_cb (EmpathyIndividualManager *manager,
         self->priv->top_group_members = g_list_prepend (
             self->priv->top_group_members, l->data);
 
-      empathy_roster_model_fire_individual_added (EMPATHY_ROSTER_MODEL (self),
-          l->data);
+      queue_change (self, l->data, TRUE);
     }
 
   for (l = removed; l != NULL; l = g_list_next (l))
@@ -147,8 +264,7 @@ members_changed_cb (EmpathyIndividualManager *manager,
         self->priv->top_group_members = g_list_remove (
             self->priv->top_group_members, l->data);
 
-      empathy_roster_model_fire_individual_removed (EMPATHY_ROSTER_MODEL (self),
-          l->data);
+      queue_change (self, l->data, FALSE);
     }
 }
 
@@ -286,6 +402,10 @@ empathy_roster_model_manager_constructed (GObject *object)
       G_CALLBACK (top_individuals_changed_cb), self, 0);
   tp_g_signal_connect_object (self->priv->manager, "notify::favourites-changed",
       G_CALLBACK (favourites_changed_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->manager, "contacts-loaded",
+      G_CALLBACK (contacts_loaded_cb), self, 0);
+
+  report_load_time (self);
 }
 
 static void
@@ -295,6 +415,15 @@ empathy_roster_model_manager_dispose (GObject *object)
   void (*chain_up) (GObject *) =
       ((GObjectClass *) empathy_roster_model_manager_parent_class)->dispose;
 
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  g_queue_foreach (self->priv->pending, (GFunc) pending_change_free, NULL);
+  g_queue_clear (self->priv->pending);
+
   g_clear_object (&self->priv->manager);
 
   if (chain_up != NULL)
@@ -309,6 +438,7 @@ empathy_roster_model_manager_finalize (GObject *object)
       ((GObjectClass *) empathy_roster_model_manager_parent_class)->finalize;
 
   g_list_free (self->priv->top_group_members);
+  g_queue_free (self->priv->pending);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -343,6 +473,8 @@ empathy_roster_model_manager_init (EmpathyRosterModelManager *self)
       EMPATHY_TYPE_ROSTER_MODEL_MANAGER, EmpathyRosterModelManagerPriv);
 
   self->priv->top_group_members = NULL;
+  self->priv->pending = g_queue_new ();
+  self->priv->creation_time = g_get_monotonic_time ();
 }
 
 EmpathyRosterModelManager *
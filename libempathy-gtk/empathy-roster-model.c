@@ -28,6 +28,8 @@ enum
   SIG_INDIVIDUAL_ADDED,
   SIG_INDIVIDUAL_REMOVED,
   SIG_GROUPS_CHANGED,
+  SIG_FREEZE,
+  SIG_THAW,
   LAST_SIGNAL
 };
 
@@ -61,6 +63,22 @@ empathy_roster_model_default_init (EmpathyRosterModelInterface *iface)
         FOLKS_TYPE_INDIVIDUAL,
         G_TYPE_STRING,
         G_TYPE_BOOLEAN);
+
+  /* Emitted around a batch of individual-added and individual-removed
+   * signals so views can process them in one go */
+  signals[SIG_FREEZE] =
+    g_signal_new ("freeze",
+        EMPATHY_TYPE_ROSTER_MODEL,
+        G_SIGNAL_RUN_LAST,
+        0, NULL, NULL, NULL,
+        G_TYPE_NONE, 0);
+
+  signals[SIG_THAW] =
+    g_signal_new ("thaw",
+        EMPATHY_TYPE_ROSTER_MODEL,
+        G_SIGNAL_RUN_LAST,
+        0, NULL, NULL, NULL,
+        G_TYPE_NONE, 0);
 }
 
 /***** Restricted *****/
@@ -89,6 +107,18 @@ empathy_roster_model_fire_groups_changed (EmpathyRosterModel *self,
       is_member);
 }
 
+void
+empathy_roster_model_fire_freeze (EmpathyRosterModel *self)
+{
+  g_signal_emit (self, signals[SIG_FREEZE], 0);
+}
+
+void
+empathy_roster_model_fire_thaw (EmpathyRosterModel *self)
+{
+  g_signal_emit (self, signals[SIG_THAW], 0);
+}
+
 /***** Public *****/
 
 /**
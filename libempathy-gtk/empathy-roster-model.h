@@ -74,6 +74,10 @@ void empathy_roster_model_fire_groups_changed (EmpathyRosterModel *self,
     const gchar *group,
     gboolean is_member);
 
+void empathy_roster_model_fire_freeze (EmpathyRosterModel *self);
+
+void empathy_roster_model_fire_thaw (EmpathyRosterModel *self);
+
 /* Public API */
 GList * empathy_roster_model_get_individuals (EmpathyRosterModel *self);
 
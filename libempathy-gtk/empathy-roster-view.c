@@ -2,6 +2,8 @@
 
 #include "empathy-roster-view.h"
 
+#include <string.h>
+
 #include <glib/gi18n-lib.h>
 
 #include <libempathy-gtk/empathy-roster-contact.h>
@@ -15,6 +17,10 @@ G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, EGG_TYPE_LIST_BOX)
 /* Flashing delay for icons (milliseconds). */
 #define FLASH_TIMEOUT 500
 
+/* Rows further than this number of pages from the visible part of the view
+ * don't keep their widgets */
+#define VIEWPORT_MARGIN_PAGES 1
+
 enum
 {
   PROP_MODEL = 1,
@@ -51,6 +57,32 @@ struct _EmpathyRosterViewPriv
   GHashTable *roster_groups;
   /* Hash of the EmpathyRosterContact currently displayed */
   GHashTable *displayed_contacts;
+  /* Set of the EmpathyRosterContact which should be displayed, ignoring
+   * whether their group is expanded */
+  GHashTable *matching_contacts;
+  /* EmpathyRosterGroup (borrowed) -> number of its matching contacts */
+  GHashTable *group_counts;
+
+  /* Set of the EmpathyRosterContact matching the live search */
+  GHashTable *search_matches;
+  /* Matches of the previous search, only set while refiltering for a
+   * search extending it */
+  GHashTable *previous_search_matches;
+  gchar *search_text;
+
+  /* While the model is frozen, new EmpathyRosterContact are kept in
+   * pending_contacts (owned) and added all at once when thawing it */
+  guint freeze_count;
+  GPtrArray *pending_contacts;
+  /* roster_view_sort() considers every child equal while they are added,
+   * and the list box is sorted once afterwards */
+  gboolean sort_suspended;
+
+  /* Adjustment of the GtkScrolledWindow containing the view, if any */
+  GtkAdjustment *vadjustment;
+  guint update_viewport_id;
+  /* Set of the EmpathyRosterContact (owned) marked as in the viewport */
+  GHashTable *in_viewport;
 
   guint last_event_id;
   /* queue of (Event *). The most recent events are in the head of the queue
@@ -181,11 +213,28 @@ add_roster_contact (EmpathyRosterView *self,
       G_CALLBACK (roster_contact_changed_cb), self);
 
   gtk_widget_show (contact);
-  gtk_container_add (GTK_CONTAINER (self), contact);
+
+  if (self->priv->freeze_count > 0)
+    g_ptr_array_add (self->priv->pending_contacts, g_object_ref_sink (contact));
+  else
+    gtk_container_add (GTK_CONTAINER (self), contact);
 
   return contact;
 }
 
+static void
+remove_roster_contact (EmpathyRosterView *self,
+    GtkWidget *contact)
+{
+  /* Contacts added while frozen are not in the list box yet */
+  if (g_ptr_array_remove (self->priv->pending_contacts, contact))
+    return;
+
+  g_hash_table_remove (self->priv->in_viewport, contact);
+
+  gtk_container_remove (GTK_CONTAINER (self), contact);
+}
+
 static void
 group_expanded_cb (EmpathyRosterGroup *group,
     GParamSpec *spec,
@@ -462,7 +511,7 @@ individual_removed (EmpathyRosterView *self,
               EMPATHY_ROSTER_CONTACT (contact), FALSE);
         }
 
-      gtk_container_remove (GTK_CONTAINER (self), contact);
+      remove_roster_contact (self, contact);
     }
 
   g_hash_table_remove (self->priv->roster_contacts, individual);
@@ -637,6 +686,9 @@ roster_view_sort (gconstpointer a,
 {
   EmpathyRosterView *self = user_data;
 
+  if (self->priv->sort_suspended)
+    return 0;
+
   if (EMPATHY_IS_ROSTER_CONTACT (a) && EMPATHY_IS_ROSTER_CONTACT (b))
     return compare_roster_contacts (self, EMPATHY_ROSTER_CONTACT (a),
         EMPATHY_ROSTER_CONTACT (b));
@@ -743,6 +795,33 @@ remove_from_displayed (EmpathyRosterView *self,
     update_empty (self, TRUE);
 }
 
+static gboolean
+contact_matches_search (EmpathyRosterView *self,
+    EmpathyRosterContact *contact)
+{
+  FolksIndividual *individual;
+  gboolean match;
+
+  /* The search extends the previous one, so it can only match contacts
+   * which matched it */
+  if (self->priv->previous_search_matches != NULL &&
+      !g_hash_table_contains (self->priv->previous_search_matches, contact))
+    return FALSE;
+
+  individual = empathy_roster_contact_get_individual (contact);
+
+  match = empathy_individual_match_string (individual,
+      empathy_live_search_get_text (self->priv->search),
+      empathy_live_search_get_words (self->priv->search));
+
+  if (match)
+    g_hash_table_add (self->priv->search_matches, contact);
+  else
+    g_hash_table_remove (self->priv->search_matches, contact);
+
+  return match;
+}
+
 /**
  * check if @contact should be displayed according to @self's current status
  * and without consideration for the state of @contact's groups.
@@ -752,15 +831,7 @@ contact_should_be_displayed (EmpathyRosterView *self,
     EmpathyRosterContact *contact)
 {
   if (is_searching (self))
-    {
-      FolksIndividual *individual;
-
-      individual = empathy_roster_contact_get_individual (contact);
-
-      return empathy_individual_match_string (individual,
-          empathy_live_search_get_text (self->priv->search),
-          empathy_live_search_get_words (self->priv->search));
-    }
+    return contact_matches_search (self, contact);
 
   if (self->priv->show_offline)
       return TRUE;
@@ -772,6 +843,45 @@ contact_should_be_displayed (EmpathyRosterView *self,
 }
 
 
+/* Keep the count of matching contacts of @contact's group up to date, and
+ * refilter the group when it becomes empty or not */
+static void
+set_contact_matching (EmpathyRosterView *self,
+    EmpathyRosterContact *contact,
+    gboolean matching)
+{
+  EmpathyRosterGroup *group;
+  guint count;
+
+  if (g_hash_table_contains (self->priv->matching_contacts, contact) ==
+      matching)
+    return;
+
+  if (matching)
+    g_hash_table_add (self->priv->matching_contacts, contact);
+  else
+    g_hash_table_remove (self->priv->matching_contacts, contact);
+
+  group = lookup_roster_group (self,
+      empathy_roster_contact_get_group (contact));
+  if (group == NULL)
+    return;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->group_counts,
+        group));
+
+  if (matching)
+    count++;
+  else
+    count--;
+
+  g_hash_table_insert (self->priv->group_counts, group,
+      GUINT_TO_POINTER (count));
+
+  if ((matching && count == 1) || (!matching && count == 0))
+    egg_list_box_child_changed (EGG_LIST_BOX (self), GTK_WIDGET (group));
+}
+
 static gboolean
 filter_contact (EmpathyRosterView *self,
     EmpathyRosterContact *contact)
@@ -779,6 +889,7 @@ filter_contact (EmpathyRosterView *self,
   gboolean displayed;
 
   displayed = contact_should_be_displayed (self, contact);
+  set_contact_matching (self, contact, displayed);
 
   if (self->priv->show_groups)
     {
@@ -813,19 +924,10 @@ static gboolean
 filter_group (EmpathyRosterView *self,
     EmpathyRosterGroup *group)
 {
-  GList *widgets, *l;
-
-  /* Display the group if it contains at least one displayed contact */
-  widgets = empathy_roster_group_get_widgets (group);
-  for (l = widgets; l != NULL; l = g_list_next (l))
-    {
-      EmpathyRosterContact *contact = l->data;
-
-      if (contact_should_be_displayed (self, contact))
-        return TRUE;
-    }
-
-  return FALSE;
+  /* Display the group if it contains at least one displayed contact. The
+   * count is updated when filtering its contacts, which refilter the
+   * group if needed. */
+  return g_hash_table_lookup (self->priv->group_counts, group) != NULL;
 }
 
 static gboolean
@@ -843,11 +945,48 @@ filter_list (GtkWidget *child,
   g_return_val_if_reached (FALSE);
 }
 
+static void
+view_freeze (EmpathyRosterView *self)
+{
+  self->priv->freeze_count++;
+}
+
+static void
+view_thaw (EmpathyRosterView *self)
+{
+  GPtrArray *pending = self->priv->pending_contacts;
+  guint i;
+
+  g_return_if_fail (self->priv->freeze_count > 0);
+
+  self->priv->freeze_count--;
+  if (self->priv->freeze_count > 0 || pending->len == 0)
+    return;
+
+  self->priv->pending_contacts = g_ptr_array_new_with_free_func (
+      g_object_unref);
+
+  /* The list box looks for the position of each child it's given with the
+   * sort function; rather than doing that for every new contact, they are
+   * appended and the whole list is sorted once */
+  self->priv->sort_suspended = TRUE;
+
+  for (i = 0; i < pending->len; i++)
+    gtk_container_add (GTK_CONTAINER (self), g_ptr_array_index (pending, i));
+
+  self->priv->sort_suspended = FALSE;
+  egg_list_box_resort (EGG_LIST_BOX (self));
+
+  g_ptr_array_unref (pending);
+}
+
 static void
 populate_view (EmpathyRosterView *self)
 {
   GList *individuals, *l;
 
+  view_freeze (self);
+
   individuals = empathy_roster_model_get_individuals (self->priv->model);
   for (l = individuals; l != NULL; l = g_list_next (l))
     {
@@ -857,6 +996,22 @@ populate_view (EmpathyRosterView *self)
     }
 
   g_list_free (individuals);
+
+  view_thaw (self);
+}
+
+static void
+model_freeze_cb (EmpathyRosterModel *model,
+    EmpathyRosterView *self)
+{
+  view_freeze (self);
+}
+
+static void
+model_thaw_cb (EmpathyRosterModel *model,
+    EmpathyRosterView *self)
+{
+  view_thaw (self);
 }
 
 static void
@@ -891,7 +1046,7 @@ remove_from_group (EmpathyRosterView *self,
           EMPATHY_ROSTER_CONTACT (contact), FALSE);
     }
 
-  gtk_container_remove (GTK_CONTAINER (self), contact);
+  remove_roster_contact (self, contact);
 }
 
 static void
@@ -937,6 +1092,10 @@ empathy_roster_view_constructed (GObject *object)
       G_CALLBACK (individual_removed_cb), self, 0);
   tp_g_signal_connect_object (self->priv->model, "groups-changed",
       G_CALLBACK (groups_changed_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->model, "freeze",
+      G_CALLBACK (model_freeze_cb), self, 0);
+  tp_g_signal_connect_object (self->priv->model, "thaw",
+      G_CALLBACK (model_thaw_cb), self, 0);
 
   egg_list_box_set_sort_func (EGG_LIST_BOX (self),
       roster_view_sort, self, NULL);
@@ -949,6 +1108,143 @@ empathy_roster_view_constructed (GObject *object)
   egg_list_box_set_activate_on_single_click (EGG_LIST_BOX (self), FALSE);
 }
 
+/* Marks the contacts between @top and @bottom as being in the viewport,
+ * looking them up from their position rather than going through all the
+ * rows, and the ones which were in it before but aren't anymore as out */
+static void
+update_viewport (EmpathyRosterView *self,
+    gint top,
+    gint bottom)
+{
+  GHashTable *in_viewport;
+  GHashTableIter iter;
+  gpointer contact;
+  gint y;
+
+  in_viewport = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+
+  for (y = MAX (top, 0); y <= bottom; )
+    {
+      GtkWidget *child;
+      GtkAllocation allocation;
+      gint child_y;
+
+      child = egg_list_box_get_child_at_y (EGG_LIST_BOX (self), y);
+      if (child == NULL)
+        break;
+
+      /* Rows which have not been allocated yet will be updated once they
+       * are */
+      gtk_widget_get_allocation (child, &allocation);
+      if (allocation.height <= 1 ||
+          !gtk_widget_translate_coordinates (child, GTK_WIDGET (self),
+            0, 0, NULL, &child_y))
+        break;
+
+      /* Filtered out rows are hidden by the list box */
+      if (EMPATHY_IS_ROSTER_CONTACT (child) &&
+          gtk_widget_get_child_visible (child))
+        {
+          empathy_roster_contact_set_in_viewport (
+              EMPATHY_ROSTER_CONTACT (child), TRUE);
+          g_hash_table_add (in_viewport, g_object_ref (child));
+        }
+
+      /* The next row starts with its separator, if any */
+      y = MAX (child_y + allocation.height, y + 1);
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->in_viewport);
+  while (g_hash_table_iter_next (&iter, &contact, NULL))
+    {
+      if (!g_hash_table_contains (in_viewport, contact))
+        empathy_roster_contact_set_in_viewport (
+            EMPATHY_ROSTER_CONTACT (contact), FALSE);
+    }
+
+  g_hash_table_unref (self->priv->in_viewport);
+  self->priv->in_viewport = in_viewport;
+}
+
+static gboolean
+update_viewport_cb (gpointer user_data)
+{
+  EmpathyRosterView *self = user_data;
+  gint top, bottom;
+
+  self->priv->update_viewport_id = 0;
+
+  if (self->priv->vadjustment != NULL)
+    {
+      gdouble value, page_size;
+
+      value = gtk_adjustment_get_value (self->priv->vadjustment);
+      page_size = gtk_adjustment_get_page_size (self->priv->vadjustment);
+
+      top = value - VIEWPORT_MARGIN_PAGES * page_size;
+      bottom = value + (VIEWPORT_MARGIN_PAGES + 1) * page_size;
+    }
+  else
+    {
+      /* Not scrollable, all the rows are visible */
+      top = 0;
+      bottom = gtk_widget_get_allocated_height (GTK_WIDGET (self));
+    }
+
+  update_viewport (self, top, bottom);
+
+  return FALSE;
+}
+
+static void
+queue_update_viewport (EmpathyRosterView *self)
+{
+  if (self->priv->update_viewport_id != 0)
+    return;
+
+  /* After the layout, but before the rows are drawn */
+  self->priv->update_viewport_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE + 15,
+      update_viewport_cb, self, NULL);
+}
+
+static void
+vadjustment_changed_cb (GtkAdjustment *adjustment,
+    EmpathyRosterView *self)
+{
+  queue_update_viewport (self);
+}
+
+static void
+empathy_roster_view_size_allocate (GtkWidget *widget,
+    GtkAllocation *allocation)
+{
+  EmpathyRosterView *self = EMPATHY_ROSTER_VIEW (widget);
+  void (*chain_up) (GtkWidget *, GtkAllocation *) =
+      ((GtkWidgetClass *) empathy_roster_view_parent_class)->size_allocate;
+
+  chain_up (widget, allocation);
+
+  if (self->priv->vadjustment == NULL)
+    {
+      GtkWidget *scrolled;
+
+      scrolled = gtk_widget_get_ancestor (widget, GTK_TYPE_SCROLLED_WINDOW);
+      if (scrolled != NULL)
+        {
+          self->priv->vadjustment = g_object_ref (
+              gtk_scrolled_window_get_vadjustment (
+                GTK_SCROLLED_WINDOW (scrolled)));
+
+          tp_g_signal_connect_object (self->priv->vadjustment, "value-changed",
+              G_CALLBACK (vadjustment_changed_cb), self, 0);
+          tp_g_signal_connect_object (self->priv->vadjustment, "changed",
+              G_CALLBACK (vadjustment_changed_cb), self, 0);
+        }
+    }
+
+  queue_update_viewport (self);
+}
+
 static void
 empathy_roster_view_dispose (GObject *object)
 {
@@ -958,6 +1254,22 @@ empathy_roster_view_dispose (GObject *object)
 
   stop_flashing (self);
 
+  g_ptr_array_set_size (self->priv->pending_contacts, 0);
+  g_hash_table_remove_all (self->priv->in_viewport);
+
+  if (self->priv->update_viewport_id != 0)
+    {
+      g_source_remove (self->priv->update_viewport_id);
+      self->priv->update_viewport_id = 0;
+    }
+
+  if (self->priv->vadjustment != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->priv->vadjustment,
+          vadjustment_changed_cb, self);
+      g_clear_object (&self->priv->vadjustment);
+    }
+
   empathy_roster_view_set_live_search (self, NULL);
   g_clear_object (&self->priv->model);
 
@@ -975,6 +1287,12 @@ empathy_roster_view_finalize (GObject *object)
   g_hash_table_unref (self->priv->roster_contacts);
   g_hash_table_unref (self->priv->roster_groups);
   g_hash_table_unref (self->priv->displayed_contacts);
+  g_hash_table_unref (self->priv->matching_contacts);
+  g_hash_table_unref (self->priv->group_counts);
+  g_hash_table_unref (self->priv->search_matches);
+  g_free (self->priv->search_text);
+  g_ptr_array_unref (self->priv->pending_contacts);
+  g_hash_table_unref (self->priv->in_viewport);
   g_queue_free_full (self->priv->events, event_free);
 
   if (chain_up != NULL)
@@ -1156,6 +1474,20 @@ empathy_roster_view_remove (GtkContainer *container,
   void (*chain_up) (GtkContainer *, GtkWidget *) =
       ((GtkContainerClass *) empathy_roster_view_parent_class)->remove;
 
+  if (EMPATHY_IS_ROSTER_CONTACT (widget))
+    {
+      /* Before the group is gone from roster_groups */
+      set_contact_matching (self, (EmpathyRosterContact *) widget, FALSE);
+      g_hash_table_remove (self->priv->search_matches, widget);
+    }
+  else if (EMPATHY_IS_ROSTER_GROUP (widget))
+    {
+      /* So its remaining contacts don't update its count any more */
+      g_hash_table_remove (self->priv->group_counts, widget);
+      g_hash_table_remove (self->priv->roster_groups,
+          empathy_roster_group_get_name (EMPATHY_ROSTER_GROUP (widget)));
+    }
+
   chain_up (container, widget);
 
   if (EMPATHY_IS_ROSTER_CONTACT (widget))
@@ -1181,6 +1513,7 @@ empathy_roster_view_class_init (
   widget_class->button_press_event = empathy_roster_view_button_press_event;
   widget_class->key_press_event = empathy_roster_view_key_press_event;
   widget_class->query_tooltip = empathy_roster_view_query_tooltip;
+  widget_class->size_allocate = empathy_roster_view_size_allocate;
 
   container_class->remove = empathy_roster_view_remove;
 
@@ -1252,6 +1585,13 @@ empathy_roster_view_init (EmpathyRosterView *self)
   self->priv->roster_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, NULL);
   self->priv->displayed_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->matching_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->group_counts = g_hash_table_new (NULL, NULL);
+  self->priv->search_matches = g_hash_table_new (NULL, NULL);
+  self->priv->pending_contacts = g_ptr_array_new_with_free_func (
+      g_object_unref);
+  self->priv->in_viewport = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
 
   self->priv->events = g_queue_new ();
 
@@ -1290,6 +1630,11 @@ clear_view (EmpathyRosterView *self)
   g_hash_table_remove_all (self->priv->roster_contacts);
   g_hash_table_remove_all (self->priv->roster_groups);
   g_hash_table_remove_all (self->priv->displayed_contacts);
+  g_hash_table_remove_all (self->priv->matching_contacts);
+  g_hash_table_remove_all (self->priv->group_counts);
+  g_hash_table_remove_all (self->priv->search_matches);
+  g_ptr_array_set_size (self->priv->pending_contacts, 0);
+  g_hash_table_remove_all (self->priv->in_viewport);
 }
 
 void
@@ -1301,7 +1646,6 @@ empathy_roster_view_show_groups (EmpathyRosterView *self,
 
   self->priv->show_groups = show;
 
-  /* TODO: block sort/filter? */
   clear_view (self);
   populate_view (self);
 
@@ -1336,8 +1680,34 @@ search_text_notify_cb (EmpathyLiveSearch *search,
     GParamSpec *pspec,
     EmpathyRosterView *self)
 {
+  const gchar *text = empathy_live_search_get_text (search);
+  GHashTable *previous = NULL;
+
+  /* When the user types one more char, only the contacts matching the
+   * previous search can match the new one */
+  if (is_searching (self) && self->priv->search_text != NULL &&
+      strlen (text) > strlen (self->priv->search_text) &&
+      g_str_has_prefix (text, self->priv->search_text))
+    {
+      previous = self->priv->search_matches;
+      self->priv->search_matches = g_hash_table_new (NULL, NULL);
+    }
+  else
+    {
+      g_hash_table_remove_all (self->priv->search_matches);
+    }
+
+  self->priv->previous_search_matches = previous;
+
   egg_list_box_refilter (EGG_LIST_BOX (self));
 
+  self->priv->previous_search_matches = NULL;
+  if (previous != NULL)
+    g_hash_table_unref (previous);
+
+  g_free (self->priv->search_text);
+  self->priv->search_text = is_searching (self) ? g_strdup (text) : NULL;
+
   select_first_contact (self);
 }
 
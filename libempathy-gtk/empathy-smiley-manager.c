@@ -33,14 +33,34 @@ typedef struct _SmileyManagerTree SmileyManagerTree;
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
 	SmileyManagerTree *tree;
+	/* All the nodes of the tree, in insertion order */
+	GPtrArray         *nodes;
+	/* TRUE if smileys were added since the fail links were computed */
+	gboolean           automaton_dirty;
 	GSList            *smileys;
 } EmpathySmileyManagerPriv;
 
+/* The smileys are matched with an Aho-Corasick automaton: a trie of the
+ * smiley strings where each node also links to the node of its longest
+ * proper suffix that is in the trie. When the next char can't extend the
+ * current match we follow those links instead of going back in the text,
+ * so every message is parsed in a single pass. */
 struct _SmileyManagerTree {
-	gunichar     c;
-	GdkPixbuf   *pixbuf;
-	gchar       *path;
-	GSList      *childrens;
+	gunichar           c;
+	/* Length in bytes of the string leading to this node */
+	guint              depth;
+	GdkPixbuf         *pixbuf;
+	gchar             *path;
+	/* Children indexed by char: ASCII ones in an array, allocated only if
+	 * the node has any, the others in a gunichar -> SmileyManagerTree*
+	 * hash table */
+	SmileyManagerTree **ascii;
+	GHashTable        *others;
+	GSList            *childrens;
+	/* Longest proper suffix of this node's string which is in the tree */
+	SmileyManagerTree *fail;
+	/* Longest proper suffix of this node's string which is a smiley */
+	SmileyManagerTree *output;
 };
 
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
@@ -54,9 +74,6 @@ smiley_manager_tree_new (gunichar c)
 
 	tree = g_slice_new0 (SmileyManagerTree);
 	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
 
 	return tree;
 }
@@ -64,19 +81,13 @@ smiley_manager_tree_new (gunichar c)
 static void
 smiley_manager_tree_free (SmileyManagerTree *tree)
 {
-	GSList *l;
-
-	if (!tree) {
-		return;
-	}
-
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
-	}
-
 	if (tree->pixbuf) {
 		g_object_unref (tree->pixbuf);
 	}
+	g_free (tree->ascii);
+	if (tree->others) {
+		g_hash_table_unref (tree->others);
+	}
 	g_slist_free (tree->childrens);
 	g_free (tree->path);
 	g_slice_free (SmileyManagerTree, tree);
@@ -107,7 +118,7 @@ smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
 
-	smiley_manager_tree_free (priv->tree);
+	g_ptr_array_unref (priv->nodes);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -150,7 +161,10 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
+	priv->nodes = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) smiley_manager_tree_free);
 	priv->tree = smiley_manager_tree_new ('\0');
+	g_ptr_array_add (priv->nodes, priv->tree);
 	priv->smileys = NULL;
 
 	empathy_smiley_manager_load (manager);
@@ -162,55 +176,133 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
+static inline SmileyManagerTree *
 smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
 {
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
+	if (c < 128) {
+		return tree->ascii != NULL ? tree->ascii[c] : NULL;
+	}
 
-		if (child->c == c) {
-			return child;
-		}
+	if (tree->others == NULL) {
+		return NULL;
 	}
 
-	return NULL;
+	return g_hash_table_lookup (tree->others, GUINT_TO_POINTER (c));
 }
 
 static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
+smiley_manager_tree_find_or_insert_child (EmpathySmileyManager *manager,
+					  SmileyManagerTree    *tree,
+					  gunichar              c)
 {
-	SmileyManagerTree *child;
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyManagerTree        *child;
 
 	child = smiley_manager_tree_find_child (tree, c);
+	if (child) {
+		return child;
+	}
+
+	child = smiley_manager_tree_new (c);
+	child->depth = tree->depth + g_unichar_to_utf8 (c, NULL);
+	tree->childrens = g_slist_prepend (tree->childrens, child);
+	g_ptr_array_add (priv->nodes, child);
 
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
+	if (c < 128) {
+		if (tree->ascii == NULL) {
+			tree->ascii = g_new0 (SmileyManagerTree *, 128);
+		}
+		tree->ascii[c] = child;
+	} else {
+		if (tree->others == NULL) {
+			tree->others = g_hash_table_new (NULL, NULL);
+		}
+		g_hash_table_insert (tree->others, GUINT_TO_POINTER (c),
+				     child);
 	}
 
 	return child;
 }
 
 static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
+smiley_manager_tree_insert (EmpathySmileyManager *manager,
+			    GdkPixbuf            *pixbuf,
+			    const gchar          *str,
+			    const gchar          *path)
 {
-	SmileyManagerTree *child;
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	SmileyManagerTree        *node = priv->tree;
+
+	for (; *str; str = g_utf8_next_char (str)) {
+		node = smiley_manager_tree_find_or_insert_child (manager, node,
+			g_utf8_get_char (str));
+	}
+
+	if (node->pixbuf) {
+		g_object_unref (node->pixbuf);
+	}
+	g_free (node->path);
+
+	node->pixbuf = g_object_ref (pixbuf);
+	node->path = g_strdup (path);
+
+	priv->automaton_dirty = TRUE;
+}
 
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
+/* Compute the fail and output links of all the nodes, breadth first so
+ * the links of the shorter strings are known when computing them for the
+ * longer ones. */
+static void
+smiley_manager_build_automaton (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	GQueue                    queue = G_QUEUE_INIT;
+	SmileyManagerTree        *node;
 
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
+	if (!priv->automaton_dirty) {
 		return;
 	}
 
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
+	priv->tree->fail = NULL;
+	priv->tree->output = NULL;
+	g_queue_push_tail (&queue, priv->tree);
+
+	while ((node = g_queue_pop_head (&queue)) != NULL) {
+		GSList *l;
+
+		for (l = node->childrens; l; l = l->next) {
+			SmileyManagerTree *child = l->data;
+			SmileyManagerTree *fail;
+
+			if (node == priv->tree) {
+				fail = priv->tree;
+			} else {
+				SmileyManagerTree *f = node->fail;
+
+				fail = NULL;
+				while (f != NULL) {
+					fail = smiley_manager_tree_find_child (f,
+						child->c);
+					if (fail != NULL) {
+						break;
+					}
+					f = f->fail;
+				}
+
+				if (fail == NULL) {
+					fail = priv->tree;
+				}
+			}
+
+			child->fail = fail;
+			child->output = fail->pixbuf != NULL ? fail :
+				fail->output;
+
+			g_queue_push_tail (&queue, child);
+		}
+	}
+
+	priv->automaton_dirty = FALSE;
 }
 
 static void
@@ -225,7 +317,7 @@ smiley_manager_add_valist (EmpathySmileyManager *manager,
 	EmpathySmiley            *smiley;
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		smiley_manager_tree_insert (manager, pixbuf, str, path);
 	}
 
 	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
@@ -313,92 +405,138 @@ empathy_smiley_hit_free (EmpathySmileyHit *hit)
 	g_slice_free (EmpathySmileyHit, hit);
 }
 
-GSList *
-empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
-				  const gchar          *text,
-				  gssize                len)
+/* Find the first smiley in the len first bytes of text. When smileys
+ * overlap, the one starting first wins, and the longest one if they start
+ * at the same position. For example ">:)" and ":(" are both valid
+ * smileys, ">:(" is parsed as ">" followed by ":(".
+ *
+ * 'match' is the best smiley found so far; it's returned as soon as no
+ * smiley which is being matched could start before it. So only the few
+ * chars following the smiley are read, and parsing all the smileys of a
+ * text by calling this right after the previous one is linear. */
+static SmileyManagerTree *
+smiley_manager_find_first (EmpathySmileyManager *manager,
+			   const gchar          *text,
+			   gssize                len,
+			   guint                *match_start,
+			   guint                *match_end)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
+	SmileyManagerTree        *state = priv->tree;
+	SmileyManagerTree        *match = NULL;
 	const gchar              *cur_str;
-	const gchar              *start = NULL;
-
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
 
-	/* If len is negative, parse the string until we find '\0' */
-	if (len < 0) {
-		len = G_MAXSSIZE;
-	}
+	smiley_manager_build_automaton (manager);
 
-	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
+	/* cur_str is a pointer in the text showing the current position
 	 * of the parsing. It is always at the begining of an UTF-8 character,
 	 * because we support unicode smileys! For example we could want to
 	 * replace ™ by an image. */
-
 	for (cur_str = text;
 	     *cur_str != '\0' && cur_str - text < len;
 	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
+		SmileyManagerTree *found;
 		gunichar           c;
+		guint              end;
 
 		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
-			}
-			cur_tree = child;
-			continue;
+		end = g_utf8_next_char (cur_str) - text;
+
+		/* Follow the fail links until c extends the current
+		 * suffix of the text */
+		while (state != priv->tree &&
+		       smiley_manager_tree_find_child (state, c) == NULL) {
+			state = state->fail;
 		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
+		state = smiley_manager_tree_find_child (state, c);
+		if (state == NULL) {
+			state = priv->tree;
+		}
+
+		/* The longest smiley ending at c, if any */
+		found = state->pixbuf != NULL ? state : state->output;
+		if (found != NULL) {
+			guint start = end - found->depth;
+
+			if (match == NULL || start < *match_start ||
+			    (start == *match_start && end > *match_end)) {
+				match = found;
+				*match_start = start;
+				*match_end = end;
 			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
 		}
+
+		/* Stop unless a longer smiley could still start at
+		 * match_start */
+		if (match != NULL && end - state->depth > *match_start) {
+			break;
+		}
+	}
+
+	return match;
+}
+
+/* Fills hit with the first smiley in the len first bytes of text (or the
+ * whole text if len is negative). Returns FALSE if there is none. */
+gboolean
+empathy_smiley_manager_find_first (EmpathySmileyManager *manager,
+				   const gchar          *text,
+				   gssize                len,
+				   EmpathySmileyHit     *hit)
+{
+	SmileyManagerTree *match;
+	guint              start, end;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), FALSE);
+	g_return_val_if_fail (text != NULL, FALSE);
+	g_return_val_if_fail (hit != NULL, FALSE);
+
+	if (len < 0) {
+		len = G_MAXSSIZE;
 	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+	match = smiley_manager_find_first (manager, text, len, &start, &end);
+	if (match == NULL) {
+		return FALSE;
+	}
+
+	hit->pixbuf = match->pixbuf;
+	hit->path = match->path;
+	hit->start = start;
+	hit->end = end;
+
+	return TRUE;
+}
+
+GSList *
+empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
+				  const gchar          *text,
+				  gssize                len)
+{
+	GSList            *hits = NULL;
+	SmileyManagerTree *match;
+	guint              offset = 0;
+	guint              start, end;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
+	g_return_val_if_fail (text != NULL, NULL);
+
+	/* If len is negative, parse the string until we find '\0' */
+	if (len < 0) {
+		len = G_MAXSSIZE;
+	}
+
+	/* Parse the len first bytes of text to find smileys. Each time a smiley
+	 * is detected, append a EmpathySmileyHit struct to the returned list,
+	 * containing the smiley pixbuf and the position of the text to be
+	 * replaced by it. */
+	while ((match = smiley_manager_find_first (manager, text + offset,
+						   len - offset,
+						   &start, &end)) != NULL) {
+		hits = g_slist_prepend (hits, smiley_hit_new (match,
+			offset + start, offset + end));
+		offset += end;
 	}
 
 	return g_slist_reverse (hits);
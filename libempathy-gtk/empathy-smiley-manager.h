@@ -74,6 +74,10 @@ GSList *              empathy_smiley_manager_get_all         (EmpathySmileyManag
 GSList *              empathy_smiley_manager_parse_len       (EmpathySmileyManager *manager,
 							      const gchar          *text,
 							      gssize                len);
+gboolean              empathy_smiley_manager_find_first      (EmpathySmileyManager *manager,
+							      const gchar          *text,
+							      gssize                len,
+							      EmpathySmileyHit     *hit);
 GtkWidget *           empathy_smiley_menu_new                (EmpathySmileyManager *manager,
 							      EmpathySmileyMenuFunc func,
 							      gpointer              user_data);
@@ -221,6 +221,178 @@ empathy_string_replace_escaped (const gchar *text,
 	g_free (escaped);
 }
 
+/* Append text escaped like g_markup_escape_text() does, with '\r'
+ * removed and, if newlines is TRUE, '\n' replaced by <br/> */
+static void
+string_append_escaped (GString *string,
+		       const gchar *text,
+		       gsize len,
+		       gboolean newlines)
+{
+	const gchar *p = text;
+	const gchar *end = text + len;
+	const gchar *pending = text;
+
+	while (p < end) {
+		const gchar *next = MIN (g_utf8_next_char (p), end);
+		const gchar *replacement = NULL;
+		gunichar c;
+
+		switch (*p) {
+		case '&':
+			replacement = "&amp;";
+			break;
+		case '<':
+			replacement = "&lt;";
+			break;
+		case '>':
+			replacement = "&gt;";
+			break;
+		case '\'':
+			replacement = "&apos;";
+			break;
+		case '"':
+			replacement = "&quot;";
+			break;
+		case '\r':
+			replacement = "";
+			break;
+		case '\n':
+			if (newlines)
+				replacement = "<br/>";
+			break;
+		default:
+			c = g_utf8_get_char (p);
+			if ((0x1 <= c && c <= 0x8) ||
+			    (0xb <= c && c <= 0xc) ||
+			    (0xe <= c && c <= 0x1f) ||
+			    (0x7f <= c && c <= 0x84) ||
+			    (0x86 <= c && c <= 0x9f)) {
+				g_string_append_len (string, pending,
+						     p - pending);
+				g_string_append_printf (string, "&#x%x;", c);
+				pending = next;
+			}
+			break;
+		}
+
+		if (replacement != NULL) {
+			g_string_append_len (string, pending, p - pending);
+			g_string_append (string, replacement);
+			pending = next;
+		}
+
+		p = next;
+	}
+
+	g_string_append_len (string, pending, end - pending);
+}
+
+static void
+string_append_link (GString *string,
+		    const gchar *text,
+		    gsize len)
+{
+	/* Same as empathy_make_absolute_url_len() */
+	g_string_append (string, "<a href=\"");
+	if (!g_str_has_prefix (text, "help:") &&
+	    !g_str_has_prefix (text, "mailto:") &&
+	    g_strstr_len (text, len, ":/") == NULL) {
+		if (memchr (text, '@', len) != NULL)
+			g_string_append (string, "mailto:");
+		else
+			g_string_append (string, "http://");
+	}
+	string_append_escaped (string, text, len, FALSE);
+	g_string_append (string, "\">");
+	string_append_escaped (string, text, len, FALSE);
+	g_string_append (string, "</a>");
+}
+
+static void
+string_append_text (GString *string,
+		    const gchar *text,
+		    gsize len,
+		    EmpathySmileyManager *smiley_manager,
+		    gboolean newlines)
+{
+	EmpathySmileyHit hit;
+
+	while (smiley_manager != NULL &&
+	       empathy_smiley_manager_find_first (smiley_manager, text, len,
+						  &hit)) {
+		string_append_escaped (string, text, hit.start, newlines);
+
+		/* Replace smiley by a <img/> tag */
+		g_string_append (string, "<img src=\"");
+		g_string_append (string, hit.path);
+		g_string_append (string, "\" alt=\"");
+		g_string_append_len (string, text + hit.start,
+				     hit.end - hit.start);
+		g_string_append (string, "\" title=\"");
+		g_string_append_len (string, text + hit.start,
+				     hit.end - hit.start);
+		g_string_append (string, "\"/>");
+
+		text += hit.end;
+		len -= hit.end;
+	}
+
+	string_append_escaped (string, text, len, newlines);
+}
+
+void
+empathy_string_append_html (GString *string,
+			    const gchar *text,
+			    gssize len,
+			    EmpathyStringParseFlags flags)
+{
+	EmpathySmileyManager *smiley_manager = NULL;
+	gboolean newlines = (flags & EMPATHY_STRING_PARSE_NEWLINES) != 0;
+	GMatchInfo *match_info = NULL;
+	GRegex *uri_regex = NULL;
+	gint last = 0;
+
+	g_return_if_fail (string != NULL);
+	g_return_if_fail (text != NULL);
+
+	if (len < 0)
+		len = strlen (text);
+
+	if (flags & EMPATHY_STRING_PARSE_SMILEYS)
+		smiley_manager = empathy_smiley_manager_dup_singleton ();
+
+	if (flags & EMPATHY_STRING_PARSE_LINKS)
+		uri_regex = uri_regex_dup_singleton ();
+
+	/* Links are found in one match over the whole text; smileys and
+	 * newlines in the text between them as it's appended */
+	if (uri_regex != NULL &&
+	    g_regex_match_full (uri_regex, text, len, 0, 0, &match_info, NULL)) {
+		gint s = 0, e = 0;
+
+		do {
+			g_match_info_fetch_pos (match_info, 0, &s, &e);
+
+			string_append_text (string, text + last, s - last,
+					    smiley_manager, newlines);
+			string_append_link (string, text + s, e - s);
+
+			last = e;
+		} while (g_match_info_next (match_info, NULL));
+	}
+
+	string_append_text (string, text + last, len - last,
+			    smiley_manager, newlines);
+
+	if (match_info != NULL)
+		g_match_info_free (match_info);
+	if (uri_regex != NULL)
+		g_regex_unref (uri_regex);
+	if (smiley_manager != NULL)
+		g_object_unref (smiley_manager);
+}
+
 gchar *
 empathy_add_link_markup (const gchar *text)
 {
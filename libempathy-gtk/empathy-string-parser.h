@@ -82,6 +82,20 @@ empathy_string_replace_escaped (const gchar *text,
 				gpointer match_data,
 				gpointer user_data);
 
+typedef enum {
+	EMPATHY_STRING_PARSE_LINKS = 1 << 0,
+	EMPATHY_STRING_PARSE_SMILEYS = 1 << 1,
+	EMPATHY_STRING_PARSE_NEWLINES = 1 << 2,
+} EmpathyStringParseFlags;
+
+/* Same as the chain link, smiley, newline and escape parsers, but in a
+ * single pass, appending directly to @string */
+void
+empathy_string_append_html (GString *string,
+			    const gchar *text,
+			    gssize len,
+			    EmpathyStringParseFlags flags);
+
 /* Returns a new string with <a> html tag around links, and escape the rest.
  * To be used with gtk_label_set_markup() for example */
 gchar *
@@ -49,6 +49,26 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Default maximum number of queued items rendered per main loop
+ * iteration, see the flush-budget property */
+#define DEFAULT_FLUSH_BUDGET 100
+
+/* Our equivalent of the appendMessage() javascript function, inserting the
+ * message above all the others. Custom templates don't define it so it is
+ * passed inline. Insertion points are dropped so consecutive messages keep
+ * being appended at the bottom. */
+#define PREPEND_MESSAGE_FUNC \
+  "(function (html) {" \
+  "  var chat = document.getElementById(\"Chat\");" \
+  "  var range = document.createRange();" \
+  "  range.selectNode(chat);" \
+  "  var fragment = range.createContextualFragment(html);" \
+  "  var inserts = fragment.querySelectorAll(\"#insert\");" \
+  "  for (var i = 0; i < inserts.length; i++)" \
+  "    inserts[i].parentNode.removeChild(inserts[i]);" \
+  "  chat.insertBefore(fragment, chat.firstChild);" \
+  "})"
+
 struct _EmpathyThemeAdiumPriv
 {
   EmpathyAdiumData *data;
@@ -59,9 +79,30 @@ struct _EmpathyThemeAdiumPriv
   guint pages_loading;
   /* Queue of QueuedItem*s containing an EmpathyMessage or string */
   GQueue message_queue;
+  /* Idle source rendering message_queue, flush_budget items at a time */
+  guint flush_id;
+  guint flush_budget;
+  /* Javascript calls accumulated while flushing message_queue, executed
+   * in one go by theme_adium_execute_batch() */
+  GString *batch;
+
+  /* Queue of RenderedBlock*s, one per top level node of the Chat element,
+   * oldest first */
+  GQueue rendered_blocks;
+  /* Number of messages in rendered_blocks */
+  guint n_rendered;
+  /* Number of text messages removed from the DOM since the last clear.
+   * Events aren't counted as they can't be reloaded from the logs. */
+  guint n_pruned;
+  /* Maximum number of messages kept in the DOM, 0 for no limit */
+  guint scrollback_limit;
   /* Queue of guint32 of pending message id to remove unread
    * marker for when we lose focus. */
   GQueue acked_messages;
+  /* Queue of guint32 of pending message id acknowledged while the view
+   * didn't have focus, but not rendered yet because a page is loading.
+   * Their unread marker is removed once they are flushed. */
+  GQueue unflushed_acks;
   GtkWidget *inspector_window;
 
   GSettings *gsettings_chat;
@@ -73,6 +114,9 @@ struct _EmpathyThemeAdiumPriv
   gchar *variant;
   gboolean in_construction;
   gboolean show_avatars;
+  /* EmpathyContact -> owned gchar* src of the default avatar shown in its
+   * messages until its own avatar is loaded */
+  GHashTable *pending_avatars;
 };
 
 struct _EmpathyAdiumData
@@ -106,8 +150,41 @@ struct _EmpathyAdiumData
    * We do this because of fallbacks, some htmls could be pointing the
    * same string. */
   GPtrArray *strings_to_free;
+
+  /* const gchar *html -> owned GArray of AdiumTemplatePart, compiled
+   * once when loading the theme. Keyed by pointer since fallbacks share
+   * strings. */
+  GHashTable *templates;
 };
 
+/* Keywords of the Adium message templates. See
+ * http://trac.adium.im/wiki/CreatingMessageStyles */
+typedef enum
+{
+  ADIUM_KEYWORD_LITERAL,
+  ADIUM_KEYWORD_USER_ICON_PATH,
+  ADIUM_KEYWORD_SENDER_SCREEN_NAME,
+  ADIUM_KEYWORD_SENDER,
+  ADIUM_KEYWORD_SENDER_COLOR,
+  ADIUM_KEYWORD_SENDER_DISPLAY_NAME,
+  ADIUM_KEYWORD_MESSAGE,
+  ADIUM_KEYWORD_TIME,
+  ADIUM_KEYWORD_SHORT_TIME,
+  ADIUM_KEYWORD_SERVICE,
+  ADIUM_KEYWORD_USER_ICONS,
+  ADIUM_KEYWORD_MESSAGE_CLASSES,
+  /* Keywords we don't support yet, they are just stripped */
+  ADIUM_KEYWORD_UNSUPPORTED,
+} AdiumKeyword;
+
+typedef struct
+{
+  AdiumKeyword keyword;
+  /* ADIUM_KEYWORD_LITERAL: the text, already escaped for javascript.
+   * ADIUM_KEYWORD_TIME: the strftime format, or NULL for the default. */
+  gchar *str;
+} AdiumTemplatePart;
+
 static gchar * adium_info_dup_path_for_variant (GHashTable *info,
     const gchar *variant);
 
@@ -116,6 +193,7 @@ enum
   PROP_0,
   PROP_ADIUM_DATA,
   PROP_VARIANT,
+  PROP_FLUSH_BUDGET,
 };
 
 G_DEFINE_TYPE (EmpathyThemeAdium, empathy_theme_adium,
@@ -124,8 +202,14 @@ G_DEFINE_TYPE (EmpathyThemeAdium, empathy_theme_adium,
 enum
 {
   QUEUED_EVENT,
+  QUEUED_EVENT_MARKUP,
   QUEUED_MESSAGE,
-  QUEUED_EDIT
+  QUEUED_PREPEND,
+  QUEUED_EDIT,
+  /* Changes of the scrolling mode, and requests to scroll to the bottom,
+   * apply to what was queued before them */
+  QUEUED_SCROLL,
+  QUEUED_SCROLL_DOWN
 };
 
 typedef struct
@@ -134,8 +218,23 @@ typedef struct
   EmpathyMessage *msg;
   char *str;
   gboolean should_highlight;
+  /* QUEUED_SCROLL only */
+  gboolean allow_scrolling;
 } QueuedItem;
 
+typedef struct
+{
+  /* Timestamp of the first message of the block */
+  gint64 timestamp;
+  guint n_messages;
+  /* Number of text messages among n_messages, the others are events */
+  guint n_text;
+  /* Reffed EmpathyMessage*s of the block sent at timestamp, so the
+   * messages sharing the oldest second can be told apart when reloading
+   * what precedes them */
+  GList *messages;
+} RenderedBlock;
+
 static QueuedItem *
 queue_item (GQueue *queue,
     guint type,
@@ -179,6 +278,16 @@ theme_adium_update_enable_webkit_developer_tools (EmpathyThemeAdium *self)
       "enable-developer-extras", enable_webkit_developer_tools, NULL);
 }
 
+static void
+theme_adium_notify_scrollback_limit_cb (GSettings *gsettings,
+    const gchar *key,
+    gpointer user_data)
+{
+  EmpathyThemeAdium *self = user_data;
+
+  self->priv->scrollback_limit = g_settings_get_uint (gsettings, key);
+}
+
 static void
 theme_adium_notify_enable_webkit_developer_tools_cb (GSettings *gsettings,
     const gchar *key,
@@ -273,13 +382,15 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
   const gchar *text,
   const gchar *token)
 {
-  EmpathyStringParser *parsers;
+  EmpathyStringParseFlags flags;
   GString *string;
 
+  flags = EMPATHY_STRING_PARSE_LINKS | EMPATHY_STRING_PARSE_NEWLINES;
+
   /* Check if we have to parse smileys */
-  parsers = empathy_webkit_get_string_parser (
-    g_settings_get_boolean (self->priv->gsettings_chat,
-      EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
+  if (g_settings_get_boolean (self->priv->gsettings_chat,
+        EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+    flags |= EMPATHY_STRING_PARSE_SMILEYS;
 
   /* Parse text and construct string with links and smileys replaced
    * by html tags. Also escape text to make sure html code is
@@ -293,7 +404,7 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
       "<span id=\"message-token-%s\">",
       token);
 
-  empathy_string_parser_substr (text, -1, parsers, string);
+  empathy_string_append_html (string, text, -1, flags);
 
   if (!tp_str_empty (token))
     g_string_append (string, "</span>");
@@ -334,47 +445,6 @@ escape_and_append_len (GString *string, const gchar *str, gint len)
     }
 }
 
-/* If *str starts with match, returns TRUE and move pointer to the end */
-static gboolean
-theme_adium_match (const gchar **str,
-    const gchar *match)
-{
-  gint len;
-
-  len = strlen (match);
-  if (strncmp (*str, match, len) == 0)
-    {
-      *str += len - 1;
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-/* Like theme_adium_match() but also return the X part if match is
- * like %foo{X}% */
-static gboolean
-theme_adium_match_with_format (const gchar **str,
-    const gchar *match,
-    gchar **format)
-{
-  const gchar *cur = *str;
-  const gchar *end;
-
-  if (!theme_adium_match (&cur, match))
-    return FALSE;
-
-  cur++;
-
-  end = strstr (cur, "}%");
-  if (!end)
-    return FALSE;
-
-  *format = g_strndup (cur , end - cur);
-  *str = end + 1;
-  return TRUE;
-}
-
 /* List of colors used by %senderColor%. Copied from
  * adium/Frameworks/AIUtilities\ Framework/Source/AIColorAdditions.m
  */
@@ -544,6 +614,178 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 }
 
 
+static void
+adium_template_part_clear (AdiumTemplatePart *part)
+{
+  g_free (part->str);
+}
+
+static void
+adium_template_add_literal (GArray *template,
+    const gchar *str,
+    gint len)
+{
+  AdiumTemplatePart *last = NULL;
+  GString *string;
+
+  if (len == 0)
+    return;
+
+  /* Merge with the previous literal, if any */
+  if (template->len > 0)
+    last = &g_array_index (template, AdiumTemplatePart, template->len - 1);
+
+  if (last != NULL && last->keyword == ADIUM_KEYWORD_LITERAL)
+    {
+      string = g_string_new (last->str);
+      g_free (last->str);
+    }
+  else
+    {
+      AdiumTemplatePart part = { ADIUM_KEYWORD_LITERAL, NULL };
+
+      g_array_append_val (template, part);
+      last = &g_array_index (template, AdiumTemplatePart, template->len - 1);
+      string = g_string_sized_new (len);
+    }
+
+  escape_and_append_len (string, str, len);
+  last->str = g_string_free (string, FALSE);
+}
+
+/* Split an html template into literal spans and keywords so messages can
+ * be rendered without scanning the template again */
+static GArray *
+adium_template_compile (EmpathyAdiumData *data,
+    const gchar *html)
+{
+  /* Those are all well known keywords that needs replacement in
+   * html files. Please keep them in the same order than the adium
+   * spec. Keywords ending with '{' take a format like %foo{X}% */
+  static const struct {
+    const gchar *match;
+    AdiumKeyword keyword;
+  } keywords[] = {
+    { "%userIconPath%", ADIUM_KEYWORD_USER_ICON_PATH },
+    { "%senderScreenName%", ADIUM_KEYWORD_SENDER_SCREEN_NAME },
+    { "%sender%", ADIUM_KEYWORD_SENDER },
+    /* FIXME: If a colon separated list of HTML colors is at
+     * Incoming/SenderColors.txt it will be used instead of
+     * the default colors. */
+    { "%senderColor%", ADIUM_KEYWORD_SENDER_COLOR },
+    /* FIXME: The path to the status icon of the sender
+     * (available, away, etc...) */
+    { "%senderStatusIcon%", ADIUM_KEYWORD_UNSUPPORTED },
+    /* FIXME: The text direction of the message (either rtl or ltr) */
+    { "%messageDirection%", ADIUM_KEYWORD_UNSUPPORTED },
+    /* FIXME: The serverside (remotely set) name of the sender, such as
+     * an MSN display name. We don't have access to that yet so we use
+     * local alias instead. */
+    { "%senderDisplayName%", ADIUM_KEYWORD_SENDER_DISPLAY_NAME },
+    /* FIXME: If we supported IRC user mode flags, this would be
+     * replaced with @ if the user is an op, + if the user has voice,
+     * etc. as per http://hg.adium.im/adium/rev/b586b027de42. But we
+     * don't, so for now we just strip it. */
+    { "%senderPrefix%", ADIUM_KEYWORD_UNSUPPORTED },
+    /* FIXME: This keyword is used to represent the highlight background
+     * color. "X" is the opacity of the background, ranges from 0 to 1
+     * and can be any decimal between. */
+    { "%textbackgroundcolor{", ADIUM_KEYWORD_UNSUPPORTED },
+    { "%message%", ADIUM_KEYWORD_MESSAGE },
+    { "%time%", ADIUM_KEYWORD_TIME },
+    { "%time{", ADIUM_KEYWORD_TIME },
+    { "%shortTime%", ADIUM_KEYWORD_SHORT_TIME },
+    { "%service%", ADIUM_KEYWORD_SERVICE },
+    /* FIXME: The name of the active message style variant, with all
+     * spaces replaced with an underscore. A variant named "Alternating
+     * Messages - Blue Red" will become "Alternating_Messages_-_Blue_Red".
+     */
+    { "%variant%", ADIUM_KEYWORD_UNSUPPORTED },
+    { "%userIcons%", ADIUM_KEYWORD_USER_ICONS },
+    { "%messageClasses%", ADIUM_KEYWORD_MESSAGE_CLASSES },
+    /* FIXME: A description of the status event. This is neither in the
+     * user's local language nor expected to be displayed; it may be
+     * useful to use a different div class to present different types of
+     * status messages. See the adium spec for a list of them. */
+    { "%status%", ADIUM_KEYWORD_UNSUPPORTED },
+  };
+  GArray *template;
+  const gchar *literal;
+  const gchar *cur;
+
+  template = g_array_new (FALSE, FALSE, sizeof (AdiumTemplatePart));
+  g_array_set_clear_func (template, (GDestroyNotify) adium_template_part_clear);
+
+  literal = html;
+  for (cur = html; *cur != '\0'; cur++)
+    {
+      AdiumTemplatePart part = { ADIUM_KEYWORD_LITERAL, NULL };
+      const gchar *end = NULL;
+      guint i;
+
+      if (*cur != '%')
+        continue;
+
+      for (i = 0; i < G_N_ELEMENTS (keywords); i++)
+        {
+          gsize len = strlen (keywords[i].match);
+
+          if (strncmp (cur, keywords[i].match, len) != 0)
+            continue;
+
+          if (!g_str_has_suffix (keywords[i].match, "{"))
+            {
+              end = cur + len;
+              break;
+            }
+
+          /* Keyword with a format */
+          end = strstr (cur + len, "}%");
+          if (end == NULL)
+            continue;
+
+          if (keywords[i].keyword == ADIUM_KEYWORD_TIME)
+            {
+              gchar *format;
+
+              format = g_strndup (cur + len, end - cur - len);
+              part.str = g_strdup (nsdate_to_strftime (data, format));
+              g_free (format);
+            }
+
+          end += 2;
+          break;
+        }
+
+      if (i == G_N_ELEMENTS (keywords))
+        continue;
+
+      adium_template_add_literal (template, literal, cur - literal);
+
+      part.keyword = keywords[i].keyword;
+      if (part.keyword != ADIUM_KEYWORD_UNSUPPORTED)
+        g_array_append_val (template, part);
+
+      literal = end;
+      cur = end - 1;
+    }
+
+  adium_template_add_literal (template, literal, cur - literal);
+
+  return template;
+}
+
+static void
+adium_data_compile_template (EmpathyAdiumData *data,
+    const gchar *html)
+{
+  if (html == NULL || g_hash_table_lookup (data->templates, html) != NULL)
+    return;
+
+  g_hash_table_insert (data->templates, (gpointer) html,
+      adium_template_compile (data, html));
+}
+
 static void
 theme_adium_append_html (EmpathyThemeAdium *self,
     const gchar *func,
@@ -558,196 +800,269 @@ theme_adium_append_html (EmpathyThemeAdium *self,
     gboolean is_backlog,
     gboolean outgoing)
 {
-  GString *string;
-  const gchar *cur = NULL;
-  gchar *script;
+  GString *string = self->priv->batch;
+  GArray *template;
+  guint i;
+
+  template = g_hash_table_lookup (self->priv->data->templates, html);
+  g_return_if_fail (template != NULL);
 
-  /* Make some search-and-replace in the html code */
-  string = g_string_sized_new (strlen (html) + strlen (message));
   g_string_append_printf (string, "%s(\"", func);
 
-  for (cur = html; *cur != '\0'; cur++)
+  for (i = 0; i < template->len; i++)
     {
+      AdiumTemplatePart *part = &g_array_index (template,
+          AdiumTemplatePart, i);
       const gchar *replace = NULL;
       gchar *dup_replace = NULL;
-      gchar *format = NULL;
 
-      /* Those are all well known keywords that needs replacement in
-       * html files. Please keep them in the same order than the adium
-       * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
-      if (theme_adium_match (&cur, "%userIconPath%"))
-        {
-          replace = avatar_filename;
-        }
-      else if (theme_adium_match (&cur, "%senderScreenName%"))
-        {
-          replace = contact_id;
-        }
-      else if (theme_adium_match (&cur, "%sender%"))
-        {
-          replace = name;
-        }
-      else if (theme_adium_match (&cur, "%senderColor%"))
-        {
-          /* A color derived from the user's name.
-           * FIXME: If a colon separated list of HTML colors is at
-           * Incoming/SenderColors.txt it will be used instead of
-           * the default colors.
-           */
-
-          /* Ensure we always use the same color when sending messages
-           * (bgo #658821) */
-          if (outgoing)
-            {
-              replace = "inherit";
-            }
-          else if (contact_id != NULL)
-            {
-              guint hash = g_str_hash (contact_id);
-              replace = colors[hash % G_N_ELEMENTS (colors)];
-            }
-        }
-      else if (theme_adium_match (&cur, "%senderStatusIcon%"))
-        {
-          /* FIXME: The path to the status icon of the sender
-           * (available, away, etc...)
-           */
-        }
-      else if (theme_adium_match (&cur, "%messageDirection%"))
-        {
-          /* FIXME: The text direction of the message
-           * (either rtl or ltr)
-           */
-        }
-      else if (theme_adium_match (&cur, "%senderDisplayName%"))
-        {
-          /* FIXME: The serverside (remotely set) name of the
-           * sender, such as an MSN display name.
-           *
-           *  We don't have access to that yet so we use
-           * local alias instead.
-           */
-          replace = name;
-        }
-      else if (theme_adium_match (&cur, "%senderPrefix%"))
-        {
-          /* FIXME: If we supported IRC user mode flags, this
-           * would be replaced with @ if the user is an op, + if
-           * the user has voice, etc. as per
-           * http://hg.adium.im/adium/rev/b586b027de42. But we
-           * don't, so for now we just strip it. */
-        }
-      else if (theme_adium_match_with_format (&cur, "%textbackgroundcolor{",
-            &format))
-        {
-          /* FIXME: This keyword is used to represent the
-           * highlight background color. "X" is the opacity of the
-           * background, ranges from 0 to 1 and can be any decimal
-           * between.
-           */
-        }
-      else if (theme_adium_match (&cur, "%message%"))
-        {
-          replace = message;
-        }
-      else if (theme_adium_match (&cur, "%time%") ||
-           theme_adium_match_with_format (&cur, "%time{", &format))
+      switch (part->keyword)
         {
-          const gchar *strftime_format;
+          case ADIUM_KEYWORD_LITERAL:
+            /* Already escaped */
+            g_string_append (string, part->str);
+            continue;
 
-          strftime_format = nsdate_to_strftime (self->priv->data, format);
-          if (is_backlog)
-            dup_replace = empathy_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
-          else
+          case ADIUM_KEYWORD_USER_ICON_PATH:
+            replace = avatar_filename;
+            break;
+
+          case ADIUM_KEYWORD_SENDER_SCREEN_NAME:
+            replace = contact_id;
+            break;
+
+          case ADIUM_KEYWORD_SENDER:
+          case ADIUM_KEYWORD_SENDER_DISPLAY_NAME:
+            replace = name;
+            break;
+
+          case ADIUM_KEYWORD_SENDER_COLOR:
+            /* A color derived from the user's name. Ensure we always use
+             * the same color when sending messages (bgo #658821) */
+            if (outgoing)
+              {
+                replace = "inherit";
+              }
+            else if (contact_id != NULL)
+              {
+                guint hash = g_str_hash (contact_id);
+                replace = colors[hash % G_N_ELEMENTS (colors)];
+              }
+            break;
+
+          case ADIUM_KEYWORD_MESSAGE:
+            replace = message;
+            break;
+
+          case ADIUM_KEYWORD_TIME:
+            if (is_backlog)
+              dup_replace = empathy_time_to_string_local (timestamp,
+                part->str ? part->str :
+                EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
+            else
+              dup_replace = empathy_time_to_string_local (timestamp,
+                part->str ? part->str :
+                EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+
+            replace = dup_replace;
+            break;
+
+          case ADIUM_KEYWORD_SHORT_TIME:
             dup_replace = empathy_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
               EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+            replace = dup_replace;
+            break;
 
-          replace = dup_replace;
-        }
-      else if (theme_adium_match (&cur, "%shortTime%"))
-        {
-          dup_replace = empathy_time_to_string_local (timestamp,
-            EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-          replace = dup_replace;
-        }
-      else if (theme_adium_match (&cur, "%service%"))
-        {
-          replace = service_name;
-        }
-      else if (theme_adium_match (&cur, "%variant%"))
-        {
-          /* FIXME: The name of the active message style variant,
-           * with all spaces replaced with an underscore.
-           * A variant named "Alternating Messages - Blue Red"
-           * will become "Alternating_Messages_-_Blue_Red".
-           */
-        }
-      else if (theme_adium_match (&cur, "%userIcons%"))
-        {
-          replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
-        }
-      else if (theme_adium_match (&cur, "%messageClasses%"))
-        {
-          replace = message_classes;
-        }
-      else if (theme_adium_match (&cur, "%status%"))
-        {
-          /* FIXME: A description of the status event. This is
-           * neither in the user's local language nor expected to
-           * be displayed; it may be useful to use a different div
-           * class to present different types of status messages.
-           * The following is a list of some of the more important
-           * status messages; your message style should be able to
-           * handle being shown a status message not in this list,
-           * as even at present the list is incomplete and is
-           * certain to become out of date in the future:
-           *  online
-           *  offline
-           *  away
-           *  away_message
-           *  return_away
-           *  idle
-           *  return_idle
-           *  date_separator
-           *  contact_joined (group chats)
-           *  contact_left
-           *  error
-           *  timed_out
-           *  encryption (all OTR messages use this status)
-           *  purple (all IRC topic and join/part messages use this status)
-           *  fileTransferStarted
-           *  fileTransferCompleted
-           */
-        }
-      else
-        {
-          escape_and_append_len (string, cur, 1);
-          continue;
+          case ADIUM_KEYWORD_SERVICE:
+            replace = service_name;
+            break;
+
+          case ADIUM_KEYWORD_USER_ICONS:
+            replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
+            break;
+
+          case ADIUM_KEYWORD_MESSAGE_CLASSES:
+            replace = message_classes;
+            break;
+
+          case ADIUM_KEYWORD_UNSUPPORTED:
+            break;
         }
 
       /* Here we have a replacement to make */
       escape_and_append_len (string, replace, -1);
 
       g_free (dup_replace);
-      g_free (format);
     }
-  g_string_append (string, "\")");
+  g_string_append (string, "\");");
+}
 
-  script = g_string_free (string, FALSE);
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self), script);
-  g_free (script);
+/* Run all the javascript calls accumulated by theme_adium_append_html()
+ * since the last call. */
+static void
+theme_adium_execute_batch (EmpathyThemeAdium *self)
+{
+  if (self->priv->batch->len == 0)
+    return;
+
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self),
+      self->priv->batch->str);
+  g_string_truncate (self->priv->batch, 0);
+}
+
+/* Keep track of the top level node created by rendering a message, so
+ * theme_adium_prune_scrollback() knows which ones it removes */
+static void
+theme_adium_track_block (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gint64 timestamp,
+    gboolean consecutive,
+    gboolean prepend)
+{
+  RenderedBlock *block;
+
+  self->priv->n_rendered++;
+
+  block = g_queue_peek_tail (&self->priv->rendered_blocks);
+  if (consecutive && block != NULL)
+    {
+      block->n_messages++;
+      if (msg != NULL)
+        block->n_text++;
+
+      if (msg != NULL && timestamp == block->timestamp)
+        block->messages = g_list_prepend (block->messages,
+            g_object_ref (msg));
+
+      return;
+    }
+
+  block = g_slice_new0 (RenderedBlock);
+  block->timestamp = timestamp;
+  block->n_messages = 1;
+
+  if (msg != NULL)
+    {
+      block->n_text = 1;
+      block->messages = g_list_prepend (NULL, g_object_ref (msg));
+    }
+
+  if (prepend)
+    g_queue_push_head (&self->priv->rendered_blocks, block);
+  else
+    g_queue_push_tail (&self->priv->rendered_blocks, block);
+}
+
+static void
+free_rendered_block (RenderedBlock *block)
+{
+  g_list_free_full (block->messages, g_object_unref);
+  g_slice_free (RenderedBlock, block);
+}
+
+static void
+theme_adium_forget_blocks (EmpathyThemeAdium *self)
+{
+  g_queue_foreach (&self->priv->rendered_blocks,
+      (GFunc) free_rendered_block, NULL);
+  g_queue_clear (&self->priv->rendered_blocks);
+  self->priv->n_rendered = 0;
+  self->priv->n_pruned = 0;
+}
+
+static void
+theme_adium_contact_avatar_cb (EmpathyContact *contact,
+    GParamSpec *spec,
+    EmpathyThemeAdium *self)
+{
+  EmpathyAvatar *avatar;
+  const gchar *placeholder;
+  WebKitDOMDocument *dom;
+  WebKitDOMNodeList *nodes;
+  guint i;
+
+  avatar = empathy_contact_get_avatar (contact);
+  if (avatar == NULL || avatar->filename == NULL)
+    return;
+
+  placeholder = g_hash_table_lookup (self->priv->pending_avatars, contact);
+
+  /* Messages still in the batch have to be in the DOM to be updated */
+  theme_adium_execute_batch (self);
+
+  dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
+  nodes = dom != NULL ?
+    webkit_dom_document_get_elements_by_tag_name (dom, "img") : NULL;
+
+  for (i = 0; nodes != NULL && i < webkit_dom_node_list_get_length (nodes);
+       i++)
+    {
+      WebKitDOMElement *img = WEBKIT_DOM_ELEMENT (
+          webkit_dom_node_list_item (nodes, i));
+      gchar *src;
+
+      src = webkit_dom_element_get_attribute (img, "src");
+      if (!tp_strdiff (src, placeholder))
+        webkit_dom_element_set_attribute (img, "src", avatar->filename,
+            NULL);
+
+      g_free (src);
+    }
+
+  g_signal_handlers_disconnect_by_func (contact,
+      theme_adium_contact_avatar_cb, self);
+  g_hash_table_remove (self->priv->pending_avatars, contact);
+}
+
+/* Contacts are often rendered before their avatar is loaded. Their
+ * messages show the default avatar, under a src unique to the contact so
+ * they can be found and updated once their own avatar is there. */
+static const gchar *
+theme_adium_get_avatar_placeholder (EmpathyThemeAdium *self,
+    EmpathyContact *contact,
+    const gchar *default_filename)
+{
+  gchar *placeholder;
+
+  placeholder = g_hash_table_lookup (self->priv->pending_avatars, contact);
+  if (placeholder != NULL)
+    return placeholder;
+
+  /* The fragment is ignored when loading the file */
+  placeholder = g_strdup_printf ("%s#%p", default_filename, contact);
+  g_hash_table_insert (self->priv->pending_avatars, g_object_ref (contact),
+      placeholder);
+
+  g_signal_connect (contact, "notify::avatar",
+      G_CALLBACK (theme_adium_contact_avatar_cb), self);
+
+  return placeholder;
+}
+
+static void
+theme_adium_forget_pending_avatars (EmpathyThemeAdium *self)
+{
+  GHashTableIter iter;
+  gpointer contact;
+
+  g_hash_table_iter_init (&iter, self->priv->pending_avatars);
+  while (g_hash_table_iter_next (&iter, &contact, NULL))
+    g_signal_handlers_disconnect_by_func (contact,
+        theme_adium_contact_avatar_cb, self);
+
+  g_hash_table_remove_all (self->priv->pending_avatars);
 }
 
 static void
 theme_adium_append_event_escaped (EmpathyThemeAdium *self,
     const gchar *escaped)
 {
+  gint64 timestamp = empathy_time_get_current ();
+
   theme_adium_append_html (self, "appendMessage",
       self->priv->data->status_html, escaped, NULL, NULL, NULL,
-      NULL, "event", empathy_time_get_current (), FALSE, FALSE);
+      NULL, "event", timestamp, FALSE, FALSE);
+  theme_adium_track_block (self, NULL, timestamp, FALSE, FALSE);
 
   /* There is no last contact */
   if (self->priv->last_contact)
@@ -813,6 +1128,9 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *self)
 
   self->priv->has_unread_message = FALSE;
 
+  /* Messages still in the batch have to be in the DOM to be unmarked */
+  theme_adium_execute_batch (self);
+
   dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
   if (dom == NULL)
     return;
@@ -831,10 +1149,13 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *self)
   theme_adium_remove_focus_marks (self, nodes);
 }
 
-void
-empathy_theme_adium_append_message (EmpathyThemeAdium *self,
+/* If prepend is TRUE the message is inserted above all the others and
+ * doesn't affect how the following ones are joined */
+static void
+theme_adium_render_message (EmpathyThemeAdium *self,
     EmpathyMessage *msg,
-    gboolean should_highlight)
+    gboolean should_highlight,
+    gboolean prepend)
 {
   EmpathyContact *sender;
   TpMessage *tp_msg;
@@ -853,13 +1174,6 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
   gboolean consecutive;
   gboolean action;
 
-  if (self->priv->pages_loading != 0)
-    {
-      queue_item (&self->priv->message_queue, QUEUED_MESSAGE, msg, NULL,
-          should_highlight);
-      return;
-    }
-
   /* Get information */
   sender = empathy_message_get_sender (msg);
   account = empathy_contact_get_account (sender);
@@ -919,6 +1233,9 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
 
           avatar_filename = self->priv->data->default_avatar_filename;
         }
+
+      avatar_filename = theme_adium_get_avatar_placeholder (self, sender,
+          avatar_filename);
     }
 
   /* We want to join this message with the last one if
@@ -927,7 +1244,8 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
    * - last message and this message both are/aren't backlog, and
    * - DisableCombineConsecutive is not set in theme's settings */
   is_backlog = empathy_message_is_backlog (msg);
-  consecutive = empathy_contact_equal (self->priv->last_contact, sender) &&
+  consecutive = !prepend &&
+    empathy_contact_equal (self->priv->last_contact, sender) &&
     (timestamp - self->priv->last_timestamp < MESSAGE_JOIN_PERIOD) &&
     (is_backlog == self->priv->last_is_backlog) &&
     !tp_asv_get_boolean (self->priv->data->info,
@@ -935,7 +1253,7 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
 
   /* Define message classes */
   message_classes = g_string_new ("message");
-  if (!self->priv->has_focus && !is_backlog)
+  if (!self->priv->has_focus && !is_backlog && !prepend)
     {
       if (!self->priv->has_unread_message)
         {
@@ -991,7 +1309,9 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
     }
 
   /* Define javascript function to use */
-  if (consecutive)
+  if (prepend)
+    func = PREPEND_MESSAGE_FUNC;
+  else if (consecutive)
     func = self->priv->allow_scrolling ? "appendNextMessage" :
       "appendNextMessageNoScroll";
   else
@@ -1010,7 +1330,8 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
           self->priv->data->out_content_html;
 
       /* remove all the unread marks when we are sending a message */
-      theme_adium_remove_all_focus_marks (self);
+      if (!prepend)
+        theme_adium_remove_all_focus_marks (self);
     }
   else
     {
@@ -1029,47 +1350,37 @@ empathy_theme_adium_append_message (EmpathyThemeAdium *self,
       avatar_filename, name_escaped, contact_id,
       service_name, message_classes->str,
       timestamp, is_backlog, empathy_contact_is_user (sender));
+  theme_adium_track_block (self, msg, timestamp, consecutive, prepend);
 
-  /* Keep the sender of the last displayed message */
-  if (self->priv->last_contact)
-    g_object_unref (self->priv->last_contact);
+  if (!prepend)
+    {
+      /* Keep the sender of the last displayed message */
+      if (self->priv->last_contact)
+        g_object_unref (self->priv->last_contact);
 
-  self->priv->last_contact = g_object_ref (sender);
-  self->priv->last_timestamp = timestamp;
-  self->priv->last_is_backlog = is_backlog;
+      self->priv->last_contact = g_object_ref (sender);
+      self->priv->last_timestamp = timestamp;
+      self->priv->last_is_backlog = is_backlog;
+    }
 
   g_free (body_escaped);
   g_free (name_escaped);
   g_string_free (message_classes, TRUE);
 }
 
-void
-empathy_theme_adium_append_event (EmpathyThemeAdium *self,
+static void
+theme_adium_render_event (EmpathyThemeAdium *self,
     const gchar *str)
 {
   gchar *str_escaped;
 
-  if (self->priv->pages_loading != 0)
-    {
-      queue_item (&self->priv->message_queue, QUEUED_EVENT, NULL, str, FALSE);
-      return;
-    }
-
   str_escaped = g_markup_escape_text (str, -1);
   theme_adium_append_event_escaped (self, str_escaped);
   g_free (str_escaped);
 }
 
-void
-empathy_theme_adium_append_event_markup (EmpathyThemeAdium *self,
-    const gchar *markup_text,
-    const gchar *fallback_text)
-{
-  theme_adium_append_event_escaped (self, markup_text);
-}
-
-void
-empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
+static void
+theme_adium_render_edit (EmpathyThemeAdium *self,
     EmpathyMessage *message)
 {
   WebKitDOMDocument *doc;
@@ -1079,11 +1390,8 @@ empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
   GtkIconInfo *icon_info;
   GError *error = NULL;
 
-  if (self->priv->pages_loading != 0)
-    {
-      queue_item (&self->priv->message_queue, QUEUED_EDIT, message, NULL, FALSE);
-      return;
-    }
+  /* The message being edited could still be in the batch */
+  theme_adium_execute_batch (self);
 
   id = g_strdup_printf ("message-token-%s",
     empathy_message_get_supersedes (message));
@@ -1171,10 +1479,377 @@ finally:
   g_free (parsed_body);
 }
 
+static gboolean
+theme_adium_is_scrolled_to_bottom (EmpathyThemeAdium *self)
+{
+  GtkAdjustment *adj;
+
+  adj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self));
+  if (adj == NULL)
+    return TRUE;
+
+  return gtk_adjustment_get_value (adj) + gtk_adjustment_get_page_size (adj)
+    >= gtk_adjustment_get_upper (adj) - 1;
+}
+
+/* Drop element's pending message id from acked_messages, as there is no
+ * unread marker to remove anymore. Returns TRUE if the element was marked
+ * as unread. */
+static gboolean
+theme_adium_forget_element (EmpathyThemeAdium *self,
+    WebKitDOMElement *element)
+{
+  gchar *class_name;
+  gchar **classes, **iter;
+  gboolean focus = FALSE;
+
+  if (!WEBKIT_DOM_IS_HTML_ELEMENT (element))
+    return FALSE;
+
+  class_name = webkit_dom_html_element_get_class_name (
+      WEBKIT_DOM_HTML_ELEMENT (element));
+  if (class_name == NULL)
+    return FALSE;
+
+  classes = g_strsplit (class_name, " ", -1);
+  for (iter = classes; *iter != NULL; iter++)
+    {
+      if (!tp_strdiff (*iter, "focus"))
+        {
+          focus = TRUE;
+        }
+      else if (g_str_has_prefix (*iter, "x-empathy-message-id-"))
+        {
+          guint32 id = g_ascii_strtoull (
+              *iter + strlen ("x-empathy-message-id-"), NULL, 10);
+
+          g_queue_remove (&self->priv->acked_messages, GUINT_TO_POINTER (id));
+        }
+    }
+
+  g_strfreev (classes);
+  g_free (class_name);
+
+  return focus;
+}
+
+/* Remove the oldest messages from the DOM until we are back under
+ * scrollback_limit. This is only done while the view is scrolled to the
+ * bottom, so we don't remove what the user is reading or what has just
+ * been reloaded from the logs. */
+static void
+theme_adium_prune_scrollback (EmpathyThemeAdium *self)
+{
+  WebKitDOMDocument *dom;
+  WebKitDOMElement *chat;
+  gboolean removed_focus = FALSE;
+
+  if (self->priv->scrollback_limit == 0 ||
+      self->priv->n_rendered <= self->priv->scrollback_limit)
+    return;
+
+  if (!theme_adium_is_scrolled_to_bottom (self))
+    return;
+
+  dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
+  if (dom == NULL)
+    return;
+
+  chat = webkit_dom_document_get_element_by_id (dom, "Chat");
+  if (chat == NULL)
+    return;
+
+  /* Never remove the last block, it holds the insertion point */
+  while (self->priv->n_rendered > self->priv->scrollback_limit &&
+      self->priv->rendered_blocks.length > 1)
+    {
+      WebKitDOMElement *first;
+      WebKitDOMNodeList *nodes;
+      RenderedBlock *block;
+      GError *error = NULL;
+      guint i;
+
+      first = webkit_dom_element_get_first_element_child (chat);
+      if (first == NULL)
+        break;
+
+      removed_focus |= theme_adium_forget_element (self, first);
+
+      nodes = webkit_dom_element_query_selector_all (first,
+          "[class*=\"x-empathy-message-id-\"], .focus", NULL);
+      for (i = 0; nodes != NULL && i < webkit_dom_node_list_get_length (nodes);
+           i++)
+        {
+          WebKitDOMNode *node = webkit_dom_node_list_item (nodes, i);
+
+          removed_focus |= theme_adium_forget_element (self,
+              WEBKIT_DOM_ELEMENT (node));
+        }
+
+      webkit_dom_node_remove_child (WEBKIT_DOM_NODE (chat),
+          WEBKIT_DOM_NODE (first), &error);
+      if (error != NULL)
+        {
+          DEBUG ("Failed to remove old message: %s", error->message);
+          g_error_free (error);
+          break;
+        }
+
+      block = g_queue_pop_head (&self->priv->rendered_blocks);
+      self->priv->n_rendered -= block->n_messages;
+      self->priv->n_pruned += block->n_text;
+      free_rendered_block (block);
+    }
+
+  /* If the unread messages are all gone, next one is the first again */
+  if (removed_focus && self->priv->has_unread_message)
+    {
+      WebKitDOMNodeList *nodes;
+
+      nodes = webkit_dom_document_query_selector_all (dom, ".focus", NULL);
+      if (nodes == NULL || webkit_dom_node_list_get_length (nodes) == 0)
+        self->priv->has_unread_message = FALSE;
+    }
+}
+
+static void theme_adium_remove_mark_from_message (EmpathyThemeAdium *self,
+    guint32 id);
+
+/* Render up to budget items of the message queue, 0 meaning all of them,
+ * executing all the resulting javascript in a single call. Returns TRUE if
+ * some items are left in the queue. */
+static gboolean
+theme_adium_flush_queue (EmpathyThemeAdium *self,
+    guint budget)
+{
+  guint n = 0;
+  gboolean scroll_down = FALSE;
+
+  while (!g_queue_is_empty (&self->priv->message_queue))
+    {
+      QueuedItem *item;
+
+      if (budget != 0 && n >= budget)
+        break;
+
+      item = g_queue_pop_head (&self->priv->message_queue);
+
+      switch (item->type)
+        {
+          case QUEUED_MESSAGE:
+            theme_adium_render_message (self, item->msg,
+              item->should_highlight, FALSE);
+            break;
+
+          case QUEUED_PREPEND:
+            theme_adium_render_message (self, item->msg,
+              item->should_highlight, TRUE);
+            if (self->priv->n_pruned > 0)
+              self->priv->n_pruned--;
+            break;
+
+          case QUEUED_EDIT:
+            theme_adium_render_edit (self, item->msg);
+            break;
+
+          case QUEUED_EVENT:
+            theme_adium_render_event (self, item->str);
+            break;
+
+          case QUEUED_EVENT_MARKUP:
+            theme_adium_append_event_escaped (self, item->str);
+            break;
+
+          case QUEUED_SCROLL:
+            self->priv->allow_scrolling = item->allow_scrolling;
+            scroll_down = item->allow_scrolling;
+            break;
+
+          case QUEUED_SCROLL_DOWN:
+            scroll_down = TRUE;
+            break;
+        }
+
+      free_queued_item (item);
+      n++;
+    }
+
+  theme_adium_execute_batch (self);
+  theme_adium_prune_scrollback (self);
+
+  if (scroll_down)
+    webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self),
+        "alignChat(true);");
+
+  if (!g_queue_is_empty (&self->priv->message_queue))
+    return TRUE;
+
+  while (!g_queue_is_empty (&self->priv->unflushed_acks))
+    theme_adium_remove_mark_from_message (self,
+        GPOINTER_TO_UINT (g_queue_pop_head (&self->priv->unflushed_acks)));
+
+  return FALSE;
+}
+
+static gboolean
+theme_adium_flush_queue_cb (gpointer user_data)
+{
+  EmpathyThemeAdium *self = user_data;
+
+  /* The page could have been reloaded since we were scheduled */
+  if (self->priv->pages_loading == 0 &&
+      theme_adium_flush_queue (self, self->priv->flush_budget))
+    return TRUE;
+
+  self->priv->flush_id = 0;
+  return FALSE;
+}
+
+/* Everything appended during one main loop iteration is rendered together
+ * from an idle callback. Its priority is lower than GTK+'s redraw one so
+ * the view keeps being repainted while a long backlog is flushed. */
+static void
+theme_adium_schedule_flush (EmpathyThemeAdium *self)
+{
+  if (self->priv->flush_id != 0 || self->priv->pages_loading != 0)
+    return;
+
+  self->priv->flush_id = g_idle_add (theme_adium_flush_queue_cb, self);
+}
+
+/* Render everything still queued right away. Operations depending on the
+ * DOM (acknowledging, looking up the oldest messages) call this first so
+ * they apply to the messages appended before them; scrolling is queued
+ * instead. Nothing can be
+ * rendered while a page is loading; the queue is flushed once it's done. */
+static void
+theme_adium_flush_now (EmpathyThemeAdium *self)
+{
+  if (self->priv->pages_loading != 0 ||
+      g_queue_is_empty (&self->priv->message_queue))
+    return;
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  theme_adium_flush_queue (self, 0);
+}
+
+void
+empathy_theme_adium_append_message (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gboolean should_highlight)
+{
+  queue_item (&self->priv->message_queue, QUEUED_MESSAGE, msg, NULL,
+      should_highlight);
+  theme_adium_schedule_flush (self);
+}
+
+void
+empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gboolean should_highlight)
+{
+  queue_item (&self->priv->message_queue, QUEUED_PREPEND, msg, NULL,
+      should_highlight);
+  theme_adium_schedule_flush (self);
+}
+
+void
+empathy_theme_adium_append_event (EmpathyThemeAdium *self,
+    const gchar *str)
+{
+  queue_item (&self->priv->message_queue, QUEUED_EVENT, NULL, str, FALSE);
+  theme_adium_schedule_flush (self);
+}
+
+void
+empathy_theme_adium_append_event_markup (EmpathyThemeAdium *self,
+    const gchar *markup_text,
+    const gchar *fallback_text)
+{
+  queue_item (&self->priv->message_queue, QUEUED_EVENT_MARKUP, NULL,
+      markup_text, FALSE);
+  theme_adium_schedule_flush (self);
+}
+
+void
+empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
+    EmpathyMessage *message)
+{
+  queue_item (&self->priv->message_queue, QUEUED_EDIT, message, NULL, FALSE);
+  theme_adium_schedule_flush (self);
+}
+
+guint
+empathy_theme_adium_get_n_pruned (EmpathyThemeAdium *self)
+{
+  return self->priv->n_pruned;
+}
+
+gint64
+empathy_theme_adium_get_oldest_timestamp (EmpathyThemeAdium *self)
+{
+  RenderedBlock *block;
+
+  /* Messages prepended but not rendered yet are older */
+  theme_adium_flush_now (self);
+
+  block = g_queue_peek_head (&self->priv->rendered_blocks);
+  if (block == NULL)
+    return G_MAXINT64;
+
+  return block->timestamp;
+}
+
+/* Returns the messages displayed with the timestamp returned by
+ * empathy_theme_adium_get_oldest_timestamp(). Free the list with
+ * g_list_free(), the messages are owned by the view. */
+GList *
+empathy_theme_adium_get_oldest_messages (EmpathyThemeAdium *self)
+{
+  GList *l, *messages = NULL;
+  RenderedBlock *first;
+
+  theme_adium_flush_now (self);
+
+  first = g_queue_peek_head (&self->priv->rendered_blocks);
+  if (first == NULL)
+    return NULL;
+
+  for (l = self->priv->rendered_blocks.head; l != NULL; l = l->next)
+    {
+      RenderedBlock *block = l->data;
+
+      if (block->timestamp != first->timestamp)
+        break;
+
+      messages = g_list_concat (g_list_copy (block->messages), messages);
+    }
+
+  return messages;
+}
+
 void
 empathy_theme_adium_scroll (EmpathyThemeAdium *self,
     gboolean allow_scrolling)
 {
+  QueuedItem *item;
+
+  /* What was appended so far has to be rendered in the current mode, so
+   * the change waits for it rather than rendering it all right away */
+  if (!g_queue_is_empty (&self->priv->message_queue))
+    {
+      item = queue_item (&self->priv->message_queue, QUEUED_SCROLL, NULL,
+          NULL, FALSE);
+      item->allow_scrolling = allow_scrolling;
+      theme_adium_schedule_flush (self);
+      return;
+    }
+
   self->priv->allow_scrolling = allow_scrolling;
 
   if (allow_scrolling)
@@ -1184,6 +1859,15 @@ empathy_theme_adium_scroll (EmpathyThemeAdium *self,
 void
 empathy_theme_adium_scroll_down (EmpathyThemeAdium *self)
 {
+  /* Scroll once the pending messages are rendered, a budget at a time */
+  if (!g_queue_is_empty (&self->priv->message_queue))
+    {
+      queue_item (&self->priv->message_queue, QUEUED_SCROLL_DOWN, NULL, NULL,
+          FALSE);
+      theme_adium_schedule_flush (self);
+      return;
+    }
+
   webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self), "alignChat(true);");
 }
 
@@ -1196,7 +1880,17 @@ empathy_theme_adium_get_has_selection (EmpathyThemeAdium *self)
 void
 empathy_theme_adium_clear (EmpathyThemeAdium *self)
 {
+  /* Items not rendered yet would be wiped by the reload anyway */
+  if (self->priv->pages_loading == 0)
+    {
+      g_queue_foreach (&self->priv->message_queue, (GFunc) free_queued_item,
+          NULL);
+      g_queue_clear (&self->priv->message_queue);
+    }
+
   theme_adium_load_template (self);
+  theme_adium_forget_blocks (self);
+  theme_adium_forget_pending_avatars (self);
 
   /* Clear last contact to avoid trying to add a 'joined'
    * message when we don't have an insertion point. */
@@ -1309,11 +2003,23 @@ empathy_theme_adium_focus_toggled (EmpathyThemeAdium *self,
   self->priv->has_focus = has_focus;
   if (!self->priv->has_focus)
     {
+      theme_adium_flush_now (self);
+
       /* We've lost focus, so let's make sure all the acked
-       * messages have lost their unread marker. */
-      g_queue_foreach (&self->priv->acked_messages,
-          theme_adium_remove_acked_message_unread_mark_foreach, self);
-      g_queue_clear (&self->priv->acked_messages);
+       * messages have lost their unread marker. If some can't be
+       * rendered yet, do it once they are. */
+      if (g_queue_is_empty (&self->priv->message_queue))
+        {
+          g_queue_foreach (&self->priv->acked_messages,
+              theme_adium_remove_acked_message_unread_mark_foreach, self);
+          g_queue_clear (&self->priv->acked_messages);
+        }
+      else
+        {
+          while (!g_queue_is_empty (&self->priv->acked_messages))
+            g_queue_push_tail (&self->priv->unflushed_acks,
+                g_queue_pop_head (&self->priv->acked_messages));
+        }
 
       self->priv->has_unread_message = FALSE;
     }
@@ -1350,6 +2056,15 @@ empathy_theme_adium_message_acknowledged (EmpathyThemeAdium *self,
       return;
     }
 
+  /* The message may still be waiting in the queue */
+  theme_adium_flush_now (self);
+
+  if (!g_queue_is_empty (&self->priv->message_queue))
+    {
+      g_queue_push_tail (&self->priv->unflushed_acks, GUINT_TO_POINTER (id));
+      return;
+    }
+
   theme_adium_remove_mark_from_message (self, id);
 }
 
@@ -1394,7 +2109,6 @@ theme_adium_load_finished_cb (WebKitWebView *view,
     gpointer user_data)
 {
   EmpathyThemeAdium *self = EMPATHY_THEME_ADIUM (view);
-  GList *l;
 
   DEBUG ("Page loaded");
   self->priv->pages_loading--;
@@ -1403,30 +2117,8 @@ theme_adium_load_finished_cb (WebKitWebView *view,
     return;
 
   /* Display queued messages */
-  for (l = self->priv->message_queue.head; l != NULL; l = l->next)
-    {
-      QueuedItem *item = l->data;
-
-      switch (item->type)
-        {
-          case QUEUED_MESSAGE:
-            empathy_theme_adium_append_message (self, item->msg,
-              item->should_highlight);
-            break;
-
-          case QUEUED_EDIT:
-            empathy_theme_adium_edit_message (self, item->msg);
-            break;
-
-          case QUEUED_EVENT:
-            empathy_theme_adium_append_event (self, item->str);
-            break;
-        }
-
-      free_queued_item (item);
-    }
-
-  g_queue_clear (&self->priv->message_queue);
+  if (!g_queue_is_empty (&self->priv->message_queue))
+    theme_adium_schedule_flush (self);
 }
 
 static void
@@ -1439,6 +2131,9 @@ theme_adium_finalize (GObject *object)
   g_object_unref (self->priv->gsettings_chat);
   g_object_unref (self->priv->gsettings_desktop);
 
+  g_string_free (self->priv->batch, TRUE);
+  g_hash_table_unref (self->priv->pending_avatars);
+
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
 
@@ -1470,6 +2165,21 @@ theme_adium_dispose (GObject *object)
       g_queue_clear (&self->priv->acked_messages);
     }
 
+  g_queue_clear (&self->priv->unflushed_acks);
+  theme_adium_forget_pending_avatars (self);
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  g_queue_foreach (&self->priv->message_queue, (GFunc) free_queued_item,
+      NULL);
+  g_queue_clear (&self->priv->message_queue);
+
+  theme_adium_forget_blocks (self);
+
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1597,6 +2307,9 @@ theme_adium_get_property (GObject *object,
       case PROP_VARIANT:
         g_value_set_string (value, self->priv->variant);
         break;
+      case PROP_FLUSH_BUDGET:
+        g_value_set_uint (value, self->priv->flush_budget);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
         break;
@@ -1620,6 +2333,9 @@ theme_adium_set_property (GObject *object,
       case PROP_VARIANT:
         empathy_theme_adium_set_variant (self, g_value_get_string (value));
         break;
+      case PROP_FLUSH_BUDGET:
+        self->priv->flush_budget = g_value_get_uint (value);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
         break;
@@ -1658,6 +2374,17 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
         G_PARAM_READWRITE |
         G_PARAM_STATIC_STRINGS));
 
+  /* The rest of a big backlog is left for the next main loop iteration, so
+   * redraws aren't blocked while it's being rendered */
+  g_object_class_install_property (object_class, PROP_FLUSH_BUDGET,
+      g_param_spec_uint ("flush-budget",
+        "Flush budget",
+        "Maximum number of queued messages rendered per main loop iteration",
+        1, G_MAXUINT, DEFAULT_FLUSH_BUDGET,
+        G_PARAM_CONSTRUCT |
+        G_PARAM_READWRITE |
+        G_PARAM_STATIC_STRINGS));
+
   g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -1669,6 +2396,10 @@ empathy_theme_adium_init (EmpathyThemeAdium *self)
 
   self->priv->in_construction = TRUE;
   g_queue_init (&self->priv->message_queue);
+  g_queue_init (&self->priv->rendered_blocks);
+  self->priv->batch = g_string_sized_new (4096);
+  self->priv->pending_avatars = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, g_free);
   self->priv->allow_scrolling = TRUE;
   self->priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
 
@@ -1690,6 +2421,14 @@ empathy_theme_adium_init (EmpathyThemeAdium *self)
     self);
 
   theme_adium_update_enable_webkit_developer_tools (self);
+
+  self->priv->scrollback_limit = g_settings_get_uint (
+      self->priv->gsettings_chat, EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
+
+  g_signal_connect (self->priv->gsettings_chat,
+    "changed::" EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT,
+    G_CALLBACK (theme_adium_notify_scrollback_limit_cb),
+    self);
 }
 
 EmpathyThemeAdium *
@@ -1969,6 +2708,8 @@ empathy_adium_data_new_with_info (const gchar *path,
   data->strings_to_free = g_ptr_array_new_with_free_func (g_free);
   data->date_format_cache = g_hash_table_new_full (g_str_hash,
     g_str_equal, g_free, g_free);
+  data->templates = g_hash_table_new_full (NULL, NULL, NULL,
+    (GDestroyNotify) g_array_unref);
 
   DEBUG ("Loading theme at %s", path);
 
@@ -2033,6 +2774,16 @@ empathy_adium_data_new_with_info (const gchar *path,
 
 #undef FALLBACK
 
+  adium_data_compile_template (data, data->in_content_html);
+  adium_data_compile_template (data, data->in_nextcontent_html);
+  adium_data_compile_template (data, data->in_context_html);
+  adium_data_compile_template (data, data->in_nextcontext_html);
+  adium_data_compile_template (data, data->out_content_html);
+  adium_data_compile_template (data, data->out_nextcontent_html);
+  adium_data_compile_template (data, data->out_context_html);
+  adium_data_compile_template (data, data->out_nextcontext_html);
+  adium_data_compile_template (data, data->status_html);
+
   /* template -> empathy's template */
   data->custom_template = (template_html != NULL);
   if (template_html == NULL)
@@ -2138,6 +2889,7 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
     g_hash_table_unref (data->info);
     g_ptr_array_unref (data->strings_to_free);
     tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
+    tp_clear_pointer (&data->templates, g_hash_table_unref);
 
     g_slice_free (EmpathyAdiumData, data);
   }
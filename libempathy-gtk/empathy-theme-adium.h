@@ -80,6 +80,10 @@ void empathy_theme_adium_append_message (EmpathyThemeAdium *self,
     EmpathyMessage *msg,
     gboolean should_highlight);
 
+void empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
+    EmpathyMessage *msg,
+    gboolean should_highlight);
+
 void empathy_theme_adium_append_event (EmpathyThemeAdium *self,
     const gchar *str);
 
@@ -90,6 +94,12 @@ void empathy_theme_adium_append_event_markup (EmpathyThemeAdium *self,
 void empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
     EmpathyMessage *message);
 
+guint empathy_theme_adium_get_n_pruned (EmpathyThemeAdium *self);
+
+gint64 empathy_theme_adium_get_oldest_timestamp (EmpathyThemeAdium *self);
+
+GList * empathy_theme_adium_get_oldest_messages (EmpathyThemeAdium *self);
+
 void empathy_theme_adium_scroll (EmpathyThemeAdium *self,
     gboolean allow_scrolling);
 
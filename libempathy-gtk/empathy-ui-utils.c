@@ -40,8 +40,10 @@
 
 #include <telepathy-glib/util.h>
 #include <folks/folks.h>
+#include <folks/folks-telepathy.h>
 
 #include "empathy-ui-utils.h"
+#include "empathy-avatar-cache.h"
 #include "empathy-images.h"
 #include "empathy-live-search.h"
 #include "empathy-smiley-manager.h"
@@ -550,18 +552,159 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
   return pixbuf;
 }
 
+static const gchar *
+avatar_cache_token (EmpathyAvatar *avatar)
+{
+  /* The token identifies the avatar image; avatars loaded from the disk
+   * cache without one are identified by their file */
+  if (!EMP_STR_EMPTY (avatar->token))
+    return avatar->token;
+
+  return avatar->filename;
+}
+
 GdkPixbuf *
 empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
     gint width,
     gint height)
 {
   EmpathyAvatar *avatar;
+  GdkPixbuf *pixbuf;
 
   g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
 
   avatar = empathy_contact_get_avatar (contact);
+  if (avatar == NULL)
+    return NULL;
+
+  pixbuf = empathy_avatar_cache_lookup (avatar_cache_token (avatar),
+      width, height, TRUE);
+  if (pixbuf != NULL)
+    return pixbuf;
+
+  pixbuf = empathy_pixbuf_from_avatar_scaled (avatar, width, height);
+  if (pixbuf != NULL)
+    empathy_avatar_cache_insert (avatar_cache_token (avatar),
+        width, height, TRUE, pixbuf);
+
+  return pixbuf;
+}
+
+typedef struct
+{
+  EmpathyAvatar *avatar;
+  gint width;
+  gint height;
+} ContactAvatarDecodeData;
+
+static void
+contact_avatar_decode_data_free (ContactAvatarDecodeData *data)
+{
+  empathy_avatar_unref (data->avatar);
+  g_slice_free (ContactAvatarDecodeData, data);
+}
+
+static void
+pixbuf_avatar_from_contact_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  ContactAvatarDecodeData *data;
+  GdkPixbuf *pixbuf;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+
+  pixbuf = empathy_pixbuf_from_avatar_scaled (data->avatar, data->width,
+      data->height);
+  if (pixbuf == NULL)
+    {
+      g_simple_async_result_set_error (simple, G_IO_ERROR, G_IO_ERROR_FAILED,
+          "failed to decode avatar");
+      return;
+    }
+
+  empathy_avatar_cache_insert (avatar_cache_token (data->avatar),
+      data->width, data->height, TRUE, pixbuf);
+
+  /* Replaces (and frees) the decode data */
+  g_simple_async_result_set_op_res_gpointer (simple, pixbuf, g_object_unref);
+}
+
+/* Same as empathy_pixbuf_avatar_from_contact_scaled() but the avatar is
+ * decoded from a thread if it's not cached yet */
+void
+empathy_pixbuf_avatar_from_contact_scaled_async (EmpathyContact *contact,
+    gint width,
+    gint height,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *result;
+  EmpathyAvatar *avatar;
+  ContactAvatarDecodeData *data;
+  GdkPixbuf *pixbuf;
+
+  g_return_if_fail (EMPATHY_IS_CONTACT (contact));
+
+  result = g_simple_async_result_new (G_OBJECT (contact), callback,
+      user_data, empathy_pixbuf_avatar_from_contact_scaled_async);
+  g_simple_async_result_set_check_cancellable (result, cancellable);
+
+  avatar = empathy_contact_get_avatar (contact);
+  if (avatar == NULL)
+    {
+      g_simple_async_result_set_error (result, G_IO_ERROR,
+        G_IO_ERROR_NOT_FOUND, "no avatar found");
+
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
 
-  return empathy_pixbuf_from_avatar_scaled (avatar, width, height);
+  pixbuf = empathy_avatar_cache_lookup (avatar_cache_token (avatar),
+      width, height, TRUE);
+  if (pixbuf != NULL)
+    {
+      g_simple_async_result_set_op_res_gpointer (result, pixbuf,
+          g_object_unref);
+
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      return;
+    }
+
+  data = g_slice_new0 (ContactAvatarDecodeData);
+  data->avatar = empathy_avatar_ref (avatar);
+  data->width = width;
+  data->height = height;
+
+  g_simple_async_result_set_op_res_gpointer (result, data,
+      (GDestroyNotify) contact_avatar_decode_data_free);
+
+  g_simple_async_result_run_in_thread (result,
+      pixbuf_avatar_from_contact_thread, G_PRIORITY_DEFAULT, cancellable);
+
+  g_object_unref (result);
+}
+
+/* Return a ref on the GdkPixbuf */
+GdkPixbuf *
+empathy_pixbuf_avatar_from_contact_scaled_finish (EmpathyContact *contact,
+    GAsyncResult *result,
+    GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+        G_OBJECT (contact), empathy_pixbuf_avatar_from_contact_scaled_async),
+      NULL);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
 }
 
 typedef struct
@@ -620,49 +763,202 @@ transform_pixbuf (GdkPixbuf *pixbuf)
   return result;
 }
 
+/* Individual avatars are decoded from a thread. Requests for an avatar
+ * which is already being decoded at the same size wait for the same job
+ * rather than decoding it again. */
+typedef struct
+{
+  gchar *key;
+  GLoadableIcon *icon;
+  gint width;
+  gint height;
+  /* The icon has no avatar token so the decoding thread adds the file's
+   * etag to the key it's cached under */
+  gboolean key_needs_etag;
+  /* List of owned PixbufAvatarFromIndividualClosure* */
+  GList *waiters;
+} AvatarDecodeJob;
+
+/* gchar *key -> borrowed AvatarDecodeJob*, only used from the main thread */
+static GHashTable *avatar_decode_jobs = NULL;
+
 static void
-avatar_icon_load_cb (GObject *object,
-    GAsyncResult *result,
-    gpointer user_data)
+avatar_decode_job_free (AvatarDecodeJob *job)
 {
-  GLoadableIcon *icon = G_LOADABLE_ICON (object);
-  PixbufAvatarFromIndividualClosure *closure = user_data;
+  g_free (job->key);
+  g_object_unref (job->icon);
+  g_list_free_full (job->waiters,
+      (GDestroyNotify) pixbuf_avatar_from_individual_closure_free);
+  g_slice_free (AvatarDecodeJob, job);
+}
+
+/* Telepathy avatars change token whenever they change, so if @icon comes
+ * from one of the individual's Telepathy contacts its token identifies it.
+ * Returns NULL otherwise. */
+static const gchar *
+individual_get_avatar_token (FolksIndividual *individual,
+    GLoadableIcon *icon)
+{
+  GeeSet *personas;
+  GeeIterator *iter;
+  const gchar *token = NULL;
+
+  personas = folks_individual_get_personas (individual);
+  iter = gee_iterable_iterator (GEE_ITERABLE (personas));
+  while (token == NULL && gee_iterator_next (iter))
+    {
+      FolksPersona *persona = gee_iterator_get (iter);
+      GLoadableIcon *persona_icon;
+      TpContact *contact;
+
+      if (!TPF_IS_PERSONA (persona))
+        goto next;
+
+      persona_icon = folks_avatar_details_get_avatar (
+          FOLKS_AVATAR_DETAILS (persona));
+      if (persona_icon == NULL ||
+          !g_icon_equal (G_ICON (persona_icon), G_ICON (icon)))
+        goto next;
+
+      contact = tpf_persona_get_contact (TPF_PERSONA (persona));
+      if (contact != NULL &&
+          !EMP_STR_EMPTY (tp_contact_get_avatar_token (contact)))
+        token = tp_contact_get_avatar_token (contact);
+
+next:
+      g_clear_object (&persona);
+    }
+  g_clear_object (&iter);
+
+  return token;
+}
+
+static gchar *
+avatar_decode_job_make_key (GLoadableIcon *icon,
+    const gchar *token,
+    gint width,
+    gint height)
+{
+  gchar *icon_str, *key;
+
+  icon_str = g_icon_to_string (G_ICON (icon));
+  if (icon_str == NULL)
+    return NULL;
+
+  key = g_strdup_printf ("%s:%s:%dx%d", icon_str, token != NULL ? token : "",
+      width, height);
+  g_free (icon_str);
+
+  return key;
+}
+
+static void
+avatar_decode_job_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  AvatarDecodeJob *job = g_simple_async_result_get_op_res_gpointer (simple);
   GInputStream *stream;
-  GError *error = NULL;
   GdkPixbuf *pixbuf;
-  GdkPixbuf *final_pixbuf;
+  gchar *cache_key = NULL;
+  GError *error = NULL;
 
-  stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
-  if (error != NULL)
+  /* Folks may replace an avatar while keeping its file name, so the
+   * file's etag (derived from its mtime) is part of the key */
+  if (job->key != NULL && job->key_needs_etag)
+    {
+      GFileInfo *info;
+
+      info = g_file_query_info (g_file_icon_get_file (G_FILE_ICON (job->icon)),
+          G_FILE_ATTRIBUTE_ETAG_VALUE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+      if (info != NULL && g_file_info_get_etag (info) != NULL)
+        cache_key = g_strdup_printf ("%s:%s", job->key,
+            g_file_info_get_etag (info));
+
+      tp_clear_object (&info);
+
+      pixbuf = empathy_avatar_cache_lookup (cache_key, job->width,
+          job->height, TRUE);
+      if (pixbuf != NULL)
+        goto out;
+    }
+  else
+    {
+      cache_key = g_strdup (job->key);
+    }
+
+  stream = g_loadable_icon_load (job->icon, job->width, NULL, NULL, &error);
+  if (stream == NULL)
     {
       DEBUG ("Failed to open avatar stream: %s", error->message);
-      g_simple_async_result_set_from_error (closure->result, error);
-      goto out;
+      g_simple_async_result_take_error (simple, error);
+      g_free (cache_key);
+      return;
     }
 
   pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream,
-      closure->width, closure->height, TRUE, closure->cancellable, &error);
+      job->width, job->height, TRUE, NULL, &error);
 
   g_object_unref (stream);
 
   if (pixbuf == NULL)
     {
       DEBUG ("Failed to read avatar: %s", error->message);
-      g_simple_async_result_set_from_error (closure->result, error);
-      goto out;
+      g_simple_async_result_take_error (simple, error);
+      g_free (cache_key);
+      return;
     }
 
-  final_pixbuf = transform_pixbuf (pixbuf);
+  pixbuf = transform_pixbuf (pixbuf);
 
-  /* Pass ownership of final_pixbuf to the result */
-  g_simple_async_result_set_op_res_gpointer (closure->result,
-      final_pixbuf, g_object_unref);
+  empathy_avatar_cache_insert (cache_key, job->width, job->height, TRUE,
+      pixbuf);
 
 out:
-  g_simple_async_result_complete (closure->result);
+  g_free (cache_key);
+
+  /* The job is the op_res of the decoding result, the pixbuf is handed to
+   * the waiters from the main thread */
+  g_object_set_data_full (G_OBJECT (simple), "pixbuf", pixbuf,
+      g_object_unref);
+}
+
+static void
+avatar_decode_job_done_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+  AvatarDecodeJob *job = user_data;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  GList *l;
+
+  if (job->key != NULL)
+    g_hash_table_remove (avatar_decode_jobs, job->key);
+
+  g_simple_async_result_propagate_error (simple, &error);
+  pixbuf = g_object_get_data (G_OBJECT (simple), "pixbuf");
+
+  for (l = job->waiters; l != NULL; l = g_list_next (l))
+    {
+      PixbufAvatarFromIndividualClosure *closure = l->data;
+      GError *cancelled = NULL;
+
+      if (g_cancellable_set_error_if_cancelled (closure->cancellable,
+            &cancelled))
+        g_simple_async_result_take_error (closure->result, cancelled);
+      else if (error != NULL)
+        g_simple_async_result_set_from_error (closure->result, error);
+      else
+        g_simple_async_result_set_op_res_gpointer (closure->result,
+            g_object_ref (pixbuf), g_object_unref);
+
+      g_simple_async_result_complete (closure->result);
+    }
 
   g_clear_error (&error);
-  pixbuf_avatar_from_individual_closure_free (closure);
+  avatar_decode_job_free (job);
 }
 
 void
@@ -677,6 +973,11 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
   GLoadableIcon *avatar_icon;
   GSimpleAsyncResult *result;
   PixbufAvatarFromIndividualClosure *closure;
+  AvatarDecodeJob *job = NULL;
+  GSimpleAsyncResult *job_result;
+  GdkPixbuf *pixbuf;
+  const gchar *token;
+  gchar *key;
 
   result = g_simple_async_result_new (G_OBJECT (individual),
       callback, user_data, empathy_pixbuf_avatar_from_individual_scaled_async);
@@ -694,14 +995,68 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
       return;
     }
 
+  token = individual_get_avatar_token (individual, avatar_icon);
+  key = avatar_decode_job_make_key (avatar_icon, token, width, height);
+
+  /* Without token the cache can only be checked once the file's etag is
+   * known, which is done from the thread */
+  if (token != NULL || !G_IS_FILE_ICON (avatar_icon))
+    pixbuf = empathy_avatar_cache_lookup (key, width, height, TRUE);
+  else
+    pixbuf = NULL;
+
+  if (pixbuf != NULL)
+    {
+      g_simple_async_result_set_op_res_gpointer (result, pixbuf,
+          g_object_unref);
+
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      g_free (key);
+      return;
+    }
+
   closure = pixbuf_avatar_from_individual_closure_new (individual, result,
       width, height, cancellable);
 
   g_return_if_fail (closure != NULL);
 
-  g_loadable_icon_load_async (avatar_icon, width, cancellable,
-      avatar_icon_load_cb, closure);
+  if (avatar_decode_jobs == NULL)
+    avatar_decode_jobs = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (key != NULL)
+    job = g_hash_table_lookup (avatar_decode_jobs, key);
+
+  if (job != NULL)
+    {
+      /* Already being decoded */
+      job->waiters = g_list_prepend (job->waiters, closure);
+      g_object_unref (result);
+      g_free (key);
+      return;
+    }
+
+  job = g_slice_new0 (AvatarDecodeJob);
+  job->key = key;
+  job->icon = g_object_ref (avatar_icon);
+  job->width = width;
+  job->height = height;
+  job->key_needs_etag = token == NULL && G_IS_FILE_ICON (avatar_icon);
+  job->waiters = g_list_prepend (NULL, closure);
+
+  if (key != NULL)
+    g_hash_table_insert (avatar_decode_jobs, job->key, job);
 
+  job_result = g_simple_async_result_new (NULL, avatar_decode_job_done_cb,
+      job, avatar_decode_job_thread);
+  g_simple_async_result_set_op_res_gpointer (job_result, job, NULL);
+
+  /* The job is shared between the waiters so it's not cancelled; each
+   * waiter checks its own cancellable once it's done */
+  g_simple_async_result_run_in_thread (job_result, avatar_decode_job_thread,
+      G_PRIORITY_DEFAULT, NULL);
+
+  g_object_unref (job_result);
   g_object_unref (result);
 }
 
@@ -997,12 +1352,14 @@ empathy_make_absolute_url_len (const gchar *url,
 {
   g_return_val_if_fail (url != NULL, NULL);
 
+  /* Only look at the len first bytes, url is usually a link in the middle
+   * of a message */
   if (g_str_has_prefix (url, "help:") ||
       g_str_has_prefix (url, "mailto:") ||
-      strstr (url, ":/"))
+      g_strstr_len (url, len, ":/"))
     return g_strndup (url, len);
 
-  if (strstr (url, "@"))
+  if (g_strstr_len (url, len, "@"))
     return g_strdup_printf ("mailto:%.*s", len, url);
 
   return g_strdup_printf ("http://%.*s", len, url);
@@ -1377,67 +1734,154 @@ empathy_get_current_action_time (void)
   return (tp_user_action_time_from_x11 (gtk_get_current_event_time ()));
 }
 
-/* @words = empathy_live_search_strip_utf8_string (@text);
- *
- * User has to pass both so we don't have to compute @words ourself each time
- * this function is called. */
-gboolean
-empathy_individual_match_string (FolksIndividual *individual,
-    const char *text,
-    GPtrArray *words)
+/* Search key of an individual, computed when it's first searched and kept
+ * on it until its alias or personas change, so live search doesn't strip
+ * the same strings again on each keystroke */
+typedef struct
+{
+  gboolean valid;
+  /* Stripped alias */
+  gchar *alias;
+  /* Display IDs of the interesting personas */
+  GPtrArray *ids;
+  /* Stripped display IDs without their @server.com part */
+  GPtrArray *stripped_ids;
+} IndividualSearchKey;
+
+static GQuark
+individual_search_key_quark (void)
 {
-  const gchar *str;
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-individual-search-key");
+
+  return quark;
+}
+
+static void
+individual_search_key_clear (IndividualSearchKey *key)
+{
+  tp_clear_pointer (&key->alias, g_free);
+  tp_clear_pointer (&key->ids, g_ptr_array_unref);
+  tp_clear_pointer (&key->stripped_ids, g_ptr_array_unref);
+  key->valid = FALSE;
+}
+
+static void
+individual_search_key_free (IndividualSearchKey *key)
+{
+  individual_search_key_clear (key);
+  g_slice_free (IndividualSearchKey, key);
+}
+
+static void
+individual_search_key_invalidate_cb (FolksIndividual *individual)
+{
+  IndividualSearchKey *key;
+
+  key = g_object_get_qdata (G_OBJECT (individual),
+      individual_search_key_quark ());
+
+  individual_search_key_clear (key);
+}
+
+static IndividualSearchKey *
+individual_get_search_key (FolksIndividual *individual)
+{
+  IndividualSearchKey *key;
   GeeSet *personas;
   GeeIterator *iter;
-  gboolean retval = FALSE;
 
-  /* check alias name */
-  str = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
+  key = g_object_get_qdata (G_OBJECT (individual),
+      individual_search_key_quark ());
 
-  if (empathy_live_search_match_words (str, words))
-    return TRUE;
+  if (key == NULL)
+    {
+      key = g_slice_new0 (IndividualSearchKey);
+      g_object_set_qdata_full (G_OBJECT (individual),
+          individual_search_key_quark (), key,
+          (GDestroyNotify) individual_search_key_free);
+
+      g_signal_connect (individual, "notify::alias",
+          G_CALLBACK (individual_search_key_invalidate_cb), NULL);
+      g_signal_connect (individual, "personas-changed",
+          G_CALLBACK (individual_search_key_invalidate_cb), NULL);
+    }
+
+  if (key->valid)
+    return key;
+
+  key->alias = empathy_live_search_strip_string (
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
+  key->ids = g_ptr_array_new_with_free_func (g_free);
+  key->stripped_ids = g_ptr_array_new_with_free_func (g_free);
 
   personas = folks_individual_get_personas (individual);
 
-  /* check contact id, remove the @server.com part */
   iter = gee_iterable_iterator (GEE_ITERABLE (personas));
-  while (retval == FALSE && gee_iterator_next (iter))
+  while (gee_iterator_next (iter))
     {
       FolksPersona *persona = gee_iterator_get (iter);
-      const gchar *p;
 
       if (empathy_folks_persona_is_interesting (persona))
         {
-          str = folks_persona_get_display_id (persona);
-
-          /* Accept the persona if @text is a full prefix of his ID; that allows
-           * user to find, say, a jabber contact by typing his JID. */
-          if (g_str_has_prefix (str, text))
-            {
-              retval = TRUE;
-            }
-          else
-            {
-              gchar *dup_str = NULL;
-              gboolean visible;
-
-              p = strstr (str, "@");
-              if (p != NULL)
-                str = dup_str = g_strndup (str, p - str);
-
-              visible = empathy_live_search_match_words (str, words);
-              g_free (dup_str);
-              if (visible)
-                retval = TRUE;
-            }
+          const gchar *str = folks_persona_get_display_id (persona);
+          const gchar *p;
+          gchar *local;
+
+          g_ptr_array_add (key->ids, g_strdup (str));
+
+          /* remove the @server.com part */
+          p = strstr (str, "@");
+          local = p != NULL ? g_strndup (str, p - str) : g_strdup (str);
+          g_ptr_array_add (key->stripped_ids,
+              empathy_live_search_strip_string (local));
+          g_free (local);
         }
       g_clear_object (&persona);
     }
   g_clear_object (&iter);
 
+  key->valid = TRUE;
+
+  return key;
+}
+
+/* @words = empathy_live_search_strip_utf8_string (@text);
+ *
+ * User has to pass both so we don't have to compute @words ourself each time
+ * this function is called. */
+gboolean
+empathy_individual_match_string (FolksIndividual *individual,
+    const char *text,
+    GPtrArray *words)
+{
+  IndividualSearchKey *key;
+  guint i;
+
+  key = individual_get_search_key (individual);
+
+  /* check alias name */
+  if (empathy_live_search_match_words_stripped (key->alias, words))
+    return TRUE;
+
+  /* check contact id */
+  for (i = 0; i < key->ids->len; i++)
+    {
+      /* Accept the persona if @text is a full prefix of his ID; that allows
+       * user to find, say, a jabber contact by typing his JID. */
+      if (g_str_has_prefix (g_ptr_array_index (key->ids, i), text))
+        return TRUE;
+
+      if (empathy_live_search_match_words_stripped (
+            g_ptr_array_index (key->stripped_ids, i), words))
+        return TRUE;
+    }
+
   /* FIXME: Add more rules here, we could check phone numbers in
    * contact's vCard for example. */
-  return retval;
+  return FALSE;
 }
 
 void
@@ -89,6 +89,17 @@ GdkPixbuf * empathy_pixbuf_avatar_from_individual_scaled_finish (
 GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
     gint width,
     gint height);
+void empathy_pixbuf_avatar_from_contact_scaled_async (
+    EmpathyContact *contact,
+    gint width,
+    gint height,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled_finish (
+    EmpathyContact *contact,
+    GAsyncResult *result,
+    GError **error);
 GdkPixbuf * empathy_pixbuf_contact_status_icon (EmpathyContact *contact,
     gboolean show_protocol);
 GdkPixbuf * empathy_pixbuf_contact_status_icon_with_icon_name (
@@ -37,6 +37,8 @@ void _tpl_action_chain_free (TplActionChain *self);
 typedef void (*TplPendingAction) (TplActionChain *ctx, gpointer user_data);
 void _tpl_action_chain_append (TplActionChain *self, TplPendingAction func,
     gpointer user_data);
+void _tpl_action_chain_append_full (TplActionChain *self,
+    TplPendingAction func, gpointer user_data, GDestroyNotify destroy);
 void _tpl_action_chain_prepend (TplActionChain *self, TplPendingAction func,
     gpointer user_data);
 void _tpl_action_chain_start (TplActionChain *self);
@@ -24,6 +24,8 @@
 typedef struct {
   TplPendingAction action;
   gpointer user_data;
+  /* frees user_data if the link is dropped without being run */
+  GDestroyNotify destroy;
 } TplActionLink;
 
 
@@ -51,10 +53,20 @@ link_free (TplActionLink *l)
 }
 
 
+static void
+link_drop (TplActionLink *l)
+{
+  if (l->destroy != NULL)
+    l->destroy (l->user_data);
+
+  link_free (l);
+}
+
+
 void
 _tpl_action_chain_free (TplActionChain *self)
 {
-  g_queue_foreach (self->chain, (GFunc) link_free, NULL);
+  g_queue_foreach (self->chain, (GFunc) link_drop, NULL);
   g_queue_free (self->chain);
   g_object_unref (self->simple);
   g_slice_free (TplActionChain, self);
@@ -94,12 +106,26 @@ void
 _tpl_action_chain_append (TplActionChain *self,
     TplPendingAction func,
     gpointer user_data)
+{
+  _tpl_action_chain_append_full (self, func, user_data, NULL);
+}
+
+
+/* Like _tpl_action_chain_append(), but @destroy is called on @user_data if
+ * the link is cleared or freed before it runs. Once the action has been
+ * called, @user_data belongs to it. */
+void
+_tpl_action_chain_append_full (TplActionChain *self,
+    TplPendingAction func,
+    gpointer user_data,
+    GDestroyNotify destroy)
 {
   TplActionLink *l;
 
   l = g_slice_new0 (TplActionLink);
   l->action = func;
   l->user_data = user_data;
+  l->destroy = destroy;
 
   g_queue_push_tail (self->chain, l);
 }
@@ -136,11 +162,14 @@ _tpl_action_chain_continue (TplActionChain *self)
 }
 
 
+/* Drops the pending links so the chain can be started again right away.
+ * An action still in flight must not continue the chain afterwards. */
 void
 _tpl_action_chain_clear (TplActionChain *self)
 {
-  g_queue_foreach (self->chain, (GFunc) link_free, NULL);
+  g_queue_foreach (self->chain, (GFunc) link_drop, NULL);
   g_queue_clear (self->chain);
+  self->running = FALSE;
 }
 
 void
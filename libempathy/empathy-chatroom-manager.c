@@ -29,6 +29,7 @@
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlwriter.h>
 
 #include <telepathy-glib/account-manager.h>
 #include <telepathy-glib/interfaces.h>
@@ -62,6 +63,13 @@ static void observe_channels_cb (TpSimpleObserver *observer,
 typedef struct
 {
   GList *chatrooms;
+  /* EmpathyChatroom -> owned IndexEntry, for every chatroom in the list */
+  GHashTable *entries;
+  /* "account-path room" -> borrowed EmpathyChatroom */
+  GHashTable *rooms;
+  /* account path -> owned GQueue of borrowed EmpathyChatroom, most
+   * recently added first */
+  GHashTable *account_rooms;
   gchar *file;
   TpAccountManager *account_manager;
 
@@ -69,7 +77,8 @@ typedef struct
   gint save_timer_id;
   gboolean ready;
   GFileMonitor *monitor;
-  gboolean writing;
+  /* etag of the file as we last wrote or reloaded it */
+  gchar *etag;
 
   TpBaseClient *observer;
 } EmpathyChatroomManagerPriv;
@@ -92,6 +101,116 @@ enum
 
 G_DEFINE_TYPE (EmpathyChatroomManager, empathy_chatroom_manager, G_TYPE_OBJECT);
 
+/* Where a chatroom currently sits in the lookup indexes. Account paths
+ * can't contain spaces, so joining them to the room id with one gives an
+ * unambiguous key. */
+typedef struct
+{
+  GList *link;
+  /* object path of the chatroom's account, or NULL */
+  gchar *account;
+  /* account path and room id, or NULL if either is unset */
+  gchar *key;
+} IndexEntry;
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+  g_free (entry->account);
+  g_free (entry->key);
+  g_slice_free (IndexEntry, entry);
+}
+
+static gchar *
+chatroom_manager_dup_key (TpAccount *account,
+    const gchar *room)
+{
+  if (account == NULL || room == NULL)
+    return NULL;
+
+  return g_strconcat (tp_proxy_get_object_path (account), " ", room, NULL);
+}
+
+static void
+chatroom_manager_index (EmpathyChatroomManager *self,
+    GList *link)
+{
+  EmpathyChatroomManagerPriv *priv = GET_PRIV (self);
+  EmpathyChatroom *chatroom = link->data;
+  TpAccount *account;
+  IndexEntry *entry;
+  GQueue *queue;
+
+  account = empathy_chatroom_get_account (chatroom);
+
+  entry = g_slice_new0 (IndexEntry);
+  entry->link = link;
+  g_hash_table_replace (priv->entries, chatroom, entry);
+
+  if (account == NULL)
+    return;
+
+  entry->account = g_strdup (tp_proxy_get_object_path (account));
+  entry->key = chatroom_manager_dup_key (account,
+      empathy_chatroom_get_room (chatroom));
+
+  queue = g_hash_table_lookup (priv->account_rooms, entry->account);
+  if (queue == NULL)
+    {
+      queue = g_queue_new ();
+      g_hash_table_insert (priv->account_rooms, g_strdup (entry->account),
+          queue);
+    }
+
+  g_queue_push_head (queue, chatroom);
+
+  /* Like the list walk this replaces, the most recent duplicate wins. The
+   * key string belongs to the entry, hence replace rather than insert. */
+  if (entry->key != NULL)
+    g_hash_table_replace (priv->rooms, entry->key, chatroom);
+}
+
+static void
+chatroom_manager_unindex (EmpathyChatroomManager *self,
+    EmpathyChatroom *chatroom)
+{
+  EmpathyChatroomManagerPriv *priv = GET_PRIV (self);
+  IndexEntry *entry;
+  GQueue *queue;
+  GList *l;
+
+  entry = g_hash_table_lookup (priv->entries, chatroom);
+  if (entry == NULL || entry->account == NULL)
+    goto out;
+
+  queue = g_hash_table_lookup (priv->account_rooms, entry->account);
+  g_queue_remove (queue, chatroom);
+
+  if (entry->key != NULL &&
+      g_hash_table_lookup (priv->rooms, entry->key) == chatroom)
+    {
+      g_hash_table_remove (priv->rooms, entry->key);
+
+      /* Let a duplicate of the same room take over, if there is one */
+      for (l = queue->head; l != NULL; l = l->next)
+        {
+          IndexEntry *other = g_hash_table_lookup (priv->entries, l->data);
+
+          if (!tp_strdiff (other->key, entry->key))
+            {
+              g_hash_table_replace (priv->rooms, other->key, l->data);
+              break;
+            }
+        }
+    }
+
+  if (g_queue_is_empty (queue))
+    g_hash_table_remove (priv->account_rooms, entry->account);
+
+out:
+  g_hash_table_remove (priv->entries, chatroom);
+}
+
 /*
  * API to save/load and parse the chatrooms file.
  */
@@ -100,22 +219,30 @@ static gboolean
 chatroom_manager_file_save (EmpathyChatroomManager *manager)
 {
   EmpathyChatroomManagerPriv *priv;
-  xmlDocPtr doc;
-  xmlNodePtr root;
+  xmlBufferPtr buffer;
+  xmlTextWriterPtr writer;
+  GFile *file;
   GList *l;
+  GError *error = NULL;
+  gboolean ret = TRUE;
 
   priv = GET_PRIV (manager);
 
-  priv->writing = TRUE;
+  /* Stream the favourites straight into a buffer rather than building a
+   * DOM we would throw away as soon as it has been serialised. */
+  buffer = xmlBufferCreate ();
+  writer = xmlNewTextWriterMemory (buffer, 0);
+
+  /* Make sure the XML is indented properly */
+  xmlTextWriterSetIndent (writer, 1);
+  xmlTextWriterSetIndentString (writer, (const xmlChar *) "  ");
 
-  doc = xmlNewDoc ((const xmlChar *) "1.0");
-  root = xmlNewNode (NULL, (const xmlChar *) "chatrooms");
-  xmlDocSetRootElement (doc, root);
+  xmlTextWriterStartDocument (writer, "1.0", "utf-8", NULL);
+  xmlTextWriterStartElement (writer, (const xmlChar *) "chatrooms");
 
   for (l = priv->chatrooms; l; l = l->next)
     {
       EmpathyChatroom *chatroom;
-      xmlNodePtr       node;
       const gchar     *account_id;
 
       chatroom = l->data;
@@ -126,32 +253,54 @@ chatroom_manager_file_save (EmpathyChatroomManager *manager)
       account_id = tp_proxy_get_object_path (empathy_chatroom_get_account (
             chatroom));
 
-      node = xmlNewChild (root, NULL, (const xmlChar *) "chatroom", NULL);
-      xmlNewTextChild (node, NULL, (const xmlChar *) "name",
+      xmlTextWriterStartElement (writer, (const xmlChar *) "chatroom");
+      xmlTextWriterWriteElement (writer, (const xmlChar *) "name",
         (const xmlChar *) empathy_chatroom_get_name (chatroom));
-      xmlNewTextChild (node, NULL, (const xmlChar *) "room",
+      xmlTextWriterWriteElement (writer, (const xmlChar *) "room",
         (const xmlChar *) empathy_chatroom_get_room (chatroom));
-      xmlNewTextChild (node, NULL, (const xmlChar *) "account",
+      xmlTextWriterWriteElement (writer, (const xmlChar *) "account",
         (const xmlChar *) account_id);
-      xmlNewTextChild (node, NULL, (const xmlChar *) "auto_connect",
+      xmlTextWriterWriteElement (writer, (const xmlChar *) "auto_connect",
         empathy_chatroom_get_auto_connect (chatroom) ?
         (const xmlChar *) "yes" : (const xmlChar *) "no");
-      xmlNewTextChild (node, NULL, (const xmlChar *) "always_urgent",
+      xmlTextWriterWriteElement (writer, (const xmlChar *) "always_urgent",
         empathy_chatroom_is_always_urgent (chatroom) ?
         (const xmlChar *) "yes" : (const xmlChar *) "no");
+      xmlTextWriterEndElement (writer);
     }
 
-  /* Make sure the XML is indented properly */
-  xmlIndentTreeOutput = 1;
+  if (xmlTextWriterEndDocument (writer) < 0)
+    {
+      DEBUG ("Failed to serialise chatrooms");
+      xmlFreeTextWriter (writer);
+      xmlBufferFree (buffer);
+      return FALSE;
+    }
 
+  xmlFreeTextWriter (writer);
+
+  /* g_file_replace_contents() writes to a temporary file and renames it
+   * over the old one, so readers never see a half-written file. The etag
+   * it hands back lets file_changed_cb() recognise our own write. */
   DEBUG ("Saving file:'%s'", priv->file);
-  xmlSaveFormatFileEnc (priv->file, doc, "utf-8", 1);
-  xmlFreeDoc (doc);
+  file = g_file_new_for_path (priv->file);
 
-  xmlMemoryDump ();
+  g_free (priv->etag);
+  priv->etag = NULL;
 
-  priv->writing = FALSE;
-  return TRUE;
+  if (!g_file_replace_contents (file, (const gchar *) xmlBufferContent (buffer),
+        xmlBufferLength (buffer), NULL, FALSE, G_FILE_CREATE_NONE,
+        &priv->etag, NULL, &error))
+    {
+      DEBUG ("Failed to save %s: %s", priv->file, error->message);
+      g_error_free (error);
+      ret = FALSE;
+    }
+
+  g_object_unref (file);
+  xmlBufferFree (buffer);
+
+  return ret;
 }
 
 static gboolean
@@ -185,13 +334,40 @@ chatroom_changed_cb (EmpathyChatroom *chatroom,
   reset_save_timeout (self);
 }
 
+static void
+chatroom_key_changed_cb (EmpathyChatroom *chatroom,
+    GParamSpec *spec,
+    EmpathyChatroomManager *self)
+{
+  EmpathyChatroomManagerPriv *priv = GET_PRIV (self);
+  IndexEntry *entry;
+  GList *link;
+
+  entry = g_hash_table_lookup (priv->entries, chatroom);
+  if (entry == NULL)
+    return;
+
+  link = entry->link;
+  chatroom_manager_unindex (self, chatroom);
+  chatroom_manager_index (self, link);
+}
+
 static void
 add_chatroom (EmpathyChatroomManager *self,
     EmpathyChatroom *chatroom)
 {
   EmpathyChatroomManagerPriv *priv = GET_PRIV (self);
 
+  /* The same object can't be indexed twice */
+  chatroom_manager_unindex (self, chatroom);
+
   priv->chatrooms = g_list_prepend (priv->chatrooms, g_object_ref (chatroom));
+  chatroom_manager_index (self, priv->chatrooms);
+
+  g_signal_connect (chatroom, "notify::room",
+      G_CALLBACK (chatroom_key_changed_cb), self);
+  g_signal_connect (chatroom, "notify::account",
+      G_CALLBACK (chatroom_key_changed_cb), self);
 
   /* Watch only those properties which are exported in the save file */
   g_signal_connect (chatroom, "notify::name",
@@ -445,6 +621,9 @@ clear_chatrooms (EmpathyChatroomManager *self)
    * re-call this function. We already set priv->chatrooms to NULL so we won't
    * try to destroy twice the same objects. */
   priv->chatrooms = NULL;
+  g_hash_table_remove_all (priv->rooms);
+  g_hash_table_remove_all (priv->account_rooms);
+  g_hash_table_remove_all (priv->entries);
 
   for (l = tmp; l != NULL; l = g_list_next (l))
     {
@@ -452,6 +631,8 @@ clear_chatrooms (EmpathyChatroomManager *self)
 
       g_signal_handlers_disconnect_by_func (chatroom, chatroom_changed_cb,
           self);
+      g_signal_handlers_disconnect_by_func (chatroom, chatroom_key_changed_cb,
+          self);
       g_signal_emit (self, signals[CHATROOM_REMOVED], 0, chatroom);
 
       g_object_unref (chatroom);
@@ -480,7 +661,12 @@ chatroom_manager_finalize (GObject *object)
 
   clear_chatrooms (self);
 
+  g_hash_table_unref (priv->rooms);
+  g_hash_table_unref (priv->account_rooms);
+  g_hash_table_unref (priv->entries);
+
   g_free (priv->file);
+  g_free (priv->etag);
 
   (G_OBJECT_CLASS (empathy_chatroom_manager_parent_class)->finalize) (object);
 }
@@ -494,13 +680,33 @@ file_changed_cb (GFileMonitor *monitor,
 {
   EmpathyChatroomManager *self = user_data;
   EmpathyChatroomManagerPriv *priv = GET_PRIV (self);
+  GFileInfo *info;
+  const gchar *etag;
 
-  if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+  /* Atomic replacements (ours included) show up as a creation rather than
+   * as a change of the existing file. */
+  if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+      event_type != G_FILE_MONITOR_EVENT_CREATED)
     return;
 
-  if (priv->writing)
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_ETAG_VALUE,
+      G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL)
     return;
 
+  etag = g_file_info_get_etag (info);
+
+  /* Either we wrote this version ourselves or we already reloaded it */
+  if (!tp_strdiff (etag, priv->etag))
+    {
+      g_object_unref (info);
+      return;
+    }
+
+  g_free (priv->etag);
+  priv->etag = g_strdup (etag);
+  g_object_unref (info);
+
   DEBUG ("chatrooms file changed; reloading list");
 
   clear_chatrooms (self);
@@ -670,6 +876,12 @@ empathy_chatroom_manager_init (EmpathyChatroomManager *manager)
       EMPATHY_TYPE_CHATROOM_MANAGER, EmpathyChatroomManagerPriv);
 
   manager->priv = priv;
+
+  priv->entries = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) index_entry_free);
+  priv->rooms = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->account_rooms = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) g_queue_free);
 }
 
 EmpathyChatroomManager *
@@ -717,10 +929,13 @@ chatroom_manager_remove_link (EmpathyChatroomManager *manager,
   if (empathy_chatroom_is_favorite (chatroom))
     reset_save_timeout (manager);
 
+  chatroom_manager_unindex (manager, chatroom);
   priv->chatrooms = g_list_delete_link (priv->chatrooms, l);
 
   g_signal_emit (manager, signals[CHATROOM_REMOVED], 0, chatroom);
   g_signal_handlers_disconnect_by_func (chatroom, chatroom_changed_cb, manager);
+  g_signal_handlers_disconnect_by_func (chatroom, chatroom_key_changed_cb,
+      manager);
 
   g_object_unref (chatroom);
 }
@@ -730,6 +945,8 @@ empathy_chatroom_manager_remove (EmpathyChatroomManager *manager,
     EmpathyChatroom        *chatroom)
 {
   EmpathyChatroomManagerPriv *priv;
+  EmpathyChatroom *found;
+  IndexEntry *entry;
   GList *l;
 
   g_return_if_fail (EMPATHY_IS_CHATROOM_MANAGER (manager));
@@ -737,6 +954,30 @@ empathy_chatroom_manager_remove (EmpathyChatroomManager *manager,
 
   priv = GET_PRIV (manager);
 
+  entry = g_hash_table_lookup (priv->entries, chatroom);
+  if (entry != NULL)
+    {
+      chatroom_manager_remove_link (manager, entry->link);
+      return;
+    }
+
+  if (empathy_chatroom_get_account (chatroom) != NULL &&
+      empathy_chatroom_get_room (chatroom) != NULL)
+    {
+      found = empathy_chatroom_manager_find (manager,
+          empathy_chatroom_get_account (chatroom),
+          empathy_chatroom_get_room (chatroom));
+
+      if (found != NULL)
+        {
+          entry = g_hash_table_lookup (priv->entries, found);
+          chatroom_manager_remove_link (manager, entry->link);
+        }
+
+      return;
+    }
+
+  /* Chatrooms without an account or room aren't in the room index */
   for (l = priv->chatrooms; l; l = l->next)
     {
       EmpathyChatroom *this_chatroom;
@@ -758,29 +999,26 @@ empathy_chatroom_manager_find (EmpathyChatroomManager *manager,
     const gchar *room)
 {
   EmpathyChatroomManagerPriv *priv;
-  GList *l;
+  EmpathyChatroom *chatroom;
+  gchar *key;
 
   g_return_val_if_fail (EMPATHY_IS_CHATROOM_MANAGER (manager), NULL);
   g_return_val_if_fail (room != NULL, NULL);
 
   priv = GET_PRIV (manager);
 
-  for (l = priv->chatrooms; l; l = l->next)
-    {
-      EmpathyChatroom *chatroom;
-      TpAccount *this_account;
-      const gchar    *this_room;
+  key = chatroom_manager_dup_key (account, room);
+  if (key == NULL)
+    return NULL;
 
-      chatroom = l->data;
-      this_account = empathy_chatroom_get_account (chatroom);
-      this_room = empathy_chatroom_get_room (chatroom);
+  chatroom = g_hash_table_lookup (priv->rooms, key);
+  g_free (key);
 
-      if (this_account && this_room && account == this_account
-          && strcmp (this_room, room) == 0)
-        return chatroom;
-    }
+  /* Keep matching on the account object itself, as the list walk did */
+  if (chatroom != NULL && empathy_chatroom_get_account (chatroom) != account)
+    return NULL;
 
-  return NULL;
+  return chatroom;
 }
 
 EmpathyChatroom *
@@ -814,6 +1052,7 @@ empathy_chatroom_manager_get_chatrooms (EmpathyChatroomManager *manager,
 {
   EmpathyChatroomManagerPriv *priv;
   GList *chatrooms, *l;
+  GQueue *queue;
 
   g_return_val_if_fail (EMPATHY_IS_CHATROOM_MANAGER (manager), NULL);
 
@@ -822,15 +1061,20 @@ empathy_chatroom_manager_get_chatrooms (EmpathyChatroomManager *manager,
   if (!account)
     return g_list_copy (priv->chatrooms);
 
+  queue = g_hash_table_lookup (priv->account_rooms,
+      tp_proxy_get_object_path (account));
+  if (queue == NULL)
+    return NULL;
+
   chatrooms = NULL;
-  for (l = priv->chatrooms; l; l = l->next)
+  for (l = queue->tail; l; l = l->prev)
     {
       EmpathyChatroom *chatroom;
 
       chatroom = l->data;
 
       if (account == empathy_chatroom_get_account (chatroom))
-        chatrooms = g_list_append (chatrooms, chatroom);
+        chatrooms = g_list_prepend (chatrooms, chatroom);
     }
 
   return chatrooms;
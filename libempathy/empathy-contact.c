@@ -55,6 +55,8 @@ typedef struct {
   gchar *alias;
   gchar *logged_alias;
   EmpathyAvatar *avatar;
+  /* Cancels the avatar being loaded, if any */
+  GCancellable *avatar_cancellable;
   TpConnectionPresenceType presence;
   guint handle;
   EmpathyCapabilities capabilities;
@@ -93,7 +95,7 @@ static void set_capabilities_from_tp_caps (EmpathyContact *self,
 static void contact_set_avatar (EmpathyContact *contact,
     EmpathyAvatar *avatar);
 static void contact_set_avatar_from_tp_contact (EmpathyContact *contact);
-static gboolean contact_load_avatar_cache (EmpathyContact *contact,
+static void contact_load_avatar_cache (EmpathyContact *contact,
     const gchar *token);
 
 G_DEFINE_TYPE (EmpathyContact, empathy_contact, G_TYPE_OBJECT);
@@ -127,6 +129,14 @@ static guint signals[LAST_SIGNAL];
 /* TpContact* -> EmpathyContact*, both borrowed ref */
 static GHashTable *contacts_table = NULL;
 
+/* owned account object path -> owned avatar cache directory of its
+ * CM/protocol; the directory is created when first added */
+static GHashTable *avatar_dirs = NULL;
+
+/* EmpathyContact* (owned ref) whose "avatar" notification is pending */
+static GHashTable *avatar_notify_pending = NULL;
+static guint avatar_notify_id = 0;
+
 static void
 tp_contact_notify_cb (TpContact *tp_contact,
                       GParamSpec *param,
@@ -207,6 +217,12 @@ contact_dispose (GObject *object)
     }
   priv->persona = NULL;
 
+  if (priv->avatar_cancellable != NULL)
+    {
+      g_cancellable_cancel (priv->avatar_cancellable);
+      tp_clear_object (&priv->avatar_cancellable);
+    }
+
   if (priv->avatar != NULL)
     {
       empathy_avatar_unref (priv->avatar);
@@ -247,6 +263,8 @@ contact_constructed (GObject *object)
   set_capabilities_from_tp_caps (contact,
       tp_contact_get_capabilities (priv->tp_contact));
 
+  /* Views showing the contact before it's loaded use a default avatar
+   * and update it on "avatar" notifications */
   contact_set_avatar_from_tp_contact (contact);
 
   /* Set is-user property. Note that it could still be the handle is
@@ -944,6 +962,47 @@ empathy_contact_get_avatar (EmpathyContact *contact)
   return priv->avatar;
 }
 
+static gboolean
+contact_avatar_notify_cb (gpointer user_data)
+{
+  GHashTable *pending = avatar_notify_pending;
+  GHashTableIter iter;
+  gpointer contact;
+
+  avatar_notify_pending = NULL;
+  avatar_notify_id = 0;
+
+  DEBUG ("Notifying avatar changes of %u contacts",
+      g_hash_table_size (pending));
+
+  g_hash_table_iter_init (&iter, pending);
+  while (g_hash_table_iter_next (&iter, &contact, NULL))
+    g_object_notify (contact, "avatar");
+
+  g_hash_table_unref (pending);
+
+  return FALSE;
+}
+
+/* Avatars of a whole roster tend to arrive at once; notify them together
+ * from an idle rather than one by one as they are loaded */
+static void
+contact_queue_avatar_notify (EmpathyContact *contact)
+{
+  if (avatar_notify_pending == NULL)
+    avatar_notify_pending = g_hash_table_new_full (NULL, NULL,
+        g_object_unref, NULL);
+
+  if (g_hash_table_lookup_extended (avatar_notify_pending, contact, NULL,
+        NULL))
+    return;
+
+  g_hash_table_insert (avatar_notify_pending, g_object_ref (contact), NULL);
+
+  if (avatar_notify_id == 0)
+    avatar_notify_id = g_idle_add (contact_avatar_notify_cb, NULL);
+}
+
 static void
 contact_set_avatar (EmpathyContact *contact,
                     EmpathyAvatar *avatar)
@@ -966,7 +1025,138 @@ contact_set_avatar (EmpathyContact *contact,
   if (avatar)
       priv->avatar = empathy_avatar_ref (avatar);
 
-  g_object_notify (G_OBJECT (contact), "avatar");
+  contact_queue_avatar_notify (contact);
+}
+
+/* Cancels the avatar currently being loaded, if any */
+static void
+contact_cancel_avatar_load (EmpathyContact *contact)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+
+  if (priv->avatar_cancellable != NULL)
+    {
+      g_cancellable_cancel (priv->avatar_cancellable);
+      tp_clear_object (&priv->avatar_cancellable);
+    }
+}
+
+/* Cancels the avatar currently being loaded and returns a cancellable for
+ * the next one */
+static GCancellable *
+contact_restart_avatar_load (EmpathyContact *contact)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+
+  contact_cancel_avatar_load (contact);
+  priv->avatar_cancellable = g_cancellable_new ();
+
+  return priv->avatar_cancellable;
+}
+
+typedef struct
+{
+  gchar *mime;
+  GCancellable *cancellable;
+} AvatarLoadData;
+
+static void
+avatar_load_data_free (AvatarLoadData *data)
+{
+  g_free (data->mime);
+  g_object_unref (data->cancellable);
+  g_slice_free (AvatarLoadData, data);
+}
+
+/* @user_data: a TpWeakRef on the contact, with an AvatarLoadData as
+ * user data */
+static void
+contact_avatar_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpWeakRef *wr = user_data;
+  AvatarLoadData *load_data = tp_weak_ref_get_user_data (wr);
+  EmpathyContact *contact;
+  EmpathyContactPriv *priv;
+  EmpathyAvatar *avatar;
+  gchar *data;
+  gsize len;
+  gchar *path;
+  GError *error = NULL;
+
+  if (!g_file_load_contents_finish (G_FILE (source), result, &data, &len,
+        NULL, &error))
+    {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (error);
+          tp_weak_ref_destroy (wr);
+          return;
+        }
+
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        DEBUG ("Failed to load avatar: %s", error->message);
+
+      g_clear_error (&error);
+      data = NULL;
+    }
+
+  contact = tp_weak_ref_dup_object (wr);
+  if (contact == NULL)
+    goto out;
+
+  priv = GET_PRIV (contact);
+
+  /* A newer avatar is being loaded */
+  if (priv->avatar_cancellable != load_data->cancellable)
+    {
+      g_object_unref (contact);
+      goto out;
+    }
+
+  tp_clear_object (&priv->avatar_cancellable);
+
+  /* Don't keep showing the previous avatar */
+  if (data == NULL)
+    {
+      contact_set_avatar (contact, NULL);
+      g_object_unref (contact);
+      goto out;
+    }
+
+  path = g_file_get_path (G_FILE (source));
+  DEBUG ("Avatar loaded from %s", path);
+
+  avatar = empathy_avatar_new ((guchar *) data, len, load_data->mime, path);
+  contact_set_avatar (contact, avatar);
+
+  empathy_avatar_unref (avatar);
+  g_free (path);
+  g_object_unref (contact);
+
+out:
+  g_free (data);
+  tp_weak_ref_destroy (wr);
+}
+
+/* Load the avatar from @file without blocking; the current avatar (or
+ * the lack of one) is kept until it's loaded, and dropped if loading
+ * fails */
+static void
+contact_load_avatar_async (EmpathyContact *contact,
+    GFile *file,
+    const gchar *mime)
+{
+  AvatarLoadData *data;
+
+  data = g_slice_new0 (AvatarLoadData);
+  data->mime = g_strdup (mime);
+  data->cancellable = g_object_ref (contact_restart_avatar_load (contact));
+
+  g_file_load_contents_async (file, data->cancellable,
+      contact_avatar_loaded_cb,
+      tp_weak_ref_new (contact, data, (GDestroyNotify) avatar_load_data_free));
 }
 
 TpAccount *
@@ -1333,76 +1523,82 @@ empathy_contact_can_do_action (EmpathyContact *self,
   return (sensitivity ? TRUE : FALSE);
 }
 
+static const gchar *
+contact_get_avatar_dir (TpAccount *account)
+{
+  const gchar *path = tp_proxy_get_object_path (account);
+  gchar *avatar_dir;
+
+  if (avatar_dirs == NULL)
+    avatar_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
+
+  avatar_dir = g_hash_table_lookup (avatar_dirs, path);
+  if (avatar_dir != NULL)
+    return avatar_dir;
+
+  avatar_dir = g_build_filename (g_get_user_cache_dir (),
+      "telepathy",
+      "avatars",
+      tp_account_get_cm_name (account),
+      tp_account_get_protocol_name (account),
+      NULL);
+  g_mkdir_with_parents (avatar_dir, 0700);
+
+  g_hash_table_insert (avatar_dirs, g_strdup (path), avatar_dir);
+
+  return avatar_dir;
+}
+
 static gchar *
 contact_get_avatar_filename (EmpathyContact *contact,
                              const gchar *token)
 {
   TpAccount *account;
-  gchar *avatar_path;
   gchar *avatar_file;
   gchar *token_escaped;
 
   if (EMP_STR_EMPTY (empathy_contact_get_id (contact)))
     return NULL;
 
-  token_escaped = tp_escape_as_identifier (token);
   account = empathy_contact_get_account (contact);
+  if (account == NULL)
+    return NULL;
 
-  avatar_path = g_build_filename (g_get_user_cache_dir (),
-      "telepathy",
-      "avatars",
-      tp_account_get_cm_name (account),
-      tp_account_get_protocol_name (account),
-      NULL);
-  g_mkdir_with_parents (avatar_path, 0700);
+  token_escaped = tp_escape_as_identifier (token);
 
-  avatar_file = g_build_filename (avatar_path, token_escaped, NULL);
+  avatar_file = g_build_filename (contact_get_avatar_dir (account),
+      token_escaped, NULL);
 
   g_free (token_escaped);
-  g_free (avatar_path);
 
   return avatar_file;
 }
 
-static gboolean
+static void
 contact_load_avatar_cache (EmpathyContact *contact,
                            const gchar *token)
 {
-  EmpathyAvatar *avatar = NULL;
   gchar *filename;
-  gchar *data = NULL;
-  gsize len;
-  GError *error = NULL;
+  GFile *file;
 
-  g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), FALSE);
-  g_return_val_if_fail (!EMP_STR_EMPTY (token), FALSE);
+  g_return_if_fail (EMPATHY_IS_CONTACT (contact));
+  g_return_if_fail (!EMP_STR_EMPTY (token));
 
-  /* Load the avatar from file if it exists */
+  /* Load the avatar from the cache if it's there. A missing file just
+   * leaves the contact without avatar. */
   filename = contact_get_avatar_filename (contact, token);
-  if (filename && g_file_test (filename, G_FILE_TEST_EXISTS))
-    {
-      if (!g_file_get_contents (filename, &data, &len, &error))
-        {
-          DEBUG ("Failed to load avatar from cache: %s",
-            error ? error->message : "No error given");
-          g_clear_error (&error);
-        }
-    }
+  if (filename == NULL)
+    return;
 
-  if (data != NULL)
-    {
-      DEBUG ("Avatar loaded from %s", filename);
-      avatar = empathy_avatar_new ((guchar *) data, len, NULL, filename);
-      contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
-    }
+  file = g_file_new_for_path (filename);
+  contact_load_avatar_async (contact, file, NULL);
 
-  g_free (data);
+  g_object_unref (file);
   g_free (filename);
-
-  return data != NULL;
 }
 
+
 GType
 empathy_avatar_get_type (void)
 {
@@ -1747,35 +1943,14 @@ contact_set_avatar_from_tp_contact (EmpathyContact *contact)
   mime = tp_contact_get_avatar_mime_type (priv->tp_contact);
   file = tp_contact_get_avatar_file (priv->tp_contact);
 
-  if (file != NULL)
+  if (file == NULL)
     {
-      EmpathyAvatar *avatar;
-      gchar *data;
-      gsize len;
-      gchar *path;
-      GError *error = NULL;
-
-      if (!g_file_load_contents (file, NULL, &data, &len, NULL, &error))
-        {
-          DEBUG ("Failed to load avatar: %s", error->message);
-
-          g_error_free (error);
-          contact_set_avatar (contact, NULL);
-          return;
-        }
-
-      path = g_file_get_path (file);
-
-      avatar = empathy_avatar_new ((guchar *) data, len, mime, path);
-
-      contact_set_avatar (contact, avatar);
-      empathy_avatar_unref (avatar);
-      g_free (path);
-      g_free (data);
+      contact_cancel_avatar_load (contact);
+      contact_set_avatar (contact, NULL);
     }
   else
     {
-      contact_set_avatar (contact, NULL);
+      contact_load_avatar_async (contact, file, mime);
     }
 }
 
@@ -23,6 +23,8 @@
 
 #include "config.h"
 
+#include <math.h>
+
 #include <glib.h>
 #include <glib/gi18n-lib.h>
 #include <telepathy-glib/account-channel-request.h>
@@ -31,7 +33,6 @@
 #include <telepathy-glib/interfaces.h>
 
 #include "empathy-ft-handler.h"
-#include "empathy-time.h"
 #include "empathy-utils.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
@@ -74,7 +75,24 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* Size of the chunks read when hashing a file */
+#define HASH_BUFFER_SIZE (256 * 1024)
+
+/* Minimum interval between two ::hashing-progress signals, in microseconds */
+#define HASHING_PROGRESS_INTERVAL (G_USEC_PER_SEC / 4)
+
+/* Throughput estimation. Progress notifications closer than
+ * RATE_MIN_INTERVAL are merged into a single sample, and the smoothed speed
+ * forgets older samples with a time constant of RATE_TIME_CONSTANT. All in
+ * microseconds. */
+#define RATE_MIN_INTERVAL (G_USEC_PER_SEC / 10)
+#define RATE_TIME_CONSTANT (3 * G_USEC_PER_SEC)
+/* One speed sample per second is kept for the last minute */
+#define RATE_HISTORY_INTERVAL G_USEC_PER_SEC
+#define RATE_HISTORY_LENGTH 60
+/* The transfer is considered stalled after this many seconds without
+ * progress */
+#define STALL_TIMEOUT 5
 
 enum {
   PROP_CHANNEL = 1,
@@ -105,11 +123,17 @@ typedef struct {
   GError *error /* comment to make the style checker happy */;
   guchar *buffer;
   GChecksum *checksum;
-  gssize total_read;
+  guint64 total_read;
   guint64 total_bytes;
   EmpathyFTHandler *handler;
 } HashingData;
 
+typedef struct {
+  EmpathyFTHandler *handler;
+  guint64 total_read;
+  guint64 total_bytes;
+} HashingProgressData;
+
 typedef struct {
   EmpathyFTHandlerReadyCallback callback;
   gpointer user_data;
@@ -141,18 +165,37 @@ typedef struct {
 
   gint64 user_action_time;
 
-  /* time and speed */
+  /* time and speed, times are from g_get_monotonic_time() */
+  gint64 transfer_start_time;
+  gint64 last_sample_time;
+  guint64 last_sample_bytes;
+  gint64 last_history_time;
+  /* bytes per second: over the last sample, smoothed, and since the start */
+  gdouble instant_speed;
   gdouble speed;
   guint remaining_time;
-  gint64 last_update_time;
+  gboolean stalled;
+  guint stall_check_id;
+  /* (gdouble) smoothed speeds, oldest first */
+  GArray *speed_history;
 
   gboolean is_completed;
+
+  /* incoming transfers: checksum of the destination file, computed while
+   * it is being written */
+  HashingData *incoming_hash;
+  /* TRUE while incoming_hash has a pending I/O operation */
+  gboolean incoming_hash_busy;
+  /* G_FILE_ATTRIBUTE_ID_FILE of the file being hashed, and whether it was
+   * checked to still be the destination once the transfer completed */
+  gchar *incoming_hash_id;
+  gboolean incoming_hash_checked;
 } EmpathyFTHandlerPriv;
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
-static gboolean do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable, gpointer user_data);
+static void hash_data_free (HashingData *data);
+static void stop_stall_check (EmpathyFTHandler *handler);
 
 /* GObject implementations */
 static void
@@ -282,6 +325,14 @@ do_dispose (GObject *object)
       priv->request = NULL;
     }
 
+  if (priv->incoming_hash != NULL)
+    {
+      hash_data_free (priv->incoming_hash);
+      priv->incoming_hash = NULL;
+    }
+
+  stop_stall_check (EMPATHY_FT_HANDLER (object));
+
   G_OBJECT_CLASS (empathy_ft_handler_parent_class)->dispose (object);
 }
 
@@ -304,6 +355,11 @@ do_finalize (GObject *object)
   g_free (priv->content_hash);
   priv->content_hash = NULL;
 
+  g_free (priv->incoming_hash_id);
+  priv->incoming_hash_id = NULL;
+
+  g_array_unref (priv->speed_history);
+
   G_OBJECT_CLASS (empathy_ft_handler_parent_class)->finalize (object);
 }
 
@@ -484,7 +540,8 @@ empathy_ft_handler_class_init (EmpathyFTHandlerClass *klass)
    * @total_bytes: the total bytes of the handler
    * @remaining_time: the number of seconds remaining for the transfer
    * to be completed
-   * @speed: the current speed of the transfer (in KB/s)
+   * @speed: the current speed of the transfer, smoothed over the last few
+   * seconds (in bytes per second)
    *
    * This signal is emitted to notify clients of the progress of the
    * transfer.
@@ -551,6 +608,8 @@ empathy_ft_handler_init (EmpathyFTHandler *self)
 
   self->priv = priv;
   priv->cancellable = g_cancellable_new ();
+  priv->speed_history = g_array_sized_new (FALSE, FALSE, sizeof (gdouble),
+      RATE_HISTORY_LENGTH);
 }
 
 /* private functions */
@@ -601,38 +660,330 @@ tp_file_hash_to_g_checksum (TpFileHashType type)
 }
 
 static void
-check_hash_incoming (EmpathyFTHandler *handler)
+emit_error_signal (EmpathyFTHandler *handler,
+    const GError *error)
 {
-  HashingData *hash_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
 
-  if (!EMP_STR_EMPTY (priv->content_hash))
+  DEBUG ("Error in transfer: %s\n", error->message);
+
+  if (!g_cancellable_is_cancelled (priv->cancellable))
+    g_cancellable_cancel (priv->cancellable);
+
+  g_signal_emit (handler, signals[TRANSFER_ERROR], 0, error);
+}
+
+/* Incoming transfers are hashed while they are being received: each time
+ * the channel reports new transferred bytes, they are read back from the
+ * destination file, which should still be in the page cache, so the file
+ * doesn't have to be read again once the transfer is done.
+ *
+ * If the destination already existed, it's written to a temporary file
+ * which only replaces it once the transfer is done, so what was read was
+ * the old file. That's detected by comparing the file ids once completed,
+ * in which case the new file is hashed again from scratch. */
+
+static void incoming_hash_feed (EmpathyFTHandler *handler);
+
+static void
+incoming_hash_done (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  const gchar *hash;
+
+  hash = g_checksum_get_string (priv->incoming_hash->checksum);
+
+  DEBUG ("Got file hash %s", hash);
+
+  if (g_strcmp0 (hash, priv->content_hash))
     {
-      hash_data = g_slice_new0 (HashingData);
-      hash_data->total_bytes = priv->total_bytes;
-      hash_data->handler = g_object_ref (handler);
-      hash_data->checksum = g_checksum_new
-        (tp_file_hash_to_g_checksum (priv->content_hash_type));
+      GError *error;
 
-      g_signal_emit (handler, signals[HASHING_STARTED], 0);
+      DEBUG ("Hash mismatch when checking incoming handler: "
+             "received %s, calculated %s", priv->content_hash, hash);
 
-      g_io_scheduler_push_job (do_hash_job_incoming, hash_data, NULL,
-                               G_PRIORITY_DEFAULT, priv->cancellable);
+      error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
+          EMPATHY_FT_ERROR_HASH_MISMATCH,
+          _("File transfer completed, but the file was corrupted"));
+
+      emit_error_signal (handler, error);
+      g_error_free (error);
+    }
+  else
+    {
+      DEBUG ("Hash verification matched, received %s, calculated %s",
+             priv->content_hash, hash);
+
+      g_signal_emit (handler, signals[HASHING_DONE], 0);
     }
+
+  hash_data_free (priv->incoming_hash);
+  priv->incoming_hash = NULL;
 }
 
 static void
-emit_error_signal (EmpathyFTHandler *handler,
-    const GError *error)
+incoming_hash_read_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
 {
+  EmpathyFTHandler *handler = user_data;
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+  GError *error = NULL;
+  gssize bytes_read;
 
-  DEBUG ("Error in transfer: %s\n", error->message);
+  priv->incoming_hash_busy = FALSE;
 
-  if (!g_cancellable_is_cancelled (priv->cancellable))
-    g_cancellable_cancel (priv->cancellable);
+  bytes_read = g_input_stream_read_finish (G_INPUT_STREAM (source), result,
+      &error);
 
-  g_signal_emit (handler, signals[TRANSFER_ERROR], 0, error);
+  if (hash_data == NULL)
+    goto out;
+
+  if (bytes_read < 0)
+    {
+      /* the transfer has already failed if it's cancelled */
+      if (!g_cancellable_is_cancelled (priv->cancellable))
+        emit_error_signal (handler, error);
+
+      g_error_free (error);
+
+      hash_data_free (priv->incoming_hash);
+      priv->incoming_hash = NULL;
+      goto out;
+    }
+
+  g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
+  hash_data->total_read += bytes_read;
+
+  if (priv->is_completed)
+    {
+      g_signal_emit (handler, signals[HASHING_PROGRESS], 0,
+          hash_data->total_read, hash_data->total_bytes);
+
+      /* the file is shorter than announced, its hash can't match; unless
+       * it's not the destination anymore, which the check will tell */
+      if (bytes_read == 0 && priv->incoming_hash_checked)
+        {
+          incoming_hash_done (handler);
+          goto out;
+        }
+    }
+  else if (bytes_read == 0)
+    {
+      /* the received bytes have not been written yet, try again when
+       * more are received */
+      goto out;
+    }
+
+  incoming_hash_feed (handler);
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+incoming_hash_stream_info_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInfo *info;
+  GError *error = NULL;
+
+  priv->incoming_hash_busy = FALSE;
+
+  info = g_file_input_stream_query_info_finish (G_FILE_INPUT_STREAM (source),
+      result, &error);
+
+  if (info == NULL)
+    {
+      DEBUG ("Failed to get the id of the destination: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_free (priv->incoming_hash_id);
+      priv->incoming_hash_id = g_strdup (g_file_info_get_attribute_string (
+            info, G_FILE_ATTRIBUTE_ID_FILE));
+      g_object_unref (info);
+    }
+
+  incoming_hash_feed (handler);
+
+  g_object_unref (handler);
+}
+
+static void
+incoming_hash_open_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  GFileInputStream *stream;
+  GError *error = NULL;
+
+  priv->incoming_hash_busy = FALSE;
+
+  stream = g_file_read_finish (G_FILE (source), result, &error);
+
+  if (priv->incoming_hash == NULL)
+    {
+      g_clear_error (&error);
+      tp_clear_object (&stream);
+      goto out;
+    }
+
+  if (stream == NULL)
+    {
+      /* the file may not have been created yet; only give up once the
+       * transfer is done */
+      if (priv->is_completed &&
+          !g_cancellable_is_cancelled (priv->cancellable))
+        {
+          emit_error_signal (handler, error);
+
+          hash_data_free (priv->incoming_hash);
+          priv->incoming_hash = NULL;
+        }
+
+      g_error_free (error);
+      goto out;
+    }
+
+  priv->incoming_hash->stream = G_INPUT_STREAM (stream);
+
+  /* remember which file this is before reading from it */
+  priv->incoming_hash_busy = TRUE;
+  g_file_input_stream_query_info_async (stream, G_FILE_ATTRIBUTE_ID_FILE,
+      G_PRIORITY_DEFAULT, priv->cancellable, incoming_hash_stream_info_cb,
+      g_object_ref (handler));
+
+out:
+  g_object_unref (handler);
+}
+
+static void
+incoming_hash_check_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+  GFileInfo *info;
+  const gchar *id = NULL;
+
+  priv->incoming_hash_busy = FALSE;
+
+  info = g_file_query_info_finish (G_FILE (source), result, NULL);
+
+  if (hash_data == NULL)
+    goto out;
+
+  priv->incoming_hash_checked = TRUE;
+
+  if (info != NULL)
+    id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
+
+  /* if either id is unknown, there's no telling what was hashed */
+  if (id == NULL || tp_strdiff (id, priv->incoming_hash_id))
+    {
+      DEBUG ("Destination was replaced while it was hashed, hashing it "
+          "again");
+
+      tp_clear_object (&hash_data->stream);
+      g_checksum_reset (hash_data->checksum);
+      hash_data->total_read = 0;
+
+      g_free (priv->incoming_hash_id);
+      priv->incoming_hash_id = NULL;
+    }
+
+  incoming_hash_feed (handler);
+
+out:
+  tp_clear_object (&info);
+  g_object_unref (handler);
+}
+
+/* Hash the bytes received since the previous call, if any */
+static void
+incoming_hash_feed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data = priv->incoming_hash;
+  guint64 available;
+
+  if (hash_data == NULL || priv->incoming_hash_busy ||
+      g_cancellable_is_cancelled (priv->cancellable))
+    return;
+
+  if (hash_data->stream == NULL)
+    {
+      priv->incoming_hash_busy = TRUE;
+      g_file_read_async (priv->gfile, G_PRIORITY_DEFAULT, priv->cancellable,
+          incoming_hash_open_cb, g_object_ref (handler));
+      return;
+    }
+
+  if (priv->is_completed && !priv->incoming_hash_checked)
+    {
+      priv->incoming_hash_busy = TRUE;
+      g_file_query_info_async (priv->gfile, G_FILE_ATTRIBUTE_ID_FILE,
+          G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, priv->cancellable,
+          incoming_hash_check_cb, g_object_ref (handler));
+      return;
+    }
+
+  if (priv->is_completed)
+    available = hash_data->total_bytes - hash_data->total_read;
+  else
+    available = priv->transferred_bytes - hash_data->total_read;
+
+  if (available == 0)
+    {
+      if (priv->is_completed)
+        incoming_hash_done (handler);
+
+      return;
+    }
+
+  priv->incoming_hash_busy = TRUE;
+  g_input_stream_read_async (hash_data->stream, hash_data->buffer,
+      MIN (available, HASH_BUFFER_SIZE), G_PRIORITY_DEFAULT,
+      priv->cancellable, incoming_hash_read_cb, g_object_ref (handler));
+}
+
+static void
+incoming_hash_start (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+  HashingData *hash_data;
+
+  hash_data = g_slice_new0 (HashingData);
+  hash_data->total_bytes = priv->total_bytes;
+  hash_data->buffer = g_malloc (HASH_BUFFER_SIZE);
+  hash_data->checksum = g_checksum_new
+    (tp_file_hash_to_g_checksum (priv->content_hash_type));
+
+  priv->incoming_hash = hash_data;
+}
+
+static void
+check_hash_incoming (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (priv->incoming_hash == NULL)
+    return;
+
+  g_signal_emit (handler, signals[HASHING_STARTED], 0);
+
+  /* finish hashing what hasn't been yet, if anything */
+  incoming_hash_feed (handler);
 }
 
 static void
@@ -640,28 +991,82 @@ update_remaining_time_and_speed (EmpathyFTHandler *handler,
     guint64 transferred_bytes)
 {
   EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  gint64 elapsed_time, current_time;
-  guint64 transferred, last_transferred_bytes;
-  gdouble speed;
-  gint remaining_time;
+  gint64 now, elapsed;
+  gdouble instant_speed, weight;
 
-  last_transferred_bytes = priv->transferred_bytes;
   priv->transferred_bytes = transferred_bytes;
 
-  current_time = empathy_time_get_current ();
-  elapsed_time = current_time - priv->last_update_time;
+  now = g_get_monotonic_time ();
+  elapsed = now - priv->last_sample_time;
+
+  if (elapsed < RATE_MIN_INTERVAL)
+    return;
+
+  instant_speed = (gdouble) (transferred_bytes - priv->last_sample_bytes) *
+    G_USEC_PER_SEC / elapsed;
+
+  /* Exponentially weighted moving average, weighting each sample by how
+   * long it lasted so irregular notifications don't bias the result */
+  if (priv->speed <= 0)
+    weight = 1;
+  else
+    weight = 1 - exp (- (gdouble) elapsed / RATE_TIME_CONSTANT);
+
+  priv->instant_speed = instant_speed;
+  priv->speed += weight * (instant_speed - priv->speed);
+  priv->last_sample_time = now;
+  priv->last_sample_bytes = transferred_bytes;
+
+  if (priv->speed > 0)
+    priv->remaining_time =
+      (priv->total_bytes - transferred_bytes) / priv->speed;
 
-  if (elapsed_time >= 1)
+  if (now - priv->last_history_time >= RATE_HISTORY_INTERVAL)
     {
-      transferred = transferred_bytes - last_transferred_bytes;
-      speed = (gdouble) transferred / (gdouble) elapsed_time;
-      remaining_time = (priv->total_bytes - priv->transferred_bytes) / speed;
-      priv->speed = speed;
-      priv->remaining_time = remaining_time;
-      priv->last_update_time = current_time;
+      if (priv->speed_history->len >= RATE_HISTORY_LENGTH)
+        g_array_remove_index (priv->speed_history, 0);
+
+      g_array_append_val (priv->speed_history, priv->speed);
+      priv->last_history_time = now;
     }
 }
 
+static void
+stop_stall_check (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (priv->stall_check_id != 0)
+    {
+      g_source_remove (priv->stall_check_id);
+      priv->stall_check_id = 0;
+    }
+}
+
+static gboolean
+stall_check_cb (gpointer user_data)
+{
+  EmpathyFTHandler *handler = user_data;
+  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
+
+  if (priv->stalled || priv->is_completed ||
+      g_get_monotonic_time () - priv->last_sample_time <
+        STALL_TIMEOUT * G_USEC_PER_SEC)
+    return TRUE;
+
+  DEBUG ("No progress for %d seconds, transfer stalled", STALL_TIMEOUT);
+
+  priv->stalled = TRUE;
+  priv->instant_speed = 0;
+  priv->speed = 0;
+
+  g_signal_emit (handler, signals[TRANSFER_PROGRESS], 0,
+      priv->transferred_bytes, priv->total_bytes, priv->remaining_time,
+      priv->speed);
+
+  return TRUE;
+}
+
 static void
 ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
     GParamSpec *pspec,
@@ -675,19 +1080,29 @@ ft_transfer_transferred_bytes_cb (TpFileTransferChannel *channel,
 
   bytes = tp_file_transfer_channel_get_transferred_bytes (channel);
 
-  if (priv->transferred_bytes == 0)
+  if (priv->transfer_start_time == 0)
     {
-      priv->last_update_time = empathy_time_get_current ();
+      priv->transfer_start_time = g_get_monotonic_time ();
+      priv->last_sample_time = priv->transfer_start_time;
+      priv->last_sample_bytes = priv->transferred_bytes;
+      priv->last_history_time = priv->transfer_start_time;
+
+      priv->stall_check_id = g_timeout_add_seconds (1, stall_check_cb,
+          handler);
+
       g_signal_emit (handler, signals[TRANSFER_STARTED], 0, channel);
     }
 
   if (priv->transferred_bytes != bytes)
     {
+      priv->stalled = FALSE;
       update_remaining_time_and_speed (handler, bytes);
 
       g_signal_emit (handler, signals[TRANSFER_PROGRESS], 0,
           bytes, priv->total_bytes, priv->remaining_time,
           priv->speed);
+
+      incoming_hash_feed (handler);
     }
 }
 
@@ -774,6 +1189,8 @@ ft_transfer_state_cb (TpFileTransferChannel *channel,
 
   if (state == TP_FILE_TRANSFER_STATE_COMPLETED)
     {
+      stop_stall_check (handler);
+
       priv->is_completed = TRUE;
       g_signal_emit (handler, signals[TRANSFER_DONE], 0, channel);
 
@@ -786,7 +1203,11 @@ ft_transfer_state_cb (TpFileTransferChannel *channel,
     }
   else if (state == TP_FILE_TRANSFER_STATE_CANCELLED)
     {
-      GError *error = error_from_state_change_reason (reason);
+      GError *error;
+
+      stop_stall_check (handler);
+
+      error = error_from_state_change_reason (reason);
       emit_error_signal (handler, error);
       g_clear_error (&error);
     }
@@ -904,36 +1325,12 @@ hash_job_done (gpointer user_data)
 
   DEBUG ("Got file hash %s", g_checksum_get_string (hash_data->checksum));
 
-  if (empathy_ft_handler_is_incoming (handler))
-    {
-      if (g_strcmp0 (g_checksum_get_string (hash_data->checksum),
-                     priv->content_hash))
-        {
-          DEBUG ("Hash mismatch when checking incoming handler: "
-                 "received %s, calculated %s", priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
-
-          error = g_error_new_literal (EMPATHY_FT_ERROR_QUARK,
-              EMPATHY_FT_ERROR_HASH_MISMATCH,
-              _("File transfer completed, but the file was corrupted"));
-          goto cleanup;
-        }
-      else
-        {
-          DEBUG ("Hash verification matched, received %s, calculated %s",
-                 priv->content_hash,
-                 g_checksum_get_string (hash_data->checksum));
-        }
-    }
-  else
-    {
-      /* set the checksum in the request...
-       * org.freedesktop.Telepathy.Channel.Type.FileTransfer.ContentHash
-       */
-      tp_asv_set_string (priv->request,
-          TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH,
-          g_checksum_get_string (hash_data->checksum));
-    }
+  /* set the checksum in the request...
+   * org.freedesktop.Telepathy.Channel.Type.FileTransfer.ContentHash
+   */
+  tp_asv_set_string (priv->request,
+      TP_PROP_CHANNEL_TYPE_FILE_TRANSFER_CONTENT_HASH,
+      g_checksum_get_string (hash_data->checksum));
 
 cleanup:
 
@@ -946,9 +1343,8 @@ cleanup:
     {
       g_signal_emit (handler, signals[HASHING_DONE], 0);
 
-      if (!empathy_ft_handler_is_incoming (handler))
-        /* the request is complete now, push it to the dispatcher */
-        ft_handler_push_to_dispatcher (handler);
+      /* the request is complete now, push it to the dispatcher */
+      ft_handler_push_to_dispatcher (handler);
     }
 
   hash_data_free (hash_data);
@@ -956,17 +1352,43 @@ cleanup:
   return FALSE;
 }
 
+static void
+hashing_progress_data_free (gpointer user_data)
+{
+  HashingProgressData *data = user_data;
+
+  g_object_unref (data->handler);
+  g_slice_free (HashingProgressData, data);
+}
+
 static gboolean
 emit_hashing_progress (gpointer user_data)
 {
-  HashingData *hash_data = user_data;
+  HashingProgressData *data = user_data;
 
-  g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
+  g_signal_emit (data->handler, signals[HASHING_PROGRESS], 0,
+      data->total_read, data->total_bytes);
 
   return FALSE;
 }
 
+static void
+send_hashing_progress (GIOSchedulerJob *job,
+    HashingData *hash_data)
+{
+  HashingProgressData *data;
+
+  /* hash_data keeps being updated by the hashing thread, so give the main
+   * loop a copy of the progress */
+  data = g_slice_new (HashingProgressData);
+  data->handler = g_object_ref (hash_data->handler);
+  data->total_read = hash_data->total_read;
+  data->total_bytes = hash_data->total_bytes;
+
+  g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
+      data, hashing_progress_data_free);
+}
+
 static gboolean
 do_hash_job (GIOSchedulerJob *job,
     GCancellable *cancellable,
@@ -974,35 +1396,37 @@ do_hash_job (GIOSchedulerJob *job,
 {
   HashingData *hash_data = user_data;
   gssize bytes_read;
+  gint64 last_progress = 0;
   GError *error = NULL;
 
-again:
+  /* the same buffer is used for the whole file */
   if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
-
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
-
-  hash_data->total_read += bytes_read;
+    hash_data->buffer = g_malloc (HASH_BUFFER_SIZE);
 
-  /* we now have the chunk */
-  if (bytes_read > 0)
+  while ((bytes_read = g_input_stream_read (hash_data->stream,
+              hash_data->buffer, HASH_BUFFER_SIZE, cancellable, &error)) > 0)
     {
-      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+      gint64 now;
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
+      hash_data->total_read += bytes_read;
 
-      goto again;
+      /* don't flood the main loop with progress notifications */
+      now = g_get_monotonic_time ();
+      if (now - last_progress >= HASHING_PROGRESS_INTERVAL)
+        {
+          send_hashing_progress (job, hash_data);
+          last_progress = now;
+        }
     }
-  else
-  {
-    g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
+
+  if (error != NULL)
+    goto out;
+
+  /* always report the final progress */
+  send_hashing_progress (job, hash_data);
+
+  g_input_stream_close (hash_data->stream, cancellable, &error);
 
 out:
   if (error != NULL)
@@ -1014,33 +1438,6 @@ out:
   return FALSE;
 }
 
-static gboolean
-do_hash_job_incoming (GIOSchedulerJob *job,
-    GCancellable *cancellable,
-    gpointer user_data)
-{
-  HashingData *hash_data = user_data;
-  EmpathyFTHandler *handler = hash_data->handler;
-  EmpathyFTHandlerPriv *priv = GET_PRIV (handler);
-  GError *error = NULL;
-
-  DEBUG ("checking integrity for incoming handler");
-
-  /* need to get the stream first */
-  hash_data->stream =
-    G_INPUT_STREAM (g_file_read (priv->gfile, cancellable, &error));
-
-  if (error != NULL)
-    {
-      hash_data->error = error;
-      g_io_scheduler_job_send_to_mainloop_async (job, hash_job_done,
-          hash_data, NULL);
-      return FALSE;
-    }
-
-  return do_hash_job (job, cancellable, user_data);
-}
-
 static void
 ft_handler_read_async_cb (GObject *source,
     GAsyncResult *res,
@@ -1455,6 +1852,9 @@ empathy_ft_handler_start_transfer (EmpathyFTHandler *handler)
     }
   else
     {
+      if (priv->use_hash)
+        incoming_hash_start (handler);
+
       /* TODO: add support for resume. */
       tp_file_transfer_channel_accept_file_async (priv->channel,
           priv->gfile, 0, ft_transfer_accept_cb, handler);
@@ -1732,3 +2132,142 @@ empathy_ft_handler_is_cancelled (EmpathyFTHandler *handler)
 
   return g_cancellable_is_cancelled (priv->cancellable);
 }
+
+/**
+ * empathy_ft_handler_get_speed:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns the current speed of the transfer, smoothed over the last few
+ * seconds. This is the speed used to estimate the remaining time.
+ *
+ * Return value: the speed of the transfer, in bytes per second
+ */
+gdouble
+empathy_ft_handler_get_speed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), 0);
+
+  priv = GET_PRIV (handler);
+
+  return priv->speed;
+}
+
+/**
+ * empathy_ft_handler_get_instant_speed:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns the speed of the transfer measured between the two last progress
+ * notifications.
+ *
+ * Return value: the instantaneous speed of the transfer, in bytes per second
+ */
+gdouble
+empathy_ft_handler_get_instant_speed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), 0);
+
+  priv = GET_PRIV (handler);
+
+  return priv->instant_speed;
+}
+
+/**
+ * empathy_ft_handler_get_average_speed:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns the average speed of the transfer since it started.
+ *
+ * Return value: the average speed of the transfer, in bytes per second
+ */
+gdouble
+empathy_ft_handler_get_average_speed (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+  gint64 elapsed;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), 0);
+
+  priv = GET_PRIV (handler);
+
+  if (priv->transfer_start_time == 0)
+    return 0;
+
+  elapsed = priv->last_sample_time - priv->transfer_start_time;
+  if (elapsed <= 0)
+    return 0;
+
+  return (gdouble) priv->last_sample_bytes * G_USEC_PER_SEC / elapsed;
+}
+
+/**
+ * empathy_ft_handler_get_remaining_time:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Return value: the estimated number of seconds before the transfer is
+ * completed, or 0 if it is not known yet
+ */
+guint
+empathy_ft_handler_get_remaining_time (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), 0);
+
+  priv = GET_PRIV (handler);
+
+  return priv->remaining_time;
+}
+
+/**
+ * empathy_ft_handler_is_stalled:
+ * @handler: an #EmpathyFTHandler
+ *
+ * Returns whether the transfer for @handler has been started but has not
+ * progressed for a few seconds. A ::transfer-progress signal is emitted when
+ * the transfer becomes stalled.
+ *
+ * Return value: %TRUE if the transfer for @handler is stalled, %FALSE
+ * otherwise
+ */
+gboolean
+empathy_ft_handler_is_stalled (EmpathyFTHandler *handler)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), FALSE);
+
+  priv = GET_PRIV (handler);
+
+  return priv->stalled;
+}
+
+/**
+ * empathy_ft_handler_get_speed_history:
+ * @handler: an #EmpathyFTHandler
+ * @n_samples: (out): return location for the number of samples
+ *
+ * Returns the smoothed speed of the transfer sampled every second, for up
+ * to the last minute.
+ *
+ * Return value: (array length=n_samples): the speeds, in bytes per second,
+ * oldest first. The array is owned by @handler and is only valid until its
+ * next ::transfer-progress signal.
+ */
+const gdouble *
+empathy_ft_handler_get_speed_history (EmpathyFTHandler *handler,
+    guint *n_samples)
+{
+  EmpathyFTHandlerPriv *priv;
+
+  g_return_val_if_fail (EMPATHY_IS_FT_HANDLER (handler), NULL);
+  g_return_val_if_fail (n_samples != NULL, NULL);
+
+  priv = GET_PRIV (handler);
+
+  *n_samples = priv->speed_history->len;
+  return (const gdouble *) priv->speed_history->data;
+}
@@ -109,6 +109,16 @@ guint64 empathy_ft_handler_get_total_bytes (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_completed (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_cancelled (EmpathyFTHandler *handler);
 
+/* throughput of the transfer */
+gdouble empathy_ft_handler_get_speed (EmpathyFTHandler *handler);
+gdouble empathy_ft_handler_get_instant_speed (EmpathyFTHandler *handler);
+gdouble empathy_ft_handler_get_average_speed (EmpathyFTHandler *handler);
+guint empathy_ft_handler_get_remaining_time (EmpathyFTHandler *handler);
+gboolean empathy_ft_handler_is_stalled (EmpathyFTHandler *handler);
+const gdouble * empathy_ft_handler_get_speed_history (
+    EmpathyFTHandler *handler,
+    guint *n_samples);
+
 G_END_DECLS
 
 #endif /* __EMPATHY_FT_HANDLER_H__ */
@@ -30,6 +30,8 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_AUTOCONNECT                  "autoconnect"
 #define EMPATHY_PREFS_AUTOAWAY                     "autoaway"
 #define EMPATHY_PREFS_FILE_TRANSFER_DEFAULT_FOLDER "file-transfer-default-folder"
+#define EMPATHY_PREFS_FILE_TRANSFER_MAX_ACTIVE     "file-transfer-max-active"
+#define EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING    "file-transfer-max-hashing"
 #define EMPATHY_PREFS_SANITY_CLEANING_NUMBER       "sanity-cleaning-number"
 
 #define EMPATHY_PREFS_NOTIFICATIONS_SCHEMA EMPATHY_PREFS_SCHEMA ".notifications"
@@ -68,6 +70,8 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_CHAT_WEBKIT_DEVELOPER_TOOLS  "enable-webkit-developer-tools"
 #define EMPATHY_PREFS_CHAT_ROOM_LAST_ACCOUNT       "room-last-account"
 #define EMPATHY_PREFS_CHAT_SEND_CHAT_STATES        "send-chat-states"
+#define EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT        "scrollback-limit"
+#define EMPATHY_PREFS_CHAT_BACKLOG_PAGE_SIZE       "backlog-page-size"
 
 #define EMPATHY_PREFS_UI_SCHEMA EMPATHY_PREFS_SCHEMA ".ui"
 #define EMPATHY_PREFS_UI_SEPARATE_CHAT_WINDOWS     "separate-chat-windows"
@@ -89,6 +93,10 @@ G_BEGIN_DECLS
 #define EMPATHY_PREFS_LOCATION_RESOURCE_GPS        "resource-gps"
 #define EMPATHY_PREFS_LOCATION_REDUCE_ACCURACY     "reduce-accuracy"
 
+#define EMPATHY_PREFS_DEBUG_SCHEMA EMPATHY_PREFS_SCHEMA ".debug"
+#define EMPATHY_PREFS_DEBUG_BUFFER_MAX_MESSAGES    "buffer-max-messages"
+#define EMPATHY_PREFS_DEBUG_BUFFER_MAX_SIZE        "buffer-max-size"
+
 #define EMPATHY_PREFS_LOGGER_SCHEMA "org.freedesktop.Telepathy.Logger"
 #define EMPATHY_PREFS_LOGGER_ENABLED "enabled"
 
@@ -55,6 +55,10 @@
 /* The constant DAY_IN_SECONDS represents the seconds in a day */
 #define DAY_IN_SECONDS 86400
 
+/* Popularities are cached and only recomputed on interactions and, to make
+ * old interactions expire, every POPULARITY_DECAY_INTERVAL seconds */
+#define POPULARITY_DECAY_INTERVAL 3600
+
 /* This class only stores and refs Individuals who contain an EmpathyContact.
  *
  * This class merely forwards along signals from the aggregator and individuals
@@ -65,8 +69,13 @@ typedef struct
   GHashTable *individuals; /* Individual.id -> Individual */
   gboolean contacts_loaded;
 
-  /* reffed FolksIndividual sorted by popularity (most popular first) */
+  /* owned PopularityEntry sorted by popularity (most popular first) */
   GSequence *individuals_pop;
+  /* FolksIndividual (borrowed) -> GSequenceIter of its PopularityEntry */
+  GHashTable *pop_iters;
+  /* Time, in seconds, popularities are computed for */
+  gint64 pop_timestamp;
+  guint pop_decay_id;
   /* The TOP_INDIVIDUALS_LEN first FolksIndividual (borrowed) from
    * individuals_pop */
   GList *top_individuals;
@@ -136,23 +145,35 @@ individual_notify_is_favourite_cb (FolksIndividual *individual,
 }
 
 
+typedef struct
+{
+  FolksIndividual *individual;
+  guint pop;
+} PopularityEntry;
+
+static void
+popularity_entry_free (PopularityEntry *entry)
+{
+  g_object_unref (entry->individual);
+  g_slice_free (PopularityEntry, entry);
+}
+
 /* Contacts that have been interacted with within the last 30 days and have
  * have an interaction count > INTERACTION_COUNT_COMPRESS_FACTOR have a
  * popularity value of the count/INTERACTION_COUNT_COMPRESS_FACTOR */
 static guint
-compute_popularity (FolksIndividual *individual)
+compute_popularity (FolksIndividual *individual,
+    gint64 current_timestamp)
 {
   FolksInteractionDetails *details = FOLKS_INTERACTION_DETAILS (individual);
   GDateTime *last;
-  guint  current_timestamp, count;
+  guint count;
   float timediff;
 
   last = folks_interaction_details_get_last_im_interaction_datetime (details);
   if (last == NULL)
     return 0;
 
-  /* Convert g_get_real_time () fro microseconds to seconds */
-  current_timestamp = g_get_real_time () / 1000000;
   timediff = current_timestamp - g_date_time_to_unix (last);
 
   if (timediff / DAY_IN_SECONDS > 30)
@@ -182,12 +203,11 @@ check_top_individuals (EmpathyIndividualManager *self)
    * still the same as the ones in top_individuals */
   for (i = 0; i < TOP_INDIVIDUALS_LEN && !g_sequence_iter_is_end (iter); i++)
     {
-      FolksIndividual *individual = g_sequence_get (iter);
-      guint pop;
+      PopularityEntry *entry = g_sequence_get (iter);
+      FolksIndividual *individual = entry->individual;
 
       /* Don't include individual having 0 as pop */
-      pop = compute_popularity (individual);
-      if (pop <= 0)
+      if (entry->pop == 0)
         break;
 
       if (!modified)
@@ -220,10 +240,12 @@ check_top_individuals (EmpathyIndividualManager *self)
       for (l = priv->top_individuals; l != NULL; l = g_list_next (l))
         {
           FolksIndividual *individual = l->data;
+          PopularityEntry *entry = g_sequence_get (
+              g_hash_table_lookup (priv->pop_iters, individual));
 
           DEBUG ("  %s (%u)",
               folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
-              compute_popularity (individual));
+              entry->pop);
         }
 
       g_object_notify (G_OBJECT (self), "top-individuals");
@@ -235,12 +257,12 @@ compare_individual_by_pop (gconstpointer a,
     gconstpointer b,
     gpointer user_data)
 {
-  guint pop_a, pop_b;
+  const PopularityEntry *entry_a = a, *entry_b = b;
 
-  pop_a = compute_popularity (FOLKS_INDIVIDUAL (a));
-  pop_b = compute_popularity (FOLKS_INDIVIDUAL (b));
+  if (entry_a->pop == entry_b->pop)
+    return 0;
 
-  return pop_b - pop_a;
+  return entry_a->pop > entry_b->pop ? -1 : 1;
 }
 
 static void
@@ -249,19 +271,69 @@ individual_notify_im_interaction_count (FolksIndividual *individual,
     EmpathyIndividualManager *self)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
+  PopularityEntry *entry;
+  guint pop;
 
-  /* We don't use g_sequence_sort_changed() because we'll first have to find
-   * the iter of @individual using g_sequence_lookup() but the lookup function
-   * won't work as it assumes that the sequence is sorted which is no longer
-   * the case at this point as @individual's popularity just changed. */
-  g_sequence_sort (priv->individuals_pop, compare_individual_by_pop, NULL);
+  iter = g_hash_table_lookup (priv->pop_iters, individual);
+  if (iter != NULL)
+    {
+      entry = g_sequence_get (iter);
+      pop = compute_popularity (individual, priv->pop_timestamp);
+
+      /* Only @individual moved, the rest of the sequence is still sorted */
+      if (pop != entry->pop)
+        {
+          entry->pop = pop;
+          g_sequence_sort_changed (iter, compare_individual_by_pop, NULL);
+        }
+    }
 
-  /* Only check for top individuals after 10 interaction events happen */
+  /* Every interaction counts, whether it changed the ranking or not.
+   * Only check for top individuals after 10 interaction events happen */
   if (priv->global_interaction_counter % 10 == 0)
     check_top_individuals (self);
   priv->global_interaction_counter++;
 }
 
+/* Interactions older than 30 days don't count, recompute all the
+ * popularities now and then so they expire */
+static gboolean
+popularity_decay_cb (gpointer user_data)
+{
+  EmpathyIndividualManager *self = user_data;
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GSequenceIter *iter;
+  gboolean changed = FALSE;
+
+  priv->pop_timestamp = g_get_real_time () / G_USEC_PER_SEC;
+
+  for (iter = g_sequence_get_begin_iter (priv->individuals_pop);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_iter_next (iter))
+    {
+      PopularityEntry *entry = g_sequence_get (iter);
+      guint pop;
+
+      pop = compute_popularity (entry->individual, priv->pop_timestamp);
+      if (pop != entry->pop)
+        {
+          entry->pop = pop;
+          changed = TRUE;
+        }
+    }
+
+  if (changed)
+    {
+      /* Iters stay valid when sorting */
+      g_sequence_sort (priv->individuals_pop, compare_individual_by_pop,
+          NULL);
+      check_top_individuals (self);
+    }
+
+  return TRUE;
+}
+
 static void
 add_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
 {
@@ -271,9 +343,20 @@ add_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
       g_strdup (folks_individual_get_id (individual)),
       g_object_ref (individual));
 
-  g_sequence_insert_sorted (priv->individuals_pop, g_object_ref (individual),
-      compare_individual_by_pop, NULL);
-  check_top_individuals (self);
+  if (g_hash_table_lookup (priv->pop_iters, individual) == NULL)
+    {
+      PopularityEntry *entry;
+      GSequenceIter *iter;
+
+      entry = g_slice_new (PopularityEntry);
+      entry->individual = g_object_ref (individual);
+      entry->pop = compute_popularity (individual, priv->pop_timestamp);
+
+      iter = g_sequence_insert_sorted (priv->individuals_pop, entry,
+          compare_individual_by_pop, NULL);
+      g_hash_table_insert (priv->pop_iters, individual, iter);
+      check_top_individuals (self);
+    }
 
   g_signal_connect (individual, "group-changed",
       G_CALLBACK (individual_group_changed_cb), self);
@@ -289,10 +372,10 @@ remove_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
   GSequenceIter *iter;
 
-  iter = g_sequence_lookup (priv->individuals_pop, individual,
-      compare_individual_by_pop, NULL);
+  iter = g_hash_table_lookup (priv->pop_iters, individual);
   if (iter != NULL)
     {
+      g_hash_table_remove (priv->pop_iters, individual);
       g_sequence_remove (iter);
       check_top_individuals (self);
     }
@@ -442,6 +525,12 @@ individual_manager_dispose (GObject *object)
   g_hash_table_unref (priv->individuals);
   tp_clear_object (&priv->aggregator);
 
+  if (priv->pop_decay_id != 0)
+    {
+      g_source_remove (priv->pop_decay_id);
+      priv->pop_decay_id = 0;
+    }
+
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->dispose (object);
 }
 
@@ -451,6 +540,7 @@ individual_manager_finalize (GObject *object)
   EmpathyIndividualManagerPriv *priv = GET_PRIV (object);
 
   g_sequence_free (priv->individuals_pop);
+  g_hash_table_unref (priv->pop_iters);
 
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->finalize (object);
 }
@@ -585,7 +675,12 @@ empathy_individual_manager_init (EmpathyIndividualManager *self)
   priv->individuals = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, g_object_unref);
 
-  priv->individuals_pop = g_sequence_new (g_object_unref);
+  priv->individuals_pop = g_sequence_new (
+      (GDestroyNotify) popularity_entry_free);
+  priv->pop_iters = g_hash_table_new (NULL, NULL);
+  priv->pop_timestamp = g_get_real_time () / G_USEC_PER_SEC;
+  priv->pop_decay_id = g_timeout_add_seconds (POPULARITY_DECAY_INTERVAL,
+      popularity_decay_cb, self);
 
   priv->aggregator = folks_individual_aggregator_new ();
   tp_g_signal_connect_object (priv->aggregator, "individuals-changed-detailed",
@@ -683,14 +683,32 @@ empathy_message_equal (EmpathyMessage *message1, EmpathyMessage *message2)
 	priv1 = GET_PRIV (message1);
 	priv2 = GET_PRIV (message2);
 
+	/* A NULL body is the same as an empty one, here and in
+	 * empathy_message_hash() */
 	if (priv1->timestamp == priv2->timestamp &&
-			!tp_strdiff (priv1->body, priv2->body)) {
+			!g_strcmp0 (priv1->body != NULL ? priv1->body : "",
+				priv2->body != NULL ? priv2->body : "")) {
 		return TRUE;
 	}
 
 	return FALSE;
 }
 
+/* Hash function consistent with empathy_message_equal(), to be used with
+ * it in a GHashTable */
+guint
+empathy_message_hash (gconstpointer message)
+{
+	EmpathyMessagePriv *priv;
+
+	g_return_val_if_fail (EMPATHY_IS_MESSAGE (message), 0);
+
+	priv = GET_PRIV (message);
+
+	return g_int64_hash (&priv->timestamp) ^
+		g_str_hash (priv->body != NULL ? priv->body : "");
+}
+
 TpChannelTextMessageFlags
 empathy_message_get_flags (EmpathyMessage *self)
 {
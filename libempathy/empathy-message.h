@@ -81,6 +81,7 @@ TpChannelTextMessageType empathy_message_type_from_str     (const gchar
 const gchar *            empathy_message_type_to_str       (TpChannelTextMessageType  type);
 
 gboolean                 empathy_message_equal (EmpathyMessage *message1, EmpathyMessage *message2);
+guint                    empathy_message_hash (gconstpointer message);
 
 TpChannelTextMessageFlags empathy_message_get_flags        (EmpathyMessage           *message);
 
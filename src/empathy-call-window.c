@@ -1822,26 +1822,20 @@ empathy_call_window_init (EmpathyCallWindow *self)
   gtk_toolbar_set_style (GTK_TOOLBAR (priv->toolbar), GTK_TOOLBAR_ICONS);
 }
 
-/* Instead of specifying a width and a height, we specify only one size. That's
-   because we want a square avatar icon.  */
 static void
-init_contact_avatar_with_size (EmpathyContact *contact,
-    GtkWidget *image_widget,
+set_contact_avatar (GtkWidget *image_widget,
+    GdkPixbuf *pixbuf_avatar,
     gint size)
 {
-  GdkPixbuf *pixbuf_avatar = NULL;
-
-  if (contact != NULL)
-    {
-      pixbuf_avatar = empathy_pixbuf_avatar_from_contact_scaled (contact,
-        size, size);
-    }
-
   if (pixbuf_avatar == NULL)
     {
       pixbuf_avatar = empathy_pixbuf_from_icon_name_sized (
           EMPATHY_IMAGE_AVATAR_DEFAULT, size);
     }
+  else
+    {
+      g_object_ref (pixbuf_avatar);
+    }
 
   gtk_image_set_from_pixbuf (GTK_IMAGE (image_widget), pixbuf_avatar);
 
@@ -1849,6 +1843,65 @@ init_contact_avatar_with_size (EmpathyContact *contact,
     g_object_unref (pixbuf_avatar);
 }
 
+static void
+contact_avatar_decoded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GtkWidget *image_widget = user_data;
+  GdkPixbuf *pixbuf_avatar;
+  GError *error = NULL;
+
+  pixbuf_avatar = empathy_pixbuf_avatar_from_contact_scaled_finish (
+      EMPATHY_CONTACT (source), result, &error);
+
+  /* A newer avatar is being decoded */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    goto out;
+
+  set_contact_avatar (image_widget, pixbuf_avatar,
+      GPOINTER_TO_INT (g_object_get_data (G_OBJECT (image_widget),
+          "avatar-size")));
+
+out:
+  g_clear_error (&error);
+  tp_clear_object (&pixbuf_avatar);
+  g_object_unref (image_widget);
+}
+
+/* Instead of specifying a width and a height, we specify only one size. That's
+   because we want a square avatar icon. The avatar is decoded from a thread;
+   the image keeps showing the previous one meanwhile. */
+static void
+init_contact_avatar_with_size (EmpathyContact *contact,
+    GtkWidget *image_widget,
+    gint size)
+{
+  GCancellable *cancellable;
+
+  cancellable = g_object_get_data (G_OBJECT (image_widget),
+      "avatar-cancellable");
+  if (cancellable != NULL)
+    g_cancellable_cancel (cancellable);
+
+  if (contact == NULL)
+    {
+      g_object_set_data (G_OBJECT (image_widget), "avatar-cancellable",
+          NULL);
+      set_contact_avatar (image_widget, NULL, size);
+      return;
+    }
+
+  cancellable = g_cancellable_new ();
+  g_object_set_data_full (G_OBJECT (image_widget), "avatar-cancellable",
+      cancellable, g_object_unref);
+  g_object_set_data (G_OBJECT (image_widget), "avatar-size",
+      GINT_TO_POINTER (size));
+
+  empathy_pixbuf_avatar_from_contact_scaled_async (contact, size, size,
+      cancellable, contact_avatar_decoded_cb, g_object_ref (image_widget));
+}
+
 static void
 set_window_title (EmpathyCallWindow *self)
 {
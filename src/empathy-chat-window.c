@@ -114,6 +114,9 @@ struct _EmpathyChatWindowPriv
   GSettings *gsettings_ui;
 
   EmpathySoundManager *sound_mgr;
+
+  /* Decoding of the avatar shown as window icon */
+  GCancellable *icon_cancellable;
 };
 
 static GList *chat_windows = NULL;
@@ -726,17 +729,49 @@ chat_window_title_update (EmpathyChatWindow *self)
   g_free (name);
 }
 
+static void
+chat_window_avatar_icon_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyChatWindow *self = user_data;
+  GdkPixbuf *icon;
+  GError *error = NULL;
+
+  icon = empathy_pixbuf_avatar_from_contact_scaled_finish (
+      EMPATHY_CONTACT (source), result, &error);
+
+  /* The window may be gone, or the icon updated again */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_error_free (error);
+      return;
+    }
+
+  g_clear_error (&error);
+
+  gtk_window_set_icon (GTK_WINDOW (self->priv->dialog), icon);
+
+  if (icon != NULL)
+    g_object_unref (icon);
+}
+
 static void
 chat_window_icon_update (EmpathyChatWindow *self,
     gboolean new_messages)
 {
-  GdkPixbuf *icon;
   EmpathyContact *remote_contact;
   gboolean avatar_in_icon;
   guint n_chats;
 
   n_chats = g_list_length (self->priv->chats);
 
+  if (self->priv->icon_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->priv->icon_cancellable);
+      tp_clear_object (&self->priv->icon_cancellable);
+    }
+
   /* Update window icon */
   if (new_messages)
     {
@@ -751,12 +786,10 @@ chat_window_icon_update (EmpathyChatWindow *self,
       if (n_chats == 1 && avatar_in_icon)
         {
           remote_contact = empathy_chat_get_remote_contact (self->priv->current_chat);
-          icon = empathy_pixbuf_avatar_from_contact_scaled (remote_contact,
-              0, 0);
-          gtk_window_set_icon (GTK_WINDOW (self->priv->dialog), icon);
-
-          if (icon != NULL)
-            g_object_unref (icon);
+          self->priv->icon_cancellable = g_cancellable_new ();
+          empathy_pixbuf_avatar_from_contact_scaled_async (remote_contact,
+              0, 0, self->priv->icon_cancellable, chat_window_avatar_icon_cb,
+              self);
         }
       else
         {
@@ -2210,6 +2243,12 @@ chat_window_finalize (GObject *object)
 
   DEBUG ("Finalized: %p", object);
 
+  if (self->priv->icon_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->priv->icon_cancellable);
+      tp_clear_object (&self->priv->icon_cancellable);
+    }
+
   g_object_unref (self->priv->ui_manager);
   g_object_unref (self->priv->chatroom_manager);
   g_object_unref (self->priv->notify_mgr);
@@ -0,0 +1,596 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A list-only GtkTreeModel storing the debug messages of a service in a ring
+ * buffer. Once the buffer is full, adding a message evicts the oldest one so
+ * the debugger's memory stays bounded however long it runs. */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "empathy-debug-buffer.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include <libempathy/empathy-debug.h>
+
+/* Number of slots allocated when the first message is added */
+#define INITIAL_SIZE 256
+
+typedef struct
+{
+  TpDebugMessage *msg;
+  /* Lowercased "domain/category: message", computed once so filtering
+   * doesn't have to fold every message again */
+  gchar *search_text;
+  GQuark domain;
+  GQuark category;
+} Entry;
+
+struct _EmpathyDebugBufferPrivate
+{
+  /* Circular array of entries, the oldest one at 'head' */
+  Entry *ring;
+  guint size;
+  guint head;
+  guint len;
+
+  /* Serial number of the message at 'head'. Iters store serials rather than
+   * slots, so evicting old messages doesn't invalidate them. */
+  guint first_serial;
+
+  /* Number of messages, starting from the oldest, exposed as rows. While
+   * paused, new messages are stored but stay hidden past this cursor. */
+  guint n_visible;
+  gboolean paused;
+
+  /* 0 means no limit */
+  guint max_messages;
+  gsize max_bytes;
+  gsize n_bytes;
+
+  gint stamp;
+};
+
+static void debug_buffer_tree_model_iface_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmpathyDebugBuffer, empathy_debug_buffer,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+        debug_buffer_tree_model_iface_init));
+
+#define RING_AT(priv, i) ((priv)->ring[((priv)->head + (i)) % (priv)->size])
+
+static void
+entry_init (Entry *entry,
+    TpDebugMessage *msg)
+{
+  const gchar *category = tp_debug_message_get_category (msg);
+  gchar *text;
+
+  text = g_strdup_printf ("%s%s%s: %s", tp_debug_message_get_domain (msg),
+      category != NULL ? "/" : "", category != NULL ? category : "",
+      tp_debug_message_get_message (msg));
+
+  entry->msg = g_object_ref (msg);
+  entry->search_text = g_utf8_strdown (text, -1);
+  entry->domain = g_quark_from_string (tp_debug_message_get_domain (msg));
+  entry->category = category != NULL ? g_quark_from_string (category) : 0;
+
+  g_free (text);
+}
+
+static void
+entry_clear (Entry *entry)
+{
+  tp_clear_object (&entry->msg);
+  tp_clear_pointer (&entry->search_text, g_free);
+}
+
+/* Rough amount of memory held by @entry. The search text is about as long
+ * as the message's strings. */
+static gsize
+entry_size (Entry *entry)
+{
+  return sizeof (Entry) + 64 /* the TpDebugMessage itself */ +
+    2 * strlen (entry->search_text);
+}
+
+static void
+debug_buffer_emit_row_inserted (EmpathyDebugBuffer *self,
+    guint index)
+{
+  GtkTreePath *path;
+  GtkTreeIter iter;
+
+  iter.stamp = self->priv->stamp;
+  iter.user_data = GUINT_TO_POINTER (self->priv->first_serial + index);
+
+  path = gtk_tree_path_new_from_indices (index, -1);
+  gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+  gtk_tree_path_free (path);
+}
+
+static void
+debug_buffer_evict_oldest (EmpathyDebugBuffer *self)
+{
+  EmpathyDebugBufferPrivate *priv = self->priv;
+  Entry entry;
+
+  g_assert (priv->len > 0);
+
+  entry = priv->ring[priv->head];
+  memset (&priv->ring[priv->head], 0, sizeof (Entry));
+  priv->head = (priv->head + 1) % priv->size;
+  priv->len--;
+  priv->first_serial++;
+  priv->n_bytes -= entry_size (&entry);
+
+  if (priv->n_visible > 0)
+    {
+      GtkTreePath *path;
+
+      priv->n_visible--;
+
+      path = gtk_tree_path_new_first ();
+      gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+      gtk_tree_path_free (path);
+    }
+
+  entry_clear (&entry);
+}
+
+static void
+debug_buffer_evict (EmpathyDebugBuffer *self,
+    gsize incoming_bytes)
+{
+  EmpathyDebugBufferPrivate *priv = self->priv;
+
+  while (priv->len > 0 &&
+      ((priv->max_messages > 0 && priv->len >= priv->max_messages) ||
+       (priv->max_bytes > 0 && priv->n_bytes + incoming_bytes > priv->max_bytes)))
+    debug_buffer_evict_oldest (self);
+}
+
+static void
+debug_buffer_grow (EmpathyDebugBuffer *self)
+{
+  EmpathyDebugBufferPrivate *priv = self->priv;
+  Entry *ring;
+  guint size, i;
+
+  size = MAX (priv->size * 2, INITIAL_SIZE);
+  if (priv->max_messages > 0)
+    size = MIN (size, priv->max_messages);
+
+  g_assert (size > priv->len);
+
+  ring = g_new0 (Entry, size);
+
+  for (i = 0; i < priv->len; i++)
+    ring[i] = RING_AT (priv, i);
+
+  g_free (priv->ring);
+  priv->ring = ring;
+  priv->size = size;
+  priv->head = 0;
+}
+
+static void
+debug_buffer_dispose (GObject *object)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (object);
+  EmpathyDebugBufferPrivate *priv = self->priv;
+  guint i;
+
+  for (i = 0; i < priv->len; i++)
+    entry_clear (&RING_AT (priv, i));
+
+  tp_clear_pointer (&priv->ring, g_free);
+  priv->size = priv->len = priv->n_visible = 0;
+  priv->n_bytes = 0;
+
+  G_OBJECT_CLASS (empathy_debug_buffer_parent_class)->dispose (object);
+}
+
+static void
+empathy_debug_buffer_class_init (EmpathyDebugBufferClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = debug_buffer_dispose;
+
+  g_type_class_add_private (klass, sizeof (EmpathyDebugBufferPrivate));
+}
+
+static void
+empathy_debug_buffer_init (EmpathyDebugBuffer *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_BUFFER, EmpathyDebugBufferPrivate);
+
+  self->priv->stamp = g_random_int ();
+}
+
+/* GtkTreeModel implementation */
+
+static gboolean
+debug_buffer_iter_to_index (EmpathyDebugBuffer *self,
+    GtkTreeIter *iter,
+    guint *index)
+{
+  guint i;
+
+  g_return_val_if_fail (iter->stamp == self->priv->stamp, FALSE);
+
+  /* unsigned arithmetic copes with the serials wrapping around */
+  i = GPOINTER_TO_UINT (iter->user_data) - self->priv->first_serial;
+  if (i >= self->priv->n_visible)
+    return FALSE;
+
+  *index = i;
+  return TRUE;
+}
+
+static gboolean
+debug_buffer_index_to_iter (EmpathyDebugBuffer *self,
+    guint index,
+    GtkTreeIter *iter)
+{
+  if (index >= self->priv->n_visible)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  iter->stamp = self->priv->stamp;
+  iter->user_data = GUINT_TO_POINTER (self->priv->first_serial + index);
+  return TRUE;
+}
+
+static GtkTreeModelFlags
+debug_buffer_get_flags (GtkTreeModel *model)
+{
+  return GTK_TREE_MODEL_ITERS_PERSIST | GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+debug_buffer_get_n_columns (GtkTreeModel *model)
+{
+  return EMPATHY_DEBUG_BUFFER_N_COLUMNS;
+}
+
+static GType
+debug_buffer_get_column_type (GtkTreeModel *model,
+    gint column)
+{
+  switch (column)
+    {
+      case EMPATHY_DEBUG_BUFFER_COL_MESSAGE:
+        return TP_TYPE_DEBUG_MESSAGE;
+      case EMPATHY_DEBUG_BUFFER_COL_SEARCH_TEXT:
+        return G_TYPE_STRING;
+      case EMPATHY_DEBUG_BUFFER_COL_DOMAIN:
+      case EMPATHY_DEBUG_BUFFER_COL_CATEGORY:
+      case EMPATHY_DEBUG_BUFFER_COL_LEVEL:
+        return G_TYPE_UINT;
+      default:
+        g_return_val_if_reached (G_TYPE_INVALID);
+    }
+}
+
+static gboolean
+debug_buffer_get_iter (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreePath *path)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+
+  g_return_val_if_fail (gtk_tree_path_get_depth (path) > 0, FALSE);
+
+  if (gtk_tree_path_get_depth (path) > 1)
+    return FALSE;
+
+  return debug_buffer_index_to_iter (self,
+      gtk_tree_path_get_indices (path)[0], iter);
+}
+
+static GtkTreePath *
+debug_buffer_get_path (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  guint index;
+
+  if (!debug_buffer_iter_to_index (self, iter, &index))
+    return NULL;
+
+  return gtk_tree_path_new_from_indices (index, -1);
+}
+
+static void
+debug_buffer_get_value (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gint column,
+    GValue *value)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  Entry *entry;
+  guint index;
+
+  g_value_init (value, debug_buffer_get_column_type (model, column));
+
+  if (!debug_buffer_iter_to_index (self, iter, &index))
+    return;
+
+  entry = &RING_AT (self->priv, index);
+
+  switch (column)
+    {
+      case EMPATHY_DEBUG_BUFFER_COL_MESSAGE:
+        g_value_set_object (value, entry->msg);
+        break;
+      case EMPATHY_DEBUG_BUFFER_COL_SEARCH_TEXT:
+        /* the entry owns it for as long as the row exists */
+        g_value_set_static_string (value, entry->search_text);
+        break;
+      case EMPATHY_DEBUG_BUFFER_COL_DOMAIN:
+        g_value_set_uint (value, entry->domain);
+        break;
+      case EMPATHY_DEBUG_BUFFER_COL_CATEGORY:
+        g_value_set_uint (value, entry->category);
+        break;
+      case EMPATHY_DEBUG_BUFFER_COL_LEVEL:
+        g_value_set_uint (value, tp_debug_message_get_level (entry->msg));
+        break;
+    }
+}
+
+static gboolean
+debug_buffer_iter_next (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  guint index;
+
+  if (!debug_buffer_iter_to_index (self, iter, &index))
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  return debug_buffer_index_to_iter (self, index + 1, iter);
+}
+
+static gboolean
+debug_buffer_iter_previous (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+  guint index;
+
+  if (!debug_buffer_iter_to_index (self, iter, &index) || index == 0)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  return debug_buffer_index_to_iter (self, index - 1, iter);
+}
+
+static gboolean
+debug_buffer_iter_nth_child (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent,
+    gint n)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+
+  if (parent != NULL || n < 0)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  return debug_buffer_index_to_iter (self, n, iter);
+}
+
+static gboolean
+debug_buffer_iter_children (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent)
+{
+  return debug_buffer_iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+debug_buffer_iter_has_child (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+debug_buffer_iter_n_children (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugBuffer *self = EMPATHY_DEBUG_BUFFER (model);
+
+  if (iter != NULL)
+    return 0;
+
+  return self->priv->n_visible;
+}
+
+static gboolean
+debug_buffer_iter_parent (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *child)
+{
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static void
+debug_buffer_tree_model_iface_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = debug_buffer_get_flags;
+  iface->get_n_columns = debug_buffer_get_n_columns;
+  iface->get_column_type = debug_buffer_get_column_type;
+  iface->get_iter = debug_buffer_get_iter;
+  iface->get_path = debug_buffer_get_path;
+  iface->get_value = debug_buffer_get_value;
+  iface->iter_next = debug_buffer_iter_next;
+  iface->iter_previous = debug_buffer_iter_previous;
+  iface->iter_children = debug_buffer_iter_children;
+  iface->iter_has_child = debug_buffer_iter_has_child;
+  iface->iter_n_children = debug_buffer_iter_n_children;
+  iface->iter_nth_child = debug_buffer_iter_nth_child;
+  iface->iter_parent = debug_buffer_iter_parent;
+}
+
+/* public methods */
+
+EmpathyDebugBuffer *
+empathy_debug_buffer_new (guint max_messages,
+    gsize max_bytes)
+{
+  EmpathyDebugBuffer *self;
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_BUFFER, NULL);
+  self->priv->max_messages = max_messages;
+  self->priv->max_bytes = max_bytes;
+
+  return self;
+}
+
+/* Changes the capacity of @self, 0 meaning no limit. The oldest messages are
+ * evicted right away if @self holds more than the new limits allow. */
+void
+empathy_debug_buffer_set_limits (EmpathyDebugBuffer *self,
+    guint max_messages,
+    gsize max_bytes)
+{
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+
+  self->priv->max_messages = max_messages;
+  self->priv->max_bytes = max_bytes;
+
+  while (self->priv->len > 0 &&
+      ((max_messages > 0 && self->priv->len > max_messages) ||
+       (max_bytes > 0 && self->priv->n_bytes > max_bytes)))
+    debug_buffer_evict_oldest (self);
+}
+
+void
+empathy_debug_buffer_append (EmpathyDebugBuffer *self,
+    TpDebugMessage *msg)
+{
+  EmpathyDebugBufferPrivate *priv;
+  Entry entry;
+  gsize size;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+  g_return_if_fail (TP_IS_DEBUG_MESSAGE (msg));
+
+  priv = self->priv;
+
+  entry_init (&entry, msg);
+  size = entry_size (&entry);
+
+  debug_buffer_evict (self, size);
+
+  if (priv->len == priv->size)
+    debug_buffer_grow (self);
+
+  RING_AT (priv, priv->len) = entry;
+  priv->len++;
+  priv->n_bytes += size;
+
+  if (!priv->paused)
+    {
+      priv->n_visible++;
+      debug_buffer_emit_row_inserted (self, priv->n_visible - 1);
+    }
+}
+
+/* Appends to @self all the messages stored in @other, including the ones
+ * hidden because @other is paused */
+void
+empathy_debug_buffer_append_buffer (EmpathyDebugBuffer *self,
+    EmpathyDebugBuffer *other)
+{
+  guint i;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (other));
+  g_return_if_fail (self != other);
+
+  for (i = 0; i < other->priv->len; i++)
+    empathy_debug_buffer_append (self, RING_AT (other->priv, i).msg);
+}
+
+void
+empathy_debug_buffer_clear (EmpathyDebugBuffer *self)
+{
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+
+  while (self->priv->len > 0)
+    debug_buffer_evict_oldest (self);
+
+  self->priv->stamp++;
+}
+
+/* While @self is paused, new messages are stored but not exposed as rows
+ * until it is resumed, so the view doesn't scroll away under the user */
+void
+empathy_debug_buffer_set_paused (EmpathyDebugBuffer *self,
+    gboolean paused)
+{
+  EmpathyDebugBufferPrivate *priv;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_BUFFER (self));
+
+  priv = self->priv;
+
+  if (priv->paused == paused)
+    return;
+
+  priv->paused = paused;
+
+  if (paused)
+    return;
+
+  DEBUG ("Resuming, %u messages arrived while paused",
+      priv->len - priv->n_visible);
+
+  while (priv->n_visible < priv->len)
+    {
+      priv->n_visible++;
+      debug_buffer_emit_row_inserted (self, priv->n_visible - 1);
+    }
+}
+
+/* Returns the number of messages stored in @self, hidden ones included */
+guint
+empathy_debug_buffer_get_length (EmpathyDebugBuffer *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_BUFFER (self), 0);
+
+  return self->priv->len;
+}
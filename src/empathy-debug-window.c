@@ -31,6 +31,7 @@
 
 #define DEBUG_FLAG EMPATHY_DEBUG_OTHER
 #include <libempathy/empathy-debug.h>
+#include <libempathy/empathy-gsettings.h>
 #include <libempathy/empathy-utils.h>
 
 #include <libempathy-gtk/empathy-account-chooser.h>
@@ -45,6 +46,7 @@
 
 #include "extensions/extensions.h"
 
+#include "empathy-debug-buffer.h"
 #include "empathy-debug-window.h"
 
 G_DEFINE_TYPE (EmpathyDebugWindow, empathy_debug_window,
@@ -58,8 +60,7 @@ typedef enum
 
 enum
 {
-  COL_DEBUG_MESSAGE = 0,
-  NUM_DEBUG_COLS
+  COL_DEBUG_MESSAGE = EMPATHY_DEBUG_BUFFER_COL_MESSAGE,
 };
 
 enum
@@ -68,7 +69,6 @@ enum
   COL_UNIQUE_NAME,
   COL_GONE,
   COL_ACTIVE_BUFFER,
-  COL_PAUSE_BUFFER,
   COL_PROXY,
   NUM_COLS
 };
@@ -92,6 +92,16 @@ struct _EmpathyDebugWindowPriv
   GtkToolItem *pause_button;
   GtkToolItem *level_label;
   GtkWidget *level_filter;
+  GtkWidget *search_entry;
+
+  /* Filter currently applied, cached so the visible func doesn't have to
+   * parse it again for every message */
+  GLogLevelFlags filter_level;
+  GQuark filter_domain;
+  GQuark filter_category;
+  /* lowercased words which must all be found in the message */
+  gchar **filter_words;
+  guint refilter_id;
 
   /* TreeView */
   GtkTreeModel *store_filter;
@@ -104,9 +114,12 @@ struct _EmpathyDebugWindowPriv
   TpDBusDaemon *dbus;
   TpProxySignalConnection *name_owner_changed_signal;
 
-  /* Whether NewDebugMessage will be fired */
+  /* Whether new messages are kept out of the view */
   gboolean paused;
 
+  /* Capacity of the message buffers */
+  GSettings *gsettings;
+
   /* Service (CM, Client) chooser store */
   GtkListStore *service_store;
 
@@ -120,7 +133,7 @@ struct _EmpathyDebugWindowPriv
   /* Misc. */
   gboolean dispose_run;
   TpAccountManager *am;
-  GtkListStore *all_active_buffer;
+  EmpathyDebugBuffer *all_active_buffer;
 };
 
 static const gchar *
@@ -168,60 +181,21 @@ get_active_service_name (EmpathyDebugWindow *self)
   return name;
 }
 
-static gboolean
-copy_buffered_messages (GtkTreeModel *buffer,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer data)
-{
-  GtkListStore *active_buffer = data;
-  GtkTreeIter active_buffer_iter;
-  TpDebugMessage *msg;
-
-  gtk_tree_model_get (buffer, iter,
-      COL_DEBUG_MESSAGE, &msg,
-      -1);
-  gtk_list_store_insert_with_values (active_buffer, &active_buffer_iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
-
-  g_object_unref (msg);
-
-  return FALSE;
-}
-
-static void
-insert_values_in_buffer (GtkListStore *store,
-    TpDebugMessage *msg)
-{
-  GtkTreeIter iter;
-
-  gtk_list_store_insert_with_values (store, &iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
-}
-
 static void
 debug_window_add_message (EmpathyDebugWindow *self,
     TpDebugClient *debug,
     TpDebugMessage *msg)
 {
-  GtkListStore *active_buffer, *pause_buffer;
+  EmpathyDebugBuffer *active_buffer;
 
-  pause_buffer = g_object_get_data (G_OBJECT (debug), "pause-buffer");
   active_buffer = g_object_get_data (G_OBJECT (debug), "active-buffer");
 
-  if (self->priv->paused)
-    {
-      insert_values_in_buffer (pause_buffer, msg);
-    }
-  else
-    {
-      /* Append 'this' message to this service's and All's active-buffers */
-      insert_values_in_buffer (active_buffer, msg);
+  /* Append 'this' message to this service's and All's active-buffers. They
+   * keep it out of the view by themselves while we are paused. */
+  empathy_debug_buffer_append (active_buffer, msg);
 
-      insert_values_in_buffer (self->priv->all_active_buffer, msg);
-    }
+  if (self->priv->all_active_buffer != NULL)
+    empathy_debug_buffer_append (self->priv->all_active_buffer, msg);
 }
 
 static void
@@ -275,6 +249,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->pause_button), sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->level_label), sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->level_filter), sensitive);
+  gtk_widget_set_sensitive (self->priv->search_entry, sensitive);
   gtk_widget_set_sensitive (GTK_WIDGET (self->priv->view), sensitive);
 
   if (sensitive && !self->priv->view_visible)
@@ -297,7 +272,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
 }
 
 static gboolean
-debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
+debug_window_get_iter_for_active_buffer (EmpathyDebugBuffer *active_buffer,
     GtkTreeIter *iter,
     EmpathyDebugWindow *self)
 {
@@ -309,7 +284,7 @@ debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
        valid_iter;
        valid_iter = gtk_tree_model_iter_next (model, iter))
     {
-      GtkListStore *stored_active_buffer;
+      EmpathyDebugBuffer *stored_active_buffer;
 
       gtk_tree_model_get (model, iter,
           COL_ACTIVE_BUFFER, &stored_active_buffer,
@@ -371,7 +346,7 @@ debug_window_get_messages_cb (GObject *object,
   EmpathyDebugWindow *self = user_data;
   gchar *active_service_name;
   guint i;
-  GtkListStore *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
   gboolean valid_iter;
   GtkTreeIter iter;
   gchar *proxy_service_name;
@@ -451,7 +426,7 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
 {
   gchar *bus_name, *name = NULL;
   TpDebugClient *new_proxy, *stored_proxy = NULL;
-  GtkTreeModel *pause_buffer, *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
   gboolean gone;
   GError *error = NULL;
 
@@ -459,7 +434,6 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
       COL_NAME, &name,
       COL_GONE, &gone,
       COL_ACTIVE_BUFFER, &active_buffer,
-      COL_PAUSE_BUFFER, &pause_buffer,
       COL_PROXY, &stored_proxy,
       -1);
 
@@ -492,7 +466,6 @@ create_proxy_to_get_messages (EmpathyDebugWindow *self,
   g_free (bus_name);
 
   g_object_set_data (G_OBJECT (new_proxy), "active-buffer", active_buffer);
-  g_object_set_data (G_OBJECT (new_proxy), "pause-buffer", pause_buffer);
 
   /* Now we call GetMessages with fresh proxy.
    * The old proxy is NULL due to one of the following -
@@ -507,14 +480,48 @@ finally:
   g_free (name);
   tp_clear_object (&stored_proxy);
   g_object_unref (active_buffer);
-  g_object_unref (pause_buffer);
 }
 
-static GtkListStore *
-new_list_store_for_service (void)
+static void
+debug_window_get_buffer_limits (EmpathyDebugWindow *self,
+    guint *max_messages,
+    gsize *max_bytes)
+{
+  *max_messages = g_settings_get_uint (self->priv->gsettings,
+      EMPATHY_PREFS_DEBUG_BUFFER_MAX_MESSAGES);
+  *max_bytes = (gsize) g_settings_get_uint (self->priv->gsettings,
+      EMPATHY_PREFS_DEBUG_BUFFER_MAX_SIZE) * 1024;
+}
+
+static EmpathyDebugBuffer *
+new_buffer_for_service (EmpathyDebugWindow *self)
 {
-  return gtk_list_store_new (NUM_DEBUG_COLS,
-             TP_TYPE_DEBUG_MESSAGE); /* COL_DEBUG_MESSAGE */
+  EmpathyDebugBuffer *buffer;
+  guint max_messages;
+  gsize max_bytes;
+
+  debug_window_get_buffer_limits (self, &max_messages, &max_bytes);
+
+  buffer = empathy_debug_buffer_new (max_messages, max_bytes);
+  empathy_debug_buffer_set_paused (buffer, self->priv->paused);
+
+  return buffer;
+}
+
+/* Reads a guint column without going through varargs */
+static guint
+debug_window_get_uint (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gint column)
+{
+  GValue value = G_VALUE_INIT;
+  guint result;
+
+  gtk_tree_model_get_value (model, iter, column, &value);
+  result = g_value_get_uint (&value);
+  g_value_unset (&value);
+
+  return result;
 }
 
 static gboolean
@@ -523,23 +530,38 @@ debug_window_visible_func (GtkTreeModel *model,
     gpointer user_data)
 {
   EmpathyDebugWindow *self = user_data;
-  GLogLevelFlags filter_value;
-  GtkTreeModel *filter_model;
-  GtkTreeIter filter_iter;
-  TpDebugMessage *msg;
-  gboolean result;
+  GValue value = G_VALUE_INIT;
+  const gchar *text;
+  gboolean result = TRUE;
+  guint i;
 
-  filter_model = gtk_combo_box_get_model (
-      GTK_COMBO_BOX (self->priv->level_filter));
-  gtk_combo_box_get_active_iter (GTK_COMBO_BOX (self->priv->level_filter),
-      &filter_iter);
+  /* Cheapest checks first */
+  if (debug_window_get_uint (model, iter, EMPATHY_DEBUG_BUFFER_COL_LEVEL) >
+      self->priv->filter_level)
+    return FALSE;
 
-  gtk_tree_model_get (model, iter, COL_DEBUG_MESSAGE, &msg, -1);
-  gtk_tree_model_get (filter_model, &filter_iter,
-      COL_LEVEL_VALUE, &filter_value, -1);
+  if (self->priv->filter_domain != 0 &&
+      debug_window_get_uint (model, iter, EMPATHY_DEBUG_BUFFER_COL_DOMAIN) !=
+      self->priv->filter_domain)
+    return FALSE;
 
-  result = (tp_debug_message_get_level (msg) <= filter_value);
-  g_object_unref (msg);
+  if (self->priv->filter_category != 0 &&
+      debug_window_get_uint (model, iter, EMPATHY_DEBUG_BUFFER_COL_CATEGORY) !=
+      self->priv->filter_category)
+    return FALSE;
+
+  if (self->priv->filter_words == NULL)
+    return TRUE;
+
+  /* The buffer stores the lowercased text once, we don't copy it */
+  gtk_tree_model_get_value (model, iter, EMPATHY_DEBUG_BUFFER_COL_SEARCH_TEXT,
+      &value);
+  text = g_value_get_string (&value);
+
+  for (i = 0; result && self->priv->filter_words[i] != NULL; i++)
+    result = (strstr (text, self->priv->filter_words[i]) != NULL);
+
+  g_value_unset (&value);
 
   return result;
 }
@@ -551,33 +573,73 @@ tree_view_search_equal_func_cb (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer search_data)
 {
-  gchar *str;
-  gint key_len;
-  gint len;
-  gint i;
-  gboolean ret = TRUE; /* The return value is counter-intuitive */
+  GValue value = G_VALUE_INIT;
+  gchar *folded_key;
+  gboolean ret; /* The return value is counter-intuitive */
 
-  gtk_tree_model_get (model, iter, column, &str, -1);
+  gtk_tree_model_get_value (model, iter, column, &value);
+  folded_key = g_utf8_strdown (key, -1);
 
-  key_len = strlen (key);
-  len = strlen (str) - key_len;
+  ret = (strstr (g_value_get_string (&value), folded_key) == NULL);
 
-  for (i = 0; i <= len; ++i)
+  g_free (folded_key);
+  g_value_unset (&value);
+
+  return ret;
+}
+
+/* Parses the search entry: "domain:" and "category:" words select messages
+ * from this domain or category, other words must all appear in the text of
+ * the message, case insensitively. */
+static void
+debug_window_update_filter (EmpathyDebugWindow *self)
+{
+  GPtrArray *words;
+  gchar **tokens;
+  guint i;
+
+  self->priv->filter_domain = 0;
+  self->priv->filter_category = 0;
+  tp_clear_pointer (&self->priv->filter_words, g_strfreev);
+
+  tokens = g_strsplit (gtk_entry_get_text (GTK_ENTRY (self->priv->search_entry)),
+      " ", -1);
+  words = g_ptr_array_new ();
+
+  for (i = 0; tokens[i] != NULL; i++)
     {
-      if (!g_ascii_strncasecmp (key, str + i, key_len))
-        {
-          ret = FALSE;
-          break;
-        }
+      const gchar *token = tokens[i];
+
+      if (token[0] == '\0')
+        continue;
+
+      /* quarks of unknown names won't match any message, as they should */
+      if (g_str_has_prefix (token, "domain:"))
+        self->priv->filter_domain = g_quark_from_string (
+            token + strlen ("domain:"));
+      else if (g_str_has_prefix (token, "category:"))
+        self->priv->filter_category = g_quark_from_string (
+            token + strlen ("category:"));
+      else
+        g_ptr_array_add (words, g_utf8_strdown (token, -1));
     }
 
-  g_free (str);
-  return ret;
+  if (words->len > 0)
+    {
+      g_ptr_array_add (words, NULL);
+      self->priv->filter_words = (gchar **) g_ptr_array_free (words, FALSE);
+    }
+  else
+    {
+      g_ptr_array_free (words, TRUE);
+    }
+
+  g_strfreev (tokens);
 }
 
 static void
 update_store_filter (EmpathyDebugWindow *self,
-    GtkListStore *active_buffer)
+    EmpathyDebugBuffer *active_buffer)
 {
   debug_window_set_toolbar_sensitivity (self, FALSE);
 
@@ -594,7 +656,7 @@ update_store_filter (EmpathyDebugWindow *self,
   /* Since view's model has changed, reset the search column and
    * search_equal_func */
   gtk_tree_view_set_search_column (GTK_TREE_VIEW (self->priv->view),
-      COL_DEBUG_MESSAGE);
+      EMPATHY_DEBUG_BUFFER_COL_SEARCH_TEXT);
   gtk_tree_view_set_search_equal_func (GTK_TREE_VIEW (self->priv->view),
       tree_view_search_equal_func_cb, NULL, NULL);
 
@@ -609,7 +671,7 @@ refresh_all_buffer (EmpathyDebugWindow *self)
   GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
 
   /* Clear All's active-buffer */
-  gtk_list_store_clear (self->priv->all_active_buffer);
+  empathy_debug_buffer_clear (self->priv->all_active_buffer);
 
   /* Skipping the first service store iter which is reserved for "All" */
   gtk_tree_model_get_iter_first (service_store, &iter);
@@ -618,7 +680,7 @@ refresh_all_buffer (EmpathyDebugWindow *self)
        valid_iter = gtk_tree_model_iter_next (service_store, &iter))
     {
       TpProxy *proxy = NULL;
-      GtkListStore *service_active_buffer;
+      EmpathyDebugBuffer *service_active_buffer;
       gboolean gone;
 
       gtk_tree_model_get (service_store, &iter,
@@ -629,8 +691,8 @@ refresh_all_buffer (EmpathyDebugWindow *self)
 
       if (gone)
         {
-          gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+          empathy_debug_buffer_append_buffer (self->priv->all_active_buffer,
+              service_active_buffer);
         }
       else
         {
@@ -640,8 +702,8 @@ refresh_all_buffer (EmpathyDebugWindow *self)
                 break;
 
               /* Copy the debug messages to all_active_buffer */
-              gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-                  copy_buffered_messages, self->priv->all_active_buffer);
+              empathy_debug_buffer_append_buffer (self->priv->all_active_buffer,
+                  service_active_buffer);
             }
           else
             {
@@ -671,7 +733,7 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
 {
   TpDBusDaemon *dbus;
   GError *error = NULL;
-  GtkListStore *stored_active_buffer = NULL;
+  EmpathyDebugBuffer *stored_active_buffer = NULL;
   gchar *name = NULL;
   GtkTreeIter iter;
   gboolean gone;
@@ -891,7 +953,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
   if (!debug_window_service_is_in_model (data->self, out, NULL, FALSE))
     {
       char *name;
-      GtkListStore *active_buffer, *pause_buffer;
+      EmpathyDebugBuffer *active_buffer;
 
       DEBUG ("Adding %s to list: %s at unique name: %s",
           data->type == SERVICE_TYPE_CM? "CM": "Client",
@@ -902,20 +964,17 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
       else
         name = g_strdup (data->name);
 
-      active_buffer = new_list_store_for_service ();
-      pause_buffer = new_list_store_for_service ();
+      active_buffer = new_buffer_for_service (self);
 
       gtk_list_store_insert_with_values (self->priv->service_store, &iter, -1,
           COL_NAME, name,
           COL_UNIQUE_NAME, out,
           COL_GONE, FALSE,
           COL_ACTIVE_BUFFER, active_buffer,
-          COL_PAUSE_BUFFER, pause_buffer,
           COL_PROXY, NULL,
           -1);
 
       g_object_unref (active_buffer);
-      g_object_unref (pause_buffer);
 
       if (self->priv->select_name != NULL &&
           !tp_strdiff (name, self->priv->select_name))
@@ -936,7 +995,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
             COL_ACTIVE_BUFFER, NULL,
             -1);
 
-        self->priv->all_active_buffer = new_list_store_for_service ();
+        self->priv->all_active_buffer = new_buffer_for_service (self);
 
         /* Populate active buffers for all services */
         refresh_all_buffer (self);
@@ -1034,12 +1093,11 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
            &found_at_iter, TRUE))
         {
           GtkTreeIter iter;
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer;
 
           DEBUG ("Adding new service '%s' at %s.", name, arg2);
 
-          active_buffer = new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self);
 
           gtk_list_store_insert_with_values (self->priv->service_store,
               &iter, -1,
@@ -1047,25 +1105,22 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
               COL_UNIQUE_NAME, arg2,
               COL_GONE, FALSE,
               COL_ACTIVE_BUFFER, active_buffer,
-              COL_PAUSE_BUFFER, pause_buffer,
               COL_PROXY, NULL,
               -1);
 
           g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
         }
       else
         {
           /* a service with the same name is already in the service_store,
            * update it and set it as re-enabled.
            */
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugBuffer *active_buffer;
           TpProxy *stored_proxy;
 
           DEBUG ("Refreshing CM '%s' at '%s'.", name, arg2);
 
-          active_buffer= new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_buffer_for_service (self);
 
           gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store),
               found_at_iter, COL_PROXY, &stored_proxy, -1);
@@ -1077,12 +1132,10 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
               COL_UNIQUE_NAME, arg2,
               COL_GONE, FALSE,
               COL_ACTIVE_BUFFER, active_buffer,
-              COL_PAUSE_BUFFER, pause_buffer,
               COL_PROXY, NULL,
               -1);
 
           g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
 
           gtk_tree_iter_free (found_at_iter);
 
@@ -1166,7 +1219,7 @@ debug_window_fill_service_chooser (EmpathyDebugWindow *self)
 {
   GError *error = NULL;
   GtkTreeIter iter;
-  GtkListStore *active_buffer, *pause_buffer;
+  EmpathyDebugBuffer *active_buffer;
 
   self->priv->dbus = tp_dbus_daemon_dup (&error);
 
@@ -1186,19 +1239,16 @@ debug_window_fill_service_chooser (EmpathyDebugWindow *self)
       debug_window_list_connection_names_cb, self, NULL, NULL);
 
   /* add Mission Control */
-  active_buffer= new_list_store_for_service ();
-  pause_buffer = new_list_store_for_service ();
+  active_buffer = new_buffer_for_service (self);
 
   gtk_list_store_insert_with_values (self->priv->service_store, &iter, -1,
       COL_NAME, "mission-control",
       COL_UNIQUE_NAME, "org.freedesktop.Telepathy.MissionControl5",
       COL_GONE, FALSE,
       COL_ACTIVE_BUFFER, active_buffer,
-      COL_PAUSE_BUFFER, pause_buffer,
       COL_PROXY, NULL,
       -1);
   g_object_unref (active_buffer);
-  g_object_unref (pause_buffer);
 
   /* add clients */
   tp_dbus_daemon_list_names (self->priv->dbus, 2000,
@@ -1219,43 +1269,111 @@ debug_window_pause_toggled_cb (GtkToggleToolButton *pause_,
 
   self->priv->paused = gtk_toggle_tool_button_get_active (pause_);
 
-  if (!self->priv->paused)
+  /* Buffers keep receiving messages while paused, they just don't show
+   * them until they are resumed */
+  for (valid_iter = gtk_tree_model_get_iter_first (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
     {
-      /* Pause has been released - flush all pause buffers */
-      GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
-
-      /* Skipping the first iter which is reserved for "All" */
-      gtk_tree_model_get_iter_first (model, &iter);
-      for (valid_iter = gtk_tree_model_iter_next (model, &iter);
-           valid_iter;
-           valid_iter = gtk_tree_model_iter_next (model, &iter))
-        {
-          GtkListStore *pause_buffer, *active_buffer;
+      EmpathyDebugBuffer *active_buffer;
 
-          gtk_tree_model_get (service_store, &iter,
-              COL_PAUSE_BUFFER, &pause_buffer,
-              COL_ACTIVE_BUFFER, &active_buffer,
-              -1);
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer,
+          -1);
 
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, active_buffer);
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+      /* "All" has no buffer in the store */
+      if (active_buffer == NULL)
+        continue;
 
-          gtk_list_store_clear (pause_buffer);
+      empathy_debug_buffer_set_paused (active_buffer, self->priv->paused);
+      g_object_unref (active_buffer);
+    }
 
-          g_object_unref (active_buffer);
-          g_object_unref (pause_buffer);
-        }
+  if (self->priv->all_active_buffer != NULL)
+    empathy_debug_buffer_set_paused (self->priv->all_active_buffer,
+        self->priv->paused);
+}
+
+static void
+debug_window_buffer_limits_changed_cb (GSettings *gsettings,
+    const gchar *key,
+    EmpathyDebugWindow *self)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+  GtkTreeIter iter;
+  gboolean valid_iter;
+  guint max_messages;
+  gsize max_bytes;
+
+  debug_window_get_buffer_limits (self, &max_messages, &max_bytes);
+
+  for (valid_iter = gtk_tree_model_get_iter_first (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugBuffer *active_buffer;
+
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer,
+          -1);
+
+      if (active_buffer == NULL)
+        continue;
+
+      empathy_debug_buffer_set_limits (active_buffer, max_messages,
+          max_bytes);
+      g_object_unref (active_buffer);
     }
+
+  if (self->priv->all_active_buffer != NULL)
+    empathy_debug_buffer_set_limits (self->priv->all_active_buffer,
+        max_messages, max_bytes);
 }
 
 static void
 debug_window_filter_changed_cb (GtkComboBox *filter,
     EmpathyDebugWindow *self)
 {
-  gtk_tree_model_filter_refilter (
-      GTK_TREE_MODEL_FILTER (self->priv->store_filter));
+  GtkTreeIter iter;
+
+  if (!gtk_combo_box_get_active_iter (filter, &iter))
+    return;
+
+  gtk_tree_model_get (gtk_combo_box_get_model (filter), &iter,
+      COL_LEVEL_VALUE, &self->priv->filter_level,
+      -1);
+
+  if (self->priv->store_filter != NULL)
+    gtk_tree_model_filter_refilter (
+        GTK_TREE_MODEL_FILTER (self->priv->store_filter));
+}
+
+static gboolean
+debug_window_refilter_cb (gpointer user_data)
+{
+  EmpathyDebugWindow *self = user_data;
+
+  self->priv->refilter_id = 0;
+
+  debug_window_update_filter (self);
+
+  if (self->priv->store_filter != NULL)
+    gtk_tree_model_filter_refilter (
+        GTK_TREE_MODEL_FILTER (self->priv->store_filter));
+
+  return FALSE;
+}
+
+static void
+debug_window_search_changed_cb (GtkEditable *editable,
+    EmpathyDebugWindow *self)
+{
+  /* Wait for the user to stop typing before going through all messages */
+  if (self->priv->refilter_id != 0)
+    g_source_remove (self->priv->refilter_id);
+
+  self->priv->refilter_id = g_timeout_add (250, debug_window_refilter_cb,
+      self);
 }
 
 static void
@@ -1263,14 +1381,14 @@ debug_window_clear_clicked_cb (GtkToolButton *clear_button,
     EmpathyDebugWindow *self)
 {
   GtkTreeIter iter;
-  GtkListStore *active_buffer;
+  EmpathyDebugBuffer *active_buffer;
 
   /* "All" is the first choice in the service chooser and it's buffer is
    * not saved in the service-store but is accessed using a self->private
    * reference */
   if (gtk_combo_box_get_active (GTK_COMBO_BOX (self->priv->chooser)) == 0)
     {
-      gtk_list_store_clear (self->priv->all_active_buffer);
+      empathy_debug_buffer_clear (self->priv->all_active_buffer);
       return;
     }
 
@@ -1278,7 +1396,7 @@ debug_window_clear_clicked_cb (GtkToolButton *clear_button,
   gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store), &iter,
       COL_ACTIVE_BUFFER, &active_buffer, -1);
 
-  gtk_list_store_clear (active_buffer);
+  empathy_debug_buffer_clear (active_buffer);
 
   g_object_unref (active_buffer);
 }
@@ -1885,8 +2003,7 @@ am_prepared_cb (GObject *am,
       G_TYPE_STRING,  /* COL_NAME */
       G_TYPE_STRING,  /* COL_UNIQUE_NAME */
       G_TYPE_BOOLEAN, /* COL_GONE */
-      G_TYPE_OBJECT,  /* COL_ACTIVE_BUFFER */
-      G_TYPE_OBJECT,  /* COL_PAUSE_BUFFER */
+      EMPATHY_TYPE_DEBUG_BUFFER, /* COL_ACTIVE_BUFFER */
       TP_TYPE_PROXY); /* COL_PROXY */
   gtk_combo_box_set_model (GTK_COMBO_BOX (self->priv->chooser),
       GTK_TREE_MODEL (self->priv->service_store));
@@ -2022,9 +2139,30 @@ am_prepared_cb (GObject *am,
       -1);
 
   gtk_combo_box_set_active (GTK_COMBO_BOX (self->priv->level_filter), 0);
+  self->priv->filter_level = G_LOG_LEVEL_DEBUG;
   g_signal_connect (self->priv->level_filter, "changed",
       G_CALLBACK (debug_window_filter_changed_cb), object);
 
+  item = gtk_separator_tool_item_new ();
+  gtk_widget_show (GTK_WIDGET (item));
+  gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+
+  /* Search */
+  self->priv->search_entry = gtk_entry_new ();
+  gtk_entry_set_icon_from_stock (GTK_ENTRY (self->priv->search_entry),
+      GTK_ENTRY_ICON_PRIMARY, GTK_STOCK_FIND);
+  gtk_widget_set_tooltip_text (self->priv->search_entry,
+      _("Show only messages containing these words. Use domain:name or "
+          "category:name to show only messages from this domain or category."));
+  gtk_widget_show (self->priv->search_entry);
+  g_signal_connect (self->priv->search_entry, "changed",
+      G_CALLBACK (debug_window_search_changed_cb), object);
+
+  item = gtk_tool_item_new ();
+  gtk_widget_show (GTK_WIDGET (item));
+  gtk_container_add (GTK_CONTAINER (item), self->priv->search_entry);
+  gtk_toolbar_insert (GTK_TOOLBAR (toolbar), item, -1);
+
   /* Debug treeview */
   self->priv->view = gtk_tree_view_new ();
   gtk_tree_view_set_rules_hint (GTK_TREE_VIEW (self->priv->view), TRUE);
@@ -2084,6 +2222,14 @@ am_prepared_cb (GObject *am,
 
   self->priv->all_active_buffer = NULL;
 
+  self->priv->gsettings = g_settings_new (EMPATHY_PREFS_DEBUG_SCHEMA);
+  g_signal_connect (self->priv->gsettings,
+      "changed::"EMPATHY_PREFS_DEBUG_BUFFER_MAX_MESSAGES,
+      G_CALLBACK (debug_window_buffer_limits_changed_cb), self);
+  g_signal_connect (self->priv->gsettings,
+      "changed::"EMPATHY_PREFS_DEBUG_BUFFER_MAX_SIZE,
+      G_CALLBACK (debug_window_buffer_limits_changed_cb), self);
+
   debug_window_set_toolbar_sensitivity (EMPATHY_DEBUG_WINDOW (object), FALSE);
   debug_window_fill_service_chooser (EMPATHY_DEBUG_WINDOW (object));
   gtk_widget_show (GTK_WIDGET (object));
@@ -2139,6 +2285,7 @@ debug_window_finalize (GObject *object)
   EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (object);
 
   g_free (self->priv->select_name);
+  g_strfreev (self->priv->filter_words);
 
   (G_OBJECT_CLASS (empathy_debug_window_parent_class)->finalize) (object);
 }
@@ -2156,6 +2303,13 @@ debug_window_dispose (GObject *object)
   g_clear_object (&self->priv->dbus);
   g_clear_object (&self->priv->am);
   g_clear_object (&self->priv->all_active_buffer);
+  g_clear_object (&self->priv->gsettings);
+
+  if (self->priv->refilter_id != 0)
+    {
+      g_source_remove (self->priv->refilter_id);
+      self->priv->refilter_id = 0;
+    }
 
   (G_OBJECT_CLASS (empathy_debug_window_parent_class)->dispose) (object);
 }
@@ -35,8 +35,11 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 
+#include <telepathy-glib/util.h>
+
 #define DEBUG_FLAG EMPATHY_DEBUG_FT
 #include <libempathy/empathy-debug.h>
+#include <libempathy/empathy-gsettings.h>
 #include <libempathy/empathy-utils.h>
 
 #include <libempathy-gtk/empathy-ui-utils.h>
@@ -64,6 +67,18 @@ typedef struct {
   GtkWidget *open_button;
   GtkWidget *abort_button;
   GtkWidget *clear_button;
+
+  /* Scheduling */
+  GSettings *gsettings;
+  /* EmpathyFTHandler waiting for a free slot, in the order they'll start */
+  GQueue *queued;
+  /* Set of queued EmpathyFTHandler the user put on hold */
+  GHashTable *paused;
+  /* Set of started EmpathyFTHandler which didn't finish yet */
+  GHashTable *running;
+  /* Subset of running which are hashing their file */
+  GHashTable *hashing;
+  guint schedule_id;
 } EmpathyFTManagerPriv;
 
 enum
@@ -82,6 +97,9 @@ static EmpathyFTManager *manager_singleton = NULL;
 
 static void ft_handler_hashing_started_cb (EmpathyFTHandler *handler,
     EmpathyFTManager *manager);
+static void ft_manager_schedule (EmpathyFTManager *manager);
+static void ft_manager_forget_handler (EmpathyFTManager *manager,
+    EmpathyFTHandler *handler);
 
 static gchar *
 ft_manager_format_interval (guint interval)
@@ -102,6 +120,44 @@ ft_manager_format_interval (guint interval)
     return g_strdup_printf (_("%02u.%02u"), mins, secs);
 }
 
+/* Number of speed samples drawn next to the remaining time */
+#define SPEED_GRAPH_SAMPLES 8
+
+/* Appends a small bar graph of the recent speeds of @handler to @str */
+static void
+ft_manager_append_speed_graph (GString *str,
+                               EmpathyFTHandler *handler)
+{
+  static const gchar *bars[] = { "\342\226\201", "\342\226\202",
+      "\342\226\203", "\342\226\204", "\342\226\205",
+      "\342\226\206", "\342\226\207", "\342\226\210" };
+  const gdouble *history;
+  guint n_samples, first, i;
+  gdouble max = 0;
+
+  history = empathy_ft_handler_get_speed_history (handler, &n_samples);
+  if (n_samples < 2)
+    return;
+
+  first = n_samples > SPEED_GRAPH_SAMPLES ?
+    n_samples - SPEED_GRAPH_SAMPLES : 0;
+
+  for (i = first; i < n_samples; i++)
+    max = MAX (max, history[i]);
+
+  if (max <= 0)
+    return;
+
+  g_string_append_c (str, ' ');
+
+  for (i = first; i < n_samples; i++)
+    {
+      guint level = history[i] / max * (G_N_ELEMENTS (bars) - 1) + 0.5;
+
+      g_string_append (str, bars[level]);
+    }
+}
+
 static void
 ft_manager_update_buttons (EmpathyFTManager *manager)
 {
@@ -245,6 +301,7 @@ remove_finished_transfer_foreach (gpointer key,
   if (empathy_ft_handler_is_completed (handler) ||
       empathy_ft_handler_is_cancelled (handler))
     {
+      ft_manager_forget_handler (manager, handler);
       ft_manager_remove_file_from_model (manager, handler);
       return TRUE;
     }
@@ -399,14 +456,37 @@ ft_manager_update_handler_progress (EmpathyFTManager *manager,
 static void
 ft_manager_update_handler_time (EmpathyFTManager *manager,
                                 GtkTreeRowReference *row_ref,
-                                guint remaining_time)
+                                EmpathyFTHandler *handler)
 {
   GtkTreePath *path;
   GtkTreeIter iter;
   EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  GString *remaining;
   char *remaining_str;
+  guint remaining_time;
+
+  remaining_time = empathy_ft_handler_get_remaining_time (handler);
+
+  if (empathy_ft_handler_is_stalled (handler))
+    {
+      /* Translators: shown instead of the time left when a transfer has
+       * stopped progressing */
+      remaining = g_string_new (_("Stalled"));
+    }
+  else if (remaining_time > 0)
+    {
+      remaining_str = ft_manager_format_interval (remaining_time);
+      remaining = g_string_new (remaining_str);
+      g_free (remaining_str);
+    }
+  else
+    {
+      /* Not known yet */
+      return;
+    }
 
-  remaining_str = ft_manager_format_interval (remaining_time);
+  ft_manager_append_speed_graph (remaining, handler);
+  remaining_str = g_string_free (remaining, FALSE);
 
   /* Set new value in the store */
   path = gtk_tree_row_reference_get_path (row_ref);
@@ -439,6 +519,58 @@ ft_manager_clear_handler_time (EmpathyFTManager *manager,
   gtk_tree_path_free (path);
 }
 
+static void
+ft_manager_update_queue_positions (EmpathyFTManager *manager)
+{
+  GList *l;
+  guint position = 1;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  for (l = priv->queued->head; l != NULL; l = l->next)
+    {
+      EmpathyFTHandler *handler = l->data;
+      GtkTreeRowReference *row_ref;
+      char *first_line, *second_line, *message;
+
+      row_ref = ft_manager_get_row_from_handler (manager, handler);
+      g_return_if_fail (row_ref != NULL);
+
+      first_line = ft_manager_format_contact_info (handler);
+
+      if (g_hash_table_contains (priv->paused, handler))
+        second_line = g_strdup (_("Paused"));
+      else
+        /* translators: %u is the position of the transfer in the queue of
+         * transfers waiting to start */
+        second_line = g_strdup_printf (_("Queued (position %u)"), position++);
+
+      message = g_strdup_printf ("%s\n%s", first_line, second_line);
+      ft_manager_update_handler_message (manager, row_ref, message);
+
+      g_free (message);
+      g_free (first_line);
+      g_free (second_line);
+    }
+}
+
+/* Drops any scheduling state about @handler, freeing its slot if it was
+ * running */
+static void
+ft_manager_forget_handler (EmpathyFTManager *manager,
+                           EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  g_hash_table_remove (priv->hashing, handler);
+  g_hash_table_remove (priv->paused, handler);
+
+  if (g_queue_remove (priv->queued, handler))
+    ft_manager_update_queue_positions (manager);
+
+  if (g_hash_table_remove (priv->running, handler))
+    ft_manager_schedule (manager);
+}
+
 static void
 ft_handler_transfer_error_cb (EmpathyFTHandler *handler,
                               GError *error,
@@ -459,6 +591,8 @@ ft_handler_transfer_error_cb (EmpathyFTHandler *handler,
   ft_manager_update_buttons (manager);
 
   g_free (message);
+
+  ft_manager_forget_handler (manager, handler);
 }
 
 static void
@@ -513,6 +647,8 @@ do_real_transfer_done (EmpathyFTManager *manager,
   gtk_recent_manager_add_item (recent_manager, uri);
 
   g_free (uri);
+
+  ft_manager_forget_handler (manager, handler);
 }
 
 static void
@@ -563,8 +699,7 @@ ft_handler_transfer_progress_cb (EmpathyFTHandler *handler,
   ft_manager_update_handler_message (manager, row_ref, message);
   ft_manager_update_handler_progress (manager, row_ref, percentage);
 
-  if (remaining_time > 0)
-    ft_manager_update_handler_time (manager, row_ref, remaining_time);
+  ft_manager_update_handler_time (manager, row_ref, handler);
 
   g_free (message);
   g_free (first_line);
@@ -608,6 +743,10 @@ ft_handler_hashing_done_cb (EmpathyFTHandler *handler,
       return;
     }
 
+  /* the hashing slot is free, the transfer keeps its own slot */
+  if (g_hash_table_remove (GET_PRIV (manager)->hashing, handler))
+    ft_manager_schedule (manager);
+
   row_ref = ft_manager_get_row_from_handler (manager, handler);
   g_return_if_fail (row_ref != NULL);
 
@@ -696,12 +835,35 @@ ft_manager_start_transfer (EmpathyFTManager *manager,
                            EmpathyFTHandler *handler)
 {
   gboolean is_outgoing;
+  GtkTreeRowReference *row_ref;
+  const char *second_line;
+  char *first_line, *message;
 
   is_outgoing = !empathy_ft_handler_is_incoming (handler);
 
   DEBUG ("Start transfer, is outgoing %s",
       is_outgoing ? "True" : "False");
 
+  /* update the row with the initial values.
+   * the only case where we postpone this is in case we're managing
+   * an outgoing+hashing transfer, as the hashing started signal will
+   * take care of updating the information.
+   */
+  if (!is_outgoing || !empathy_ft_handler_get_use_hash (handler))
+    {
+      row_ref = ft_manager_get_row_from_handler (manager, handler);
+      g_return_if_fail (row_ref != NULL);
+
+      first_line = ft_manager_format_contact_info (handler);
+      second_line = _("Waiting for the other participant's response");
+      message = g_strdup_printf ("%s\n%s", first_line, second_line);
+
+      ft_manager_update_handler_message (manager, row_ref, message);
+
+      g_free (first_line);
+      g_free (message);
+    }
+
   /* now connect the signals */
   g_signal_connect (handler, "transfer-error",
       G_CALLBACK (ft_handler_transfer_error_cb), manager);
@@ -718,6 +880,100 @@ ft_manager_start_transfer (EmpathyFTManager *manager,
   empathy_ft_handler_start_transfer (handler);
 }
 
+static gboolean
+ft_manager_needs_hashing (EmpathyFTHandler *handler)
+{
+  /* incoming files are hashed while they are received */
+  return !empathy_ft_handler_is_incoming (handler) &&
+      empathy_ft_handler_get_use_hash (handler);
+}
+
+static gboolean
+ft_manager_schedule_cb (gpointer user_data)
+{
+  EmpathyFTManager *manager = user_data;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  guint max_running, max_hashing;
+  GList *l, *next;
+
+  priv->schedule_id = 0;
+
+  max_running = g_settings_get_uint (priv->gsettings,
+      EMPATHY_PREFS_FILE_TRANSFER_MAX_ACTIVE);
+  max_hashing = g_settings_get_uint (priv->gsettings,
+      EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING);
+
+  for (l = priv->queued->head; l != NULL; l = next)
+    {
+      EmpathyFTHandler *handler = l->data;
+      gboolean needs_hashing;
+
+      next = l->next;
+
+      if (max_running > 0 && g_hash_table_size (priv->running) >= max_running)
+        break;
+
+      if (g_hash_table_contains (priv->paused, handler))
+        continue;
+
+      /* transfers which don't need hashing can overtake the ones waiting
+       * for a hashing slot */
+      needs_hashing = ft_manager_needs_hashing (handler);
+      if (needs_hashing && max_hashing > 0 &&
+          g_hash_table_size (priv->hashing) >= max_hashing)
+        continue;
+
+      g_queue_delete_link (priv->queued, l);
+      g_hash_table_add (priv->running, handler);
+      if (needs_hashing)
+        g_hash_table_add (priv->hashing, handler);
+
+      /* hook up the signals and start the transfer */
+      ft_manager_start_transfer (manager, handler);
+    }
+
+  DEBUG ("%u transfers running (%u hashing), %u queued",
+      g_hash_table_size (priv->running), g_hash_table_size (priv->hashing),
+      g_queue_get_length (priv->queued));
+
+  ft_manager_update_queue_positions (manager);
+
+  return FALSE;
+}
+
+/* Starts as many queued transfers as the limits allow, once we are back in
+ * the main loop */
+static void
+ft_manager_schedule (EmpathyFTManager *manager)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  if (priv->schedule_id != 0)
+    return;
+
+  priv->schedule_id = g_idle_add (ft_manager_schedule_cb, manager);
+}
+
+static void
+ft_manager_settings_changed_cb (GSettings *gsettings,
+                                const gchar *key,
+                                EmpathyFTManager *manager)
+{
+  ft_manager_schedule (manager);
+}
+
+static void
+ft_manager_enqueue (EmpathyFTManager *manager,
+                    EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  g_queue_push_tail (priv->queued, handler);
+  ft_manager_update_queue_positions (manager);
+
+  ft_manager_schedule (manager);
+}
+
 static void
 ft_manager_add_handler_to_list (EmpathyFTManager *manager,
                                 EmpathyFTHandler *handler,
@@ -728,8 +984,8 @@ ft_manager_add_handler_to_list (EmpathyFTManager *manager,
   GtkTreeSelection *selection;
   GtkTreePath *path;
   GIcon *icon;
-  const char *content_type, *second_line;
-  char *first_line, *message;
+  const char *content_type;
+  char *message;
   EmpathyFTManagerPriv *priv = GET_PRIV (manager);
 
   icon = NULL;
@@ -768,25 +1024,13 @@ ft_manager_add_handler_to_list (EmpathyFTManager *manager,
       return;
     }
 
-  /* update the row with the initial values.
-   * the only case where we postpone this is in case we're managing
-   * an outgoing+hashing transfer, as the hashing started signal will
-   * take care of updating the information.
-   */
-  if (empathy_ft_handler_is_incoming (handler) ||
-      !empathy_ft_handler_get_use_hash (handler)) {
-    first_line = ft_manager_format_contact_info (handler);
-    second_line = _("Waiting for the other participant's response");
-    message = g_strdup_printf ("%s\n%s", first_line, second_line);
-
-    ft_manager_update_handler_message (manager, row_ref, message);
-
-    g_free (first_line);
-    g_free (message);
-  }
-
-  /* hook up the signals and start the transfer */
-  ft_manager_start_transfer (manager, handler);
+  /* Incoming transfers were already accepted by the user, start them
+   * right away; outgoing ones start once the scheduler finds a free slot
+   * for them */
+  if (empathy_ft_handler_is_incoming (handler))
+    ft_manager_start_transfer (manager, handler);
+  else
+    ft_manager_enqueue (manager, handler);
 }
 
 static void
@@ -862,9 +1106,115 @@ ft_manager_stop (EmpathyFTManager *manager)
 
   empathy_ft_handler_cancel_transfer (handler);
 
+  if (g_queue_find (priv->queued, handler) != NULL)
+    {
+      /* it never started, there is nothing to report about it */
+      ft_manager_forget_handler (manager, handler);
+      ft_manager_remove_file_from_model (manager, handler);
+      g_hash_table_remove (priv->ft_handler_to_row_ref, handler);
+    }
+
   g_object_unref (handler);
 }
 
+static void
+ft_manager_move_queued (EmpathyFTManager *manager,
+                        EmpathyFTHandler *handler,
+                        gint offset)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+  gint position;
+
+  position = g_queue_index (priv->queued, handler);
+  g_return_if_fail (position >= 0);
+
+  position = CLAMP (position + offset, 0,
+      (gint) g_queue_get_length (priv->queued) - 1);
+
+  g_queue_remove (priv->queued, handler);
+  g_queue_push_nth (priv->queued, handler, position);
+
+  ft_manager_update_queue_positions (manager);
+  ft_manager_schedule (manager);
+}
+
+static void
+ft_manager_move_up_activate_cb (GtkMenuItem *item,
+                                EmpathyFTHandler *handler)
+{
+  ft_manager_move_queued (manager_singleton, handler, -1);
+}
+
+static void
+ft_manager_move_down_activate_cb (GtkMenuItem *item,
+                                  EmpathyFTHandler *handler)
+{
+  ft_manager_move_queued (manager_singleton, handler, 1);
+}
+
+static void
+ft_manager_pause_toggled_cb (GtkCheckMenuItem *item,
+                             EmpathyFTHandler *handler)
+{
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager_singleton);
+
+  if (gtk_check_menu_item_get_active (item))
+    g_hash_table_add (priv->paused, handler);
+  else
+    g_hash_table_remove (priv->paused, handler);
+
+  ft_manager_update_queue_positions (manager_singleton);
+  ft_manager_schedule (manager_singleton);
+}
+
+/* Returns FALSE if @handler isn't queued, so there is no menu to show */
+static gboolean
+ft_manager_popup_queue_menu (EmpathyFTManager *manager,
+                             EmpathyFTHandler *handler,
+                             GdkEventButton *event)
+{
+  GtkWidget *menu, *item;
+  gint position;
+  EmpathyFTManagerPriv *priv = GET_PRIV (manager);
+
+  position = g_queue_index (priv->queued, handler);
+  if (position < 0)
+    return FALSE;
+
+  menu = empathy_context_menu_new (priv->treeview);
+
+  /* Menu item: Move Up */
+  item = gtk_menu_item_new_with_mnemonic (_("Move _Up"));
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+  gtk_widget_set_sensitive (item, position > 0);
+  tp_g_signal_connect_object (item, "activate",
+      G_CALLBACK (ft_manager_move_up_activate_cb), handler, 0);
+  gtk_widget_show (item);
+
+  /* Menu item: Move Down */
+  item = gtk_menu_item_new_with_mnemonic (_("Move _Down"));
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+  gtk_widget_set_sensitive (item,
+      (guint) position + 1 < g_queue_get_length (priv->queued));
+  tp_g_signal_connect_object (item, "activate",
+      G_CALLBACK (ft_manager_move_down_activate_cb), handler, 0);
+  gtk_widget_show (item);
+
+  /* Menu item: Pause */
+  item = gtk_check_menu_item_new_with_mnemonic (_("_Pause"));
+  gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item),
+      g_hash_table_contains (priv->paused, handler));
+  tp_g_signal_connect_object (item, "toggled",
+      G_CALLBACK (ft_manager_pause_toggled_cb), handler, 0);
+  gtk_widget_show (item);
+
+  gtk_menu_popup (GTK_MENU (menu), NULL, NULL, NULL, NULL,
+      event->button, event->time);
+
+  return TRUE;
+}
+
 static gboolean
 close_window (EmpathyFTManager *manager)
 {
@@ -936,9 +1286,33 @@ ft_manager_destroy_cb (GtkWidget *widget,
 
 static gboolean
 ft_view_button_press_event_cb (GtkWidget *widget,
-                               GdkEventKey *event,
+                               GdkEventButton *event,
                                EmpathyFTManager *manager)
 {
+  if (event->type == GDK_BUTTON_PRESS && event->button == 3)
+    {
+      GtkTreeView *view = GTK_TREE_VIEW (widget);
+      GtkTreeModel *model = gtk_tree_view_get_model (view);
+      GtkTreePath *path;
+      GtkTreeIter iter;
+      EmpathyFTHandler *handler;
+      gboolean shown;
+
+      if (!gtk_tree_view_get_path_at_pos (view, event->x, event->y, &path,
+              NULL, NULL, NULL))
+        return FALSE;
+
+      gtk_tree_selection_select_path (gtk_tree_view_get_selection (view),
+          path);
+      gtk_tree_model_get_iter (model, &iter, path);
+      gtk_tree_path_free (path);
+
+      gtk_tree_model_get (model, &iter, COL_FT_OBJECT, &handler, -1);
+      shown = ft_manager_popup_queue_menu (manager, handler, event);
+      g_object_unref (handler);
+
+      return shown;
+    }
 
   if (event->type != GDK_2BUTTON_PRESS)
       return FALSE;
@@ -1081,6 +1455,18 @@ empathy_ft_manager_finalize (GObject *object)
 
   DEBUG ("FT Manager %p", object);
 
+  if (priv->schedule_id != 0)
+    g_source_remove (priv->schedule_id);
+
+  /* nothing would ever start the transfers still queued */
+  g_queue_foreach (priv->queued, (GFunc) empathy_ft_handler_cancel_transfer,
+      NULL);
+  g_queue_free (priv->queued);
+  g_hash_table_unref (priv->paused);
+  g_hash_table_unref (priv->running);
+  g_hash_table_unref (priv->hashing);
+  g_object_unref (priv->gsettings);
+
   g_hash_table_unref (priv->ft_handler_to_row_ref);
 
   G_OBJECT_CLASS (empathy_ft_manager_parent_class)->finalize (object);
@@ -1100,6 +1486,19 @@ empathy_ft_manager_init (EmpathyFTManager *manager)
       g_direct_equal, (GDestroyNotify) g_object_unref,
       (GDestroyNotify) gtk_tree_row_reference_free);
 
+  priv->queued = g_queue_new ();
+  priv->paused = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->running = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->hashing = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  priv->gsettings = g_settings_new (EMPATHY_PREFS_SCHEMA);
+  g_signal_connect (priv->gsettings,
+      "changed::"EMPATHY_PREFS_FILE_TRANSFER_MAX_ACTIVE,
+      G_CALLBACK (ft_manager_settings_changed_cb), manager);
+  g_signal_connect (priv->gsettings,
+      "changed::"EMPATHY_PREFS_FILE_TRANSFER_MAX_HASHING,
+      G_CALLBACK (ft_manager_settings_changed_cb), manager);
+
   ft_manager_build_ui (manager);
 }
 
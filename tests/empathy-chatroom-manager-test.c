@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include <telepathy-glib/util.h>
 
 #include <libempathy/empathy-chatroom-manager.h>
+#include <libempathy/empathy-client-factory.h>
 
 #include "test-helper.h"
 
@@ -382,6 +384,267 @@ START_TEST (test_empathy_chatroom_manager_change_chatroom)
 END_TEST
 #endif
 
+/* Account proxies with made-up paths are enough for the manager, which
+ * only looks at their identity and object path */
+static TpAccount *
+ensure_account (EmpathyClientFactory *factory,
+    const gchar *name)
+{
+  TpAccount *account;
+  gchar *path;
+
+  path = g_strdup_printf ("%sfake/fake/%s", TP_ACCOUNT_OBJECT_PATH_BASE,
+      name);
+  account = tp_simple_client_factory_ensure_account (
+      TP_SIMPLE_CLIENT_FACTORY (factory), path, NULL, NULL);
+  g_assert (account != NULL);
+  g_free (path);
+
+  return account;
+}
+
+static void
+check_account_rooms (EmpathyChatroomManager *mgr,
+    TpAccount *account,
+    EmpathyChatroom *first,
+    ...)
+{
+  GList *chatrooms;
+  EmpathyChatroom *chatroom;
+  guint n = 0;
+  va_list args;
+
+  chatrooms = empathy_chatroom_manager_get_chatrooms (mgr, account);
+
+  va_start (args, first);
+  for (chatroom = first; chatroom != NULL;
+       chatroom = va_arg (args, EmpathyChatroom *))
+    {
+      g_assert (g_list_find (chatrooms, chatroom) != NULL);
+      n++;
+    }
+  va_end (args);
+
+  g_assert_cmpuint (g_list_length (chatrooms), ==, n);
+  g_list_free (chatrooms);
+}
+
+static void
+test_index (void)
+{
+  EmpathyChatroomManager *mgr;
+  EmpathyClientFactory *factory;
+  TpAccount *account1, *account2;
+  EmpathyChatroom *room1, *room2, *other_room1, *copy;
+  gchar *file;
+
+  factory = empathy_client_factory_dup ();
+  account1 = ensure_account (factory, "index1");
+  account2 = ensure_account (factory, "index2");
+
+  file = get_user_xml_file ("index-chatrooms.xml");
+  g_unlink (file);
+  mgr = empathy_chatroom_manager_dup_singleton (file);
+
+  room1 = empathy_chatroom_new_full (account1, "room1", "room1", FALSE);
+  room2 = empathy_chatroom_new_full (account1, "room2", "room2", FALSE);
+  other_room1 = empathy_chatroom_new_full (account2, "room1", "room1", FALSE);
+
+  g_assert (empathy_chatroom_manager_add (mgr, room1));
+  g_assert (empathy_chatroom_manager_add (mgr, room2));
+  g_assert (empathy_chatroom_manager_add (mgr, other_room1));
+
+  /* the same room on the same account is refused */
+  copy = empathy_chatroom_new_full (account1, "room1", "room1", FALSE);
+  g_assert (!empathy_chatroom_manager_add (mgr, copy));
+  g_object_unref (copy);
+
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room1") == room1);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room2") == room2);
+  g_assert (empathy_chatroom_manager_find (mgr, account2, "room1") ==
+      other_room1);
+  g_assert (empathy_chatroom_manager_find (mgr, account2, "room2") == NULL);
+  check_account_rooms (mgr, account1, room1, room2, NULL);
+  check_account_rooms (mgr, account2, other_room1, NULL);
+
+  /* renamed rooms are found under their new name only */
+  empathy_chatroom_set_room (room2, "room3");
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room2") == NULL);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room3") == room2);
+
+  /* renaming a room to the one of another makes it the one found... */
+  empathy_chatroom_set_room (room2, "room1");
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room1") == room2);
+  check_account_rooms (mgr, account1, room1, room2, NULL);
+
+  /* ...until it's removed, and the other one takes over */
+  empathy_chatroom_manager_remove (mgr, room2);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room1") == room1);
+  check_account_rooms (mgr, account1, room1, NULL);
+
+  /* rooms moved to another account are found under that one only */
+  empathy_chatroom_set_room (other_room1, "room4");
+  empathy_chatroom_set_account (other_room1, account1);
+  g_assert (empathy_chatroom_manager_find (mgr, account2, "room4") == NULL);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room4") ==
+      other_room1);
+  check_account_rooms (mgr, account1, room1, other_room1, NULL);
+  check_account_rooms (mgr, account2, NULL);
+
+  /* removing an equal chatroom removes the one in the manager */
+  copy = empathy_chatroom_new_full (account1, "room4", "room4", FALSE);
+  empathy_chatroom_manager_remove (mgr, copy);
+  g_object_unref (copy);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room4") == NULL);
+  check_account_rooms (mgr, account1, room1, NULL);
+
+  empathy_chatroom_manager_remove (mgr, room1);
+  g_assert (empathy_chatroom_manager_find (mgr, account1, "room1") == NULL);
+  check_account_rooms (mgr, account1, NULL);
+  check_account_rooms (mgr, NULL, NULL);
+
+  g_object_unref (room1);
+  g_object_unref (room2);
+  g_object_unref (other_room1);
+  g_object_unref (mgr);
+  g_unlink (file);
+  g_free (file);
+  g_object_unref (account1);
+  g_object_unref (account2);
+  g_object_unref (factory);
+}
+
+#define BENCHMARK_ACCOUNTS 20
+#define BENCHMARK_ROOMS 250
+
+/* What empathy_chatroom_manager_find() used to do */
+static EmpathyChatroom *
+linear_find (GList *chatrooms,
+    TpAccount *account,
+    const gchar *room)
+{
+  GList *l;
+
+  for (l = chatrooms; l != NULL; l = l->next)
+    {
+      EmpathyChatroom *chatroom = l->data;
+
+      if (empathy_chatroom_get_account (chatroom) == account &&
+          !tp_strdiff (empathy_chatroom_get_room (chatroom), room))
+        return chatroom;
+    }
+
+  return NULL;
+}
+
+static void
+benchmark_lookup (void)
+{
+  EmpathyChatroomManager *mgr;
+  EmpathyClientFactory *factory;
+  TpAccount *accounts[BENCHMARK_ACCOUNTS];
+  GList *all, *list;
+  GTimer *timer;
+  gdouble add_time, find_time, linear_time, list_time;
+  gchar *file, *room;
+  guint i, j;
+
+  if (!g_test_perf ())
+    return;
+
+  factory = empathy_client_factory_dup ();
+
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    {
+      gchar *name;
+
+      name = g_strdup_printf ("account%u", i);
+      accounts[i] = ensure_account (factory, name);
+      g_free (name);
+    }
+
+  file = get_user_xml_file ("benchmark-chatrooms.xml");
+  g_unlink (file);
+  mgr = empathy_chatroom_manager_dup_singleton (file);
+
+  timer = g_timer_new ();
+
+  /* Each add looks the room up first to refuse duplicates */
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    {
+      for (j = 0; j < BENCHMARK_ROOMS; j++)
+        {
+          EmpathyChatroom *chatroom;
+
+          room = g_strdup_printf ("room%u@conference.example.com", j);
+          chatroom = empathy_chatroom_new_full (accounts[i], room, room,
+              FALSE);
+          g_assert (empathy_chatroom_manager_add (mgr, chatroom));
+          g_object_unref (chatroom);
+          g_free (room);
+        }
+    }
+  add_time = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    {
+      for (j = 0; j < BENCHMARK_ROOMS; j++)
+        {
+          EmpathyChatroom *chatroom;
+
+          room = g_strdup_printf ("room%u@conference.example.com", j);
+          chatroom = empathy_chatroom_manager_find (mgr, accounts[i], room);
+          g_assert (chatroom != NULL);
+          g_assert (empathy_chatroom_get_account (chatroom) == accounts[i]);
+          g_assert_cmpstr (empathy_chatroom_get_room (chatroom), ==, room);
+          g_free (room);
+        }
+    }
+  find_time = g_timer_elapsed (timer, NULL);
+
+  all = empathy_chatroom_manager_get_chatrooms (mgr, NULL);
+  g_assert_cmpuint (g_list_length (all), ==,
+      BENCHMARK_ACCOUNTS * BENCHMARK_ROOMS);
+
+  g_timer_start (timer);
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    {
+      for (j = 0; j < BENCHMARK_ROOMS; j++)
+        {
+          room = g_strdup_printf ("room%u@conference.example.com", j);
+          g_assert (linear_find (all, accounts[i], room) != NULL);
+          g_free (room);
+        }
+    }
+  linear_time = g_timer_elapsed (timer, NULL);
+
+  g_list_free (all);
+
+  g_timer_start (timer);
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    {
+      list = empathy_chatroom_manager_get_chatrooms (mgr, accounts[i]);
+      g_assert_cmpuint (g_list_length (list), ==, BENCHMARK_ROOMS);
+      g_list_free (list);
+    }
+  list_time = g_timer_elapsed (timer, NULL);
+
+  g_test_message ("%u rooms: add %.3fs, find %.3fs (linear %.3fs), "
+      "per-account list %.3fs", BENCHMARK_ACCOUNTS * BENCHMARK_ROOMS,
+      add_time, find_time, linear_time, list_time);
+
+  g_timer_destroy (timer);
+  g_object_unref (mgr);
+  g_unlink (file);
+  g_free (file);
+
+  for (i = 0; i < BENCHMARK_ACCOUNTS; i++)
+    g_object_unref (accounts[i]);
+
+  g_object_unref (factory);
+}
+
 int
 main (int argc,
     char **argv)
@@ -401,6 +664,8 @@ main (int argc,
   g_test_add_func ("/chatroom-manager/change-chatroom",
       test_empathy_chatroom_manager_change_chatroom);
 #endif
+  g_test_add_func ("/chatroom-manager/index", test_index);
+  g_test_add_func ("/chatroom-manager/benchmark", benchmark_lookup);
 
   result = g_test_run ();
   test_deinit ();
@@ -57,10 +57,21 @@ test_live_search (void)
     {
       gboolean match;
       gboolean ok;
+      GPtrArray *words;
+      gchar *stripped;
 
       match = empathy_live_search_match_string (tests[i].string, tests[i].prefix);
       ok = (match == tests[i].should_match);
 
+      /* Matching against the precomputed search key must agree */
+      words = empathy_live_search_strip_utf8_string (tests[i].prefix);
+      stripped = empathy_live_search_strip_string (tests[i].string);
+      ok = ok && (empathy_live_search_match_words_stripped (stripped, words)
+          == match);
+      g_free (stripped);
+      if (words != NULL)
+        g_ptr_array_unref (words);
+
       DEBUG ("'%s' - '%s' %s: %s", tests[i].string, tests[i].prefix,
           tests[i].should_match ? "should match" : "should NOT match",
           ok ? "OK" : "FAILED");
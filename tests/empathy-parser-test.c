@@ -12,6 +12,7 @@
 #include <libempathy/empathy-debug.h>
 
 #include <libempathy-gtk/empathy-string-parser.h>
+#include <libempathy-gtk/empathy-webkit-utils.h>
 
 static void
 test_replace_match (const gchar *text,
@@ -123,6 +124,62 @@ test_parsers (void)
     }
 }
 
+/* The single pass parser must give the same result as the chain of
+ * parsers used to render messages before it */
+static void
+test_append_html (void)
+{
+  gchar *tests[] =
+    {
+      "http://foo.com",
+      "http://foo.com\nhttp://bar.com",
+      "http://foo.com/test?id=bar?",
+      "user@server.com",
+      "www.foo.com and http://bar.com/baz",
+      "Foo <a href=\"http://foo.com\">bar</a>",
+      "Foo 'bar'?user@server.com'",
+      "a:)b",
+      ">:(",
+      ":)http://foo.com",
+      "a :) b http://foo.com c :( d www.test.com e",
+      "line1\nline2\r\nline3\n\r",
+      "tab\there & <there> \"quoted\" 'apos'",
+      "control \x01\x1f\x7f chars \xc2\x80\xc2\x85\xc2\x9f",
+      "unicode ™ élève :-) :-(|) :-(|x",
+      "",
+      NULL
+    };
+  guint i;
+
+  for (i = 0; tests[i] != NULL; i++)
+    {
+      gboolean smileys;
+
+      for (smileys = FALSE; smileys <= TRUE; smileys++)
+        {
+          EmpathyStringParseFlags flags;
+          GString *expected, *result;
+
+          flags = EMPATHY_STRING_PARSE_LINKS | EMPATHY_STRING_PARSE_NEWLINES;
+          if (smileys)
+            flags |= EMPATHY_STRING_PARSE_SMILEYS;
+
+          expected = g_string_new (NULL);
+          empathy_string_parser_substr (tests[i], -1,
+              empathy_webkit_get_string_parser (smileys), expected);
+
+          result = g_string_new (NULL);
+          empathy_string_append_html (result, tests[i], -1, flags);
+
+          DEBUG ("'%s' => '%s'", tests[i], result->str);
+          g_assert_cmpstr (result->str, ==, expected->str);
+
+          g_string_free (expected, TRUE);
+          g_string_free (result, TRUE);
+        }
+    }
+}
+
 int
 main (int argc,
     char **argv)
@@ -132,6 +189,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/append-html", test_append_html);
 
   result = g_test_run ();
   test_deinit ();
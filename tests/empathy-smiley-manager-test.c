@@ -0,0 +1,324 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+
+#include <libempathy-gtk/empathy-smiley-manager.h>
+
+/* Same strings as empathy_smiley_manager_load() */
+static const gchar *smileys[] = {
+  "O:-)", "O:)", "X-(", ":@", "B-)", ":'(", ">:-)", ">:)", ":-[", ":[",
+  ":-$", ":$", ":-*", ":*", ":-))", ":))", ":-(|)", ":(|)", ":-|", ":|",
+  ":-P", ":P", ":-p", ":p", ":-(", ":(", ":-&", ":&", ":-)", ":)", ":-D",
+  ":D", ":-d", ":d", ":-!", ":!", ":-O", ":O", ":-o", ":o", "|-)", "|)",
+  ":-/", ":/", ";-)", ";)", ":-S", ":S", ":-s", ":s",
+  NULL
+};
+
+/* Reference matcher: at each position, take the longest smiley starting
+ * there, if any. Returns the hits formatted as "start-end;..." */
+static gchar *
+naive_parse (const gchar *text)
+{
+  GString *result = g_string_new (NULL);
+  gsize len = strlen (text);
+  gsize i = 0;
+
+  while (i < len)
+    {
+      gsize best = 0;
+      guint j;
+
+      for (j = 0; smileys[j] != NULL; j++)
+        {
+          gsize l = strlen (smileys[j]);
+
+          if (l > best && !strncmp (text + i, smileys[j], l))
+            best = l;
+        }
+
+      if (best > 0)
+        {
+          g_string_append_printf (result, "%" G_GSIZE_FORMAT "-%"
+              G_GSIZE_FORMAT ";", i, i + best);
+          i += best;
+        }
+      else
+        {
+          i++;
+        }
+    }
+
+  return g_string_free (result, FALSE);
+}
+
+static gchar *
+manager_parse (EmpathySmileyManager *manager,
+    const gchar *text)
+{
+  GString *result = g_string_new (NULL);
+  GSList *hits, *l;
+
+  hits = empathy_smiley_manager_parse_len (manager, text, -1);
+
+  for (l = hits; l != NULL; l = g_slist_next (l))
+    {
+      EmpathySmileyHit *hit = l->data;
+
+      g_string_append_printf (result, "%u-%u;", hit->start, hit->end);
+      empathy_smiley_hit_free (hit);
+    }
+
+  g_slist_free (hits);
+
+  return g_string_free (result, FALSE);
+}
+
+static void
+test_smileys (void)
+{
+  EmpathySmileyManager *manager;
+  const gchar *alphabet = ":-()>|;PpOo x'@[$*&D!/S";
+  const gchar *tests[] = {
+    "a:)b", ">:)", ">:(", ":-))", ":-(|)", ":-(|x", ">:>:>:>:)",
+    ":):):)", "O:-)", "", NULL
+  };
+  GRand *rand;
+  guint i;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+
+  for (i = 0; tests[i] != NULL; i++)
+    {
+      gchar *expected = naive_parse (tests[i]);
+      gchar *result = manager_parse (manager, tests[i]);
+
+      DEBUG ("'%s' => '%s'", tests[i], result);
+      g_assert_cmpstr (result, ==, expected);
+
+      g_free (expected);
+      g_free (result);
+    }
+
+  /* Random strings made of chars found in smileys */
+  rand = g_rand_new_with_seed (42);
+
+  for (i = 0; i < 10000; i++)
+    {
+      gchar text[16];
+      gchar *expected, *result;
+      guint j, len;
+
+      len = g_rand_int_range (rand, 0, sizeof (text));
+      for (j = 0; j < len; j++)
+        text[j] = alphabet[g_rand_int_range (rand, 0, strlen (alphabet))];
+      text[len] = '\0';
+
+      expected = naive_parse (text);
+      result = manager_parse (manager, text);
+
+      g_assert_cmpstr (result, ==, expected);
+
+      g_free (expected);
+      g_free (result);
+    }
+
+  g_rand_free (rand);
+  g_object_unref (manager);
+}
+
+/* The trie matcher the manager used before, which walks the children lists
+ * and goes back in the text when a smiley doesn't match. Only kept here
+ * to compare its speed. */
+typedef struct _LegacyTree LegacyTree;
+struct _LegacyTree
+{
+  gunichar c;
+  gboolean terminal;
+  GSList *children;
+};
+
+static LegacyTree *
+legacy_tree_find_child (LegacyTree *tree,
+    gunichar c)
+{
+  GSList *l;
+
+  for (l = tree->children; l != NULL; l = l->next)
+    {
+      LegacyTree *child = l->data;
+
+      if (child->c == c)
+        return child;
+    }
+
+  return NULL;
+}
+
+static LegacyTree *
+legacy_tree_new (void)
+{
+  LegacyTree *root = g_new0 (LegacyTree, 1);
+  guint i;
+
+  for (i = 0; smileys[i] != NULL; i++)
+    {
+      LegacyTree *node = root;
+      const gchar *str;
+
+      for (str = smileys[i]; *str != '\0'; str = g_utf8_next_char (str))
+        {
+          gunichar c = g_utf8_get_char (str);
+          LegacyTree *child = legacy_tree_find_child (node, c);
+
+          if (child == NULL)
+            {
+              child = g_new0 (LegacyTree, 1);
+              child->c = c;
+              node->children = g_slist_prepend (node->children, child);
+            }
+
+          node = child;
+        }
+
+      node->terminal = TRUE;
+    }
+
+  return root;
+}
+
+static void
+legacy_tree_free (LegacyTree *tree)
+{
+  g_slist_free_full (tree->children, (GDestroyNotify) legacy_tree_free);
+  g_free (tree);
+}
+
+static guint
+legacy_parse (LegacyTree *root,
+    const gchar *text)
+{
+  LegacyTree *cur_tree = root;
+  const gchar *cur_str;
+  const gchar *start = NULL;
+  guint n_hits = 0;
+
+  for (cur_str = text; *cur_str != '\0';
+      cur_str = g_utf8_next_char (cur_str))
+    {
+      gunichar c = g_utf8_get_char (cur_str);
+      LegacyTree *child = legacy_tree_find_child (cur_tree, c);
+
+      if (child != NULL)
+        {
+          if (cur_tree == root)
+            start = cur_str;
+          cur_tree = child;
+          continue;
+        }
+
+      if (cur_tree->terminal)
+        {
+          n_hits++;
+          cur_tree = legacy_tree_find_child (root, c);
+          if (cur_tree != NULL)
+            start = cur_str;
+          else
+            cur_tree = root;
+        }
+      else if (cur_tree != root)
+        {
+          cur_str = start;
+          cur_tree = root;
+        }
+    }
+
+  if (cur_tree->terminal)
+    n_hits++;
+
+  return n_hits;
+}
+
+static void
+benchmark_text (EmpathySmileyManager *manager,
+    LegacyTree *legacy,
+    const gchar *name,
+    const gchar *text)
+{
+  GTimer *timer = g_timer_new ();
+  gdouble legacy_time, automaton_time;
+  guint i;
+
+  for (i = 0; i < 100; i++)
+    legacy_parse (legacy, text);
+  legacy_time = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i < 100; i++)
+    {
+      GSList *hits = empathy_smiley_manager_parse_len (manager, text, -1);
+
+      g_slist_free_full (hits, (GDestroyNotify) empathy_smiley_hit_free);
+    }
+  automaton_time = g_timer_elapsed (timer, NULL);
+
+  g_test_message ("%s: legacy trie %.3fs, automaton %.3fs", name,
+      legacy_time, automaton_time);
+
+  g_timer_destroy (timer);
+}
+
+static void
+benchmark_smileys (void)
+{
+  EmpathySmileyManager *manager;
+  LegacyTree *legacy;
+  GString *chat, *adversarial;
+  guint i;
+
+  if (!g_test_perf ())
+    return;
+
+  manager = empathy_smiley_manager_dup_singleton ();
+  legacy = legacy_tree_new ();
+
+  chat = g_string_new (NULL);
+  adversarial = g_string_new (NULL);
+
+  for (i = 0; i < 10000; i++)
+    {
+      g_string_append (chat, "Hello there :) see you at 5:30 ;-) bye ");
+      g_string_append (adversarial, ":-(|:-(|>:>:");
+    }
+
+  benchmark_text (manager, legacy, "chat", chat->str);
+  benchmark_text (manager, legacy, "adversarial", adversarial->str);
+
+  g_string_free (chat, TRUE);
+  g_string_free (adversarial, TRUE);
+  legacy_tree_free (legacy);
+  g_object_unref (manager);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/smiley-manager/parse", test_smileys);
+  g_test_add_func ("/smiley-manager/benchmark", benchmark_smileys);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}